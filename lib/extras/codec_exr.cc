@@ -5,16 +5,23 @@
 
 #include "lib/extras/codec_exr.h"
 
+#include <ImfChannelList.h>
 #include <ImfChromaticitiesAttribute.h>
+#include <ImfFrameBuffer.h>
 #include <ImfIO.h>
-#include <ImfRgbaFile.h>
+#include <ImfInputFile.h>
+#include <ImfOutputFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfTiledInputFile.h>
+
+#include <string.h>
 
 #include <vector>
 
 #include "lib/jxl/alpha.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/color_management.h"
+#include "lib/jxl/image_ops.h"
 
 namespace jxl {
 
@@ -32,6 +39,13 @@ using ExrInt64 = decltype(std::declval<OpenEXR::IStream>().tellg());
 constexpr int kExrBitsPerSample = 16;
 constexpr int kExrAlphaBits = 16;
 
+// Names of the R, G, B and A channels in the default layer.
+constexpr const char* kExrChannelNames[4] = {"R", "G", "B", "A"};
+
+// Number of rows decoded at once when the data window is wider than the
+// display window and rows therefore cannot be decoded in place.
+constexpr int kExrBandRows = 256;
+
 float GetIntensityTarget(const CodecInOut& io,
                          const OpenEXR::Header& exr_header) {
   if (OpenEXR::hasWhiteLuminance(exr_header)) {
@@ -125,13 +139,119 @@ class InMemoryOStream : public OpenEXR::OStream {
   size_t pos_ = 0;
 };
 
+// Returns the plane that holds EXR channel `c` (in kExrChannelNames order).
+ImageF* ChannelPlane(size_t c, Image3F* image, ImageF* alpha) {
+  return c < 3 ? &image->Plane(c) : alpha;
+}
+
+// Adds float slices for the RGB(A) channels to `frame_buffer`, such that pixel
+// (x0, y0) of the EXR file maps to the top-left pixel of each plane. OpenEXR
+// then converts the (typically half-float) samples while decoding its line
+// buffers or tiles on its own threads, without an intermediate copy.
+void InsertSlices(size_t num_channels, int x0, int y0, Image3F* image,
+                  ImageF* alpha, OpenEXR::FrameBuffer* frame_buffer) {
+  for (size_t c = 0; c < num_channels; ++c) {
+    ImageF* plane = ChannelPlane(c, image, alpha);
+    const size_t y_stride = plane->bytes_per_row();
+    char* const base = reinterpret_cast<char*>(plane->Row(0)) -
+                       static_cast<intptr_t>(x0) * sizeof(float) -
+                       static_cast<intptr_t>(y0) * y_stride;
+    frame_buffer->insert(kExrChannelNames[c],
+                         OpenEXR::Slice(OpenEXR::FLOAT, base,
+                                        /*xStride=*/sizeof(float),
+                                        /*yStride=*/y_stride));
+  }
+}
+
+// Reads the part of the EXR data window that lies within the display window
+// into `image` and `alpha`, which cover the display window. Regions without
+// data are left untouched.
+Status ReadPixels(const Span<const uint8_t> bytes, OpenEXR::InputFile& input,
+                  bool has_alpha, ThreadPool* pool, Image3F* image,
+                  ImageF* alpha) {
+  const Imath::Box2i& data_window = input.header().dataWindow();
+  const Imath::Box2i& display_window = input.header().displayWindow();
+  const int x_begin = std::max(data_window.min.x, display_window.min.x);
+  const int x_end = std::min(data_window.max.x, display_window.max.x);
+  const int y_begin = std::max(data_window.min.y, display_window.min.y);
+  const int y_end = std::min(data_window.max.y, display_window.max.y);
+  // Inclusive bounds.
+  if (x_begin > x_end || y_begin > y_end) return true;
+  const size_t num_channels = has_alpha ? 4 : 3;
+
+  if (input.header().hasTileDescription() &&
+      data_window.min.x >= display_window.min.x &&
+      data_window.min.y >= display_window.min.y &&
+      data_window.max.x <= display_window.max.x &&
+      data_window.max.y <= display_window.max.y) {
+    // All tiles fit into the image: decode them in one call, which lets
+    // OpenEXR decompress all of them in parallel instead of one row of tiles
+    // at a time as it does when reading tiled files through scanlines.
+    InMemoryIStream tiled_is(bytes);
+    OpenEXR::TiledInputFile tiled_input(tiled_is);
+    OpenEXR::FrameBuffer frame_buffer;
+    InsertSlices(num_channels, display_window.min.x, display_window.min.y,
+                 image, alpha, &frame_buffer);
+    tiled_input.setFrameBuffer(frame_buffer);
+    tiled_input.readTiles(0, tiled_input.numXTiles(0) - 1, 0,
+                          tiled_input.numYTiles(0) - 1, /*lx=*/0, /*ly=*/0);
+    return true;
+  }
+
+  if (data_window.min.x >= display_window.min.x &&
+      data_window.max.x <= display_window.max.x) {
+    // Rows of the data window fit into the image: decode in place.
+    OpenEXR::FrameBuffer frame_buffer;
+    InsertSlices(num_channels, display_window.min.x, display_window.min.y,
+                 image, alpha, &frame_buffer);
+    input.setFrameBuffer(frame_buffer);
+    input.readPixels(y_begin, y_end);
+    return true;
+  }
+
+  // The data window extends beyond the display window horizontally (e.g.
+  // overscan): decode bands of whole rows and copy their visible part.
+  const size_t data_xsize = data_window.max.x - data_window.min.x + 1;
+  const size_t band_ysize = std::min(kExrBandRows, y_end - y_begin + 1);
+  Image3F band(data_xsize, band_ysize);
+  ImageF band_alpha;
+  if (has_alpha) band_alpha = ImageF(data_xsize, band_ysize);
+  const size_t visible_bytes = (x_end - x_begin + 1) * sizeof(float);
+  for (int start_y = y_begin; start_y <= y_end; start_y += kExrBandRows) {
+    // Inclusive.
+    const int end_y = std::min(start_y + kExrBandRows - 1, y_end);
+    OpenEXR::FrameBuffer frame_buffer;
+    InsertSlices(num_channels, data_window.min.x, start_y, &band, &band_alpha,
+                 &frame_buffer);
+    input.setFrameBuffer(frame_buffer);
+    input.readPixels(start_y, end_y);
+    RunOnPool(
+        pool, start_y, end_y + 1, ThreadPool::SkipInit(),
+        [&](const int exr_y, const int /*thread*/) {
+          const size_t image_y = exr_y - display_window.min.y;
+          const size_t band_y = exr_y - start_y;
+          for (size_t c = 0; c < num_channels; ++c) {
+            memcpy(ChannelPlane(c, image, alpha)->Row(image_y) +
+                       (x_begin - display_window.min.x),
+                   ChannelPlane(c, &band, &band_alpha)->ConstRow(band_y) +
+                       (x_begin - data_window.min.x),
+                   visible_bytes);
+          }
+        },
+        "DecodeImageEXR");
+  }
+  return true;
+}
+
 }  // namespace
 
 Status DecodeImageEXR(Span<const uint8_t> bytes, ThreadPool* pool,
                       CodecInOut* io) {
   // Get the number of threads we should be using for OpenEXR.
-  // OpenEXR creates its own set of threads, independent from ours. `pool` is
-  // only used for converting from a buffer of OpenEXR::Rgba to Image3F.
+  // OpenEXR creates its own set of threads, independent from ours; it decodes
+  // line buffers and tiles on them, including the half to float conversion.
+  // `pool` is only used for copying rows that are cropped by the display
+  // window.
   // TODO(sboukortt): look into changing that with OpenEXR 2.3 which allows
   // custom thread pools according to its changelog.
   OpenEXR::setGlobalThreadCount(GetNumThreads(pool));
@@ -139,88 +259,54 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, ThreadPool* pool,
   InMemoryIStream is(bytes);
 
 #ifdef __EXCEPTIONS
-  std::unique_ptr<OpenEXR::RgbaInputFile> input_ptr;
+  std::unique_ptr<OpenEXR::InputFile> input_ptr;
   try {
-    input_ptr.reset(new OpenEXR::RgbaInputFile(is));
+    input_ptr.reset(new OpenEXR::InputFile(is));
   } catch (...) {
     return JXL_FAILURE("OpenEXR failed to parse input");
   }
-  OpenEXR::RgbaInputFile& input = *input_ptr;
+  OpenEXR::InputFile& input = *input_ptr;
 #else
-  OpenEXR::RgbaInputFile input(is);
+  OpenEXR::InputFile input(is);
 #endif
 
-  if ((input.channels() & OpenEXR::RgbaChannels::WRITE_RGB) !=
-      OpenEXR::RgbaChannels::WRITE_RGB) {
-    return JXL_FAILURE("only RGB OpenEXR files are supported");
+  const OpenEXR::ChannelList& channels = input.header().channels();
+  for (size_t c = 0; c < 3; ++c) {
+    if (channels.findChannel(kExrChannelNames[c]) == nullptr) {
+      return JXL_FAILURE("only RGB OpenEXR files are supported");
+    }
+  }
+  const bool has_alpha = channels.findChannel(kExrChannelNames[3]) != nullptr;
+  for (size_t c = 0; c < (has_alpha ? 4 : 3); ++c) {
+    const OpenEXR::Channel* channel = channels.findChannel(kExrChannelNames[c]);
+    if (channel->xSampling != 1 || channel->ySampling != 1) {
+      return JXL_FAILURE("subsampled OpenEXR channels are not supported");
+    }
   }
-  const bool has_alpha = (input.channels() & OpenEXR::RgbaChannels::WRITE_A) ==
-                         OpenEXR::RgbaChannels::WRITE_A;
 
   const float intensity_target = GetIntensityTarget(*io, input.header());
 
-  auto image_size = input.displayWindow().size();
+  const Imath::Box2i& data_window = input.header().dataWindow();
+  const Imath::Box2i& display_window = input.header().displayWindow();
+  auto image_size = display_window.size();
   // Size is computed as max - min, but both bounds are inclusive.
   ++image_size.x;
   ++image_size.y;
   Image3F image(image_size.x, image_size.y);
-  ZeroFillImage(&image);
   ImageF alpha;
-  if (has_alpha) {
-    alpha = ImageF(image_size.x, image_size.y);
-    FillImage(1.f, &alpha);
+  if (has_alpha) alpha = ImageF(image_size.x, image_size.y);
+  // Parts of the display window that are not covered by the data window are
+  // black and opaque.
+  if (data_window.min.x > display_window.min.x ||
+      data_window.min.y > display_window.min.y ||
+      data_window.max.x < display_window.max.x ||
+      data_window.max.y < display_window.max.y) {
+    ZeroFillImage(&image);
+    if (has_alpha) FillImage(1.f, &alpha);
   }
 
-  const int row_size = input.dataWindow().size().x + 1;
-  // Number of rows to read at a time.
-  // https://www.openexr.com/documentation/ReadingAndWritingImageFiles.pdf
-  // recommends reading the whole file at once.
-  const int y_chunk_size = input.displayWindow().size().y + 1;
-  std::vector<OpenEXR::Rgba> input_rows(row_size * y_chunk_size);
-  for (int start_y =
-           std::max(input.dataWindow().min.y, input.displayWindow().min.y);
-       start_y <=
-       std::min(input.dataWindow().max.y, input.displayWindow().max.y);
-       start_y += y_chunk_size) {
-    // Inclusive.
-    const int end_y = std::min(
-        start_y + y_chunk_size - 1,
-        std::min(input.dataWindow().max.y, input.displayWindow().max.y));
-    input.setFrameBuffer(
-        input_rows.data() - input.dataWindow().min.x - start_y * row_size,
-        /*xStride=*/1, /*yStride=*/row_size);
-    input.readPixels(start_y, end_y);
-    RunOnPool(
-        pool, start_y, end_y + 1, ThreadPool::SkipInit(),
-        [&](const int exr_y, const int /*thread*/) {
-          const int image_y = exr_y - input.displayWindow().min.y;
-          const OpenEXR::Rgba* const JXL_RESTRICT input_row =
-              &input_rows[(exr_y - start_y) * row_size];
-          float* const JXL_RESTRICT rows[] = {
-              image.PlaneRow(0, image_y),
-              image.PlaneRow(1, image_y),
-              image.PlaneRow(2, image_y),
-          };
-          float* const JXL_RESTRICT alpha_row =
-              has_alpha ? alpha.Row(image_y) : nullptr;
-          for (int exr_x = std::max(input.dataWindow().min.x,
-                                    input.displayWindow().min.x);
-               exr_x <=
-               std::min(input.dataWindow().max.x, input.displayWindow().max.x);
-               ++exr_x) {
-            const int image_x = exr_x - input.displayWindow().min.x;
-            const OpenEXR::Rgba& pixel =
-                input_row[exr_x - input.dataWindow().min.x];
-            rows[0][image_x] = pixel.r;
-            rows[1][image_x] = pixel.g;
-            rows[2][image_x] = pixel.b;
-            if (has_alpha) {
-              alpha_row[image_x] = pixel.a;
-            }
-          }
-        },
-        "DecodeImageEXR");
-  }
+  JXL_RETURN_IF_ERROR(
+      ReadPixels(bytes, input, has_alpha, pool, &image, &alpha));
 
   ColorEncoding color_encoding;
   color_encoding.tf.SetTransferFunction(TransferFunction::kLinear);
@@ -259,8 +345,9 @@ Status DecodeImageEXR(Span<const uint8_t> bytes, ThreadPool* pool,
 
 Status EncodeImageEXR(const CodecInOut* io, const ColorEncoding& c_desired,
                       ThreadPool* pool, PaddedBytes* bytes) {
-  // As in `DecodeImageEXR`, `pool` is only used for pixel conversion, not for
-  // actual OpenEXR I/O.
+  // As in `DecodeImageEXR`, OpenEXR compresses line buffers (including the
+  // float to half conversion) on its own threads; `pool` is only used for
+  // premultiplying alpha.
   OpenEXR::setGlobalThreadCount(GetNumThreads(pool));
 
   ColorEncoding c_linear = c_desired;
@@ -288,60 +375,44 @@ Status EncodeImageEXR(const CodecInOut* io, const ColorEncoding& c_desired,
   OpenEXR::addChromaticities(header, chromaticities);
   OpenEXR::addWhiteLuminance(header, io->metadata.m.IntensityTarget());
 
-  // Ensure that the destructor of RgbaOutputFile has run before we look at the
+  const size_t num_channels = has_alpha ? 4 : 3;
+  for (size_t c = 0; c < num_channels; ++c) {
+    header.channels().insert(kExrChannelNames[c],
+                             OpenEXR::Channel(OpenEXR::HALF));
+  }
+
+  // OpenEXR expects premultiplied alpha.
+  Image3F premultiplied;
+  const Image3F* color = &linear->color();
+  if (has_alpha && !alpha_is_premultiplied) {
+    premultiplied = CopyImage(linear->color());
+    RunOnPool(
+        pool, 0, io->ysize(), ThreadPool::SkipInit(),
+        [&](const int y, const int /*thread*/) {
+          PremultiplyAlpha(premultiplied.PlaneRow(0, y),
+                           premultiplied.PlaneRow(1, y),
+                           premultiplied.PlaneRow(2, y),
+                           io->Main().alpha().ConstRow(y), io->xsize());
+        },
+        "EncodeImageEXR");
+    color = &premultiplied;
+  }
+
+  // OpenEXR only reads from the slices when writing.
+  OpenEXR::FrameBuffer frame_buffer;
+  InsertSlices(num_channels, /*x0=*/0, /*y0=*/0, const_cast<Image3F*>(color),
+               has_alpha ? const_cast<ImageF*>(&io->Main().alpha()) : nullptr,
+               &frame_buffer);
+
+  // Ensure that the destructor of OutputFile has run before we look at the
   // size of `bytes`.
   {
     InMemoryOStream os(bytes);
-    OpenEXR::RgbaOutputFile output(
-        os, header, has_alpha ? OpenEXR::WRITE_RGBA : OpenEXR::WRITE_RGB);
-    // How many rows to write at once. Again, the OpenEXR documentation
-    // recommends writing the whole image in one call.
-    const int y_chunk_size = io->ysize();
-    std::vector<OpenEXR::Rgba> output_rows(io->xsize() * y_chunk_size);
-
-    for (size_t start_y = 0; start_y < io->ysize(); start_y += y_chunk_size) {
-      // Inclusive.
-      const size_t end_y =
-          std::min(start_y + y_chunk_size - 1, io->ysize() - 1);
-      output.setFrameBuffer(output_rows.data() - start_y * io->xsize(),
-                            /*xStride=*/1, /*yStride=*/io->xsize());
-      RunOnPool(
-          pool, start_y, end_y + 1, ThreadPool::SkipInit(),
-          [&](const int y, const int /*thread*/) {
-            const float* const JXL_RESTRICT input_rows[] = {
-                linear->color().ConstPlaneRow(0, y),
-                linear->color().ConstPlaneRow(1, y),
-                linear->color().ConstPlaneRow(2, y),
-            };
-            OpenEXR::Rgba* const JXL_RESTRICT row_data =
-                &output_rows[(y - start_y) * io->xsize()];
-            if (has_alpha) {
-              const float* const JXL_RESTRICT alpha_row =
-                  io->Main().alpha().ConstRow(y);
-              if (alpha_is_premultiplied) {
-                for (size_t x = 0; x < io->xsize(); ++x) {
-                  row_data[x] =
-                      OpenEXR::Rgba(input_rows[0][x], input_rows[1][x],
-                                    input_rows[2][x], alpha_row[x]);
-                }
-              } else {
-                for (size_t x = 0; x < io->xsize(); ++x) {
-                  row_data[x] = OpenEXR::Rgba(alpha_row[x] * input_rows[0][x],
-                                              alpha_row[x] * input_rows[1][x],
-                                              alpha_row[x] * input_rows[2][x],
-                                              alpha_row[x]);
-                }
-              }
-            } else {
-              for (size_t x = 0; x < io->xsize(); ++x) {
-                row_data[x] = OpenEXR::Rgba(input_rows[0][x], input_rows[1][x],
-                                            input_rows[2][x], 1.f);
-              }
-            }
-          },
-          "EncodeImageEXR");
-      output.writePixels(/*numScanLines=*/end_y - start_y + 1);
-    }
+    OpenEXR::OutputFile output(os, header);
+    output.setFrameBuffer(frame_buffer);
+    // The OpenEXR documentation recommends writing the whole image in one
+    // call, which also lets it compress all line buffers in parallel.
+    output.writePixels(/*numScanLines=*/io->ysize());
   }
 
   return true;
@@ -244,7 +244,7 @@ Status DecodeImageJPG(const Span<const uint8_t> bytes, ThreadPool* pool,
 
   // Use brunsli JPEG decoder to read quantized coefficients.
   if (target == DecodeTarget::kQuantizedCoeffs) {
-    return jxl::jpeg::DecodeImageJPG(bytes, io);
+    return jxl::jpeg::DecodeImageJPG(bytes, io, pool);
   }
 
 #if JPEGXL_ENABLE_JPEG
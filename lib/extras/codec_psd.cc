@@ -10,6 +10,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <numeric>
 #include <string>
 #include <utility>
@@ -18,6 +19,7 @@
 #include "lib/jxl/base/bits.h"
 #include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/file_io.h"
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/common.h"
@@ -65,19 +67,106 @@ int safe_strncmp(const uint8_t* pos, const uint8_t* maxpos, const char* s2,
 }
 constexpr int PSD_VERBOSITY = 1;
 
+// Compressed or raw data of one row of a channel.
+struct PSDRow {
+  const uint8_t* begin;
+  size_t size;
+};
+
+// Decodes one row of `w` samples. Reads are clamped to `maxpos`; uncompressed
+// samples past it are zero.
+Status decode_row(const PSDRow& in, const uint8_t* maxpos,
+                  int compression_method, int depth, bool invert, int w,
+                  float* JXL_RESTRICT row) {
+  const uint8_t* pos = in.begin;
+  const uint8_t* end = pos + in.size;
+  if (pos >= maxpos) {
+    end = pos;
+  } else if (static_cast<size_t>(maxpos - pos) < in.size) {
+    end = maxpos;
+  }
+  if (compression_method == 0) {
+    // uncompressed is easy
+    const int bytes = depth >> 3;
+    const int available = std::min<int>(w, (end - pos) / bytes);
+    if (depth == 8) {
+      for (int x = 0; x < available; x++) {
+        row[x] = pos[x] * (1.f / 255.f);
+      }
+    } else if (depth == 16) {
+      for (int x = 0; x < available; x++) {
+        row[x] = LoadBE16(pos + 2 * x) * (1.f / 65535.f);
+      }
+    } else if (depth == 32) {
+      for (int x = 0; x < available; x++) {
+        uint32_t f = LoadBE32(pos + 4 * x);
+        memcpy(&row[x], &f, 4);
+      }
+    }
+    std::fill(row + available, row + w, 0.f);
+  } else {
+    // RLE is not that hard
+    for (int x = 0; x < w;) {
+      if (pos >= end) return JXL_FAILURE("PSD: out of bounds");
+      int8_t rle = *pos++;
+      if (rle <= 0) {
+        if (rle == -128) continue;  // nop
+        int count = 1 - rle;
+        if (count > w - x) return JXL_FAILURE("PSD: row overflow");
+        float v = (pos < end ? *pos : 0) * (1.f / 255.f);
+        pos++;
+        std::fill(row + x, row + x + count, v);
+        x += count;
+      } else {
+        int count = 1 + rle;
+        if (count > w - x) return JXL_FAILURE("PSD: row overflow");
+        if (count > end - pos) return JXL_FAILURE("PSD: out of bounds");
+        for (int i = 0; i < count; i++) {
+          row[x + i] = pos[i] * (1.f / 255.f);
+        }
+        pos += count;
+        x += count;
+      }
+    }
+  }
+  if (invert) {
+    // sometimes 0 means full ink
+    for (int x = 0; x < w; x++) {
+      row[x] = 1.f - row[x];
+    }
+  }
+  return true;
+}
+
+// Channel data is parsed in two steps: a cheap serial pass locates the data of
+// every row (from the RLE line counts or the fixed raw row size), then all rows
+// of all channels are decoded in parallel.
 Status decode_layer(const uint8_t*& pos, const uint8_t* maxpos,
                     ImageBundle& layer, std::vector<int> chans,
                     std::vector<bool> invert, int w, int h, int version,
-                    int colormodel, bool is_layer, int depth) {
+                    int colormodel, bool is_layer, int depth,
+                    ThreadPool* pool) {
   int compression_method = 2;
   int nb_channels = chans.size();
   JXL_DEBUG_V(PSD_VERBOSITY,
               "Trying to decode layer with dimensions %ix%i and %i channels", w,
               h, nb_channels);
   if (w <= 0 || h <= 0) return JXL_FAILURE("PSD: empty layer");
+  const size_t raw_row_size = static_cast<size_t>(w) * (depth >> 3);
+  // RLE byte counts of the rows of the channels that share the current line
+  // count table: one channel for layers, all of them for the merged image.
+  std::vector<size_t> row_sizes;
+  size_t row_sizes_offset = 0;
+  std::vector<PSDRow> rows;
+  std::vector<ImageF*> planes;
+  std::vector<int> channel_compression;
+  std::vector<bool> channel_invert;
   for (int c = 0; c < nb_channels; c++) {
-    // skip nop byte padding
-    while (pos < maxpos && *pos == 128) pos++;
+    // skip nop byte padding (the color channels of the merged image are
+    // contiguous)
+    if (is_layer || c == 0 || c >= colormodel) {
+      while (pos < maxpos && *pos == 128) pos++;
+    }
     JXL_DEBUG_V(PSD_VERBOSITY, "Channel %i (pos %zu)", c, (size_t)pos);
     // Merged image stores all channels together (same compression method)
     // Layers store channel per channel
@@ -88,100 +177,76 @@ Status decode_layer(const uint8_t*& pos, const uint8_t* maxpos,
         return JXL_FAILURE("PSD: can't handle compression method %i",
                            compression_method);
       }
-    }
-
-    if (!is_layer && c < colormodel) {
-      // skip to the extra channels
-      if (compression_method == 0) {
-        pos += w * h * (depth >> 3) * colormodel;
-        c = colormodel - 1;
-        continue;
-      }
-      size_t skip_amount = 0;
-      for (int i = 0; i < nb_channels; i++) {
-        if (i < colormodel) {
-          for (int y = 0; y < h; y++) {
-            skip_amount += get_be_int(2 * version, pos, maxpos);
-          }
-        } else {
-          pos += h * 2 * version;
-        }
-      }
-      pos += skip_amount;
-      c = colormodel - 1;
-      continue;
-    }
-    if (is_layer || c == 0) {
-      // skip the line-counts, we don't need them
       if (compression_method == 1) {
-        pos += h * (is_layer ? 1 : nb_channels) * 2 *
-               version;  // PSB uses 4 bytes per rowsize instead of 2
+        // PSB uses 4 bytes per rowsize instead of 2
+        const size_t num_counts = h * (is_layer ? 1 : nb_channels);
+        if (pos > maxpos ||
+            static_cast<size_t>(maxpos - pos) / (2 * version) < num_counts) {
+          return JXL_FAILURE("PSD: premature end of input");
+        }
+        row_sizes.resize(num_counts);
+        for (size_t i = 0; i < num_counts; i++) {
+          row_sizes[i] = get_be_int(2 * version, pos, maxpos);
+        }
+        row_sizes_offset = 0;
       }
     }
+
+    const size_t channel_size =
+        compression_method == 0
+            ? raw_row_size * h
+            : std::accumulate(row_sizes.begin() + row_sizes_offset,
+                              row_sizes.begin() + row_sizes_offset + h,
+                              size_t(0));
+    const uint8_t* channel_begin = pos;
+    pos += channel_size;
+    const size_t channel_row_sizes_offset = row_sizes_offset;
+    if (compression_method == 1) row_sizes_offset += h;
+    if (pos < channel_begin) return JXL_FAILURE("PSD: invalid channel size");
+
+    // The merged image is only used for the extra channels.
+    if (!is_layer && c < colormodel) continue;
     int c_id = chans[c];
     if (c_id < 0) continue;  // skip
     if (static_cast<unsigned int>(c_id) >= 3 + layer.extra_channels().size())
       return JXL_FAILURE("PSD: can't handle channel id %i", c_id);
-    ImageF& ch = (c_id < 3 ? layer.color()->Plane(c_id)
-                           : layer.extra_channels()[c_id - 3]);
-
+    if (channel_begin > maxpos) {
+      return JXL_FAILURE("PSD: premature end of input");
+    }
+    if (compression_method == 1 && depth != 8) {
+      return JXL_FAILURE("PSD: did not expect RLE with depth>1");
+    }
+    planes.push_back(c_id < 3 ? &layer.color()->Plane(c_id)
+                              : &layer.extra_channels()[c_id - 3]);
+    channel_compression.push_back(compression_method);
+    channel_invert.push_back(invert[c]);
     for (int y = 0; y < h; y++) {
-      if (pos > maxpos) return JXL_FAILURE("PSD: premature end of input");
-      float* const JXL_RESTRICT row = ch.Row(y);
       if (compression_method == 0) {
-        // uncompressed is easy
-        if (depth == 8) {
-          for (int x = 0; x < w; x++) {
-            row[x] = get_be_int(1, pos, maxpos) * (1.f / 255.f);
-          }
-        } else if (depth == 16) {
-          for (int x = 0; x < w; x++) {
-            row[x] = get_be_int(2, pos, maxpos) * (1.f / 65535.f);
-          }
-        } else if (depth == 32) {
-          for (int x = 0; x < w; x++) {
-            uint32_t f = get_be_int(4, pos, maxpos);
-            memcpy(&row[x], &f, 4);
-          }
-        }
+        rows.push_back({channel_begin, raw_row_size});
+        channel_begin += raw_row_size;
       } else {
-        // RLE is not that hard
-        if (depth != 8)
-          return JXL_FAILURE("PSD: did not expect RLE with depth>1");
-        for (int x = 0; x < w;) {
-          if (pos >= maxpos) return JXL_FAILURE("PSD: out of bounds");
-          int8_t rle = *pos++;
-          if (rle <= 0) {
-            if (rle == -128) continue;  // nop
-            int count = 1 - rle;
-            float v = get_be_int(1, pos, maxpos) * (1.f / 255.f);
-            while (count && x < w) {
-              row[x] = v;
-              count--;
-              x++;
-            }
-            if (count) return JXL_FAILURE("PSD: row overflow");
-          } else {
-            int count = 1 + rle;
-            while (count && x < w) {
-              row[x] = get_be_int(1, pos, maxpos) * (1.f / 255.f);
-              count--;
-              x++;
-            }
-            if (count) return JXL_FAILURE("PSD: row overflow");
-          }
-        }
-      }
-      if (invert[c]) {
-        // sometimes 0 means full ink
-        for (int x = 0; x < w; x++) {
-          row[x] = 1.f - row[x];
-        }
+        const size_t size = row_sizes[channel_row_sizes_offset + y];
+        rows.push_back({channel_begin, size});
+        channel_begin += size;
       }
     }
-    JXL_DEBUG_V(PSD_VERBOSITY, "Channel %i read.", c);
   }
 
+  std::atomic<bool> has_error{false};
+  RunOnPool(
+      pool, 0, rows.size(), ThreadPool::SkipInit(),
+      [&](const int task, const int /*thread*/) {
+        const size_t c = task / h;
+        const size_t y = task % h;
+        if (!decode_row(rows[task], maxpos, channel_compression[c], depth,
+                        channel_invert[c], w, planes[c]->Row(y))) {
+          has_error = true;
+        }
+      },
+      "DecodePSDLayer");
+  if (has_error) return JXL_FAILURE("PSD: error in channel data");
+  JXL_DEBUG_V(PSD_VERBOSITY, "%zu channels read.", planes.size());
+
   return true;
 }
 
@@ -530,7 +595,7 @@ Status DecodeImagePSD(const Span<const uint8_t> bytes, ThreadPool* pool,
       if (chan_id.size() > invert.size()) invert.resize(chan_id.size(), false);
       JXL_RETURN_IF_ERROR(decode_layer(pos, maxpos, layer, chan_id, invert,
                                        layer.xsize(), layer.ysize(), version,
-                                       colormodel, true, bitdepth));
+                                       colormodel, true, bitdepth, pool));
     }
   } else
     return JXL_FAILURE("PSD: no layer data found");
@@ -588,7 +653,7 @@ Status DecodeImagePSD(const Span<const uint8_t> bytes, ThreadPool* pool,
     }
     JXL_RETURN_IF_ERROR(decode_layer(
         pos, maxpos, layer, chan_id, invert, layer.xsize(), layer.ysize(),
-        version, (have_only_merged ? 0 : colormodel), false, bitdepth));
+        version, (have_only_merged ? 0 : colormodel), false, bitdepth, pool));
   }
 
   if (io->frames.empty()) return JXL_FAILURE("PSD: no layers");
@@ -180,6 +180,8 @@ set(JPEGXL_INTERNAL_SOURCES_DEC
   jxl/quantizer.h
   jxl/rational_polynomial-inl.h
   jxl/sanitizers.h
+  jxl/spilled_image.cc
+  jxl/spilled_image.h
   jxl/splines.cc
   jxl/splines.h
   jxl/toc.cc
@@ -12,6 +12,7 @@
 #include <hwy/base.h>  // HWY_ALIGN_MAX
 #include <hwy/tests/test_util-inl.h>
 #include <utility>
+#include <vector>
 
 #include "lib/jxl/common.h"
 #include "lib/jxl/dct_scales.h"
@@ -199,6 +200,36 @@ TEST_P(AcStrategyTargetTest, RoundtripAFVDCT) {
   }
 }
 
+TEST_P(AcStrategyTargetTest, DCT8Batch) {
+  constexpr size_t kMaxBatch = 8;
+  constexpr size_t kStride = kMaxBatch * kBlockDim + 3;
+  auto mem = hwy::AllocateAligned<float>(AcStrategy::kMaxCoeffArea * 2 +
+                                         2 * kBlockDim * kStride);
+  float* coeffs = mem.get();
+  float* scratch_space = coeffs + AcStrategy::kMaxCoeffArea;
+  float* expected = scratch_space + AcStrategy::kMaxCoeffArea;
+  float* actual = expected + kBlockDim * kStride;
+  for (size_t num = 1; num <= kMaxBatch; num++) {
+    for (size_t i = 0; i < num * kDCTBlockSize; i++) {
+      coeffs[i] = std::sin(0.7f * i + num);
+    }
+    // TransformToPixels modifies its input.
+    std::vector<float> input(coeffs, coeffs + num * kDCTBlockSize);
+    std::fill_n(actual, kBlockDim * kStride, 0.0f);
+    DCT8BatchToPixels(coeffs, num, actual, kStride, scratch_space);
+    std::fill_n(expected, kBlockDim * kStride, 0.0f);
+    for (size_t b = 0; b < num; b++) {
+      std::copy(input.begin() + b * kDCTBlockSize,
+                input.begin() + (b + 1) * kDCTBlockSize, coeffs);
+      TransformToPixels(AcStrategy::Type::DCT, coeffs, expected + b * kBlockDim,
+                        kStride, scratch_space);
+    }
+    for (size_t i = 0; i < kBlockDim * kStride; i++) {
+      ASSERT_NEAR(expected[i], actual[i], 1e-5f) << "num " << num << " i " << i;
+    }
+  }
+}
+
 TEST_P(AcStrategyTargetTest, BenchmarkAFV) {
   const AcStrategy::Type type = AcStrategy::Type::AFV0;
   HWY_ALIGN_MAX float pixels[64] = {1};
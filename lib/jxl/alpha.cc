@@ -7,105 +7,297 @@
 
 #include <string.h>
 
-#include <algorithm>
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/alpha.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
 
+HWY_BEFORE_NAMESPACE();
 namespace jxl {
+namespace HWY_NAMESPACE {
 
-static float Clamp(float x) { return std::max(std::min(1.0f, x), 0.0f); }
+// Calls `kernel(d, x)` for every x in [0, num_pixels) that is a multiple of
+// Lanes(d): full vectors first, then single lanes for the remainder, so that
+// rows need neither be aligned nor padded. Kernels load all their inputs
+// before storing, so outputs may alias inputs.
+template <class Kernel>
+JXL_INLINE void ForEachPixel(size_t num_pixels, const Kernel& kernel) {
+  const HWY_FULL(float) d;
+  size_t x = 0;
+  for (; x + Lanes(d) <= num_pixels; x += Lanes(d)) {
+    kernel(d, x);
+  }
+  const HWY_CAPPED(float, 1) d1;
+  for (; x < num_pixels; ++x) {
+    kernel(d1, x);
+  }
+}
+
+template <class D, class V>
+JXL_INLINE V Clamp01(D d, V v) {
+  return Min(Max(v, Zero(d)), Set(d, 1.0f));
+}
+
+struct BlendLayersPremultiplied {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto fga = LoadU(d, fg.a + x);
+    if (clamp) fga = Clamp01(d, fga);
+    const auto one = Set(d, 1.0f);
+    const auto fg_weight = one - fga;
+    const auto r = LoadU(d, fg.r + x) + LoadU(d, bg.r + x) * fg_weight;
+    const auto g = LoadU(d, fg.g + x) + LoadU(d, bg.g + x) * fg_weight;
+    const auto b = LoadU(d, fg.b + x) + LoadU(d, bg.b + x) * fg_weight;
+    const auto a = one - fg_weight * (one - LoadU(d, bg.a + x));
+    StoreU(r, d, out.r + x);
+    StoreU(g, d, out.g + x);
+    StoreU(b, d, out.b + x);
+    StoreU(a, d, out.a + x);
+  }
+  const AlphaBlendingInputLayer& bg;
+  const AlphaBlendingInputLayer& fg;
+  const AlphaBlendingOutput& out;
+  bool clamp;
+};
+
+struct BlendLayers {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto fga = LoadU(d, fg.a + x);
+    if (clamp) fga = Clamp01(d, fga);
+    const auto bga = LoadU(d, bg.a + x);
+    const auto one = Set(d, 1.0f);
+    const auto new_a = one - (one - fga) * (one - bga);
+    const auto rnew_a = IfThenElseZero(new_a > Zero(d), one / new_a);
+    const auto bg_weight = bga * (one - fga);
+    const auto r =
+        (LoadU(d, fg.r + x) * fga + LoadU(d, bg.r + x) * bg_weight) * rnew_a;
+    const auto g =
+        (LoadU(d, fg.g + x) * fga + LoadU(d, bg.g + x) * bg_weight) * rnew_a;
+    const auto b =
+        (LoadU(d, fg.b + x) * fga + LoadU(d, bg.b + x) * bg_weight) * rnew_a;
+    StoreU(r, d, out.r + x);
+    StoreU(g, d, out.g + x);
+    StoreU(b, d, out.b + x);
+    StoreU(new_a, d, out.a + x);
+  }
+  const AlphaBlendingInputLayer& bg;
+  const AlphaBlendingInputLayer& fg;
+  const AlphaBlendingOutput& out;
+  bool clamp;
+};
+
+void PerformAlphaBlendingLayers(const AlphaBlendingInputLayer& bg,
+                                const AlphaBlendingInputLayer& fg,
+                                const AlphaBlendingOutput& out,
+                                size_t num_pixels, bool alpha_is_premultiplied,
+                                bool clamp) {
+  if (alpha_is_premultiplied) {
+    ForEachPixel(num_pixels, BlendLayersPremultiplied{bg, fg, out, clamp});
+  } else {
+    ForEachPixel(num_pixels, BlendLayers{bg, fg, out, clamp});
+  }
+}
+
+// The single plane variants clamp alpha when `clamp` is false, as the scalar
+// code they replace did.
+struct BlendAlphaPlane {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto fa = LoadU(d, fga + x);
+    if (!clamp) fa = Clamp01(d, fa);
+    const auto one = Set(d, 1.0f);
+    StoreU(one - (one - fa) * (one - LoadU(d, bga + x)), d, out + x);
+  }
+  const float* bga;
+  const float* fga;
+  float* out;
+  bool clamp;
+};
+
+struct BlendPlanePremultiplied {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto fa = LoadU(d, fga + x);
+    if (!clamp) fa = Clamp01(d, fa);
+    const auto one = Set(d, 1.0f);
+    StoreU(LoadU(d, fg + x) + LoadU(d, bg + x) * (one - fa), d, out + x);
+  }
+  const float* bg;
+  const float* fg;
+  const float* fga;
+  float* out;
+  bool clamp;
+};
+
+struct BlendPlane {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto fa = LoadU(d, fga + x);
+    if (!clamp) fa = Clamp01(d, fa);
+    const auto ba = LoadU(d, bga + x);
+    const auto one = Set(d, 1.0f);
+    const auto new_a = one - (one - fa) * (one - ba);
+    const auto rnew_a = IfThenElseZero(new_a > Zero(d), one / new_a);
+    StoreU((LoadU(d, fg + x) * fa + LoadU(d, bg + x) * ba * (one - fa)) *
+               rnew_a,
+           d, out + x);
+  }
+  const float* bg;
+  const float* bga;
+  const float* fg;
+  const float* fga;
+  float* out;
+  bool clamp;
+};
+
+void PerformAlphaBlendingPlane(const float* bg, const float* bga,
+                               const float* fg, const float* fga, float* out,
+                               size_t num_pixels, bool alpha_is_premultiplied,
+                               bool clamp) {
+  if (bg == bga && fg == fga) {
+    ForEachPixel(num_pixels, BlendAlphaPlane{bga, fga, out, clamp});
+  } else if (alpha_is_premultiplied) {
+    ForEachPixel(num_pixels, BlendPlanePremultiplied{bg, fg, fga, out, clamp});
+  } else {
+    ForEachPixel(num_pixels, BlendPlane{bg, bga, fg, fga, out, clamp});
+  }
+}
+
+struct AlphaWeightedAdd {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    const auto weight = Clamp01(d, LoadU(d, fga + x));
+    StoreU(LoadU(d, bg + x) + LoadU(d, fg + x) * weight, d, out + x);
+  }
+  const float* bg;
+  const float* fg;
+  const float* fga;
+  float* out;
+};
+
+void PerformAlphaWeightedAddImpl(const float* bg, const float* fg,
+                                 const float* fga, float* out,
+                                 size_t num_pixels) {
+  ForEachPixel(num_pixels, AlphaWeightedAdd{bg, fg, fga, out});
+}
+
+struct MulBlending {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    auto v = LoadU(d, fg + x);
+    if (clamp) v = Clamp01(d, v);
+    StoreU(LoadU(d, bg + x) * v, d, out + x);
+  }
+  const float* bg;
+  const float* fg;
+  float* out;
+  bool clamp;
+};
+
+void PerformMulBlendingImpl(const float* bg, const float* fg, float* out,
+                            size_t num_pixels, bool clamp) {
+  ForEachPixel(num_pixels, MulBlending{bg, fg, out, clamp});
+}
+
+struct Premultiply {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    const auto multiplier = Max(Set(d, kSmallAlpha), LoadU(d, a + x));
+    StoreU(LoadU(d, r + x) * multiplier, d, r + x);
+    StoreU(LoadU(d, g + x) * multiplier, d, g + x);
+    StoreU(LoadU(d, b + x) * multiplier, d, b + x);
+  }
+  float* JXL_RESTRICT r;
+  float* JXL_RESTRICT g;
+  float* JXL_RESTRICT b;
+  const float* JXL_RESTRICT a;
+};
+
+void PremultiplyAlphaImpl(float* JXL_RESTRICT r, float* JXL_RESTRICT g,
+                          float* JXL_RESTRICT b, const float* JXL_RESTRICT a,
+                          size_t num_pixels) {
+  ForEachPixel(num_pixels, Premultiply{r, g, b, a});
+}
+
+struct Unpremultiply {
+  template <class D>
+  JXL_INLINE void operator()(D d, size_t x) const {
+    const auto multiplier =
+        Set(d, 1.0f) / Max(Set(d, kSmallAlpha), LoadU(d, a + x));
+    StoreU(LoadU(d, r + x) * multiplier, d, r + x);
+    StoreU(LoadU(d, g + x) * multiplier, d, g + x);
+    StoreU(LoadU(d, b + x) * multiplier, d, b + x);
+  }
+  float* JXL_RESTRICT r;
+  float* JXL_RESTRICT g;
+  float* JXL_RESTRICT b;
+  const float* JXL_RESTRICT a;
+};
+
+void UnpremultiplyAlphaImpl(float* JXL_RESTRICT r, float* JXL_RESTRICT g,
+                            float* JXL_RESTRICT b, const float* JXL_RESTRICT a,
+                            size_t num_pixels) {
+  ForEachPixel(num_pixels, Unpremultiply{r, g, b, a});
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(PerformAlphaBlendingLayers);
+HWY_EXPORT(PerformAlphaBlendingPlane);
+HWY_EXPORT(PerformAlphaWeightedAddImpl);
+HWY_EXPORT(PerformMulBlendingImpl);
+HWY_EXPORT(PremultiplyAlphaImpl);
+HWY_EXPORT(UnpremultiplyAlphaImpl);
 
 void PerformAlphaBlending(const AlphaBlendingInputLayer& bg,
                           const AlphaBlendingInputLayer& fg,
                           const AlphaBlendingOutput& out, size_t num_pixels,
                           bool alpha_is_premultiplied, bool clamp) {
-  if (alpha_is_premultiplied) {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      float fga = clamp ? Clamp(fg.a[x]) : fg.a[x];
-      out.r[x] = (fg.r[x] + bg.r[x] * (1.f - fga));
-      out.g[x] = (fg.g[x] + bg.g[x] * (1.f - fga));
-      out.b[x] = (fg.b[x] + bg.b[x] * (1.f - fga));
-      out.a[x] = (1.f - (1.f - fga) * (1.f - bg.a[x]));
-    }
-  } else {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      float fga = clamp ? Clamp(fg.a[x]) : fg.a[x];
-      const float new_a = 1.f - (1.f - fga) * (1.f - bg.a[x]);
-      const float rnew_a = (new_a > 0 ? 1.f / new_a : 0.f);
-      out.r[x] = (fg.r[x] * fga + bg.r[x] * bg.a[x] * (1.f - fga)) * rnew_a;
-      out.g[x] = (fg.g[x] * fga + bg.g[x] * bg.a[x] * (1.f - fga)) * rnew_a;
-      out.b[x] = (fg.b[x] * fga + bg.b[x] * bg.a[x] * (1.f - fga)) * rnew_a;
-      out.a[x] = new_a;
-    }
-  }
+  HWY_DYNAMIC_DISPATCH(PerformAlphaBlendingLayers)(
+      bg, fg, out, num_pixels, alpha_is_premultiplied, clamp);
 }
+
 void PerformAlphaBlending(const float* bg, const float* bga, const float* fg,
                           const float* fga, float* out, size_t num_pixels,
                           bool alpha_is_premultiplied, bool clamp) {
-  if (bg == bga && fg == fga) {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      float fa = clamp ? fga[x] : std::min(std::max(0.0f, fga[x]), 1.0f);
-      out[x] = (1.f - (1.f - fa) * (1.f - bga[x]));
-    }
-  } else {
-    if (alpha_is_premultiplied) {
-      for (size_t x = 0; x < num_pixels; ++x) {
-        float fa = clamp ? fga[x] : Clamp(fga[x]);
-        out[x] = (fg[x] + bg[x] * (1.f - fa));
-      }
-    } else {
-      for (size_t x = 0; x < num_pixels; ++x) {
-        float fa = clamp ? fga[x] : Clamp(fga[x]);
-        const float new_a = 1.f - (1.f - fa) * (1.f - bga[x]);
-        const float rnew_a = (new_a > 0 ? 1.f / new_a : 0.f);
-        out[x] = (fg[x] * fa + bg[x] * bga[x] * (1.f - fa)) * rnew_a;
-      }
-    }
-  }
+  HWY_DYNAMIC_DISPATCH(PerformAlphaBlendingPlane)(
+      bg, bga, fg, fga, out, num_pixels, alpha_is_premultiplied, clamp);
 }
 
 void PerformAlphaWeightedAdd(const float* bg, const float* fg, const float* fga,
                              float* out, size_t num_pixels, bool clamp) {
   if (fg == fga) {
     memcpy(out, bg, num_pixels * sizeof(*out));
-  } else {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      out[x] = bg[x] + fg[x] * Clamp(fga[x]);
-    }
+    return;
   }
+  HWY_DYNAMIC_DISPATCH(PerformAlphaWeightedAddImpl)(bg, fg, fga, out,
+                                                           num_pixels);
 }
 
 void PerformMulBlending(const float* bg, const float* fg, float* out,
                         size_t num_pixels, bool clamp) {
-  if (clamp) {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      out[x] = bg[x] * Clamp(fg[x]);
-    }
-  } else {
-    for (size_t x = 0; x < num_pixels; ++x) {
-      out[x] = bg[x] * fg[x];
-    }
-  }
+  HWY_DYNAMIC_DISPATCH(PerformMulBlendingImpl)(bg, fg, out, num_pixels,
+                                                      clamp);
 }
 
 void PremultiplyAlpha(float* JXL_RESTRICT r, float* JXL_RESTRICT g,
                       float* JXL_RESTRICT b, const float* JXL_RESTRICT a,
                       size_t num_pixels) {
-  for (size_t x = 0; x < num_pixels; ++x) {
-    const float multiplier = std::max(kSmallAlpha, a[x]);
-    r[x] *= multiplier;
-    g[x] *= multiplier;
-    b[x] *= multiplier;
-  }
+  HWY_DYNAMIC_DISPATCH(PremultiplyAlphaImpl)(r, g, b, a, num_pixels);
 }
 
 void UnpremultiplyAlpha(float* JXL_RESTRICT r, float* JXL_RESTRICT g,
                         float* JXL_RESTRICT b, const float* JXL_RESTRICT a,
                         size_t num_pixels) {
-  for (size_t x = 0; x < num_pixels; ++x) {
-    const float multiplier = 1.f / std::max(kSmallAlpha, a[x]);
-    r[x] *= multiplier;
-    g[x] *= multiplier;
-    b[x] *= multiplier;
-  }
+  HWY_DYNAMIC_DISPATCH(UnpremultiplyAlphaImpl)(r, g, b, a, num_pixels);
 }
 
 }  // namespace jxl
+#endif  // HWY_ONCE
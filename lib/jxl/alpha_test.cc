@@ -5,6 +5,9 @@
 
 #include "lib/jxl/alpha.h"
 
+#include <random>
+#include <vector>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -130,5 +133,107 @@ TEST(AlphaTest, UnpremultiplyAndPremultiply) {
                              FloatNear(77, 1e-4f), FloatNear(87, 1e-4f)));
 }
 
+// Whole rows are processed a vector at a time, with a scalar remainder; the
+// result must not depend on the position of a pixel within the row.
+TEST(AlphaTest, RowsMatchSinglePixels) {
+  // Not a multiple of any vector size, starting at an unaligned offset.
+  constexpr size_t kNumPixels = 37;
+  constexpr size_t kOffset = 1;
+  std::mt19937 rng(77);
+  std::uniform_real_distribution<float> dist(-0.25f, 1.25f);
+  std::vector<float> in[8];
+  for (auto& v : in) {
+    v.resize(kNumPixels + kOffset);
+    for (float& f : v) f = dist(rng);
+  }
+  in[7][kOffset] = 0.0f;  // fully transparent
+  const float* bg[4] = {&in[0][kOffset], &in[1][kOffset], &in[2][kOffset],
+                        &in[3][kOffset]};
+  const float* fg[4] = {&in[4][kOffset], &in[5][kOffset], &in[6][kOffset],
+                        &in[7][kOffset]};
+
+  std::vector<float> row[4], pixel[4];
+  const auto ExpectSame = [&](size_t num_channels) {
+    for (size_t c = 0; c < num_channels; c++) {
+      for (size_t x = 0; x < kNumPixels; x++) {
+        EXPECT_FLOAT_EQ(pixel[c][kOffset + x], row[c][kOffset + x])
+            << "c=" << c << " x=" << x;
+      }
+    }
+  };
+  const auto Reset = [&]() {
+    for (size_t c = 0; c < 4; c++) {
+      row[c].assign(kNumPixels + kOffset, 0.0f);
+      pixel[c].assign(kNumPixels + kOffset, 0.0f);
+    }
+  };
+
+  for (bool premultiplied : {false, true}) {
+    for (bool clamp : {false, true}) {
+      Reset();
+      PerformAlphaBlending({bg[0], bg[1], bg[2], bg[3]},
+                           {fg[0], fg[1], fg[2], fg[3]},
+                           {&row[0][kOffset], &row[1][kOffset],
+                            &row[2][kOffset], &row[3][kOffset]},
+                           kNumPixels, premultiplied, clamp);
+      for (size_t x = 0; x < kNumPixels; x++) {
+        PerformAlphaBlending(
+            {bg[0] + x, bg[1] + x, bg[2] + x, bg[3] + x},
+            {fg[0] + x, fg[1] + x, fg[2] + x, fg[3] + x},
+            {&pixel[0][kOffset + x], &pixel[1][kOffset + x],
+             &pixel[2][kOffset + x], &pixel[3][kOffset + x]},
+            1, premultiplied, clamp);
+      }
+      ExpectSame(4);
+
+      Reset();
+      PerformAlphaBlending(bg[0], bg[3], fg[0], fg[3], &row[0][kOffset],
+                           kNumPixels, premultiplied, clamp);
+      PerformAlphaBlending(bg[3], bg[3], fg[3], fg[3], &row[1][kOffset],
+                           kNumPixels, premultiplied, clamp);
+      for (size_t x = 0; x < kNumPixels; x++) {
+        PerformAlphaBlending(bg[0] + x, bg[3] + x, fg[0] + x, fg[3] + x,
+                             &pixel[0][kOffset + x], 1, premultiplied, clamp);
+        PerformAlphaBlending(bg[3] + x, bg[3] + x, fg[3] + x, fg[3] + x,
+                             &pixel[1][kOffset + x], 1, premultiplied, clamp);
+      }
+      ExpectSame(2);
+    }
+  }
+
+  Reset();
+  PerformAlphaWeightedAdd(bg[0], fg[0], fg[3], &row[0][kOffset], kNumPixels,
+                          /*clamp=*/false);
+  PerformMulBlending(bg[1], fg[1], &row[1][kOffset], kNumPixels,
+                     /*clamp=*/true);
+  for (size_t x = 0; x < kNumPixels; x++) {
+    PerformAlphaWeightedAdd(bg[0] + x, fg[0] + x, fg[3] + x,
+                            &pixel[0][kOffset + x], 1, /*clamp=*/false);
+    PerformMulBlending(bg[1] + x, fg[1] + x, &pixel[1][kOffset + x], 1,
+                       /*clamp=*/true);
+  }
+  ExpectSame(2);
+
+  Reset();
+  for (size_t c = 0; c < 3; c++) {
+    row[c] = in[c];
+    pixel[c] = in[c];
+  }
+  UnpremultiplyAlpha(&row[0][kOffset], &row[1][kOffset], &row[2][kOffset],
+                     fg[3], kNumPixels);
+  for (size_t x = 0; x < kNumPixels; x++) {
+    UnpremultiplyAlpha(&pixel[0][kOffset + x], &pixel[1][kOffset + x],
+                       &pixel[2][kOffset + x], fg[3] + x, 1);
+  }
+  ExpectSame(3);
+  PremultiplyAlpha(&row[0][kOffset], &row[1][kOffset], &row[2][kOffset],
+                   fg[3], kNumPixels);
+  for (size_t x = 0; x < kNumPixels; x++) {
+    PremultiplyAlpha(&pixel[0][kOffset + x], &pixel[1][kOffset + x],
+                     &pixel[2][kOffset + x], fg[3] + x, 1);
+  }
+  ExpectSame(3);
+}
+
 }  // namespace
 }  // namespace jxl
@@ -48,33 +48,38 @@ std::vector<int> CreateFlatHistogram(int length, int total_count) {
 // underfull nor overfull, and represents exactly two symbols. The overfull
 // entry might be either overfull or underfull, and is pushed into the
 // corresponding stack.
-void InitAliasTable(std::vector<int> distribution, uint32_t range,
+void InitAliasTable(const std::vector<int>& distribution, uint32_t range,
                     size_t log_alpha_size, AliasTable::Entry* JXL_RESTRICT a) {
-  while (!distribution.empty() && distribution.back() == 0) {
-    distribution.pop_back();
+  size_t num_symbols = distribution.size();
+  while (num_symbols != 0 && distribution[num_symbols - 1] == 0) {
+    num_symbols--;
   }
   // Ensure that a valid table is always returned, even for an empty
   // alphabet. Otherwise, a specially-crafted stream might crash the
   // decoder.
-  if (distribution.empty()) {
-    distribution.emplace_back(range);
+  const int empty_distribution = range;
+  const int* JXL_RESTRICT counts = distribution.data();
+  if (num_symbols == 0) {
+    counts = &empty_distribution;
+    num_symbols = 1;
   }
   const size_t table_size = 1 << log_alpha_size;
 #if JXL_ENABLE_ASSERT
-  int sum = std::accumulate(distribution.begin(), distribution.end(), 0);
+  int sum = std::accumulate(counts, counts + num_symbols, 0);
 #endif  // JXL_ENABLE_ASSERT
   JXL_ASSERT(static_cast<uint32_t>(sum) == range);
   // range must be a power of two
   JXL_ASSERT((range & (range - 1)) == 0);
-  JXL_ASSERT(distribution.size() <= table_size);
+  JXL_ASSERT(num_symbols <= table_size);
   JXL_ASSERT(table_size <= range);
+  JXL_ASSERT(table_size <= ANS_MAX_ALPHABET_SIZE);
   const uint32_t entry_size = range >> log_alpha_size;  // this is exact
   // Special case for single-symbol distributions, that ensures that the state
   // does not change when decoding from such a distribution. Note that, since we
   // hardcode offset0 == 0, it is not straightforward (if at all possible) to
   // fix the general case to produce this result.
-  for (size_t sym = 0; sym < distribution.size(); sym++) {
-    if (distribution[sym] == ANS_TAB_SIZE) {
+  for (size_t sym = 0; sym < num_symbols; sym++) {
+    if (counts[sym] == ANS_TAB_SIZE) {
       for (size_t i = 0; i < table_size; i++) {
         a[i].right_value = sym;
         a[i].cutoff = 0;
@@ -85,29 +90,31 @@ void InitAliasTable(std::vector<int> distribution, uint32_t range,
       return;
     }
   }
-  std::vector<uint32_t> underfull_posn;
-  std::vector<uint32_t> overfull_posn;
-  std::vector<uint32_t> cutoffs(1 << log_alpha_size);
+  // This runs for every histogram of every stream, so the stacks live on the
+  // stack rather than in heap-allocated vectors.
+  uint32_t underfull_posn[ANS_MAX_ALPHABET_SIZE];
+  uint32_t overfull_posn[ANS_MAX_ALPHABET_SIZE];
+  size_t num_underfull = 0;
+  size_t num_overfull = 0;
+  uint32_t cutoffs[ANS_MAX_ALPHABET_SIZE];
   // Initialize entries.
-  for (size_t i = 0; i < distribution.size(); i++) {
-    cutoffs[i] = distribution[i];
+  for (size_t i = 0; i < num_symbols; i++) {
+    cutoffs[i] = counts[i];
     if (cutoffs[i] > entry_size) {
-      overfull_posn.push_back(i);
+      overfull_posn[num_overfull++] = i;
     } else if (cutoffs[i] < entry_size) {
-      underfull_posn.push_back(i);
+      underfull_posn[num_underfull++] = i;
     }
   }
-  for (uint32_t i = distribution.size(); i < table_size; i++) {
+  for (uint32_t i = num_symbols; i < table_size; i++) {
     cutoffs[i] = 0;
-    underfull_posn.push_back(i);
+    underfull_posn[num_underfull++] = i;
   }
   // Reassign overflow/underflow values.
-  while (!overfull_posn.empty()) {
-    uint32_t overfull_i = overfull_posn.back();
-    overfull_posn.pop_back();
-    JXL_ASSERT(!underfull_posn.empty());
-    uint32_t underfull_i = underfull_posn.back();
-    underfull_posn.pop_back();
+  while (num_overfull != 0) {
+    uint32_t overfull_i = overfull_posn[--num_overfull];
+    JXL_ASSERT(num_underfull != 0);
+    uint32_t underfull_i = underfull_posn[--num_underfull];
     uint32_t underfull_by = entry_size - cutoffs[underfull_i];
     cutoffs[overfull_i] -= underfull_by;
     // overfull positions have their original symbols
@@ -116,9 +123,9 @@ void InitAliasTable(std::vector<int> distribution, uint32_t range,
     // Slots in the right part of entry underfull_i were taken from the end
     // of the symbols in entry overfull_i.
     if (cutoffs[overfull_i] < entry_size) {
-      underfull_posn.push_back(overfull_i);
+      underfull_posn[num_underfull++] = overfull_i;
     } else if (cutoffs[overfull_i] > entry_size) {
-      overfull_posn.push_back(overfull_i);
+      overfull_posn[num_overfull++] = overfull_i;
     }
   }
   for (uint32_t i = 0; i < table_size; i++) {
@@ -137,9 +144,9 @@ void InitAliasTable(std::vector<int> distribution, uint32_t range,
       a[i].offsets1 -= cutoffs[i];
       a[i].cutoff = cutoffs[i];
     }
-    const size_t freq0 = i < distribution.size() ? distribution[i] : 0;
+    const size_t freq0 = i < num_symbols ? counts[i] : 0;
     const size_t i1 = a[i].right_value;
-    const size_t freq1 = i1 < distribution.size() ? distribution[i1] : 0;
+    const size_t freq1 = i1 < num_symbols ? counts[i1] : 0;
     a[i].freq0 = static_cast<uint16_t>(freq0);
     a[i].freq1_xor_freq0 = static_cast<uint16_t>(freq1 ^ freq0);
   }
@@ -135,7 +135,7 @@ struct AliasTable {
 };
 
 // Computes an alias table for a given distribution.
-void InitAliasTable(std::vector<int> distribution, uint32_t range,
+void InitAliasTable(const std::vector<int>& distribution, uint32_t range,
                     size_t log_alpha_size, AliasTable::Entry* JXL_RESTRICT a);
 
 }  // namespace jxl
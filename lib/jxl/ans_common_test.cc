@@ -5,6 +5,8 @@
 
 #include "lib/jxl/ans_common.h"
 
+#include <algorithm>
+#include <random>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -39,5 +41,21 @@ TEST(ANSCommonTest, AliasDistributionSmoke) {
   VerifyAliasDistribution({0, 0, 0, ANS_TAB_SIZE, 0}, ANS_TAB_SIZE);
 }
 
+TEST(ANSCommonTest, AliasDistributionRandom) {
+  std::mt19937 rng(0);
+  for (size_t i = 0; i < 100; i++) {
+    std::vector<int> distribution(1 + rng() % 256);
+    // Leave some symbols (including trailing ones) unused.
+    int remaining = ANS_TAB_SIZE;
+    for (size_t j = 0; j + 1 < distribution.size() && remaining > 0; j++) {
+      if (rng() % 3 == 0) continue;
+      distribution[j] = std::min<int>(remaining, rng() % 64);
+      remaining -= distribution[j];
+    }
+    distribution[rng() % distribution.size()] += remaining;
+    VerifyAliasDistribution(distribution, ANS_TAB_SIZE);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
@@ -5,14 +5,18 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
 #include <random>
 #include <vector>
 
 #include "gtest/gtest.h"
 #include "lib/jxl/ans_params.h"
 #include "lib/jxl/aux_out_fwd.h"
+#include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/span.h"
+#include "lib/jxl/base/thread_pool_internal.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/dec_bit_reader.h"
 #include "lib/jxl/enc_ans.h"
@@ -276,5 +280,310 @@ TEST(ANSTest, TestCheckpointingPrefixLZ77) {
   TestCheckpointing(/*ans=*/false, /*lz77=*/true);
 }
 
+void TestResumeFromTokenCheckpoints(bool ans) {
+  constexpr int kNumHistograms = 3;
+  std::mt19937_64 rng;
+  std::vector<std::vector<Token>> input_values(1);
+  for (size_t i = 0; i < 10000; i++) {
+    int context = std::uniform_int_distribution<>(0, kNumHistograms - 1)(rng);
+    int value = std::uniform_int_distribution<>(0, 1000)(rng);
+    input_values[0].emplace_back(context, value);
+  }
+
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  HistogramParams params;
+  params.force_huffman = !ans;
+  TokenCheckpoints checkpoints;
+  for (size_t i = 0; i < input_values[0].size(); i += 97) {
+    checkpoints.tokens.push_back(i);
+  }
+
+  BitWriter writer;
+  BuildAndEncodeHistograms(params, kNumHistograms, input_values, &codes,
+                           &context_map, &writer, 0, nullptr);
+  WriteTokens(input_values[0], codes, context_map, &writer, 0, nullptr,
+              &checkpoints);
+  writer.ZeroPadToByte();
+  ASSERT_EQ(checkpoints.bit_offsets.size(), checkpoints.tokens.size());
+  ASSERT_EQ(checkpoints.ans_states.size(), ans ? checkpoints.tokens.size() : 0);
+
+  BitReader br(writer.GetSpan());
+  std::vector<uint8_t> dec_context_map;
+  ANSCode decoded_codes;
+  ASSERT_TRUE(DecodeHistograms(&br, kNumHistograms, &decoded_codes,
+                               &dec_context_map));
+  // Reads the initial ANS state.
+  ANSSymbolReader initial_reader(&decoded_codes, &br);
+  const size_t data_start = br.TotalBitsConsumed();
+  ASSERT_TRUE(br.Close());
+
+  // Decode the segments in reverse order, as a parallel decoder might.
+  for (size_t k = checkpoints.tokens.size(); k-- > 0;) {
+    BitReader segment_br(writer.GetSpan());
+    segment_br.SkipBits(data_start + checkpoints.bit_offsets[k]);
+    ANSSymbolReader reader = ANSSymbolReader::Resume(
+        &decoded_codes, ans ? checkpoints.ans_states[k] : 0);
+    const size_t end = k + 1 < checkpoints.tokens.size()
+                           ? checkpoints.tokens[k + 1]
+                           : input_values[0].size();
+    for (size_t i = checkpoints.tokens[k]; i < end; i++) {
+      const Token symbol = input_values[0][i];
+      uint32_t read_symbol =
+          reader.ReadHybridUint(symbol.context, &segment_br, dec_context_map);
+      ASSERT_EQ(read_symbol, symbol.value) << "i = " << i;
+    }
+    if (k + 1 == checkpoints.tokens.size()) {
+      EXPECT_TRUE(reader.CheckANSFinalState());
+    }
+    EXPECT_TRUE(segment_br.Close());
+  }
+}
+
+TEST(ANSTest, ResumeFromTokenCheckpointsANS) {
+  TestResumeFromTokenCheckpoints(/*ans=*/true);
+}
+
+TEST(ANSTest, ResumeFromTokenCheckpointsPrefix) {
+  TestResumeFromTokenCheckpoints(/*ans=*/false);
+}
+
+// Streams with repeated rows, long flat areas and some noise, like palette
+// images or screenshots.
+std::vector<std::vector<Token>> RepetitiveStreams(size_t width) {
+  std::mt19937_64 rng;
+  std::vector<std::vector<Token>> streams(5);
+  for (size_t s = 0; s < streams.size(); s++) {
+    for (size_t y = 0; y < 64; y++) {
+      for (size_t x = 0; x < width; x++) {
+        int value = ((y / 16) + (x / (8 + s))) % 5;
+        if (std::uniform_int_distribution<>(0, 99)(rng) == 0) {
+          value = std::uniform_int_distribution<>(0, 100)(rng);
+        }
+        streams[s].emplace_back(x % 3, value);
+      }
+    }
+  }
+  return streams;
+}
+
+void TestLZ77Streams(HistogramParams::LZ77Method method) {
+  constexpr size_t kWidth = 100;
+  constexpr size_t kNumContexts = 3;
+  const std::vector<std::vector<Token>> input_values =
+      RepetitiveStreams(kWidth);
+  HistogramParams params;
+  params.lz77_method = method;
+  params.image_widths.assign(input_values.size(), kWidth);
+
+  // The result must not depend on the number of threads.
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  BitWriter writer;
+  ThreadPoolInternal pool(4);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr),
+                        static_cast<ThreadPool*>(&pool)}) {
+    auto tokens = input_values;
+    context_map.clear();
+    codes = EntropyEncodingData();
+    BitWriter stream_writer;
+    BuildAndEncodeHistograms(params, kNumContexts, tokens, &codes, &context_map,
+                             &stream_writer, 0, nullptr, p);
+    EXPECT_TRUE(codes.lz77.enabled);
+    for (const auto& stream : tokens) {
+      WriteTokens(stream, codes, context_map, &stream_writer, 0, nullptr);
+    }
+    stream_writer.ZeroPadToByte();
+    if (p == nullptr) {
+      writer = std::move(stream_writer);
+      continue;
+    }
+    const Span<const uint8_t> serial = writer.GetSpan();
+    const Span<const uint8_t> parallel = stream_writer.GetSpan();
+    ASSERT_EQ(serial.size(), parallel.size());
+    EXPECT_EQ(0, memcmp(serial.data(), parallel.data(), serial.size()));
+  }
+
+  BitReader br(writer.GetSpan());
+  std::vector<uint8_t> dec_context_map;
+  ANSCode decoded_codes;
+  ASSERT_TRUE(
+      DecodeHistograms(&br, kNumContexts, &decoded_codes, &dec_context_map));
+  for (const auto& stream : input_values) {
+    ANSSymbolReader reader(&decoded_codes, &br, kWidth);
+    for (size_t i = 0; i < stream.size(); i++) {
+      const Token symbol = stream[i];
+      uint32_t read_symbol =
+          reader.ReadHybridUint(symbol.context, &br, dec_context_map);
+      ASSERT_EQ(read_symbol, symbol.value) << "i = " << i;
+    }
+    EXPECT_TRUE(reader.CheckANSFinalState());
+  }
+  EXPECT_TRUE(br.Close());
+}
+
+TEST(ANSTest, LZ77StreamsRoundtrip) {
+  TestLZ77Streams(HistogramParams::LZ77Method::kLZ77);
+}
+
+TEST(ANSTest, LZ77OptimalStreamsRoundtrip) {
+  TestLZ77Streams(HistogramParams::LZ77Method::kOptimal);
+}
+
+// Contexts 2k and 2k+1 share a distribution, so clustering can merge them.
+// The last context only occurs if `all_contexts` is true.
+std::vector<Token> SimilarStream(size_t seed, bool all_contexts) {
+  constexpr size_t kNumContexts = 8;
+  std::mt19937_64 rng(seed);
+  std::vector<Token> stream;
+  for (size_t i = 0; i < 4000; i++) {
+    size_t ctx = rng() % (all_contexts ? kNumContexts : kNumContexts - 1);
+    std::geometric_distribution<uint32_t> dist(1.0 / (1 + 20 * (ctx / 2)));
+    stream.emplace_back(ctx, dist(rng));
+  }
+  return stream;
+}
+
+// Encodes `stream` with `params` and checks that it decodes to the same values.
+// Stores the context map and the codes that were used.
+void PresetRoundtrip(const HistogramParams& params, size_t num_contexts,
+                     const std::vector<Token>& stream,
+                     std::vector<uint8_t>* context_map,
+                     EntropyEncodingData* codes) {
+  std::vector<std::vector<Token>> tokens = {stream};
+  BitWriter writer;
+  BuildAndEncodeHistograms(params, num_contexts, tokens, codes, context_map,
+                           &writer, 0, nullptr);
+  WriteTokens(tokens[0], *codes, *context_map, &writer, 0, nullptr);
+  writer.ZeroPadToByte();
+
+  BitReader br(writer.GetSpan());
+  std::vector<uint8_t> dec_context_map;
+  ANSCode decoded_codes;
+  ASSERT_TRUE(
+      DecodeHistograms(&br, num_contexts, &decoded_codes, &dec_context_map));
+  ANSSymbolReader reader(&decoded_codes, &br);
+  for (const Token& token : stream) {
+    ASSERT_EQ(token.value,
+              reader.ReadHybridUint(token.context, &br, dec_context_map));
+  }
+  EXPECT_TRUE(reader.CheckANSFinalState());
+  EXPECT_TRUE(br.Close());
+}
+
+TEST(ANSTest, EntropyCodePresetRoundtrip) {
+  constexpr size_t kNumContexts = 8;
+  HistogramParams params;
+  std::vector<std::vector<Token>> training;
+  for (size_t i = 0; i < 4; i++) {
+    training.push_back(SimilarStream(i, /*all_contexts=*/true));
+  }
+  const EntropyCodePreset preset =
+      LearnEntropyCodePreset(params, kNumContexts, training);
+  ASSERT_TRUE(preset.AppliesTo(kNumContexts));
+  EXPECT_FALSE(preset.AppliesTo(kNumContexts + 1));
+
+  params.preset = &preset;
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  PresetRoundtrip(params, kNumContexts,
+                  SimilarStream(10, /*all_contexts=*/false), &context_map,
+                  &codes);
+  EXPECT_EQ(preset.context_map, context_map);
+  ASSERT_EQ(preset.uint_config.size(), codes.uint_config.size());
+  for (size_t i = 0; i < codes.uint_config.size(); i++) {
+    EXPECT_EQ(preset.uint_config[i].split_exponent,
+              codes.uint_config[i].split_exponent);
+  }
+}
+
+TEST(ANSTest, EntropyCodePresetOnSmallValues) {
+  constexpr size_t kNumContexts = 2;
+  std::mt19937_64 rng(0);
+  // Uniform 8-bit values, for which direct coding is best.
+  std::vector<std::vector<Token>> training(1);
+  for (size_t i = 0; i < 20000; i++) {
+    training[0].emplace_back(i % kNumContexts, rng() % 256);
+  }
+  HistogramParams params;
+  const EntropyCodePreset preset =
+      LearnEntropyCodePreset(params, kNumContexts, training);
+  ASSERT_TRUE(preset.AppliesTo(kNumContexts));
+  uint32_t max_split_exponent = 0;
+  for (const HybridUintConfig& config : preset.uint_config) {
+    max_split_exponent = std::max(max_split_exponent, config.split_exponent);
+  }
+  ASSERT_EQ(8u, max_split_exponent);
+
+  // The tokens of these fit in a much smaller alphabet, which must still be
+  // large enough to signal the split exponents of the preset.
+  std::vector<Token> stream;
+  for (size_t i = 0; i < 1000; i++) {
+    stream.emplace_back(i % kNumContexts, rng() % 4);
+  }
+  params.preset = &preset;
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  PresetRoundtrip(params, kNumContexts, stream, &context_map, &codes);
+  EXPECT_EQ(preset.context_map, context_map);
+}
+
+TEST(ANSTest, EntropyCodePresetRespectsMaxHistograms) {
+  constexpr size_t kNumContexts = 8;
+  HistogramParams params;
+  std::vector<std::vector<Token>> training;
+  for (size_t i = 0; i < 4; i++) {
+    training.push_back(SimilarStream(i, /*all_contexts=*/true));
+  }
+  const EntropyCodePreset preset =
+      LearnEntropyCodePreset(params, kNumContexts, training);
+  ASSERT_GT(preset.uint_config.size(), 2u);
+
+  // A preset with too many clusters is not used.
+  params.preset = &preset;
+  params.max_histograms = 2;
+  std::vector<uint8_t> context_map;
+  EntropyEncodingData codes;
+  PresetRoundtrip(params, kNumContexts,
+                  SimilarStream(10, /*all_contexts=*/true), &context_map,
+                  &codes);
+  EXPECT_LE(codes.uint_config.size(), 2u);
+}
+
+TEST(ANSTest, EntropyCodePresetSerialization) {
+  constexpr size_t kNumContexts = 8;
+  HistogramParams params;
+  std::vector<std::vector<Token>> training;
+  for (size_t i = 0; i < 4; i++) {
+    training.push_back(SimilarStream(i, /*all_contexts=*/true));
+  }
+  const EntropyCodePreset preset =
+      LearnEntropyCodePreset(params, kNumContexts, training);
+  PaddedBytes bytes;
+  WriteEntropyCodePreset(preset, &bytes);
+
+  EntropyCodePreset read;
+  ASSERT_TRUE(ReadEntropyCodePreset(Span<const uint8_t>(bytes), &read));
+  EXPECT_EQ(preset.context_map, read.context_map);
+  ASSERT_EQ(preset.uint_config.size(), read.uint_config.size());
+  for (size_t i = 0; i < preset.uint_config.size(); i++) {
+    EXPECT_EQ(preset.uint_config[i].split_exponent,
+              read.uint_config[i].split_exponent);
+    EXPECT_EQ(preset.uint_config[i].msb_in_token,
+              read.uint_config[i].msb_in_token);
+    EXPECT_EQ(preset.uint_config[i].lsb_in_token,
+              read.uint_config[i].lsb_in_token);
+  }
+
+  EXPECT_FALSE(ReadEntropyCodePreset(
+      Span<const uint8_t>(bytes.data(), bytes.size() - 1), &read));
+  // msb_in_token + lsb_in_token larger than split_exponent.
+  PaddedBytes invalid = bytes;
+  invalid[invalid.size() - 3] = 1;
+  invalid[invalid.size() - 2] = 1;
+  invalid[invalid.size() - 1] = 1;
+  EXPECT_FALSE(ReadEntropyCodePreset(Span<const uint8_t>(invalid), &read));
+}
+
 }  // namespace
 }  // namespace jxl
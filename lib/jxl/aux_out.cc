@@ -48,6 +48,11 @@ void AuxOut::Print(size_t num_inputs) const {
     }
   }
 
+  if (num_global_modular_channels != 0) {
+    printf("\nModular channels: %zu, independent: %zu\n",
+           num_global_modular_channels, num_independent_modular_channels);
+  }
+
   size_t total_blocks = 0;
   size_t total_positions = 0;
   if (total_blocks != 0 && total_positions != 0) {
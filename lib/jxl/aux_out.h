@@ -159,6 +159,9 @@ struct AuxOut {
     num_dct16x32_blocks += victim.num_dct16x32_blocks;
     num_dct32_blocks += victim.num_dct32_blocks;
     num_butteraugli_iters += victim.num_butteraugli_iters;
+    num_global_modular_channels += victim.num_global_modular_channels;
+    num_independent_modular_channels +=
+        victim.num_independent_modular_channels;
     for (size_t i = 0; i < dc_pred_usage.size(); ++i) {
       dc_pred_usage[i] += victim.dc_pred_usage[i];
       dc_pred_usage_xb[i] += victim.dc_pred_usage_xb[i];
@@ -286,6 +289,12 @@ struct AuxOut {
 
   int num_butteraugli_iters = 0;
 
+  // Number of coded channels of the global modular stream, and how many of
+  // them do not depend on previous channels (and can be decoded in parallel
+  // if the frame has a per-channel index).
+  size_t num_global_modular_channels = 0;
+  size_t num_independent_modular_channels = 0;
+
   // If not empty, additional debugging information (e.g. debug images) is
   // saved in files with this prefix.
   std::string debug_prefix;
@@ -73,8 +73,9 @@ Status ImageBlender::PrepareBlending(
   overlap_ = Rect(x0, y0, xsize, ysize);
 
   // Image to write to.
-  ImageBundle& bg = *state.reference_frames[info_.source].frame;
-  if (bg.xsize() == 0 && bg.ysize() == 0) {
+  const auto& bg_frame = state.reference_frames[info_.source];
+  ImageBundle& bg = *bg_frame.frame;
+  if (bg_frame.xsize() == 0 && bg_frame.ysize() == 0) {
     // there is no background, assume it to be all zeroes
     ImageBundle empty(&state.metadata->m);
     Image3F color(image_xsize, image_ysize);
@@ -90,16 +91,16 @@ Status ImageBlender::PrepareBlending(
       empty.SetExtraChannels(std::move(ec));
     }
     bg = std::move(empty);
-  } else if (state.reference_frames[info_.source].ib_is_in_xyb) {
+  } else if (bg_frame.ib_is_in_xyb) {
     return JXL_FAILURE(
         "Trying to blend XYB reference frame %i and non-XYB frame",
         info_.source);
   }
 
-  if (bg.xsize() < image_xsize || bg.ysize() < image_ysize ||
-      bg.origin.x0 != 0 || bg.origin.y0 != 0) {
+  if (bg_frame.xsize() < image_xsize || bg_frame.ysize() < image_ysize ||
+      bg_frame.origin().x0 != 0 || bg_frame.origin().y0 != 0) {
     return JXL_FAILURE("Trying to use a %zux%zu crop as a background",
-                       bg.xsize(), bg.ysize());
+                       bg_frame.xsize(), bg_frame.ysize());
   }
   if (state.metadata->m.xyb_encoded) {
     if (!dec_state->output_encoding_info.color_encoding_is_original) {
@@ -112,34 +113,35 @@ Status ImageBlender::PrepareBlending(
                        foreground_xsize, foreground_ysize);
   }
 
-  if (!cropbox_.IsInside(bg)) {
+  if (!cropbox_.IsInside(Rect(0, 0, bg_frame.xsize(), bg_frame.ysize()))) {
     return JXL_FAILURE(
         "Trying blend %zux%zu to (%zu,%zu), but background is %zux%zu",
         cropbox_.xsize(), cropbox_.ysize(), cropbox_.x0(), cropbox_.y0(),
-        bg.xsize(), bg.ysize());
+        bg_frame.xsize(), bg_frame.ysize());
   }
 
-  CopyImageTo(frame_rect, *bg.color(), output_rect, output);
+  for (size_t c = 0; c < 3; c++) {
+    bg_frame.CopyTo(c, frame_rect, output_rect, &output->Plane(c));
+  }
   for (size_t i = 0; i < ec_info_->size(); ++i) {
     const auto& eci = (*ec_info_)[i];
-    const auto& src = *state.reference_frames[eci.source].frame;
+    const auto& src = state.reference_frames[eci.source];
     if (src.xsize() == 0 && src.ysize() == 0) {
       ZeroFillPlane(&(*output_extra_channels_)[i],
                     output_extra_channels_rects_[i]);
     } else {
-      if (src.extra_channels()[i].xsize() < image_xsize ||
-          src.extra_channels()[i].ysize() < image_ysize || src.origin.x0 != 0 ||
-          src.origin.y0 != 0) {
+      // Extra channels of a reference frame have the size of its color.
+      if (src.xsize() < image_xsize || src.ysize() < image_ysize ||
+          src.origin().x0 != 0 || src.origin().y0 != 0) {
         return JXL_FAILURE(
             "Invalid size %zux%zu or origin %+d%+d for extra channel %zu of "
             "reference frame %zu, expected at least %zux%zu+0+0",
-            src.extra_channels()[i].xsize(), src.extra_channels()[i].ysize(),
-            static_cast<int>(src.origin.x0), static_cast<int>(src.origin.y0), i,
+            src.xsize(), src.ysize(), static_cast<int>(src.origin().x0),
+            static_cast<int>(src.origin().y0), i,
             static_cast<size_t>(eci.source), image_xsize, image_ysize);
       }
-      CopyImageTo(frame_rect, src.extra_channels()[i],
-                  output_extra_channels_rects_[i],
-                  &(*output_extra_channels_)[i]);
+      src.CopyTo(3 + i, frame_rect, output_extra_channels_rects_[i],
+                 &(*output_extra_channels_)[i]);
     }
   }
 
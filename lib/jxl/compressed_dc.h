@@ -24,6 +24,13 @@ namespace jxl {
 void AdaptiveDCSmoothing(const float* dc_factors, Image3F* dc,
                          ThreadPool* pool);
 
+// Equivalent to AdaptiveDCSmoothing, restricted to `rect`: reads `dc` in
+// `rect` and up to one pixel around it, and writes the smoothed values to the
+// same rect of `out`, which must have the same size as `dc`. Allows smoothing
+// each DC group as soon as its neighbours are available.
+void AdaptiveDCSmoothingRect(const float* dc_factors, const Image3F& dc,
+                             const Rect& rect, Image3F* out);
+
 void DequantDC(const Rect& r, Image3F* dc, ImageB* quant_dc, const Image& in,
                const float* dc_factors, float mul, const float* cfl_factors,
                YCbCrChromaSubsampling chroma_subsampling,
@@ -6,7 +6,9 @@
 #include "lib/jxl/dec_ans.h"
 
 #include <stdint.h>
+#include <string.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "lib/jxl/ans_common.h"
@@ -59,7 +61,7 @@ Status ReadHistogram(int precision_bits, std::vector<int>* counts,
       symbols[i] = DecodeVarLenUint8(input);
       if (symbols[i] > max_symbol) max_symbol = symbols[i];
     }
-    counts->resize(max_symbol + 1);
+    counts->assign(max_symbol + 1, 0);
     if (num_symbols == 1) {
       (*counts)[symbols[0]] = 1 << precision_bits;
     } else {
@@ -95,7 +97,7 @@ Status ReadHistogram(int precision_bits, std::vector<int>* counts,
     }
 
     int length = DecodeVarLenUint8(input) + 3;
-    counts->resize(length);
+    counts->assign(length, 0);
     int total_count = 0;
 
     static const uint8_t huff[128][2] = {
@@ -117,12 +119,14 @@ Status ReadHistogram(int precision_bits, std::vector<int>* counts,
         {3, 10}, {4, 4},  {3, 7}, {4, 1}, {3, 6}, {3, 8}, {3, 9}, {4, 2},
     };
 
-    std::vector<int> logcounts(counts->size());
+    // Histograms are read for every stream, so these live on the stack.
+    // `length` is at most 255 + 3.
+    int logcounts[ANS_MAX_ALPHABET_SIZE + 3] = {};
     int omit_log = -1;
     int omit_pos = -1;
     // This array remembers which symbols have an RLE length.
-    std::vector<int> same(counts->size(), 0);
-    for (size_t i = 0; i < logcounts.size(); ++i) {
+    int same[ANS_MAX_ALPHABET_SIZE + 3] = {};
+    for (size_t i = 0; i < static_cast<size_t>(length); ++i) {
       input->Refill();  // for PeekFixedBits + Advance
       int idx = input->PeekFixedBits<7>();
       input->Consume(huff[idx][0]);
@@ -141,13 +145,13 @@ Status ReadHistogram(int precision_bits, std::vector<int>* counts,
     }
     // Invalid input, e.g. due to invalid usage of RLE.
     if (omit_pos < 0) return JXL_FAILURE("Invalid histogram.");
-    if (static_cast<size_t>(omit_pos) + 1 < logcounts.size() &&
+    if (omit_pos + 1 < length &&
         logcounts[omit_pos + 1] == ANS_TAB_SIZE + 1) {
       return JXL_FAILURE("Invalid histogram.");
     }
     int prev = 0;
     int numsame = 0;
-    for (size_t i = 0; i < logcounts.size(); ++i) {
+    for (size_t i = 0; i < static_cast<size_t>(length); ++i) {
       if (same[i]) {
         // RLE sequence, let this loop output the same count for the next
         // iterations.
@@ -229,8 +233,13 @@ Status DecodeANSCodes(const size_t num_histograms,
                       sizeof(AliasTable::Entry));
     AliasTable::Entry* alias_tables =
         reinterpret_cast<AliasTable::Entry*>(result->alias_tables.get());
+    const size_t table_size = 1 << result->log_alpha_size;
+    // Histograms that are equal to a previous one (with the same hash) copy its
+    // alias table instead of building it again.
+    std::vector<int> all_counts(num_histograms * table_size);
+    std::vector<uint64_t> hashes(num_histograms);
+    std::vector<int> counts;
     for (size_t c = 0; c < num_histograms; ++c) {
-      std::vector<int> counts;
       if (!ReadHistogram(ANS_LOG_TAB_SIZE, &counts, in)) {
         return JXL_FAILURE("Invalid histogram bitstream.");
       }
@@ -254,8 +263,24 @@ Status DecodeANSCodes(const size_t num_histograms,
         }
       }
       result->degenerate_symbols[c] = degenerate_symbol;
+      int* JXL_RESTRICT padded_counts = &all_counts[c * table_size];
+      uint64_t hash = counts.size();
+      for (size_t s = 0; s < counts.size(); s++) {
+        padded_counts[s] = counts[s];
+        hash = (hash ^ static_cast<uint32_t>(counts[s])) * 0x100000001B3ull;
+      }
+      hashes[c] = hash;
+      // At most kMaxClusters histograms, so a linear search is good enough.
+      const size_t prev =
+          std::find(hashes.begin(), hashes.begin() + c, hash) - hashes.begin();
+      if (prev != c && memcmp(padded_counts, &all_counts[prev * table_size],
+                              table_size * sizeof(int)) == 0) {
+        memcpy(alias_tables + c * table_size, alias_tables + prev * table_size,
+               table_size * sizeof(AliasTable::Entry));
+        continue;
+      }
       InitAliasTable(counts, ANS_TAB_SIZE, result->log_alpha_size,
-                     alias_tables + c * (1 << result->log_alpha_size));
+                     alias_tables + c * table_size);
     }
   }
   return true;
@@ -186,6 +186,28 @@ class ANSSymbolReader {
     }
   }
 
+  // Returns a reader that continues a stream without LZ77 from a position
+  // recorded by the encoder (see TokenCheckpoints): `state` is the ANS state
+  // before the next symbol, and the BitReader passed to the following reads
+  // must point to the corresponding bit.
+  static ANSSymbolReader Resume(const ANSCode* code, uint32_t state) {
+    JXL_DASSERT(!code->lz77.enabled);
+    ANSSymbolReader reader;
+    reader.alias_tables_ =
+        reinterpret_cast<AliasTable::Entry*>(code->alias_tables.get());
+    reader.huffman_data_ = code->huffman_data.data();
+    reader.use_prefix_code_ = code->use_prefix_code;
+    reader.configs = code->uint_config.data();
+    reader.num_special_distances_ = 0;
+    if (!reader.use_prefix_code_) {
+      reader.state_ = state;
+      reader.log_alpha_size_ = code->log_alpha_size;
+      reader.log_entry_size_ = ANS_LOG_TAB_SIZE - code->log_alpha_size;
+      reader.entry_size_minus_1_ = (1 << reader.log_entry_size_) - 1;
+    }
+    return reader;
+  }
+
   JXL_INLINE size_t ReadSymbolANSWithoutRefill(const size_t histo_idx,
                                                BitReader* JXL_RESTRICT br) {
     const uint32_t res = state_ & (ANS_TAB_SIZE - 1u);
@@ -236,6 +258,11 @@ class ANSSymbolReader {
   }
 
   bool CheckANSFinalState() { return state_ == (ANS_SIGNATURE << 16u); }
+  // Returns whether the ANS state is `state`, e.g. one recorded by the encoder
+  // for the current position (see Resume). Always true for prefix codes.
+  bool CheckANSState(uint32_t state) const {
+    return use_prefix_code_ || state_ == state;
+  }
 
   template <typename BitReader>
   static JXL_INLINE uint32_t ReadHybridUintConfig(
@@ -7,7 +7,10 @@
 #define LIB_JXL_DEC_CACHE_H_
 
 #include <stdint.h>
+#include <string.h>
 
+#include <array>
+#include <hwy/aligned_allocator.h>
 #include <hwy/base.h>  // HWY_ALIGN_MAX
 
 #include "lib/jxl/ac_strategy.h"
@@ -15,6 +18,7 @@
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/convolve.h"
+#include "lib/jxl/dct_util.h"
 #include "lib/jxl/dec_group_border.h"
 #include "lib/jxl/dec_noise.h"
 #include "lib/jxl/dec_upsample.h"
@@ -26,6 +30,32 @@
 
 namespace jxl {
 
+// Parameters of VarDCT group decoding that are the same for all the groups of
+// a frame. Filled in once per frame by PrepareGroupDecoding (dec_group.h),
+// after the AC global section is known, and read-only afterwards.
+struct GroupDecodePlan {
+  bool prepared = false;
+
+  ACType ac_type = ACType::k32;
+  // Whether coefficients are stored for future passes, and/or read from
+  // previous ones.
+  bool accumulate = false;
+
+  size_t hshift[3] = {};
+  size_t vshift[3] = {};
+
+  // JPEG reconstruction only.
+  bool is_jpeg = false;
+  bool jpeg_is_gray = false;
+  // True if no block has a non-zero CfL factor that needs to be undone.
+  bool jpeg_cfl_is_trivial = false;
+  std::array<int, 3> jpeg_c_map = {};
+  std::array<int, 3> dcoff = {};
+  // Transposed JPEG quantization tables of the three channels, multiplied by
+  // the Y table and scaled to kCFLFixedPointPrecision.
+  hwy::AlignedFreeUniquePtr<int32_t[]> scaled_qtable;
+};
+
 // Per-frame decoder state. All the images here should be accessed through a
 // group rect (either with block units or pixel units).
 struct PassesDecoderState {
@@ -57,6 +87,17 @@ struct PassesDecoderState {
   Image3F decoded;
   std::vector<ImageF> extra_channels;
 
+  // If true, `decoded` is not allocated and the decoded image is instead
+  // stored as binary16 in `decoded_f16`, and converted back to float one
+  // group at a time when filters are applied. Only supported for Modular
+  // frames.
+  bool decoded_in_f16 = false;
+  Image3U decoded_f16;
+
+  // If true, VarDCT color is not reconstructed: `decoded` (or `group_data`) is
+  // zero-filled instead, and only the extra channels are meaningful.
+  bool skip_color = false;
+
   // Borders between groups. Only allocated if `decoded` is *not* allocated.
   // We also store the extremal borders for simplicity. Horizontal borders are
   // stored in an image as wide as the main frame, in top-to-bottom order (top
@@ -95,6 +136,8 @@ struct PassesDecoderState {
   // Storage for coefficients if in "accumulate" mode.
   std::unique_ptr<ACImage> coefficients = make_unique<ACImageT<int32_t>>(0, 0);
 
+  GroupDecodePlan group_decode_plan;
+
   // Filter application pipeline used by ApplyImageFeatures. One entry is needed
   // per thread.
   std::vector<FilterPipeline> filter_pipelines;
@@ -264,6 +307,7 @@ struct PassesDecoderState {
     rgb_output_is_rgba = false;
     fast_xyb_srgb8_conversion = false;
     used_acs = 0;
+    group_decode_plan.prepared = false;
 
     group_border_assigner.Init(shared->frame_dim);
     const LoopFilter& lf = shared->frame_header.loop_filter;
@@ -329,12 +373,21 @@ struct PassesDecoderState {
       // decoded must be padded to a multiple of kBlockDim rows since the last
       // rows may be used by the filters even if they are outside the frame
       // dimension.
-      decoded = Image3F(shared->frame_dim.xsize_padded,
-                        shared->frame_dim.ysize_padded);
+      if (decoded_in_f16) {
+        JXL_ASSERT(shared->frame_header.encoding == FrameEncoding::kModular);
+        decoded = Image3F();
+        decoded_f16 = Image3U(shared->frame_dim.xsize_padded,
+                              shared->frame_dim.ysize_padded);
+      } else {
+        decoded = Image3F(shared->frame_dim.xsize_padded,
+                          shared->frame_dim.ysize_padded);
+        decoded_f16 = Image3U();
+      }
     }
 #if MEMORY_SANITIZER
     // Avoid errors due to loading vectors on the outermost padding.
     FillImage(msan::kSanitizerSentinel, &decoded);
+    ZeroFillImage(&decoded_f16);
 #endif
   }
 
@@ -377,25 +430,57 @@ struct GroupDecCache {
       // We need 3x int32 or int16 blocks for quantized coefficients.
       int32_memory_ = hwy::AllocateAligned<int32_t>(max_block_area_ * 3);
       int16_memory_ = hwy::AllocateAligned<int16_t>(max_block_area_ * 3);
+      qblock_is_zero = false;
     }
 
     dec_group_block = float_memory_.get();
     scratch_space = dec_group_block + max_block_area_ * 3;
     dec_group_qblock = int32_memory_.get();
     dec_group_qblock16 = int16_memory_.get();
+
+    if ((used_acs & (1 << AcStrategy::Type::DCT)) != 0 && !dct8_memory_) {
+      // Coefficients of up to kDCT8BatchSize blocks for each channel, and
+      // kDCT8BatchSize + 1 blocks of scratch space for the transform.
+      const size_t batch_size = kDCT8BatchSize * kDCTBlockSize;
+      dct8_memory_ =
+          hwy::AllocateAligned<float>(batch_size * 4 + kDCTBlockSize);
+      for (size_t c = 0; c < 3; c++) {
+        dct8_batch[c] = dct8_memory_.get() + c * batch_size;
+      }
+      dct8_batch_scratch = dct8_memory_.get() + 3 * batch_size;
+    }
   }
 
+  // Maximum number of adjacent DCT8 blocks whose IDCT is run at once. Must
+  // not exceed kMaxDCT8Batch in dec_transforms-inl.h.
+  static constexpr size_t kDCT8BatchSize = 8;
+
   // Scratch space used by DecGroupImpl().
   float* dec_group_block;
   int32_t* dec_group_qblock;
   int16_t* dec_group_qblock16;
 
+  // Whether dec_group_qblock and dec_group_qblock16 only contain zeros. In
+  // single-pass decoding, dequantization clears the coefficients as it reads
+  // them, so that the buffers do not need to be zeroed before every block.
+  bool qblock_is_zero = false;
+  void ZeroFillQBlock() {
+    memset(int32_memory_.get(), 0, max_block_area_ * 3 * sizeof(int32_t));
+    memset(int16_memory_.get(), 0, max_block_area_ * 3 * sizeof(int16_t));
+    qblock_is_zero = true;
+  }
+
   // For TransformToPixels.
   float* scratch_space;
   // Note that scratch_space is never used at the same time as dec_group_qblock.
   // Moreover, only one of dec_group_qblock16 is ever used.
   // TODO(veluca): figure out if we can save allocations.
 
+  // Dequantized coefficients of pending DCT8 blocks, per channel, and scratch
+  // space for DCT8BatchToPixels. Only allocated if DCT8 is used.
+  float* dct8_batch[3] = {};
+  float* dct8_batch_scratch = nullptr;
+
   // AC decoding
   Image3I num_nzeroes[kMaxNumPasses];
 
@@ -403,6 +488,7 @@ struct GroupDecCache {
   hwy::AlignedFreeUniquePtr<float[]> float_memory_;
   hwy::AlignedFreeUniquePtr<int32_t[]> int32_memory_;
   hwy::AlignedFreeUniquePtr<int16_t[]> int16_memory_;
+  hwy::AlignedFreeUniquePtr<float[]> dct8_memory_;
   size_t max_block_area_ = 0;
 };
 
@@ -5,6 +5,8 @@
 
 #include "lib/jxl/dec_context_map.h"
 
+#include <string.h>
+
 #include <algorithm>
 #include <vector>
 
@@ -19,8 +21,7 @@ namespace {
 
 void MoveToFront(uint8_t* v, uint8_t index) {
   uint8_t value = v[index];
-  uint8_t i = index;
-  for (; i; --i) v[i] = v[i - 1];
+  memmove(v + 1, v, index);
   v[0] = value;
 }
 
@@ -39,7 +40,7 @@ void InverseMoveToFrontTransform(uint8_t* v, int v_len) {
 
 bool VerifyContextMap(const std::vector<uint8_t>& context_map,
                       const size_t num_htrees) {
-  std::vector<bool> have_htree(num_htrees);
+  bool have_htree[kMaxClusters] = {};
   size_t num_found = 0;
   for (const uint8_t htree : context_map) {
     if (htree >= num_htrees) {
@@ -278,10 +278,15 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
   const size_t bytes_per_pixel = num_channels * bytes_per_channel;
 
   const Image3F* color = &ib.color();
-  Image3F temp_color, unpremul;
+  Image3F temp_color;
   const ImageF* alpha = ib.HasAlpha() ? &ib.alpha() : nullptr;
   ImageF temp_alpha;
 
+  // Premultiplied color is converted to straight alpha one row at a time,
+  // right before it is written out, in a per-thread copy of the row.
+  const bool unpremultiply = ib.AlphaIsPremultiplied() && ib.HasAlpha();
+  Image3F unpremul_rows;
+
   std::vector<std::vector<uint8_t>> row_out_callback;
   auto InitOutCallback = [&](size_t num_threads) {
     if (out_callback) {
@@ -290,18 +295,10 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
         row_out_callback[i].resize(stride);
       }
     }
-  };
-
-  if (ib.AlphaIsPremultiplied() && ib.HasAlpha()) {
-    unpremul = Image3F(color->xsize(), color->ysize());
-    CopyImageTo(*color, &unpremul);
-    for (size_t y = 0; y < unpremul.ysize(); y++) {
-      UnpremultiplyAlpha(unpremul.PlaneRow(0, y), unpremul.PlaneRow(1, y),
-                         unpremul.PlaneRow(2, y), alpha->Row(y),
-                         unpremul.xsize());
+    if (unpremultiply) {
+      unpremul_rows = Image3F(xsize, num_threads);
     }
-    color = &unpremul;
-  }
+  };
   if (undo_orientation != Orientation::kIdentity) {
     Image3F transformed;
     for (size_t c = 0; c < color_channels; ++c) {
@@ -335,6 +332,30 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
     FillImage(1.0f, &ones);
   }
 
+  // Sets the `num_channels` input rows for output row `y`.
+  const auto GetInputRows = [&](size_t y, size_t thread,
+                                const float* JXL_RESTRICT* row_in) {
+    size_t c = 0;
+    if (unpremultiply) {
+      // Only the first plane of grayscale images is meaningful (and
+      // reoriented); it is also used to fill the other two.
+      float* JXL_RESTRICT rows[3];
+      for (size_t i = 0; i < 3; i++) {
+        rows[i] = unpremul_rows.PlaneRow(i, thread);
+        memcpy(rows[i], color->ConstPlaneRow(i < color_channels ? i : 0, y),
+               xsize * sizeof(float));
+      }
+      UnpremultiplyAlpha(rows[0], rows[1], rows[2], alpha->ConstRow(y), xsize);
+      for (; c < color_channels; c++) row_in[c] = rows[c];
+    } else {
+      for (; c < color_channels; c++) row_in[c] = color->ConstPlaneRow(c, y);
+    }
+    if (want_alpha) {
+      row_in[c++] = ib.HasAlpha() ? alpha->ConstRow(y) : ones.ConstRow(0);
+    }
+    JXL_ASSERT(c == num_channels);
+  };
+
   if (float_out) {
     if (bits_per_sample == 16) {
       bool swap_endianness = little_endian != IsLittleEndian();
@@ -350,16 +371,9 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
           [&](const int task, int thread) {
             const int64_t y = task;
             const float* JXL_RESTRICT row_in[4];
-            size_t c = 0;
-            for (; c < color_channels; c++) {
-              row_in[c] = color->PlaneRow(c, y);
-            }
-            if (want_alpha) {
-              row_in[c++] = ib.HasAlpha() ? alpha->Row(y) : ones.Row(0);
-            }
-            JXL_ASSERT(c == num_channels);
+            GetInputRows(y, thread, row_in);
             hwy::float16_t* JXL_RESTRICT row_f16[4];
-            for (size_t r = 0; r < c; r++) {
+            for (size_t r = 0; r < num_channels; r++) {
               row_f16[r] = f16_cache.Row(r + thread * num_channels);
               HWY_DYNAMIC_DISPATCH(FloatToF16)
               (row_in[r], row_f16[r], xsize);
@@ -372,7 +386,7 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
             hwy::float16_t* row_f16_out =
                 reinterpret_cast<hwy::float16_t*>(row_out);
             for (size_t x = 0; x < xsize; x++) {
-              for (size_t r = 0; r < c; r++) {
+              for (size_t r = 0; r < num_channels; r++) {
                 row_f16_out[x * num_channels + r] = row_f16[r][x];
               }
             }
@@ -401,18 +415,11 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                     ? row_out_callback[thread].data()
                     : &(reinterpret_cast<uint8_t*>(out_image))[stride * y];
             const float* JXL_RESTRICT row_in[4];
-            size_t c = 0;
-            for (; c < color_channels; c++) {
-              row_in[c] = color->PlaneRow(c, y);
-            }
-            if (want_alpha) {
-              row_in[c++] = ib.HasAlpha() ? alpha->Row(y) : ones.Row(0);
-            }
-            JXL_ASSERT(c == num_channels);
+            GetInputRows(y, thread, row_in);
             if (little_endian) {
-              StoreFloatRow<StoreLEFloat>(row_in, c, xsize, row_out);
+              StoreFloatRow<StoreLEFloat>(row_in, num_channels, xsize, row_out);
             } else {
-              StoreFloatRow<StoreBEFloat>(row_in, c, xsize, row_out);
+              StoreFloatRow<StoreBEFloat>(row_in, num_channels, xsize, row_out);
             }
             if (out_callback) {
               (*out_callback)(out_opaque, 0, y, xsize, row_out);
@@ -441,16 +448,9 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
                   ? row_out_callback[thread].data()
                   : &(reinterpret_cast<uint8_t*>(out_image))[stride * y];
           const float* JXL_RESTRICT row_in[4];
-          size_t c = 0;
-          for (; c < color_channels; c++) {
-            row_in[c] = color->PlaneRow(c, y);
-          }
-          if (want_alpha) {
-            row_in[c++] = ib.HasAlpha() ? alpha->Row(y) : ones.Row(0);
-          }
-          JXL_ASSERT(c == num_channels);
+          GetInputRows(y, thread, row_in);
           uint32_t* JXL_RESTRICT row_u32[4];
-          for (size_t r = 0; r < c; r++) {
+          for (size_t r = 0; r < num_channels; r++) {
             row_u32[r] = u32_cache.Row(r + thread * num_channels);
             // row_u32[] is a per-thread temporary row storage, this isn't
             // intended to be initialized on a previous run.
@@ -460,24 +460,24 @@ Status ConvertToExternal(const jxl::ImageBundle& ib, size_t bits_per_sample,
           }
           // TODO(deymo): add bits_per_sample == 1 case here.
           if (bits_per_sample <= 8) {
-            StoreUintRow<Store8>(row_u32, c, xsize, 1, row_out);
+            StoreUintRow<Store8>(row_u32, num_channels, xsize, 1, row_out);
           } else if (bits_per_sample <= 16) {
             if (little_endian) {
-              StoreUintRow<StoreLE16>(row_u32, c, xsize, 2, row_out);
+              StoreUintRow<StoreLE16>(row_u32, num_channels, xsize, 2, row_out);
             } else {
-              StoreUintRow<StoreBE16>(row_u32, c, xsize, 2, row_out);
+              StoreUintRow<StoreBE16>(row_u32, num_channels, xsize, 2, row_out);
             }
           } else if (bits_per_sample <= 24) {
             if (little_endian) {
-              StoreUintRow<StoreLE24>(row_u32, c, xsize, 3, row_out);
+              StoreUintRow<StoreLE24>(row_u32, num_channels, xsize, 3, row_out);
             } else {
-              StoreUintRow<StoreBE24>(row_u32, c, xsize, 3, row_out);
+              StoreUintRow<StoreBE24>(row_u32, num_channels, xsize, 3, row_out);
             }
           } else {
             if (little_endian) {
-              StoreUintRow<StoreLE32>(row_u32, c, xsize, 4, row_out);
+              StoreUintRow<StoreLE32>(row_u32, num_channels, xsize, 4, row_out);
             } else {
-              StoreUintRow<StoreBE32>(row_u32, c, xsize, 4, row_out);
+              StoreUintRow<StoreBE32>(row_u32, num_channels, xsize, 4, row_out);
             }
           }
           if (out_callback) {
@@ -7,16 +7,20 @@
 
 #include <stddef.h>
 
+#include <atomic>
+#include <memory>
 #include <utility>
 #include <vector>
 
 #include "jxl/decode.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/override.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/color_management.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_frame.h"
 #include "lib/jxl/frame_header.h"
 #include "lib/jxl/headers.h"
@@ -39,6 +43,114 @@ Status DecodeHeaders(BitReader* reader, CodecInOut* io) {
   return true;
 }
 
+// Whether the frame described by `header` can be decoded without any state
+// left by the previous frames: a displayed frame that replaces the whole
+// canvas, and uses neither patches nor a DC frame.
+bool IsSelfContainedFrame(const FrameHeader& header) {
+  if (header.frame_type != FrameType::kRegularFrame) return false;
+  if (header.custom_size_or_origin) return false;
+  if (header.flags & (FrameHeader::kPatches | FrameHeader::kUseDcFrame)) {
+    return false;
+  }
+  if (header.blending_info.mode != BlendMode::kReplace) return false;
+  for (const BlendingInfo& info : header.extra_channel_blending_info) {
+    if (info.mode != BlendMode::kReplace) return false;
+  }
+  return true;
+}
+
+// Finds up to `max_frames` consecutive self-contained frames starting at byte
+// `pos` of `data`. `offsets` receives the start of each of them, followed by
+// the end of the last one, and `noise_seeds` the amount by which each of them
+// advances the noise seed. Frames that cannot be parsed are left to the
+// regular decoding path, which reports the error.
+void FindSelfContainedFrames(const CodecMetadata& metadata,
+                             const Span<const uint8_t> data, size_t pos,
+                             size_t max_frames, std::vector<size_t>* offsets,
+                             std::vector<size_t>* noise_seeds,
+                             bool* found_last) {
+  offsets->assign(1, pos);
+  noise_seeds->clear();
+  *found_last = false;
+  while (offsets->size() <= max_frames && pos < data.size()) {
+    BitReader reader(Span<const uint8_t>(data.data() + pos, data.size() - pos));
+    FrameHeader header(&metadata);
+    Status ok = SkipFrame(metadata, &reader, /*is_preview=*/false, &header);
+    const size_t size = reader.TotalBitsConsumed() / kBitsPerByte;
+    if (!reader.Close() || !ok || !IsSelfContainedFrame(header)) break;
+    pos += size;
+    offsets->push_back(pos);
+    // See PassesDecoderState::InitForAC.
+    noise_seeds->push_back((header.flags & FrameHeader::kNoise)
+                               ? header.ToFrameDimensions().num_groups
+                               : 0);
+    if (header.is_last) {
+      *found_last = true;
+      break;
+    }
+  }
+}
+
+// Decodes the frames between consecutive `offsets` in parallel, each with its
+// own decoder state and a single thread, then moves the reference frames they
+// saved to `dec_state`, in bitstream order. Each frame starts from the noise
+// seed that sequential decoding would reach, and `dec_state` is advanced past
+// all of them.
+Status DecodeSelfContainedFrames(const DecompressParams& dparams,
+                                 const Span<const uint8_t> data,
+                                 const std::vector<size_t>& offsets,
+                                 const std::vector<size_t>& noise_seeds,
+                                 ThreadPool* pool, CodecInOut* io,
+                                 PassesDecoderState* dec_state,
+                                 std::vector<ImageBundle>* frames) {
+  PROFILER_FUNC;
+  const size_t num_frames = offsets.size() - 1;
+  JXL_ASSERT(noise_seeds.size() == num_frames);
+  std::vector<size_t> first_noise_seed(num_frames);
+  for (size_t i = 0; i < num_frames; i++) {
+    first_noise_seed[i] = dec_state->noise_seed;
+    dec_state->noise_seed += noise_seeds[i];
+  }
+  std::vector<std::unique_ptr<PassesDecoderState>> states(num_frames);
+  frames->clear();
+  for (size_t i = 0; i < num_frames; i++) {
+    frames->emplace_back(&io->metadata.m);
+  }
+  std::atomic<bool> has_error{false};
+  RunOnPool(
+      pool, 0, num_frames, ThreadPool::SkipInit(),
+      [&](const int i, const int /*thread*/) {
+        states[i] = make_unique<PassesDecoderState>();
+        states[i]->noise_seed = first_noise_seed[i];
+        Status ok = states[i]->output_encoding_info.Set(
+            io->metadata,
+            ColorEncoding::LinearSRGB(io->metadata.m.color_encoding.IsGray()));
+        if (ok) {
+          BitReader reader(Span<const uint8_t>(data.data() + offsets[i],
+                                               offsets[i + 1] - offsets[i]));
+          BitReaderScopedCloser reader_closer(&reader, &ok);
+          ok = DecodeFrame(dparams, states[i].get(), /*pool=*/nullptr, &reader,
+                           &(*frames)[i], io->metadata, &io->constraints);
+        }
+        if (!ok) has_error = true;
+      },
+      "DecodeFrames");
+  if (has_error) return JXL_FAILURE("Error in self-contained frame");
+
+  for (size_t i = 0; i < num_frames; i++) {
+    const FrameHeader& frame_header = states[i]->shared->frame_header;
+    if (!frame_header.CanBeReferenced()) continue;
+    const size_t id = frame_header.save_as_reference;
+    auto& from = states[i]->shared_storage.reference_frames[id];
+    auto& to = dec_state->shared_storage.reference_frames[id];
+    to.storage = std::move(from.storage);
+    to.frame = &to.storage;
+    to.ib_is_in_xyb = from.ib_is_in_xyb;
+    to.spilled = std::move(from.spilled);
+  }
+  return true;
+}
+
 }  // namespace
 
 Status DecodePreview(const DecompressParams& dparams,
@@ -81,6 +193,13 @@ Status DecodePreview(const DecompressParams& dparams,
 Status DecodeFile(const DecompressParams& dparams,
                   const Span<const uint8_t> file, CodecInOut* JXL_RESTRICT io,
                   ThreadPool* pool) {
+  return DecodeFile(dparams, file, io, pool, DecodedFrameCallback());
+}
+
+Status DecodeFile(const DecompressParams& dparams,
+                  const Span<const uint8_t> file, CodecInOut* JXL_RESTRICT io,
+                  ThreadPool* pool,
+                  const DecodedFrameCallback& frame_callback) {
   PROFILER_ZONE("DecodeFile uninstrumented");
 
   // Marker
@@ -140,8 +259,49 @@ Status DecodeFile(const DecompressParams& dparams,
         ColorEncoding::LinearSRGB(io->metadata.m.color_encoding.IsGray())));
 
     io->frames.clear();
+    size_t num_frames = 0;
     Status dec_ok(false);
+    const bool decode_frames_in_parallel =
+        dparams.parallel_frames > 1 && io->metadata.m.have_animation &&
+        !dparams.allow_partial_files && !dparams.keep_dct;
+    std::vector<size_t> frame_offsets;
+    std::vector<size_t> frame_noise_seeds;
+    std::vector<ImageBundle> parallel_frames;
+    bool is_last = false;
     do {
+      // Frames start at byte boundaries.
+      if (decode_frames_in_parallel &&
+          reader.TotalBitsConsumed() % kBitsPerByte == 0) {
+        FindSelfContainedFrames(io->metadata, file,
+                                reader.TotalBitsConsumed() / kBitsPerByte,
+                                dparams.parallel_frames, &frame_offsets,
+                                &frame_noise_seeds, &is_last);
+        if (frame_offsets.size() > 2) {
+          JXL_RETURN_IF_ERROR(DecodeSelfContainedFrames(
+              dparams, file, frame_offsets, frame_noise_seeds, pool, io,
+              &dec_state, &parallel_frames));
+          reader.SkipBits((frame_offsets.back() - frame_offsets[0]) *
+                          kBitsPerByte);
+          for (ImageBundle& frame : parallel_frames) {
+            if (frame_callback && !io->frames.empty()) {
+              io->frames.pop_back();
+            }
+            io->frames.push_back(std::move(frame));
+            io->dec_pixels +=
+                io->frames.back().xsize() * io->frames.back().ysize();
+            if (frame_callback) {
+              JXL_RETURN_IF_ERROR(
+                  frame_callback(num_frames, &io->frames.back()));
+            }
+            ++num_frames;
+          }
+          continue;
+        }
+      }
+      if (frame_callback && !io->frames.empty()) {
+        // The previous frame was already handed over to the callback.
+        io->frames.pop_back();
+      }
       io->frames.emplace_back(&io->metadata.m);
       if (jpeg_data) {
         io->frames.back().jpeg_data = std::move(jpeg_data);
@@ -161,10 +321,16 @@ Status DecodeFile(const DecompressParams& dparams,
                    FrameType::kRegularFrame &&
                dec_state.shared->frame_header.frame_type !=
                    FrameType::kSkipProgressive);
+      if (!dec_ok) break;
       io->dec_pixels += io->frames.back().xsize() * io->frames.back().ysize();
-    } while (!dec_state.shared->frame_header.is_last && dec_ok);
+      if (frame_callback) {
+        JXL_RETURN_IF_ERROR(frame_callback(num_frames, &io->frames.back()));
+      }
+      ++num_frames;
+      is_last = dec_state.shared->frame_header.is_last;
+    } while (!is_last);
 
-    if (io->frames.empty()) return JXL_FAILURE("Not enough data.");
+    if (num_frames == 0) return JXL_FAILURE("Not enough data.");
 
     if (dparams.check_decompressed_size && !dparams.allow_partial_files &&
         dparams.max_downsampling == 1) {
@@ -183,4 +349,47 @@ Status DecodeFile(const DecompressParams& dparams,
   return ret;
 }
 
+Status CountDisplayedFrames(const Span<const uint8_t> file,
+                            size_t* JXL_RESTRICT num_frames) {
+  JxlSignature signature = JxlSignatureCheck(file.data(), file.size());
+  if (signature == JXL_SIG_NOT_ENOUGH_BYTES || signature == JXL_SIG_INVALID) {
+    return JXL_FAILURE("File does not start with known JPEG XL signature");
+  }
+
+  *num_frames = 0;
+  CodecMetadata metadata;
+  Status ret = true;
+  {
+    BitReader reader(file);
+    BitReaderScopedCloser reader_closer(&reader, &ret);
+    (void)reader.ReadFixedBits<16>();  // skip marker
+
+    JXL_RETURN_IF_ERROR(ReadSizeHeader(&reader, &metadata.size));
+    JXL_RETURN_IF_ERROR(ReadImageMetadata(&reader, &metadata.m));
+    metadata.transform_data.nonserialized_xyb_encoded = metadata.m.xyb_encoded;
+    JXL_RETURN_IF_ERROR(Bundle::Read(&reader, &metadata.transform_data));
+
+    if (metadata.m.color_encoding.WantICC()) {
+      PaddedBytes icc;
+      JXL_RETURN_IF_ERROR(ReadICC(&reader, &icc));
+    }
+    if (metadata.m.have_preview) {
+      JXL_RETURN_IF_ERROR(reader.JumpToByteBoundary());
+      JXL_RETURN_IF_ERROR(SkipFrame(metadata, &reader, /*is_preview=*/true));
+    }
+    JXL_RETURN_IF_ERROR(reader.JumpToByteBoundary());
+
+    FrameHeader frame_header(&metadata);
+    do {
+      JXL_RETURN_IF_ERROR(SkipFrame(metadata, &reader, /*is_preview=*/false,
+                                    &frame_header));
+      if (frame_header.frame_type == FrameType::kRegularFrame ||
+          frame_header.frame_type == FrameType::kSkipProgressive) {
+        ++*num_frames;
+      }
+    } while (!frame_header.is_last);
+  }
+  return ret;
+}
+
 }  // namespace jxl
@@ -8,8 +8,11 @@
 
 // Top-level interface for JXL decoding.
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include <functional>
+
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/span.h"
@@ -37,6 +40,27 @@ Status DecodeFile(const DecompressParams& params,
                   const Span<const uint8_t> file, CodecInOut* io,
                   ThreadPool* pool = nullptr);
 
+// Invoked with the index and pixels of each displayed frame as soon as it has
+// been decoded. `frame` remains owned by the caller of DecodeFile and is
+// released before the next frame is decoded.
+using DecodedFrameCallback =
+    std::function<Status(size_t index, ImageBundle* JXL_RESTRICT frame)>;
+
+// Same as above, but streams frames to `frame_callback` instead of collecting
+// all of them: `io->frames` only ever holds the most recently decoded frame, so
+// memory usage of long animations is bounded by the reference frames kept by
+// the decoder itself. `io->metadata` is already valid when the callback runs.
+Status DecodeFile(const DecompressParams& params,
+                  const Span<const uint8_t> file, CodecInOut* io,
+                  ThreadPool* pool,
+                  const DecodedFrameCallback& frame_callback);
+
+// Returns in `num_frames` the number of displayed frames (i.e. the number of
+// entries DecodeFile would append to `io->frames`) by only parsing the frame
+// headers and TOCs, without decoding any pixels.
+Status CountDisplayedFrames(const Span<const uint8_t> file,
+                            size_t* JXL_RESTRICT num_frames);
+
 static inline Status DecodeFile(const DecompressParams& params,
                                 const PaddedBytes& file, CodecInOut* io,
                                 ThreadPool* pool = nullptr) {
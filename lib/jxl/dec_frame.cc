@@ -53,6 +53,7 @@
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
 #include "lib/jxl/sanitizers.h"
+#include "lib/jxl/spilled_image.h"
 #include "lib/jxl/splines.h"
 #include "lib/jxl/toc.h"
 
@@ -87,7 +88,7 @@ Status DecodeFrameHeader(BitReader* JXL_RESTRICT reader,
 }
 
 Status SkipFrame(const CodecMetadata& metadata, BitReader* JXL_RESTRICT reader,
-                 bool is_preview) {
+                 bool is_preview, FrameHeader* JXL_RESTRICT frame_header) {
   FrameHeader header(&metadata);
   header.nonserialized_is_preview = is_preview;
   JXL_RETURN_IF_ERROR(DecodeFrameHeader(reader, &header));
@@ -110,6 +111,7 @@ Status SkipFrame(const CodecMetadata& metadata, BitReader* JXL_RESTRICT reader,
     return JXL_FAILURE("Group code extends after stream end");
   }
 
+  if (frame_header != nullptr) *frame_header = header;
   return true;
 }
 
@@ -175,6 +177,10 @@ Status DecodeFrame(const DecompressParams& dparams,
     frame_decoder.SetMaxPasses(max_passes);
   }
   frame_decoder.SetRenderSpotcolors(dparams.render_spotcolors);
+  frame_decoder.SetSpillReferenceFrames(dparams.spill_reference_frames);
+  frame_decoder.SetHalfPrecisionIntermediates(
+      dparams.half_precision_intermediates);
+  frame_decoder.SetSkipColor(dparams.alpha_only);
 
   size_t processed_bytes = reader->TotalBitsConsumed() / kBitsPerByte;
 
@@ -286,9 +292,19 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
         "Non-444 chroma subsampling is not allowed when adaptive DC "
         "smoothing is enabled");
   }
+  const bool skip_color = skip_color_ && !decoded->IsJPEG();
+  if (skip_color) {
+    // Gaborish and EPF only filter the color channels.
+    frame_header_.loop_filter.gab = false;
+    frame_header_.loop_filter.epf_iters = 0;
+  }
   JXL_RETURN_IF_ERROR(
       InitializePassesSharedState(frame_header_, &dec_state_->shared_storage));
   JXL_RETURN_IF_ERROR(dec_state_->Init());
+  dec_state_->decoded_in_f16 =
+      half_precision_intermediates_ &&
+      frame_header_.encoding == FrameEncoding::kModular;
+  dec_state_->skip_color = skip_color;
   modular_frame_decoder_.Init(frame_dim_);
 
   if (decoded->IsJPEG()) {
@@ -328,6 +344,16 @@ Status FrameDecoder::InitFrame(BitReader* JXL_RESTRICT br, ImageBundle* decoded,
   finalized_dc_ = false;
   decoded_dc_groups_.clear();
   decoded_dc_groups_.resize(frame_dim_.num_dc_groups);
+  smooth_dc_ =
+      frame_header_.encoding == FrameEncoding::kVarDCT && !skip_color &&
+      !(frame_header_.flags & FrameHeader::kSkipAdaptiveDCSmoothing) &&
+      !(frame_header_.flags & FrameHeader::kUseDcFrame);
+  smoothed_dc_groups_.clear();
+  smoothed_dc_groups_.resize(frame_dim_.num_dc_groups);
+  if (smooth_dc_ && !SameSize(smoothed_dc_, dec_state_->shared->dc_storage)) {
+    smoothed_dc_ = Image3F(dec_state_->shared->dc_storage.xsize(),
+                           dec_state_->shared->dc_storage.ysize());
+  }
   decoded_passes_per_ac_group_.clear();
   decoded_passes_per_ac_group_.resize(frame_dim_.num_groups, 0);
   processed_section_.clear();
@@ -372,7 +398,7 @@ Status FrameDecoder::ProcessDCGlobal(BitReader* br) {
         jxl::DecodeGlobalDCInfo(br, decoded_->IsJPEG(), dec_state_, pool_));
   }
   Status dec_status = modular_frame_decoder_.DecodeGlobalInfo(
-      br, frame_header_, allow_partial_dc_global_);
+      br, frame_header_, pool_, allow_partial_dc_global_);
   if (dec_status.IsFatalError()) return dec_status;
   if (dec_status) {
     decoded_dc_global_ = true;
@@ -406,14 +432,45 @@ Status FrameDecoder::ProcessDCGroup(size_t dc_group_id, BitReader* br) {
   return true;
 }
 
+void FrameDecoder::SmoothDCGroups(bool all) {
+  if (!smooth_dc_ || (!all && !decoded_dc_global_)) return;
+  const size_t xsize_groups = frame_dim_.xsize_dc_groups;
+  const size_t ysize_groups = frame_dim_.ysize_dc_groups;
+  std::vector<size_t> groups;
+  for (size_t g = 0; g < frame_dim_.num_dc_groups; g++) {
+    if (smoothed_dc_groups_[g]) continue;
+    const size_t gx = g % xsize_groups;
+    const size_t gy = g / xsize_groups;
+    bool ready = true;
+    // Smoothing reads one pixel of each neighbouring DC group.
+    for (size_t ny = gy == 0 ? 0 : gy - 1;
+         ready && ny <= std::min(gy + 1, ysize_groups - 1); ny++) {
+      for (size_t nx = gx == 0 ? 0 : gx - 1;
+           nx <= std::min(gx + 1, xsize_groups - 1); nx++) {
+        if (!decoded_dc_groups_[ny * xsize_groups + nx]) ready = false;
+      }
+    }
+    if (ready || all) groups.push_back(g);
+  }
+  const float* dc_factors = dec_state_->shared->quantizer.MulDC();
+  RunOnPool(
+      pool_, 0, groups.size(), ThreadPool::SkipInit(),
+      [&](size_t i, size_t /*thread*/) {
+        AdaptiveDCSmoothingRect(dc_factors, dec_state_->shared->dc_storage,
+                                dec_state_->shared->DCGroupRect(groups[i]),
+                                &smoothed_dc_);
+      },
+      "DCSmoothingGroup");
+  for (size_t g : groups) smoothed_dc_groups_[g] = true;
+}
+
 void FrameDecoder::FinalizeDC() {
   // Do Adaptive DC smoothing if enabled. This *must* happen between all the
-  // ProcessDCGroup and ProcessACGroup.
-  if (frame_header_.encoding == FrameEncoding::kVarDCT &&
-      !(frame_header_.flags & FrameHeader::kSkipAdaptiveDCSmoothing) &&
-      !(frame_header_.flags & FrameHeader::kUseDcFrame)) {
-    AdaptiveDCSmoothing(dec_state_->shared->quantizer.MulDC(),
-                        &dec_state_->shared_storage.dc_storage, pool_);
+  // ProcessDCGroup and ProcessACGroup. Most DC groups have usually already
+  // been smoothed by ProcessSections.
+  if (smooth_dc_) {
+    SmoothDCGroups(/*all=*/true);
+    dec_state_->shared_storage.dc_storage.Swap(smoothed_dc_);
   }
 
   finalized_dc_ = true;
@@ -534,6 +591,9 @@ Status FrameDecoder::ProcessACGlobal(BitReader* br) {
       }
     }
   }
+  if (frame_header_.encoding == FrameEncoding::kVarDCT) {
+    JXL_RETURN_IF_ERROR(PrepareGroupDecoding(*decoded_, dec_state_));
+  }
   // Set memory buffer for pre-color-transform frame, if needed.
   if (frame_header_.needs_color_transform() &&
       frame_header_.save_before_color_transform) {
@@ -677,6 +737,7 @@ Status FrameDecoder::ProcessSections(const SectionInfo* sections, size_t num,
         "DecodeDCGroup");
   }
   if (has_error) return JXL_FAILURE("Error in DC group");
+  if (!finalized_dc_) SmoothDCGroups(/*all=*/false);
 
   if (*std::min_element(decoded_dc_groups_.begin(), decoded_dc_groups_.end()) ==
           true &&
@@ -808,9 +869,26 @@ Status FrameDecoder::Flush() {
   // TODO(veluca): the rest of this function should be removed once we have full
   // support for per-group decoding.
 
+  // Modular channels that are decoded group by group are complete down to
+  // this shift if all the DC groups and the same passes of every AC group were
+  // decoded. Otherwise, some groups have residuals below it and the inverse
+  // squeeze is not stopped early, so that they are not dropped.
+  int complete_shift = 0;
+  const uint32_t last_decoded_ac_pass = *std::max_element(
+      decoded_passes_per_ac_group_.begin(), decoded_passes_per_ac_group_.end());
+  if (finalized_dc_ && completely_decoded_ac_pass == last_decoded_ac_pass) {
+    if (completely_decoded_ac_pass == 0) {
+      complete_shift = 3;
+    } else if (completely_decoded_ac_pass < frame_header_.passes.num_passes) {
+      int max_shift;
+      frame_header_.passes.GetDownsamplingBracket(
+          completely_decoded_ac_pass - 1, complete_shift, max_shift);
+    }
+  }
+
   // undo global modular transforms and copy int pixel buffers to float ones
-  JXL_RETURN_IF_ERROR(
-      modular_frame_decoder_.FinalizeDecoding(dec_state_, pool_, decoded_));
+  JXL_RETURN_IF_ERROR(modular_frame_decoder_.FinalizeDecoding(
+      dec_state_, pool_, decoded_, complete_shift));
 
   JXL_RETURN_IF_ERROR(FinalizeFrameDecoding(decoded_, dec_state_, pool_,
                                             /*force_fir=*/false,
@@ -945,6 +1023,13 @@ Status FrameDecoder::FinalizeFrame() {
       }
       reference_frame.storage.ShrinkTo(metadata->xsize(), metadata->ysize());
     }
+    reference_frame.spilled = SpilledImage();
+    if (spill_reference_frames_) {
+      JXL_RETURN_IF_ERROR(SpilledImage::Create(reference_frame.storage,
+                                               reference_frame.ib_is_in_xyb,
+                                               &reference_frame.spilled));
+      reference_frame.storage = ImageBundle(decoded_->metadata());
+    }
   }
   if (frame_header_.nonserialized_is_preview) {
     // Fix possible larger image size (multiple of kBlockDim)
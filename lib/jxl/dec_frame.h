@@ -45,9 +45,10 @@ Status DecodeFrame(const DecompressParams& dparams,
                    const SizeConstraints* constraints, bool is_preview = false);
 
 // Leaves reader in the same state as DecodeFrame would. Used to skip preview.
-// Also updates `dec_state` with the new frame header.
+// If `frame_header` is not null, it receives the header of the skipped frame.
 Status SkipFrame(const CodecMetadata& metadata, BitReader* JXL_RESTRICT reader,
-                 bool is_preview = false);
+                 bool is_preview = false,
+                 FrameHeader* JXL_RESTRICT frame_header = nullptr);
 
 // TODO(veluca): implement "forced drawing".
 class FrameDecoder {
@@ -63,6 +64,11 @@ class FrameDecoder {
     constraints_ = constraints;
   }
   void SetRenderSpotcolors(bool rsc) { render_spotcolors_ = rsc; }
+  void SetSpillReferenceFrames(bool spill) { spill_reference_frames_ = spill; }
+  void SetHalfPrecisionIntermediates(bool hp) {
+    half_precision_intermediates_ = hp;
+  }
+  void SetSkipColor(bool skip) { skip_color_ = skip; }
 
   // Read FrameHeader and table of contents from the given BitReader.
   // Also checks frame dimensions for their limits, and sets the output
@@ -129,6 +135,10 @@ class FrameDecoder {
   // TODO(veluca): remove once we remove --downsampling flag.
   void SetMaxPasses(size_t max_passes) { max_passes_ = max_passes; }
   const FrameHeader& GetFrameHeader() const { return frame_header_; }
+  // For tests.
+  const ModularFrameDecoder& GetModularFrameDecoder() const {
+    return modular_frame_decoder_;
+  }
 
   // Returns whether a DC image has been decoded, accessible at low resolution
   // at passes.shared_storage.dc_storage
@@ -196,6 +206,10 @@ class FrameDecoder {
  private:
   Status ProcessDCGlobal(BitReader* br);
   Status ProcessDCGroup(size_t dc_group_id, BitReader* br);
+  // Runs adaptive DC smoothing on the DC groups that have not been smoothed
+  // yet and whose neighbours are all decoded, or on all the remaining ones if
+  // `all` is true.
+  void SmoothDCGroups(bool all);
   void FinalizeDC();
   void AllocateOutput();
   Status ProcessACGlobal(BitReader* br);
@@ -256,10 +270,19 @@ class FrameDecoder {
   bool allow_partial_frames_;
   bool allow_partial_dc_global_;
   bool render_spotcolors_ = true;
+  bool spill_reference_frames_ = false;
+  bool half_precision_intermediates_ = false;
+  bool skip_color_ = false;
 
   std::vector<uint8_t> processed_section_;
   std::vector<uint8_t> decoded_passes_per_ac_group_;
   std::vector<uint8_t> decoded_dc_groups_;
+  // Adaptive DC smoothing is done one DC group at a time, as soon as the
+  // neighbouring DC groups are decoded, into smoothed_dc_; FinalizeDC() then
+  // swaps it with the DC image.
+  bool smooth_dc_ = false;
+  Image3F smoothed_dc_;
+  std::vector<uint8_t> smoothed_dc_groups_;
   bool decoded_dc_global_;
   bool decoded_ac_global_;
   bool finalized_dc_ = true;
@@ -35,6 +35,7 @@
 #include "lib/jxl/dec_xyb.h"
 #include "lib/jxl/entropy_coder.h"
 #include "lib/jxl/epf.h"
+#include "lib/jxl/image_ops.h"
 #include "lib/jxl/opsin_params.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer-inl.h"
@@ -63,6 +64,10 @@ enum DrawMode {
   // Don't do IDCT or dequantization, but just postprocessing. Used for
   // progressive DC.
   kOnlyImageFeatures = 2,
+  // Read the coefficients from the bitstream, but zero-fill the pixels instead
+  // of reconstructing them; then do postprocessing. Used when only the extra
+  // channels are needed.
+  kSkipColor = 3,
 };
 
 }  // namespace jxl
@@ -76,6 +81,9 @@ namespace HWY_NAMESPACE {
 using hwy::HWY_NAMESPACE::Rebind;
 using hwy::HWY_NAMESPACE::ShiftRight;
 
+static_assert(GroupDecCache::kDCT8BatchSize <= kMaxDCT8Batch,
+              "DCT8 batch does not fit DCT8BatchToPixels");
+
 using D = HWY_FULL(float);
 using DU = HWY_FULL(uint32_t);
 using DI = HWY_FULL(int32_t);
@@ -93,13 +101,14 @@ void Transpose8x8InPlace(int32_t* JXL_RESTRICT block) {
   }
 }
 
-template <ACType ac_type>
+// If kClearInput, the quantized coefficients are set to zero after being read.
+template <ACType ac_type, bool kClearInput>
 void DequantLane(Vec<D> scaled_dequant_x, Vec<D> scaled_dequant_y,
                  Vec<D> scaled_dequant_b,
                  const float* JXL_RESTRICT dequant_matrices, size_t dq_ofs,
                  size_t size, size_t k, Vec<D> x_cc_mul, Vec<D> b_cc_mul,
                  const float* JXL_RESTRICT biases, ACPtr qblock[3],
-                 float* JXL_RESTRICT block) {
+                 float* const JXL_RESTRICT* block) {
   const auto x_mul = Load(d, dequant_matrices + dq_ofs + k) * scaled_dequant_x;
   const auto y_mul =
       Load(d, dequant_matrices + dq_ofs + size + k) * scaled_dequant_y;
@@ -114,10 +123,20 @@ void DequantLane(Vec<D> scaled_dequant_x, Vec<D> scaled_dequant_y,
     quantized_x_int = PromoteTo(di, Load(di16, qblock[0].ptr16 + k));
     quantized_y_int = PromoteTo(di, Load(di16, qblock[1].ptr16 + k));
     quantized_b_int = PromoteTo(di, Load(di16, qblock[2].ptr16 + k));
+    if (kClearInput) {
+      for (size_t c = 0; c < 3; c++) {
+        Store(Zero(di16), di16, qblock[c].ptr16 + k);
+      }
+    }
   } else {
     quantized_x_int = Load(di, qblock[0].ptr32 + k);
     quantized_y_int = Load(di, qblock[1].ptr32 + k);
     quantized_b_int = Load(di, qblock[2].ptr32 + k);
+    if (kClearInput) {
+      for (size_t c = 0; c < 3; c++) {
+        Store(Zero(di), di, qblock[c].ptr32 + k);
+      }
+    }
   }
 
   const auto dequant_x_cc =
@@ -129,12 +148,12 @@ void DequantLane(Vec<D> scaled_dequant_x, Vec<D> scaled_dequant_y,
 
   const auto dequant_x = MulAdd(x_cc_mul, dequant_y, dequant_x_cc);
   const auto dequant_b = MulAdd(b_cc_mul, dequant_y, dequant_b_cc);
-  Store(dequant_x, d, block + k);
-  Store(dequant_y, d, block + size + k);
-  Store(dequant_b, d, block + 2 * size + k);
+  Store(dequant_x, d, block[0] + k);
+  Store(dequant_y, d, block[1] + k);
+  Store(dequant_b, d, block[2] + k);
 }
 
-template <ACType ac_type>
+template <ACType ac_type, bool kClearInput>
 void DequantBlock(const AcStrategy& acs, float inv_global_scale, int quant,
                   float x_dm_multiplier, float b_dm_multiplier, Vec<D> x_cc_mul,
                   Vec<D> b_cc_mul, size_t kind, size_t size,
@@ -143,7 +162,7 @@ void DequantBlock(const AcStrategy& acs, float inv_global_scale, int quant,
                   size_t covered_blocks, const size_t* sbx,
                   const float* JXL_RESTRICT* JXL_RESTRICT dc_row,
                   size_t dc_stride, const float* JXL_RESTRICT biases,
-                  ACPtr qblock[3], float* JXL_RESTRICT block) {
+                  ACPtr qblock[3], float* const JXL_RESTRICT* block) {
   PROFILER_FUNC;
 
   const auto scaled_dequant_s = inv_global_scale / quant;
@@ -155,26 +174,29 @@ void DequantBlock(const AcStrategy& acs, float inv_global_scale, int quant,
   const size_t dq_ofs = quantizer.DequantMatrixOffset(kind, 0);
 
   for (size_t k = 0; k < covered_blocks * kDCTBlockSize; k += Lanes(d)) {
-    DequantLane<ac_type>(scaled_dequant_x, scaled_dequant_y, scaled_dequant_b,
-                         dequant_matrices, dq_ofs, size, k, x_cc_mul, b_cc_mul,
-                         biases, qblock, block);
+    DequantLane<ac_type, kClearInput>(scaled_dequant_x, scaled_dequant_y,
+                                      scaled_dequant_b, dequant_matrices,
+                                      dq_ofs, size, k, x_cc_mul, b_cc_mul,
+                                      biases, qblock, block);
   }
   for (size_t c = 0; c < 3; c++) {
     LowestFrequenciesFromDC(acs.Strategy(), dc_row[c] + sbx[c], dc_stride,
-                            block + c * size);
+                            block[c]);
   }
 }
 
-Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
-                       GroupDecCache* JXL_RESTRICT group_dec_cache,
-                       PassesDecoderState* JXL_RESTRICT dec_state,
-                       size_t thread, size_t group_idx, ImageBundle* decoded,
-                       DrawMode draw) {
+template <ACType ac_type, bool kIsJPEG>
+Status DecodeGroupImplT(GetBlock* JXL_RESTRICT get_block,
+                        GroupDecCache* JXL_RESTRICT group_dec_cache,
+                        PassesDecoderState* JXL_RESTRICT dec_state,
+                        size_t thread, size_t group_idx, ImageBundle* decoded,
+                        DrawMode draw) {
   // TODO(veluca): investigate cache usage in this function.
   PROFILER_FUNC;
   constexpr size_t kGroupDataXBorder = PassesDecoderState::kGroupDataXBorder;
   constexpr size_t kGroupDataYBorder = PassesDecoderState::kGroupDataYBorder;
 
+  const GroupDecodePlan& plan = dec_state->group_decode_plan;
   const Rect block_rect = dec_state->shared->BlockGroupRect(group_idx);
   const AcStrategyImage& ac_strategy = dec_state->shared->ac_strategy;
 
@@ -187,63 +209,21 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
   const float* JXL_RESTRICT dequant_matrices =
       dec_state->shared->quantizer.DequantMatrix(0, 0);
 
-  const YCbCrChromaSubsampling& cs =
-      dec_state->shared->frame_header.chroma_subsampling;
-
-  const size_t idct_stride = dec_state->EagerFinalizeImageRect()
+  const bool eager_finalize = dec_state->EagerFinalizeImageRect();
+  const size_t idct_stride = eager_finalize
                                  ? dec_state->group_data[thread].PixelsPerRow()
                                  : dec_state->decoded.PixelsPerRow();
 
-  HWY_ALIGN int32_t scaled_qtable[64 * 3];
+  const int32_t* JXL_RESTRICT scaled_qtable = plan.scaled_qtable.get();
+  const bool jpeg_is_gray = plan.jpeg_is_gray;
+  const std::array<int, 3>& jpeg_c_map = plan.jpeg_c_map;
+  const std::array<int, 3>& dcoff = plan.dcoff;
+  const size_t* hshift = plan.hshift;
+  const size_t* vshift = plan.vshift;
 
-  ACType ac_type = dec_state->coefficients->Type();
-  auto dequant_block = ac_type == ACType::k16 ? DequantBlock<ACType::k16>
-                                              : DequantBlock<ACType::k32>;
-  // Whether or not coefficients should be stored for future usage, and/or read
-  // from past usage.
-  bool accumulate = !dec_state->coefficients->IsEmpty();
   // Offset of the current block in the group.
   size_t offset = 0;
 
-  std::array<int, 3> jpeg_c_map;
-  bool jpeg_is_gray = false;
-  std::array<int, 3> dcoff = {};
-
-  // TODO(veluca): all of this should be done only once per image.
-  if (decoded->IsJPEG()) {
-    if (!dec_state->shared->cmap.IsJPEGCompatible()) {
-      return JXL_FAILURE("The CfL map is not JPEG-compatible");
-    }
-    jpeg_is_gray = (decoded->jpeg_data->components.size() == 1);
-    jpeg_c_map = JpegOrder(dec_state->shared->frame_header.color_transform,
-                           jpeg_is_gray);
-    const std::vector<QuantEncoding>& qe =
-        dec_state->shared->matrices.encodings();
-    if (qe.empty() || qe[0].mode != QuantEncoding::Mode::kQuantModeRAW ||
-        std::abs(qe[0].qraw.qtable_den - 1.f / (8 * 255)) > 1e-8f) {
-      return JXL_FAILURE(
-          "Quantization table is not a JPEG quantization table.");
-    }
-    for (size_t c = 0; c < 3; c++) {
-      if (dec_state->shared->frame_header.color_transform ==
-          ColorTransform::kNone) {
-        dcoff[c] = 1024 / (*qe[0].qraw.qtable)[64 * c];
-      }
-      for (size_t i = 0; i < 64; i++) {
-        // Transpose the matrix, as it will be used on the transposed block.
-        int n = qe[0].qraw.qtable->at(64 + i);
-        int d = qe[0].qraw.qtable->at(64 * c + i);
-        if (n <= 0 || d <= 0 || n >= 65536 || d >= 65536) {
-          return JXL_FAILURE("Invalid JPEG quantization table");
-        }
-        scaled_qtable[64 * c + (i % 8) * 8 + (i / 8)] =
-            (1 << kCFLFixedPointPrecision) * n / d;
-      }
-    }
-  }
-
-  size_t hshift[3] = {cs.HShift(0), cs.HShift(1), cs.HShift(2)};
-  size_t vshift[3] = {cs.VShift(0), cs.VShift(1), cs.VShift(2)};
   Rect r[3];
   for (size_t i = 0; i < 3; i++) {
     r[i] =
@@ -251,6 +231,19 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
              block_rect.xsize() >> hshift[i], block_rect.ysize() >> vshift[i]);
   }
 
+  if (!kIsJPEG && draw == kSkipColor) {
+    if (eager_finalize) {
+      ZeroFillImage(&dec_state->group_data[thread]);
+    } else {
+      const Rect pixel_rect(block_rect.x0() * kBlockDim,
+                            block_rect.y0() * kBlockDim,
+                            xsize_blocks * kBlockDim, ysize_blocks * kBlockDim);
+      for (size_t c = 0; c < 3; c++) {
+        ZeroFillPlane(&dec_state->decoded.Plane(c), pixel_rect);
+      }
+    }
+  }
+
   for (size_t by = 0; by < ysize_blocks; ++by) {
     if (draw == kOnlyImageFeatures) break;
     get_block->StartRow(by);
@@ -277,7 +270,13 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
     float* JXL_RESTRICT idct_row[3];
     int16_t* JXL_RESTRICT jpeg_row[3];
     for (size_t c = 0; c < 3; c++) {
-      if (dec_state->EagerFinalizeImageRect()) {
+      if (kIsJPEG) {
+        auto& component = decoded->jpeg_data->components[jpeg_c_map[c]];
+        jpeg_row[c] =
+            component.coeffs.data() +
+            (component.width_in_blocks * (r[c].y0() + sby[c]) + r[c].x0()) *
+                kDCTBlockSize;
+      } else if (eager_finalize) {
         idct_row[c] = dec_state->group_data[thread].PlaneRow(
                           c, sby[c] * kBlockDim + kGroupDataYBorder) +
                       kGroupDataXBorder;
@@ -286,15 +285,20 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
             dec_state->decoded.PlaneRow(c, (r[c].y0() + sby[c]) * kBlockDim) +
             r[c].x0() * kBlockDim;
       }
-      if (decoded->IsJPEG()) {
-        auto& component = decoded->jpeg_data->components[jpeg_c_map[c]];
-        jpeg_row[c] =
-            component.coeffs.data() +
-            (component.width_in_blocks * (r[c].y0() + sby[c]) + r[c].x0()) *
-                kDCTBlockSize;
-      }
     }
 
+    // Horizontally adjacent DCT8 blocks of each channel whose IDCT is still
+    // pending; see DCT8BatchToPixels.
+    size_t dct8_run_start[3] = {};
+    size_t dct8_run_len[3] = {};
+    const auto flush_dct8_run = [&](size_t c) {
+      if (dct8_run_len[c] == 0) return;
+      DCT8BatchToPixels(group_dec_cache->dct8_batch[c], dct8_run_len[c],
+                        idct_row[c] + dct8_run_start[c] * kBlockDim,
+                        idct_stride, group_dec_cache->dct8_batch_scratch);
+      dct8_run_len[c] = 0;
+    };
+
     size_t bx = 0;
     for (size_t tx = 0; tx < DivCeil(xsize_blocks, kColorTileDimInBlocks);
          tx++) {
@@ -322,23 +326,26 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
         const size_t size = covered_blocks * kDCTBlockSize;
 
         ACPtr qblock[3];
-        if (accumulate) {
+        if (plan.accumulate) {
           for (size_t c = 0; c < 3; c++) {
             qblock[c] = dec_state->coefficients->PlaneRow(c, group_idx, offset);
           }
         } else {
           // No point in reading from bitstream without accumulating and not
           // drawing.
-          JXL_ASSERT(draw == kDraw);
+          JXL_ASSERT(draw == kDraw || draw == kSkipColor);
+          // Dequantization clears the coefficients of the previous block, so
+          // the buffer only needs zeroing if that did not happen: on first
+          // use, after JPEG reconstruction, or after a decoding error.
+          if (!group_dec_cache->qblock_is_zero) {
+            group_dec_cache->ZeroFillQBlock();
+          }
+          group_dec_cache->qblock_is_zero = false;
           if (ac_type == ACType::k16) {
-            memset(group_dec_cache->dec_group_qblock16, 0,
-                   size * 3 * sizeof(int16_t));
             for (size_t c = 0; c < 3; c++) {
               qblock[c].ptr16 = group_dec_cache->dec_group_qblock16 + c * size;
             }
           } else {
-            memset(group_dec_cache->dec_group_qblock, 0,
-                   size * 3 * sizeof(int32_t));
             for (size_t c = 0; c < 3; c++) {
               qblock[c].ptr32 = group_dec_cache->dec_group_qblock + c * size;
             }
@@ -347,16 +354,14 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
         JXL_RETURN_IF_ERROR(get_block->LoadBlock(
             bx, by, acs, size, log2_covered_blocks, qblock, ac_type));
         offset += size;
-        if (draw == kDontDraw) {
+        if (draw == kDontDraw || draw == kSkipColor) {
           bx += llf_x;
           continue;
         }
 
-        if (JXL_UNLIKELY(decoded->IsJPEG())) {
-          if (acs.Strategy() != AcStrategy::Type::DCT) {
-            return JXL_FAILURE(
-                "Can only decode to JPEG if only DCT-8 is used.");
-          }
+        if (kIsJPEG) {
+          // Checked once per frame in PrepareGroupDecoding.
+          JXL_DASSERT(acs.Strategy() == AcStrategy::Type::DCT);
 
           HWY_ALIGN int32_t transposed_dct_y[64];
           for (size_t c : {1, 0, 2}) {
@@ -373,7 +378,7 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
             auto transposed_dct = qblock[c].ptr32;
             Transpose8x8InPlace(transposed_dct);
             // No CfL - no need to store the y block converted to integers.
-            if (!cs.Is444() ||
+            if (plan.jpeg_cfl_is_trivial ||
                 (row_cmap[0][abs_tx] == 0 && row_cmap[2][abs_tx] == 0)) {
               for (size_t i = 0; i < 64; i += Lanes(d)) {
                 const auto ini = Load(di, transposed_dct + i);
@@ -396,7 +401,7 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
               for (int i = 0; i < 64; i += Lanes(d)) {
                 auto in = Load(di, transposed_dct + i);
                 auto in_y = Load(di, transposed_dct_y + i);
-                auto qt = Load(di, scaled_qtable + c * size + i);
+                auto qt = Load(di, scaled_qtable + c * kDCTBlockSize + i);
                 auto coeff_scale =
                     ShiftRight<kCFLFixedPointPrecision>(qt * scale + round);
                 auto cfl_factor = ShiftRight<kCFLFixedPointPrecision>(
@@ -408,8 +413,29 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
                 Clamp1<float>(dc_rows[c][sbx[c]] - dcoff[c], -2047, 2047);
           }
         } else {
-          HWY_ALIGN float* const block = group_dec_cache->dec_group_block;
-          // Dequantize and add predictions.
+          // DCT8 blocks are dequantized directly into the pending batch of
+          // their channel.
+          const bool batch_dct8 = acs.Strategy() == AcStrategy::Type::DCT;
+          float* JXL_RESTRICT block[3];
+          for (size_t c = 0; c < 3; c++) {
+            block[c] = group_dec_cache->dec_group_block + c * size;
+            if (!batch_dct8 || (sbx[c] << hshift[c] != bx) ||
+                (sby[c] << vshift[c] != by)) {
+              continue;
+            }
+            if (dct8_run_len[c] == GroupDecCache::kDCT8BatchSize ||
+                (dct8_run_len[c] != 0 &&
+                 dct8_run_start[c] + dct8_run_len[c] != sbx[c])) {
+              flush_dct8_run(c);
+            }
+            if (dct8_run_len[c] == 0) dct8_run_start[c] = sbx[c];
+            block[c] = group_dec_cache->dct8_batch[c] +
+                       dct8_run_len[c] * kDCTBlockSize;
+          }
+          // Dequantize and add predictions. In single-pass decoding, this
+          // also clears the quantized coefficients for the next block.
+          auto dequant_block = plan.accumulate ? DequantBlock<ac_type, false>
+                                               : DequantBlock<ac_type, true>;
           dequant_block(
               acs, inv_global_scale, row_quant[bx], dec_state->x_dm_multiplier,
               dec_state->b_dm_multiplier, x_cc_mul, b_cc_mul, acs.RawStrategy(),
@@ -418,32 +444,71 @@ Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
               dc_stride,
               dec_state->output_encoding_info.opsin_params.quant_biases, qblock,
               block);
+          if (!plan.accumulate) group_dec_cache->qblock_is_zero = true;
 
           for (size_t c : {1, 0, 2}) {
             if ((sbx[c] << hshift[c] != bx) || (sby[c] << vshift[c] != by)) {
               continue;
             }
+            if (batch_dct8) {
+              dct8_run_len[c]++;
+              continue;
+            }
             // IDCT
             float* JXL_RESTRICT idct_pos = idct_row[c] + sbx[c] * kBlockDim;
-            TransformToPixels(acs.Strategy(), block + c * size, idct_pos,
-                              idct_stride, group_dec_cache->scratch_space);
+            TransformToPixels(acs.Strategy(), block[c], idct_pos, idct_stride,
+                              group_dec_cache->scratch_space);
           }
         }
         bx += llf_x;
       }
     }
+    if (!kIsJPEG) {
+      for (size_t c = 0; c < 3; c++) flush_dct8_run(c);
+    }
   }
   if (draw == kDontDraw) {
     return true;
   }
   // No ApplyImageFeatures in JPEG mode or when we need to delay it.
-  if (!decoded->IsJPEG() && dec_state->EagerFinalizeImageRect()) {
+  if (!kIsJPEG && eager_finalize) {
     JXL_RETURN_IF_ERROR(dec_state->FinalizeGroup(
         group_idx, thread, &dec_state->group_data[thread], decoded));
   }
   return true;
 }
 
+Status DecodeGroupImpl(GetBlock* JXL_RESTRICT get_block,
+                       GroupDecCache* JXL_RESTRICT group_dec_cache,
+                       PassesDecoderState* JXL_RESTRICT dec_state,
+                       size_t thread, size_t group_idx, ImageBundle* decoded,
+                       DrawMode draw) {
+  const GroupDecodePlan& plan = dec_state->group_decode_plan;
+  if (!plan.prepared) {
+    // Only happens when drawing the DC of a frame whose AC global section has
+    // not been decoded yet.
+    JXL_ASSERT(draw == kOnlyImageFeatures && !decoded->IsJPEG());
+    return DecodeGroupImplT<ACType::k32, false>(get_block, group_dec_cache,
+                                               dec_state, thread, group_idx,
+                                               decoded, draw);
+  }
+  JXL_ASSERT(plan.is_jpeg == decoded->IsJPEG());
+  if (plan.is_jpeg) {
+    // JPEG reconstruction always uses 32-bit coefficients.
+    return DecodeGroupImplT<ACType::k32, true>(get_block, group_dec_cache,
+                                              dec_state, thread, group_idx,
+                                              decoded, draw);
+  }
+  if (plan.ac_type == ACType::k16) {
+    return DecodeGroupImplT<ACType::k16, false>(get_block, group_dec_cache,
+                                               dec_state, thread, group_idx,
+                                               decoded, draw);
+  }
+  return DecodeGroupImplT<ACType::k32, false>(get_block, group_dec_cache,
+                                             dec_state, thread, group_idx,
+                                             decoded, draw);
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -683,6 +748,78 @@ HWY_EXPORT(DecodeGroupImpl);
 
 }  // namespace
 
+Status PrepareGroupDecoding(const ImageBundle& decoded,
+                            PassesDecoderState* JXL_RESTRICT dec_state) {
+  PROFILER_FUNC;
+  GroupDecodePlan& plan = dec_state->group_decode_plan;
+  const PassesSharedState& shared = *dec_state->shared;
+  const FrameHeader& frame_header = shared.frame_header;
+  plan.prepared = false;
+  plan.ac_type = dec_state->coefficients->Type();
+  plan.accumulate = !dec_state->coefficients->IsEmpty();
+  const YCbCrChromaSubsampling& cs = frame_header.chroma_subsampling;
+  for (size_t c = 0; c < 3; c++) {
+    plan.hshift[c] = cs.HShift(c);
+    plan.vshift[c] = cs.VShift(c);
+  }
+
+  plan.is_jpeg = decoded.IsJPEG();
+  if (plan.is_jpeg) {
+    if (!shared.cmap.IsJPEGCompatible()) {
+      return JXL_FAILURE("The CfL map is not JPEG-compatible");
+    }
+    if ((dec_state->used_acs & ~(1u << AcStrategy::Type::DCT)) != 0) {
+      return JXL_FAILURE("Can only decode to JPEG if only DCT-8 is used.");
+    }
+    if (plan.ac_type != ACType::k32) {
+      return JXL_FAILURE("JPEG reconstruction needs 32-bit coefficients");
+    }
+    plan.jpeg_is_gray = (decoded.jpeg_data->components.size() == 1);
+    plan.jpeg_c_map =
+        JpegOrder(frame_header.color_transform, plan.jpeg_is_gray);
+    // CfL is only applied to 4:4:4 images; check if any tile uses it at all.
+    plan.jpeg_cfl_is_trivial = true;
+    if (cs.Is444()) {
+      for (const ImageSB* map :
+           {&shared.cmap.ytox_map, &shared.cmap.ytob_map}) {
+        for (size_t y = 0; y < map->ysize(); y++) {
+          const int8_t* JXL_RESTRICT row = map->ConstRow(y);
+          for (size_t x = 0; x < map->xsize(); x++) {
+            if (row[x] != 0) plan.jpeg_cfl_is_trivial = false;
+          }
+        }
+      }
+    }
+    const std::vector<QuantEncoding>& qe = shared.matrices.encodings();
+    if (qe.empty() || qe[0].mode != QuantEncoding::Mode::kQuantModeRAW ||
+        std::abs(qe[0].qraw.qtable_den - 1.f / (8 * 255)) > 1e-8f) {
+      return JXL_FAILURE(
+          "Quantization table is not a JPEG quantization table.");
+    }
+    if (!plan.scaled_qtable) {
+      plan.scaled_qtable = hwy::AllocateAligned<int32_t>(3 * kDCTBlockSize);
+    }
+    plan.dcoff = {};
+    for (size_t c = 0; c < 3; c++) {
+      if (frame_header.color_transform == ColorTransform::kNone) {
+        plan.dcoff[c] = 1024 / (*qe[0].qraw.qtable)[64 * c];
+      }
+      for (size_t i = 0; i < 64; i++) {
+        // Transpose the matrix, as it will be used on the transposed block.
+        int n = qe[0].qraw.qtable->at(64 + i);
+        int d = qe[0].qraw.qtable->at(64 * c + i);
+        if (n <= 0 || d <= 0 || n >= 65536 || d >= 65536) {
+          return JXL_FAILURE("Invalid JPEG quantization table");
+        }
+        plan.scaled_qtable[64 * c + (i % 8) * 8 + (i / 8)] =
+            (1 << kCFLFixedPointPrecision) * n / d;
+      }
+    }
+  }
+  plan.prepared = true;
+  return true;
+}
+
 Status DecodeGroup(BitReader* JXL_RESTRICT* JXL_RESTRICT readers,
                    size_t num_passes, size_t group_idx,
                    PassesDecoderState* JXL_RESTRICT dec_state,
@@ -724,6 +861,9 @@ Status DecodeGroup(BitReader* JXL_RESTRICT* JXL_RESTRICT readers,
         dec_state->upsampler_storage[thread].get());
     draw = kOnlyImageFeatures;
   }
+  // Only after the DC-only case above, which must still end up drawing image
+  // features: groups drawn from the DC have no AC plan to decode with.
+  if (draw == kDraw && dec_state->skip_color) draw = kSkipColor;
 
   size_t histo_selector_bits = 0;
   if (dc_only) {
@@ -28,6 +28,13 @@
 
 namespace jxl {
 
+// Computes dec_state->group_decode_plan, i.e. everything that DecodeGroup
+// needs that does not depend on the group. Must be called after the AC global
+// section was decoded (or, on the encoder side, after `coefficients` is set)
+// and before any group is decoded.
+Status PrepareGroupDecoding(const ImageBundle& decoded,
+                            PassesDecoderState* JXL_RESTRICT dec_state);
+
 Status DecodeGroup(BitReader* JXL_RESTRICT* JXL_RESTRICT readers,
                    size_t num_passes, size_t group_idx,
                    PassesDecoderState* JXL_RESTRICT dec_state,
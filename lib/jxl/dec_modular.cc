@@ -24,12 +24,14 @@
 #include "lib/jxl/epf.h"
 #include "lib/jxl/modular/encoding/encoding.h"
 #include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/transform/squeeze.h"
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
 
 // These templates are not found via ADL.
 using hwy::HWY_NAMESPACE::Rebind;
+using hwy::HWY_NAMESPACE::Vec;
 
 void MultiplySum(const size_t xsize,
                  const pixel_type* const JXL_RESTRICT row_in,
@@ -45,10 +47,22 @@ void MultiplySum(const size_t xsize,
   }
 }
 
-void RgbFromSingle(const size_t xsize,
-                   const pixel_type* const JXL_RESTRICT row_in,
-                   const float factor, Image3F* decoded, size_t /*c*/,
-                   size_t y) {
+// Loads Lanes(di) samples of `row` as int32; `row` must be aligned like a
+// vector of `di`, which also holds for int16 rows at the same x.
+template <class DI>
+HWY_INLINE Vec<DI> LoadSamples(DI di, const pixel_type* row) {
+  return Load(di, row);
+}
+
+template <class DI>
+HWY_INLINE Vec<DI> LoadSamples(DI di, const int16_t* row) {
+  const Rebind<int16_t, DI> di16;
+  return PromoteTo(di, Load(di16, row));
+}
+
+template <typename T>
+void RgbFromSingleImpl(const size_t xsize, const T* const JXL_RESTRICT row_in,
+                       const float factor, Image3F* decoded, size_t y) {
   const HWY_FULL(float) df;
   const Rebind<pixel_type, HWY_FULL(float)> di;  // assumes pixel_type <= float
 
@@ -58,7 +72,7 @@ void RgbFromSingle(const size_t xsize,
 
   const auto factor_v = Set(df, factor);
   for (size_t x = 0; x < xsize; x += Lanes(di)) {
-    const auto in = Load(di, row_in + x);
+    const auto in = LoadSamples(di, row_in + x);
     const auto out = ConvertTo(df, in) * factor_v;
     Store(out, df, row_out_r + x);
     Store(out, df, row_out_g + x);
@@ -66,23 +80,60 @@ void RgbFromSingle(const size_t xsize,
   }
 }
 
-// Same signature as RgbFromSingle so we can assign to the same pointer.
-void SingleFromSingle(const size_t xsize,
-                      const pixel_type* const JXL_RESTRICT row_in,
-                      const float factor, Image3F* decoded, size_t c,
-                      size_t y) {
+template <typename T>
+void SingleFromSingleImpl(const size_t xsize,
+                          const T* const JXL_RESTRICT row_in,
+                          const float factor,
+                          float* const JXL_RESTRICT row_out) {
   const HWY_FULL(float) df;
   const Rebind<pixel_type, HWY_FULL(float)> di;  // assumes pixel_type <= float
 
-  float* const JXL_RESTRICT row_out = decoded->PlaneRow(c, y);
-
   const auto factor_v = Set(df, factor);
   for (size_t x = 0; x < xsize; x += Lanes(di)) {
-    const auto in = Load(di, row_in + x);
+    const auto in = LoadSamples(di, row_in + x);
     const auto out = ConvertTo(df, in) * factor_v;
     Store(out, df, row_out + x);
   }
 }
+
+void RgbFromSingle(const size_t xsize,
+                   const pixel_type* const JXL_RESTRICT row_in,
+                   const float factor, Image3F* decoded, size_t /*c*/,
+                   size_t y) {
+  RgbFromSingleImpl(xsize, row_in, factor, decoded, y);
+}
+
+void RgbFromSingle16(const size_t xsize,
+                     const int16_t* const JXL_RESTRICT row_in,
+                     const float factor, Image3F* decoded, size_t y) {
+  RgbFromSingleImpl(xsize, row_in, factor, decoded, y);
+}
+
+void SingleFromSingle(const size_t xsize,
+                      const pixel_type* const JXL_RESTRICT row_in,
+                      const float factor, float* const JXL_RESTRICT row_out) {
+  SingleFromSingleImpl(xsize, row_in, factor, row_out);
+}
+
+void SingleFromSingle16(const size_t xsize,
+                        const int16_t* const JXL_RESTRICT row_in,
+                        const float factor, float* const JXL_RESTRICT row_out) {
+  SingleFromSingleImpl(xsize, row_in, factor, row_out);
+}
+
+// Stores `row_in` as binary16 into `row_out`; both must be vector-aligned and
+// padded, as Image rows are.
+void FloatToF16Row(const size_t xsize, const float* const JXL_RESTRICT row_in,
+                   uint16_t* const JXL_RESTRICT row_out) {
+  const HWY_FULL(float) df;
+  const Rebind<hwy::float16_t, HWY_FULL(float)> df16;
+  hwy::float16_t* const JXL_RESTRICT out =
+      reinterpret_cast<hwy::float16_t*>(row_out);
+
+  for (size_t x = 0; x < xsize; x += Lanes(df)) {
+    Store(DemoteTo(df16, Load(df, row_in + x)), df16, out + x);
+  }
+}
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -90,9 +141,12 @@ HWY_AFTER_NAMESPACE();
 
 #if HWY_ONCE
 namespace jxl {
-HWY_EXPORT(MultiplySum);       // Local function
-HWY_EXPORT(RgbFromSingle);     // Local function
-HWY_EXPORT(SingleFromSingle);  // Local function
+HWY_EXPORT(MultiplySum);         // Local function
+HWY_EXPORT(RgbFromSingle);       // Local function
+HWY_EXPORT(RgbFromSingle16);     // Local function
+HWY_EXPORT(SingleFromSingle);    // Local function
+HWY_EXPORT(SingleFromSingle16);  // Local function
+HWY_EXPORT(FloatToF16Row);       // Local function
 
 // convert custom [bits]-bit float (with [exp_bits] exponent bits) stored as int
 // back to binary32 float
@@ -146,6 +200,7 @@ void int_to_float(const pixel_type* const JXL_RESTRICT row_in,
 
 Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
                                              const FrameHeader& frame_header,
+                                             ThreadPool* pool,
                                              bool allow_truncated_group) {
   bool decode_color = frame_header.encoding == FrameEncoding::kModular;
   const auto& metadata = frame_header.nonserialized_metadata->m;
@@ -208,7 +263,11 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
       reader, gi, &global_header, ModularStreamId::Global().ID(frame_dim),
       &options,
       /*undo_transforms=*/-2, &tree, &code, &context_map,
-      allow_truncated_group);
+      allow_truncated_group,
+      frame_header.extensions & FrameHeader::kModularRowIndex
+          ? &frame_header.modular_row_index
+          : nullptr,
+      pool);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) {
     return JXL_FAILURE("Failed to decode global modular info");
@@ -223,9 +282,59 @@ Status ModularFrameDecoder::DecodeGlobalInfo(BitReader* reader,
       have_something = true;
   }
   full_image = std::move(gi);
+
+  full_image_16.clear();
+  if (CanUse16BitStorage(frame_header)) {
+    full_image_16.resize(full_image.channel.size());
+    bool decoded_by_groups = false;
+    for (size_t c = 0; c < full_image.channel.size(); c++) {
+      Channel& fc = full_image.channel[c];
+      // Same as in DecodeGroup: groups decode all the channels starting from
+      // the first one that is larger than a group.
+      if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) {
+        decoded_by_groups = true;
+      }
+      if (!decoded_by_groups) continue;
+      full_image_16[c] = ImageS(fc.w, fc.h);
+      fc.plane = ImageI();
+    }
+  }
   return dec_status;
 }
 
+bool ModularFrameDecoder::CanUse16BitStorage(
+    const FrameHeader& frame_header) const {
+  // Global transforms are undone on the full image, with 32-bit samples.
+  if (!full_image.transform.empty()) return false;
+  constexpr uint32_t kMaxBits = 12;
+  const auto& metadata = frame_header.nonserialized_metadata->m;
+  if (do_color) {
+    // XYB samples are quantized values, not bounded by the bit depth.
+    if (frame_header.color_transform == ColorTransform::kXYB) return false;
+    if (metadata.bit_depth.floating_point_sample ||
+        metadata.bit_depth.bits_per_sample > kMaxBits) {
+      return false;
+    }
+  }
+  for (const ExtraChannelInfo& eci : metadata.extra_channel_info) {
+    if (eci.bit_depth.floating_point_sample ||
+        eci.bit_depth.bits_per_sample > kMaxBits) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t ModularFrameDecoder::FirstGroupChannel() const {
+  // start at the first bigger-than-groupsize non-metachannel
+  size_t c = full_image.nb_meta_channels;
+  for (; c < full_image.channel.size(); c++) {
+    const Channel& fc = full_image.channel[c];
+    if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) break;
+  }
+  return c;
+}
+
 Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
                                         int minShift, int maxShift,
                                         const ModularStreamId& stream,
@@ -235,13 +344,8 @@ Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
   const size_t xsize = rect.xsize();
   const size_t ysize = rect.ysize();
   Image gi(xsize, ysize, full_image.bitdepth, 0);
-  // start at the first bigger-than-groupsize non-metachannel
-  size_t c = full_image.nb_meta_channels;
-  for (; c < full_image.channel.size(); c++) {
-    Channel& fc = full_image.channel[c];
-    if (fc.w > frame_dim.group_dim || fc.h > frame_dim.group_dim) break;
-  }
-  size_t beginc = c;
+  const size_t beginc = FirstGroupChannel();
+  size_t c = beginc;
   for (; c < full_image.channel.size(); c++) {
     Channel& fc = full_image.channel[c];
     int shift = std::min(fc.hshift, fc.vshift);
@@ -265,9 +369,15 @@ Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
       Rect r(rect.x0() >> fc.hshift, rect.y0() >> fc.vshift,
              rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
       if (r.xsize() == 0 || r.ysize() == 0) continue;
+      const bool is_16bit = IsStoredIn16Bit(c);
       for (size_t y = 0; y < r.ysize(); ++y) {
-        pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
-        memset(row_out, 0, r.xsize() * sizeof(*row_out));
+        if (is_16bit) {
+          int16_t* const JXL_RESTRICT row_out = r.Row(&full_image_16[c], y);
+          memset(row_out, 0, r.xsize() * sizeof(*row_out));
+        } else {
+          pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
+          memset(row_out, 0, r.xsize() * sizeof(*row_out));
+        }
       }
       gic++;
     }
@@ -287,11 +397,22 @@ Status ModularFrameDecoder::DecodeGroup(const Rect& rect, BitReader* reader,
     Rect r(rect.x0() >> fc.hshift, rect.y0() >> fc.vshift,
            rect.xsize() >> fc.hshift, rect.ysize() >> fc.vshift, fc.w, fc.h);
     if (r.xsize() == 0 || r.ysize() == 0) continue;
-    for (size_t y = 0; y < r.ysize(); ++y) {
-      pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
-      const pixel_type* const JXL_RESTRICT row_in = gi.channel[gic].Row(y);
-      for (size_t x = 0; x < r.xsize(); ++x) {
-        row_out[x] = row_in[x];
+    if (IsStoredIn16Bit(c)) {
+      for (size_t y = 0; y < r.ysize(); ++y) {
+        int16_t* const JXL_RESTRICT row_out = r.Row(&full_image_16[c], y);
+        const pixel_type* const JXL_RESTRICT row_in = gi.channel[gic].Row(y);
+        // Valid samples fit; saturate the values of invalid streams.
+        for (size_t x = 0; x < r.xsize(); ++x) {
+          row_out[x] = Clamp1<pixel_type>(row_in[x], INT16_MIN, INT16_MAX);
+        }
+      }
+    } else {
+      for (size_t y = 0; y < r.ysize(); ++y) {
+        pixel_type* const JXL_RESTRICT row_out = r.Row(&fc.plane, y);
+        const pixel_type* const JXL_RESTRICT row_in = gi.channel[gic].Row(y);
+        for (size_t x = 0; x < r.xsize(); ++x) {
+          row_out[x] = row_in[x];
+        }
       }
     }
     gic++;
@@ -420,7 +541,8 @@ Status ModularFrameDecoder::DecodeAcMetadata(size_t group_id, BitReader* reader,
 
 Status ModularFrameDecoder::FinalizeDecoding(PassesDecoderState* dec_state,
                                              jxl::ThreadPool* pool,
-                                             ImageBundle* output) {
+                                             ImageBundle* output,
+                                             int complete_shift) {
   Image& gi = full_image;
   size_t xsize = gi.w;
   size_t ysize = gi.h;
@@ -432,10 +554,42 @@ Status ModularFrameDecoder::FinalizeDecoding(PassesDecoderState* dec_state,
   if (xsize * ysize < frame_dim.group_dim * frame_dim.group_dim) pool = nullptr;
 
   // Undo the global transforms
+  if (complete_shift > 0 && !gi.transform.empty() &&
+      gi.transform.back().id == TransformId::kSqueeze) {
+    // Stop the inverse squeeze of each channel at the last level whose
+    // residuals were decoded in every group.
+    std::vector<bool> decoded(gi.channel.size(), true);
+    for (size_t c = FirstGroupChannel(); c < gi.channel.size(); c++) {
+      const Channel& ch = gi.channel[c];
+      decoded[c] = std::min(ch.hshift, ch.vshift) >= complete_shift;
+    }
+    JXL_RETURN_IF_ERROR(InvSqueeze(gi, gi.transform.back().squeezes, pool,
+                                   std::move(decoded)));
+    gi.transform.pop_back();
+  }
   gi.undo_transforms(global_header.wp_header, -1, pool);
   if (gi.error) return JXL_FAILURE("Undoing transforms failed");
 
   auto& decoded = dec_state->decoded;
+  // If the frame is stored in half precision, rows are converted to float in a
+  // per-thread buffer first.
+  const bool to_f16 = dec_state->decoded_in_f16;
+  ImageF f32_rows;
+  const auto allocate_rows = [&](size_t num_threads) {
+    if (to_f16 && f32_rows.ysize() < num_threads) {
+      f32_rows = ImageF(xsize, num_threads);
+    }
+    return true;
+  };
+  const auto output_row = [&](size_t c, size_t y, size_t thread) {
+    return to_f16 ? f32_rows.Row(thread) : decoded.PlaneRow(c, y);
+  };
+  const auto store_row = [&](size_t c, size_t y, size_t row_xsize,
+                             size_t thread) {
+    if (!to_f16) return;
+    HWY_DYNAMIC_DISPATCH(FloatToF16Row)
+    (row_xsize, f32_rows.Row(thread), dec_state->decoded_f16.PlaneRow(c, y));
+  };
 
   int c = 0;
   if (do_color) {
@@ -469,44 +623,72 @@ Status ModularFrameDecoder::FinalizeDecoding(PassesDecoderState* dec_state,
       if (frame_header.color_transform == ColorTransform::kXYB && c == 2) {
         JXL_ASSERT(!fp);
         RunOnPool(
-            pool, 0, ysize_shifted, jxl::ThreadPool::SkipInit(),
+            pool, 0, ysize_shifted, allocate_rows,
             [&](const int task, const int thread) {
               const size_t y = task;
               const pixel_type* const JXL_RESTRICT row_in =
                   gi.channel[c_in].Row(y);
               const pixel_type* const JXL_RESTRICT row_in_Y =
                   gi.channel[0].Row(y);
-              float* const JXL_RESTRICT row_out = decoded.PlaneRow(c, y);
+              float* const JXL_RESTRICT row_out = output_row(c, y, thread);
               HWY_DYNAMIC_DISPATCH(MultiplySum)
               (xsize_shifted, row_in, row_in_Y, factor, row_out);
+              store_row(c, y, xsize_shifted, thread);
             },
             "ModularIntToFloat");
       } else if (fp) {
         int bits = metadata->m.bit_depth.bits_per_sample;
         int exp_bits = metadata->m.bit_depth.exponent_bits_per_sample;
         RunOnPool(
-            pool, 0, ysize_shifted, jxl::ThreadPool::SkipInit(),
+            pool, 0, ysize_shifted, allocate_rows,
             [&](const int task, const int thread) {
               const size_t y = task;
               const pixel_type* const JXL_RESTRICT row_in =
                   gi.channel[c_in].Row(y);
-              float* const JXL_RESTRICT row_out = decoded.PlaneRow(c, y);
+              float* const JXL_RESTRICT row_out = output_row(c, y, thread);
               int_to_float(row_in, row_out, xsize_shifted, bits, exp_bits);
+              store_row(c, y, xsize_shifted, thread);
             },
             "ModularIntToFloat_losslessfloat");
+      } else if (IsStoredIn16Bit(c_in)) {
+        const ImageS& plane16 = full_image_16[c_in];
+        RunOnPool(
+            pool, 0, ysize_shifted, allocate_rows,
+            [&](const int task, const int thread) {
+              const size_t y = task;
+              const int16_t* const JXL_RESTRICT row_in = plane16.ConstRow(y);
+              if (rgb_from_gray && !to_f16) {
+                HWY_DYNAMIC_DISPATCH(RgbFromSingle16)
+                (xsize_shifted, row_in, factor, &decoded, y);
+              } else {
+                HWY_DYNAMIC_DISPATCH(SingleFromSingle16)
+                (xsize_shifted, row_in, factor, output_row(c, y, thread));
+                store_row(c, y, xsize_shifted, thread);
+                if (rgb_from_gray) {
+                  store_row(1, y, xsize_shifted, thread);
+                  store_row(2, y, xsize_shifted, thread);
+                }
+              }
+            },
+            "ModularInt16ToFloat");
       } else {
         RunOnPool(
-            pool, 0, ysize_shifted, jxl::ThreadPool::SkipInit(),
+            pool, 0, ysize_shifted, allocate_rows,
             [&](const int task, const int thread) {
               const size_t y = task;
               const pixel_type* const JXL_RESTRICT row_in =
                   gi.channel[c_in].Row(y);
-              if (rgb_from_gray) {
+              if (rgb_from_gray && !to_f16) {
                 HWY_DYNAMIC_DISPATCH(RgbFromSingle)
                 (xsize_shifted, row_in, factor, &decoded, c, y);
               } else {
                 HWY_DYNAMIC_DISPATCH(SingleFromSingle)
-                (xsize_shifted, row_in, factor, &decoded, c, y);
+                (xsize_shifted, row_in, factor, output_row(c, y, thread));
+                store_row(c, y, xsize_shifted, thread);
+                if (rgb_from_gray) {
+                  store_row(1, y, xsize_shifted, thread);
+                  store_row(2, y, xsize_shifted, thread);
+                }
               }
             },
             "ModularIntToFloat");
@@ -529,6 +711,14 @@ Status ModularFrameDecoder::FinalizeDecoding(PassesDecoderState* dec_state,
     size_t ecups = frame_header.extra_channel_upsampling[ec];
     const size_t ec_xsize = DivCeil(frame_dim.xsize_upsampled, ecups);
     const size_t ec_ysize = DivCeil(frame_dim.ysize_upsampled, ecups);
+    if (IsStoredIn16Bit(c)) {
+      for (size_t y = 0; y < ec_ysize; ++y) {
+        HWY_DYNAMIC_DISPATCH(SingleFromSingle16)
+        (ec_xsize, full_image_16[c].ConstRow(y), mul,
+         dec_state->extra_channels[ec].Row(y));
+      }
+      continue;
+    }
     for (size_t y = 0; y < ec_ysize; ++y) {
       float* const JXL_RESTRICT row_out = dec_state->extra_channels[ec].Row(y);
       const pixel_type* const JXL_RESTRICT row_in = gi.channel[c].Row(y);
@@ -87,7 +87,10 @@ struct ModularStreamId {
 class ModularFrameDecoder {
  public:
   void Init(const FrameDimensions& frame_dim) { this->frame_dim = frame_dim; }
+  // If the frame header has a modular row index, the rows of the global
+  // stream are decoded in parallel on `pool`.
   Status DecodeGlobalInfo(BitReader* reader, const FrameHeader& frame_header,
+                          jxl::ThreadPool* pool,
                           bool allow_truncated_group = false);
   Status DecodeGroup(const Rect& rect, BitReader* reader, int minShift,
                      int maxShift, const ModularStreamId& stream,
@@ -105,12 +108,36 @@ class ModularFrameDecoder {
                                  BitReader* br, QuantEncoding* encoding,
                                  size_t idx,
                                  ModularFrameDecoder* modular_frame_decoder);
+  // Undoes the global transforms and converts the image to float. The
+  // channels that are decoded group by group are complete only down to a
+  // downsampling shift of `complete_shift` (0 if all passes were decoded):
+  // squeeze residuals with smaller shifts are zero-filled, so their channels
+  // are upsampled from the last complete level instead.
   Status FinalizeDecoding(PassesDecoderState* dec_state, jxl::ThreadPool* pool,
-                          ImageBundle* output);
+                          ImageBundle* output, int complete_shift = 0);
   bool have_dc() const { return have_something; }
+  // Returns whether channel `c` of the current frame is stored with 16 bits per
+  // sample (see full_image_16).
+  bool IsStoredIn16Bit(size_t c) const {
+    return c < full_image_16.size() && full_image_16[c].xsize() != 0;
+  }
 
  private:
+  // Returns whether the channels of `full_image` that are decoded group by
+  // group can be stored with 16 bits per sample, i.e. whether they hold final
+  // integer samples (no global transforms to undo) of at most 12 bits.
+  bool CanUse16BitStorage(const FrameHeader& frame_header) const;
+  // Returns the index of the first channel of `full_image` that is decoded
+  // group by group; the ones before it are in the global stream.
+  size_t FirstGroupChannel() const;
+
   Image full_image;
+  // If non-empty, full_image_16[c] holds the samples of channel c, and
+  // full_image.channel[c].plane is empty. Used for the frame-sized storage of
+  // low bit depth images, which halves its size and the memory traffic of
+  // DecodeGroup and FinalizeDecoding; groups are still decoded into (and
+  // their local transforms undone on) 32-bit channels.
+  std::vector<ImageS> full_image_16;
   FrameDimensions frame_dim;
   bool do_color;
   bool have_something;
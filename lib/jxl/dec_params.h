@@ -26,6 +26,30 @@ struct DecompressParams {
   bool keep_dct = false;
   // If true, render spot colors (otherwise only returned as extra channels)
   bool render_spotcolors = true;
+  // If true, frames saved for later reference (blending, patches) are kept in
+  // a compact, file-backed SpilledImage instead of full float images. This
+  // bounds the memory held by long animations; color saved before the color
+  // transform is stored with binary16 precision.
+  bool spill_reference_frames = false;
+  // If true, full-frame intermediate images are stored as binary16 where
+  // supported; all arithmetic is still done in float. This is enough for
+  // 8-bit output and halves the footprint of those images. Only the output
+  // of Modular frames before filtering and color conversion is covered so
+  // far: VarDCT frames still keep their decoded image and filter buffers in
+  // float.
+  bool half_precision_intermediates = false;
+  // If greater than 1, DecodeFile decodes up to this many consecutive
+  // animation frames at the same time when they do not depend on previous
+  // frames (no blending, cropping or patches). Each of them is then decoded
+  // with a single thread, so this trades per-frame latency for throughput on
+  // long animations.
+  size_t parallel_frames = 0;
+  // If true, only the extra channels (such as alpha) of the output are needed,
+  // e.g. to compute hit-testing masks. VarDCT color coefficients are still
+  // entropy-decoded, as they share sections with the extra channels, but are
+  // neither dequantized nor transformed, and filters that only affect color
+  // are skipped. The color channels of the output are then unspecified.
+  bool alpha_only = false;
 
   // These cannot be kOn because they need encoder support.
   Override preview = Override::kDefault;
@@ -35,6 +59,9 @@ struct DecompressParams {
   // Alternatively, one can specify the maximum tolerable downscaling factor
   // with respect to the full size of the image. By default, nothing less than
   // the full size is requested.
+  // Either way, the output keeps the full size. For Modular frames with the
+  // squeeze transform, the squeeze steps whose residuals are not decoded are
+  // replaced by bilinear upsampling, so the result is smooth, not blocky.
   size_t max_downsampling = 1;
 
   // Try to decode as much as possible of a truncated codestream, but only whole
@@ -47,6 +74,11 @@ struct DecompressParams {
     return check_decompressed_size == other.check_decompressed_size &&
            keep_dct == other.keep_dct &&
            render_spotcolors == other.render_spotcolors &&
+           spill_reference_frames == other.spill_reference_frames &&
+           half_precision_intermediates ==
+               other.half_precision_intermediates &&
+           parallel_frames == other.parallel_frames &&
+           alpha_only == other.alpha_only &&
            preview == other.preview && max_passes == other.max_passes &&
            max_downsampling == other.max_downsampling &&
            allow_partial_files == other.allow_partial_files &&
@@ -61,22 +61,22 @@ Status PatchDictionary::Decode(BitReader* br, size_t xsize, size_t ysize,
     PatchReferencePosition ref_pos;
     ref_pos.ref = read_num(kReferenceFrameContext);
     if (ref_pos.ref >= kMaxNumReferenceFrames ||
-        shared_->reference_frames[ref_pos.ref].frame->xsize() == 0) {
+        shared_->reference_frames[ref_pos.ref].xsize() == 0) {
       return JXL_FAILURE("Invalid reference frame ID");
     }
     if (!shared_->reference_frames[ref_pos.ref].ib_is_in_xyb) {
       return JXL_FAILURE(
           "Patches cannot use frames saved post color transforms");
     }
-    const ImageBundle& ib = *shared_->reference_frames[ref_pos.ref].frame;
+    const auto& ref_frame = shared_->reference_frames[ref_pos.ref];
     ref_pos.x0 = read_num(kPatchReferencePositionContext);
     ref_pos.y0 = read_num(kPatchReferencePositionContext);
     ref_pos.xsize = read_num(kPatchSizeContext) + 1;
     ref_pos.ysize = read_num(kPatchSizeContext) + 1;
-    if (ref_pos.x0 + ref_pos.xsize > ib.xsize()) {
+    if (ref_pos.x0 + ref_pos.xsize > ref_frame.xsize()) {
       return JXL_FAILURE("Invalid position specified in reference frame");
     }
-    if (ref_pos.y0 + ref_pos.ysize > ib.ysize()) {
+    if (ref_pos.y0 + ref_pos.ysize > ref_frame.ysize()) {
       return JXL_FAILURE("Invalid position specified in reference frame");
     }
     size_t id_count = read_num(kPatchCountContext) + 1;
@@ -195,6 +195,8 @@ Status PatchDictionary::AddTo(Image3F* opsin, const Rect& opsin_rect,
   size_t num_ec = shared_->metadata->m.num_extra_channels;
   std::vector<const float*> fg_ptrs(3 + num_ec);
   std::vector<float*> bg_ptrs(3 + num_ec);
+  // Rows of spilled reference frames are converted into this buffer.
+  std::vector<float> scratch;
   for (size_t y = image_rect.y0(); y < image_rect.y0() + image_rect.ysize();
        y++) {
     if (y + 1 >= patch_starts_.size()) continue;
@@ -211,19 +213,22 @@ Status PatchDictionary::AddTo(Image3F* opsin, const Rect& opsin_rect,
       if (bx + xsize < image_rect.x0()) continue;
       size_t x0 = std::max(bx, image_rect.x0());
       size_t x1 = std::min(bx + xsize, image_rect.x0() + image_rect.xsize());
+      const auto& ref_frame = shared_->reference_frames[ref];
+      if (!ref_frame.spilled.empty()) {
+        scratch.resize((3 + num_ec) * image_rect.xsize());
+      }
+      for (size_t c = 0; c < 3 + num_ec; c++) {
+        float* scratch_row =
+            scratch.empty() ? nullptr : scratch.data() + c * image_rect.xsize();
+        fg_ptrs[c] = ref_frame.ConstRow(c, pos.ref_pos.x0 + x0 - bx,
+                                        pos.ref_pos.y0 + iy, x1 - x0,
+                                        scratch_row);
+      }
       for (size_t c = 0; c < 3; c++) {
-        fg_ptrs[c] =
-            shared_->reference_frames[ref].frame->color()->ConstPlaneRow(
-                c, pos.ref_pos.y0 + iy) +
-            pos.ref_pos.x0 + x0 - bx;
         bg_ptrs[c] = opsin_rect.PlaneRow(opsin, c, y - image_rect.y0()) + x0 -
                      image_rect.x0();
       }
       for (size_t i = 0; i < num_ec; i++) {
-        fg_ptrs[3 + i] =
-            shared_->reference_frames[ref].frame->extra_channels()[i].ConstRow(
-                pos.ref_pos.y0 + iy) +
-            pos.ref_pos.x0 + x0 - bx;
         bg_ptrs[3 + i] = extra_channels[i] + x0 - image_rect.x0();
       }
       JXL_RETURN_IF_ERROR(
@@ -403,6 +403,43 @@ void DoYCbCrUpsampling(size_t hs, size_t vs, ImageF* plane_in, const Rect& rect,
   JXL_CHECK_IMAGE_INITIALIZED(*plane_out, Rect(x0, y0, x1 - x0, y1 - y0));
 }
 
+// Same as CopyImageToWithPadding, but converts from binary16 samples.
+void CopyF16ToWithPadding(const Rect& from_rect, const ImageU& from,
+                          size_t padding, const Rect& to_rect, ImageF* to) {
+  const size_t xextra0 = std::min(padding, from_rect.x0());
+  const size_t xextra1 =
+      std::min(padding, from.xsize() - from_rect.x0() - from_rect.xsize());
+  const size_t yextra0 = std::min(padding, from_rect.y0());
+  const size_t yextra1 =
+      std::min(padding, from.ysize() - from_rect.y0() - from_rect.ysize());
+  JXL_DASSERT(to_rect.x0() >= xextra0);
+  JXL_DASSERT(to_rect.y0() >= yextra0);
+  const Rect from_padded(from_rect.x0() - xextra0, from_rect.y0() - yextra0,
+                         from_rect.xsize() + xextra0 + xextra1,
+                         from_rect.ysize() + yextra0 + yextra1);
+  const Rect to_padded(to_rect.x0() - xextra0, to_rect.y0() - yextra0,
+                       from_padded.xsize(), from_padded.ysize());
+
+  const HWY_FULL(float) d;
+  const HWY_CAPPED(float, 1) d1;
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, decltype(d)> df16;
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, decltype(d1)> df16_1;
+  const size_t xsize = from_padded.xsize();
+  for (size_t y = 0; y < from_padded.ysize(); y++) {
+    const hwy::float16_t* JXL_RESTRICT row_in =
+        reinterpret_cast<const hwy::float16_t*>(from_padded.ConstRow(from, y));
+    float* JXL_RESTRICT row_out = to_padded.Row(to, y);
+    // The padded rects are generally not vector-aligned.
+    size_t x = 0;
+    for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+      StoreU(PromoteTo(d, LoadU(df16, row_in + x)), d, row_out + x);
+    }
+    for (; x < xsize; x++) {
+      StoreU(PromoteTo(d1, LoadU(df16_1, row_in + x)), d1, row_out + x);
+    }
+  }
+}
+
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
 }  // namespace jxl
@@ -414,6 +451,7 @@ namespace jxl {
 HWY_EXPORT(UndoXYBInPlace);
 HWY_EXPORT(FloatToRGBA8);
 HWY_EXPORT(DoYCbCrUpsampling);
+HWY_EXPORT(CopyF16ToWithPadding);
 
 void UndoXYB(const Image3F& src, Image3F* dst,
              const OutputEncodingInfo& output_info, ThreadPool* pool) {
@@ -1130,9 +1168,17 @@ Status FinalizeFrameDecoding(ImageBundle* decoded,
         // Poison the image in this thread to prevent leaking initialized data
         // from a previous run in this thread in msan builds.
         msan::PoisonImage(dec_state->group_data[thread].Plane(c));
-        CopyImageToWithPadding(
-            rh, dec_state->decoded.Plane(c), dec_state->FinalizeRectPadding(),
-            group_data_rect, &dec_state->group_data[thread].Plane(c));
+        if (dec_state->decoded_in_f16) {
+          HWY_DYNAMIC_DISPATCH(CopyF16ToWithPadding)
+          (rh, dec_state->decoded_f16.Plane(c),
+           dec_state->FinalizeRectPadding(), group_data_rect,
+           &dec_state->group_data[thread].Plane(c));
+        } else {
+          CopyImageToWithPadding(rh, dec_state->decoded.Plane(c),
+                                 dec_state->FinalizeRectPadding(),
+                                 group_data_rect,
+                                 &dec_state->group_data[thread].Plane(c));
+        }
       }
       Rect group_data_rect(xstart, ystart, rects_to_process[rect_id].xsize(),
                            rects_to_process[rect_id].ysize());
@@ -466,6 +466,47 @@ void AFVTransformToPixels(const float* JXL_RESTRICT coefficients,
       scratch_space);
 }
 
+// Maximum number of blocks passed to DCT8BatchToPixels at once.
+constexpr size_t kMaxDCT8Batch = 8;
+// Number of floats of scratch space needed by DCT8BatchToPixels.
+constexpr size_t kDCT8BatchScratchSize =
+    kDCTBlockSize * (kMaxDCT8Batch + 1);
+
+// Equivalent to calling TransformToPixels(DCT, ...) on `num` horizontally
+// adjacent 8x8 blocks, whose coefficients are stored one after the other.
+// After the first pass, the blocks are laid out side by side, so that the
+// second pass runs on full vectors that span several blocks (instead of
+// being capped to the 8 lanes of a single one) and with a single dispatch.
+// `coefficients` and `scratch_space` must be aligned; `scratch_space` should
+// have room for kDCT8BatchScratchSize floats.
+HWY_MAYBE_UNUSED void DCT8BatchToPixels(const float* JXL_RESTRICT coefficients,
+                                        size_t num, float* JXL_RESTRICT pixels,
+                                        size_t pixels_stride,
+                                        float* JXL_RESTRICT scratch_space) {
+  PROFILER_ZONE("IDCT 8 batch");
+  JXL_DASSERT(num <= kMaxDCT8Batch);
+  const size_t stride = num * kBlockDim;
+  float* JXL_RESTRICT block = scratch_space;
+  float* JXL_RESTRICT rows = scratch_space + kDCTBlockSize;
+  for (size_t i = 0; i < num; i++) {
+    IDCT1D<8, 8>()(DCTFrom(coefficients + i * kDCTBlockSize, kBlockDim),
+                   DCTTo(block, kBlockDim));
+    Transpose<8, 8>::Run(DCTFrom(block, kBlockDim),
+                         DCTTo(rows + i * kBlockDim, stride));
+  }
+  // Columns that fill whole vectors, then the remaining (at most one vector
+  // worth of) blocks, one at a time.
+  const size_t full = stride - stride % Lanes(FV<0>());
+  if (full != 0) {
+    IDCT1DWrapper<8, 0>(DCTFrom(rows, stride), DCTTo(pixels, pixels_stride),
+                        full);
+  }
+  for (size_t x = full; x < stride; x += kBlockDim) {
+    IDCT1D<8, 8>()(DCTFrom(rows + x, stride),
+                   DCTTo(pixels + x, pixels_stride));
+  }
+}
+
 HWY_MAYBE_UNUSED void TransformToPixels(const AcStrategy::Type strategy,
                                         float* JXL_RESTRICT coefficients,
                                         float* JXL_RESTRICT pixels,
@@ -0,0 +1,139 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <string.h>
+
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/ac_strategy.h"
+#include "lib/jxl/common.h"
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/dec_transforms_gbench.cc"
+#include <hwy/aligned_allocator.h>
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/dec_transforms-inl.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+namespace {
+
+// One row of blocks of a group. Every state.range(0) DCT8 blocks, the row has
+// a DCT4X8 block, so that the argument controls the strategy mix (and the
+// length of the DCT8 runs that can be batched).
+constexpr size_t kNumBlocks = kGroupDimInBlocks;
+
+struct IDCTRow {
+  explicit IDCTRow(size_t dct8_run) {
+    input = hwy::AllocateAligned<float>(kNumBlocks * kDCTBlockSize);
+    coefficients = hwy::AllocateAligned<float>(kNumBlocks * kDCTBlockSize);
+    pixels = hwy::AllocateAligned<float>(kNumBlocks * kDCTBlockSize);
+    scratch = hwy::AllocateAligned<float>(kDCT8BatchScratchSize +
+                                          AcStrategy::kMaxCoeffArea);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (size_t i = 0; i < kNumBlocks * kDCTBlockSize; i++) {
+      input[i] = dist(rng);
+    }
+    for (size_t i = 0; i < kNumBlocks; i++) {
+      strategies.push_back(i % (dct8_run + 1) == dct8_run
+                               ? AcStrategy::Type::DCT4X8
+                               : AcStrategy::Type::DCT);
+    }
+  }
+
+  // TransformToPixels overwrites its input, so each iteration starts from a
+  // fresh copy of `input`.
+  void Reset() {
+    memcpy(coefficients.get(), input.get(),
+           kNumBlocks * kDCTBlockSize * sizeof(float));
+  }
+
+  std::vector<AcStrategy::Type> strategies;
+  hwy::AlignedFreeUniquePtr<float[]> input;
+  hwy::AlignedFreeUniquePtr<float[]> coefficients;
+  hwy::AlignedFreeUniquePtr<float[]> pixels;
+  hwy::AlignedFreeUniquePtr<float[]> scratch;
+};
+
+HWY_NOINLINE void BM_IDCTRowPerBlock(benchmark::State& state) {
+  IDCTRow row(state.range(0));
+  const size_t stride = kNumBlocks * kBlockDim;
+  for (auto _ : state) {
+    row.Reset();
+    for (size_t i = 0; i < kNumBlocks; i++) {
+      TransformToPixels(row.strategies[i],
+                        row.coefficients.get() + i * kDCTBlockSize,
+                        row.pixels.get() + i * kBlockDim, stride,
+                        row.scratch.get());
+    }
+    benchmark::DoNotOptimize(row.pixels[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumBlocks * kDCTBlockSize);
+}
+
+HWY_NOINLINE void BM_IDCTRowBatched(benchmark::State& state) {
+  IDCTRow row(state.range(0));
+  const size_t stride = kNumBlocks * kBlockDim;
+  for (auto _ : state) {
+    row.Reset();
+    size_t i = 0;
+    while (i < kNumBlocks) {
+      size_t num = 0;
+      while (i + num < kNumBlocks && num < kMaxDCT8Batch &&
+             row.strategies[i + num] == AcStrategy::Type::DCT) {
+        num++;
+      }
+      if (num == 0) {
+        TransformToPixels(row.strategies[i],
+                          row.coefficients.get() + i * kDCTBlockSize,
+                          row.pixels.get() + i * kBlockDim, stride,
+                          row.scratch.get());
+        i++;
+        continue;
+      }
+      DCT8BatchToPixels(row.coefficients.get() + i * kDCTBlockSize, num,
+                        row.pixels.get() + i * kBlockDim, stride,
+                        row.scratch.get());
+      i += num;
+    }
+    benchmark::DoNotOptimize(row.pixels[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * kNumBlocks * kDCTBlockSize);
+}
+
+}  // namespace
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+namespace {
+
+HWY_EXPORT(BM_IDCTRowPerBlock);
+HWY_EXPORT(BM_IDCTRowBatched);
+
+void BM_IDCTRowPerBlock(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_IDCTRowPerBlock)(state);
+}
+void BM_IDCTRowBatched(benchmark::State& state) {
+  HWY_DYNAMIC_DISPATCH(BM_IDCTRowBatched)(state);
+}
+
+// Argument: number of DCT8 blocks between two DCT4X8 blocks; 32 means that
+// the row only has DCT8 blocks.
+BENCHMARK(BM_IDCTRowPerBlock)->Arg(1)->Arg(3)->Arg(7)->Arg(32);
+BENCHMARK(BM_IDCTRowBatched)->Arg(1)->Arg(3)->Arg(7)->Arg(32);
+
+}  // namespace
+}  // namespace jxl
+#endif
@@ -25,6 +25,14 @@ void TransformToPixels(AcStrategy::Type strategy,
                                                  pixels_stride, scratch_space);
 }
 
+HWY_EXPORT(DCT8BatchToPixels);
+void DCT8BatchToPixels(const float* JXL_RESTRICT coefficients, size_t num,
+                       float* JXL_RESTRICT pixels, size_t pixels_stride,
+                       float* JXL_RESTRICT scratch_space) {
+  return HWY_DYNAMIC_DISPATCH(DCT8BatchToPixels)(coefficients, num, pixels,
+                                                 pixels_stride, scratch_space);
+}
+
 HWY_EXPORT(LowestFrequenciesFromDC);
 void LowestFrequenciesFromDC(const jxl::AcStrategy::Type strategy,
                              const float* dc, size_t dc_stride, float* llf) {
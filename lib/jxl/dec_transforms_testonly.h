@@ -21,6 +21,12 @@ void TransformToPixels(AcStrategy::Type strategy,
                        float* JXL_RESTRICT pixels, size_t pixels_stride,
                        float* JXL_RESTRICT scratch_space);
 
+// Inverse DCT8 of `num` horizontally adjacent blocks, see
+// dec_transforms-inl.h.
+void DCT8BatchToPixels(const float* JXL_RESTRICT coefficients, size_t num,
+                       float* JXL_RESTRICT pixels, size_t pixels_stride,
+                       float* JXL_RESTRICT scratch_space);
+
 // Equivalent of the above for DC image.
 void LowestFrequenciesFromDC(const jxl::AcStrategy::Type strategy,
                              const float* dc, size_t dc_stride, float* llf);
@@ -12,9 +12,16 @@
 #define LIB_JXL_DEC_XYB_INL_H_
 #endif
 
+#include <string.h>
+
+#include <algorithm>
 #include <hwy/highway.h>
 
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/common.h"
 #include "lib/jxl/dec_xyb.h"
+#include "lib/jxl/fast_math-inl.h"
+#include "lib/jxl/transfer_functions-inl.h"
 HWY_BEFORE_NAMESPACE();
 namespace jxl {
 namespace HWY_NAMESPACE {
@@ -81,11 +88,25 @@ HWY_INLINE HWY_MAYBE_UNUSED void XybToRgb(D d, const V opsin_x, const V opsin_y,
 static inline HWY_MAYBE_UNUSED bool HasFastXYBTosRGB8() {
 #if HWY_TARGET == HWY_NEON
   return true;
+#elif HWY_TARGET != HWY_SCALAR && JXL_BYTE_ORDER_LITTLE
+  return true;
 #else
   return false;
 #endif
 }
 
+#if HWY_TARGET != HWY_NEON && HWY_TARGET != HWY_SCALAR
+// Returns sRGB-encoded `linear` in [0, 255], rounded to integer.
+template <class D, class V>
+HWY_INLINE HWY_MAYBE_UNUSED V LinearToSRGB8(D d, V linear) {
+  const auto zero = Zero(d);
+  const auto encoded =
+      FastLinearToSRGB(d, Clamp(linear, zero, Set(d, 1.0f))) * Set(d, 255.0f);
+  // FastLinearToSRGB(1) may be slightly larger than 1.
+  return Clamp(encoded, zero, Set(d, 255.0f));
+}
+#endif
+
 static inline HWY_MAYBE_UNUSED void FastXYBTosRGB8(
     const Image3F& input, const Rect& input_rect, const Rect& output_buf_rect,
     const ImageF* alpha, const Rect& alpha_rect, bool is_rgba,
@@ -332,6 +353,78 @@ static inline HWY_MAYBE_UNUSED void FastXYBTosRGB8(
       }
     }
   }
+#elif HWY_TARGET != HWY_SCALAR && JXL_BYTE_ORDER_LITTLE
+  // Portable version for other SIMD targets. All arithmetic is in float, with
+  // the same approximations as the generic path for sRGB output (the cube is
+  // computed with multiplications and the sRGB transfer function with
+  // FastLinearToSRGB), but the color conversion, rounding to 8 bits and
+  // interleaving are done in a single pass. Pixels are assembled into 32-bit
+  // lanes as R | G << 8 | B << 16 | A << 24, which is RGBA in memory on
+  // little-endian targets; for RGB output, each 128-bit block of 4 pixels is
+  // shuffled into 12 contiguous bytes.
+  static const OpsinParams opsin_params = [] {
+    OpsinParams params;
+    params.Init(kDefaultIntensityTarget);
+    return params;
+  }();
+  const HWY_FULL(float) d;
+  const hwy::HWY_NAMESPACE::Rebind<uint32_t, decltype(d)> du;
+  const HWY_FULL(uint8_t) du8;
+  const size_t N = Lanes(d);
+  HWY_ALIGN constexpr uint8_t kRGBxToRGB[16] = {
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15,
+  };
+  const auto rgbx_to_rgb = LoadDup128(du8, kRGBxToRGB);
+  HWY_ALIGN uint8_t tmp[hwy::kMaxVectorSize];
+
+  for (size_t y = 0; y < output_buf_rect.ysize(); y++) {
+    const float* JXL_RESTRICT row_in_x = input_rect.ConstPlaneRow(input, 0, y);
+    const float* JXL_RESTRICT row_in_y = input_rect.ConstPlaneRow(input, 1, y);
+    const float* JXL_RESTRICT row_in_b = input_rect.ConstPlaneRow(input, 2, y);
+    const float* JXL_RESTRICT row_in_a =
+        alpha == nullptr ? nullptr : alpha_rect.ConstRow(*alpha, y);
+    const size_t cnt = !is_rgba ? 3 : 4;
+    uint8_t* JXL_RESTRICT row_out =
+        output_buf + (y + output_buf_rect.y0()) * output_stride +
+        output_buf_rect.x0() * cnt;
+    // Rows are padded, so whole vectors can be loaded; only the output is
+    // written pixel-exactly.
+    for (size_t x = 0; x < output_buf_rect.xsize(); x += N) {
+      auto linear_r = Undefined(d);
+      auto linear_g = Undefined(d);
+      auto linear_b = Undefined(d);
+      XybToRgb(d, LoadU(d, row_in_x + x), LoadU(d, row_in_y + x),
+               LoadU(d, row_in_b + x), opsin_params, &linear_r, &linear_g,
+               &linear_b);
+      auto pixels = BitCast(du, NearestInt(LinearToSRGB8(d, linear_r))) |
+                    ShiftLeft<8>(BitCast(
+                        du, NearestInt(LinearToSRGB8(d, linear_g)))) |
+                    ShiftLeft<16>(BitCast(
+                        du, NearestInt(LinearToSRGB8(d, linear_b))));
+      const size_t n = std::min(N, output_buf_rect.xsize() - x);
+      uint8_t* JXL_RESTRICT out = row_out + cnt * x;
+      if (is_rgba) {
+        auto a8 = Set(du, 255);
+        if (row_in_a != nullptr) {
+          const auto a = Clamp(LoadU(d, row_in_a + x), Zero(d), Set(d, 1.0f));
+          a8 = BitCast(du, NearestInt(a * Set(d, 255.0f)));
+        }
+        pixels = pixels | ShiftLeft<24>(a8);
+        if (JXL_LIKELY(n == N)) {
+          StoreU(pixels, du, reinterpret_cast<uint32_t*>(out));
+        } else {
+          Store(pixels, du, reinterpret_cast<uint32_t*>(tmp));
+          memcpy(out, tmp, n * 4);
+        }
+      } else {
+        Store(TableLookupBytes(BitCast(du8, pixels), rgbx_to_rgb), du8, tmp);
+        for (size_t i = 0; i < n; i += 4) {
+          memcpy(out + 3 * i, tmp + 4 * i, 3 * std::min<size_t>(4, n - i));
+        }
+      }
+    }
+  }
+  (void)xsize;
 #else
   (void)input;
   (void)input_rect;
@@ -1978,6 +1978,9 @@ JxlDecoderStatus JxlDecoderFlushImage(JxlDecoder* dec) {
   }
   if (dec->frame_header->encoding != jxl::FrameEncoding::kVarDCT) {
     // Flushing does not yet work correctly if the frame uses modular encoding.
+    // TODO: flush Modular frames with the squeeze transform by undoing
+    // only the squeeze steps whose residuals were already decoded, as
+    // max_downsampling does.
     return JXL_DEC_ERROR;
   }
   if (dec->metadata.m.num_extra_channels > 0) {
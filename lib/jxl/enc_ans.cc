@@ -13,7 +13,6 @@
 #include <limits>
 #include <numeric>
 #include <type_traits>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -21,6 +20,8 @@
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/byte_order.h"
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_cluster.h"
 #include "lib/jxl/enc_context_map.h"
@@ -535,6 +536,31 @@ template void EncodeUintConfigs(const std::vector<HybridUintConfig>&,
 
 namespace {
 
+// Recomputes the clustered histograms with the HybridUintConfigs in `codes`.
+void RebuildClusteredHistograms(const std::vector<std::vector<Token>>& tokens,
+                                const std::vector<uint8_t>& context_map,
+                                const EntropyEncodingData& codes,
+                                std::vector<Histogram>* clustered_histograms,
+                                size_t* log_alpha_size) {
+  for (size_t i = 0; i < clustered_histograms->size(); i++) {
+    (*clustered_histograms)[i].Clear();
+  }
+  *log_alpha_size = 4;
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    for (size_t j = 0; j < tokens[i].size(); ++j) {
+      const Token token = tokens[i][j];
+      uint32_t tok, nbits, bits;
+      size_t histo = context_map[token.context];
+      (token.is_lz77_length ? codes.lz77.length_uint_config
+                            : codes.uint_config[histo])
+          .Encode(token.value, &tok, &nbits, &bits);
+      tok += token.is_lz77_length ? codes.lz77.min_symbol : 0;
+      (*clustered_histograms)[histo].Add(tok);
+      while (tok >= (1u << *log_alpha_size)) (*log_alpha_size)++;
+    }
+  }
+}
+
 void ChooseUintConfigs(const HistogramParams& params,
                        const std::vector<std::vector<Token>>& tokens,
                        const std::vector<uint8_t>& context_map,
@@ -629,30 +655,56 @@ void ChooseUintConfigs(const HistogramParams& params,
     }
   }
 
-  // Rebuild histograms.
-  for (size_t i = 0; i < clustered_histograms->size(); i++) {
-    (*clustered_histograms)[i].Clear();
-  }
-  *log_alpha_size = 4;
-  for (size_t i = 0; i < tokens.size(); ++i) {
-    for (size_t j = 0; j < tokens[i].size(); ++j) {
-      const Token token = tokens[i][j];
-      uint32_t tok, nbits, bits;
-      size_t histo = context_map[token.context];
-      (token.is_lz77_length ? codes->lz77.length_uint_config
-                            : codes->uint_config[histo])
-          .Encode(token.value, &tok, &nbits, &bits);
-      tok += token.is_lz77_length ? codes->lz77.min_symbol : 0;
-      (*clustered_histograms)[histo].Add(tok);
-      while (tok >= (1u << *log_alpha_size)) (*log_alpha_size)++;
-    }
-  }
+  RebuildClusteredHistograms(tokens, context_map, *codes, clustered_histograms,
+                             log_alpha_size);
 #if JXL_ENABLE_ASSERT
   size_t max_log_alpha_size = codes->use_prefix_code ? PREFIX_MAX_BITS : 8;
   JXL_ASSERT(*log_alpha_size <= max_log_alpha_size);
 #endif
 }
 
+// Uses the context map and HybridUintConfigs of `params.preset` and computes
+// the clustered histograms for them. Returns false, leaving the outputs
+// untouched, if there is no preset or it cannot be used for these tokens.
+bool ApplyEntropyCodePreset(const HistogramParams& params, size_t num_contexts,
+                            const std::vector<std::vector<Token>>& tokens,
+                            EntropyEncodingData* codes,
+                            std::vector<uint8_t>* context_map,
+                            std::vector<Histogram>* clustered_histograms,
+                            size_t* log_alpha_size) {
+  const EntropyCodePreset* preset = params.preset;
+  if (preset == nullptr || ans_fuzzer_friendly_ || codes->lz77.enabled ||
+      !preset->AppliesTo(num_contexts) ||
+      preset->uint_config.size() >
+          std::min(params.max_histograms, kClustersLimit)) {
+    return false;
+  }
+  EntropyEncodingData preset_codes;
+  preset_codes.lz77 = codes->lz77;
+  preset_codes.uint_config = preset->uint_config;
+  std::vector<Histogram> histograms(preset->uint_config.size());
+  size_t preset_log_alpha_size;
+  RebuildClusteredHistograms(tokens, preset->context_map, preset_codes,
+                             &histograms, &preset_log_alpha_size);
+  // The split exponents are coded with the bits of log_alpha_size and must
+  // not exceed it, even if the tokens of this image are all small.
+  for (const HybridUintConfig& config : preset->uint_config) {
+    preset_log_alpha_size =
+        std::max<size_t>(preset_log_alpha_size, config.split_exponent);
+  }
+  size_t max_log_alpha_size = codes->use_prefix_code ? PREFIX_MAX_BITS : 8;
+  if (preset_log_alpha_size > max_log_alpha_size) return false;
+  // Clusters that are unused in this image still need a valid histogram.
+  for (Histogram& histogram : histograms) {
+    if (histogram.total_count_ == 0) histogram.Add(0);
+  }
+  codes->uint_config = preset->uint_config;
+  *context_map = preset->context_map;
+  clustered_histograms->swap(histograms);
+  *log_alpha_size = preset_log_alpha_size;
+  return true;
+}
+
 class HistogramBuilder {
  public:
   explicit HistogramBuilder(const size_t num_contexts)
@@ -671,10 +723,20 @@ class HistogramBuilder {
       BitWriter* writer, size_t layer, AuxOut* aux_out) const {
     size_t cost = 0;
     codes->encoding_info.clear();
-    std::vector<Histogram> clustered_histograms(histograms_);
-    context_map->resize(histograms_.size());
+    codes->use_prefix_code = use_prefix_code;
+    size_t log_alpha_size = codes->lz77.enabled ? 8 : 7;  // Sane default.
+    std::vector<Histogram> clustered_histograms;
+    const bool use_preset = ApplyEntropyCodePreset(
+        params, histograms_.size(), tokens, codes, context_map,
+        &clustered_histograms, &log_alpha_size);
+    if (!use_preset) {
+      clustered_histograms = histograms_;
+      context_map->resize(histograms_.size());
+    }
     if (histograms_.size() > 1) {
-      if (!ans_fuzzer_friendly_) {
+      if (use_preset) {
+        // Context map and clusters come from the preset.
+      } else if (!ans_fuzzer_friendly_) {
         std::vector<uint32_t> histogram_symbols;
         ClusterHistograms(params, histograms_, histograms_.size(),
                           kClustersLimit, &clustered_histograms,
@@ -705,9 +767,9 @@ class HistogramBuilder {
             clustered_histograms[i].ShannonEntropy();
       }
     }
-    codes->use_prefix_code = use_prefix_code;
-    size_t log_alpha_size = codes->lz77.enabled ? 8 : 7;  // Sane default.
-    if (ans_fuzzer_friendly_) {
+    if (use_preset) {
+      // HybridUintConfigs and histograms come from the preset.
+    } else if (ans_fuzzer_friendly_) {
       codes->uint_config.clear();
       codes->uint_config.resize(1, HybridUintConfig(7, 0, 0));
     } else {
@@ -910,6 +972,9 @@ void ApplyLZ77_RLE(const HistogramParams& params, size_t num_contexts,
   }
 }
 
+// Marks distances without a special distance code in HashChain.
+constexpr uint8_t kNoSpecialDistance = 0xFF;
+
 // Hash chain for LZ77 matching
 struct HashChain {
   size_t size_;
@@ -934,8 +999,9 @@ struct HashChain {
   size_t min_length_;
   size_t max_length_;
 
-  // Map of special distance codes.
-  std::unordered_map<int, int> special_dist_table_;
+  // Map of special distance codes, indexed by distance; kNoSpecialDistance
+  // for distances without one. Dense because it is queried for every match.
+  std::vector<uint8_t> special_dist_table_;
   size_t num_special_distances_ = 0;
 
   uint32_t maxchainlength = 256;  // window_size_ to allow all
@@ -967,6 +1033,8 @@ struct HashChain {
     }
     // Translate distance to special distance code.
     if (distance_multiplier) {
+      static_assert(kNumSpecialDistances < kNoSpecialDistance,
+                    "Special distance codes must fit in the table");
       // Count down, so if due to small distance multiplier multiple distances
       // map to the same code, the smallest code will be used in the end.
       for (int i = kNumSpecialDistances - 1; i >= 0; --i) {
@@ -975,6 +1043,11 @@ struct HashChain {
         int distance = yi * distance_multiplier + xi;
         // Ensure that we map distance 1 to the lowest symbols.
         if (distance < 1) distance = 1;
+        // Distances at or beyond the window never match.
+        if (static_cast<size_t>(distance) >= window_size_) continue;
+        if (special_dist_table_.size() <= static_cast<size_t>(distance)) {
+          special_dist_table_.resize(distance + 1, kNoSpecialDistance);
+        }
         special_dist_table_[distance] = i;
       }
       num_special_distances_ = kNumSpecialDistances;
@@ -1050,7 +1123,16 @@ struct HashChain {
       if (dist < prev_dist) break;
       prev_dist = dist;
       uint32_t len = 0;
-      if (dist > 0) {
+      // Unless the length is needed to pick the zero chain below, reject
+      // candidates that differ before the shortest reportable length without
+      // comparing the whole match.
+      const size_t min_report = std::max<size_t>(
+          min_length_, best_len > 2 ? best_len - 2 : 0);
+      if (dist > 0 && numzeros < 3 &&
+          (pos + min_report > static_cast<size_t>(end) ||
+           data_[pos + min_report - 1] != data_[pos - dist + min_report - 1])) {
+        // len < min_report: not reported, and the hash chain is followed.
+      } else if (dist > 0) {
         int i = pos;
         int j = pos - dist;
         if (numzeros > 3) {
@@ -1068,10 +1150,11 @@ struct HashChain {
         // best length, because it is possible for a slightly cheaper distance
         // symbol to occur.
         if (len >= min_length_ && len + 2 >= best_len) {
-          auto it = special_dist_table_.find(dist);
-          int dist_symbol = (it == special_dist_table_.end())
-                                ? (num_special_distances_ + dist - 1)
-                                : it->second;
+          int dist_symbol =
+              (static_cast<size_t>(dist) < special_dist_table_.size() &&
+               special_dist_table_[dist] != kNoSpecialDistance)
+                  ? special_dist_table_[dist]
+                  : (num_special_distances_ + dist - 1);
           found_match(len, dist_symbol);
           if (len > best_len) best_len = len;
         }
@@ -1183,22 +1266,22 @@ float DistCost(size_t dist) {
 void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
                     const std::vector<std::vector<Token>>& tokens,
                     LZ77Params& lz77,
-                    std::vector<std::vector<Token>>& tokens_lz77) {
+                    std::vector<std::vector<Token>>& tokens_lz77,
+                    ThreadPool* pool) {
   // TODO(veluca): tune heuristics here.
   SymbolCostEstimator sce(num_contexts, params.force_huffman, tokens, lz77);
-  float bit_decrease = 0;
-  size_t total_symbols = 0;
+  // Per stream, so that the total does not depend on the number of threads.
+  std::vector<float> stream_bit_decrease(tokens.size());
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  const auto process_stream = [&](const uint32_t stream, size_t /*thread*/) {
+    HybridUintConfig uint_config;
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
     auto& out = tokens_lz77[stream];
-    total_symbols += in.size();
+    float& bit_decrease = stream_bit_decrease[stream];
     // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
+    std::vector<float> sym_cost(in.size() + 1);
     for (size_t i = 0; i < in.size(); i++) {
       uint32_t tok, nbits, unused_bits;
       uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
@@ -1277,35 +1360,48 @@ void ApplyLZ77_LZ77(const HistogramParams& params, size_t num_contexts,
         // Literal, already pushed
       }
     }
-  }
+  };
+  RunOnPool(pool, 0, tokens.size(), ThreadPool::SkipInit(), process_stream,
+            "ApplyLZ77");
 
+  float bit_decrease = 0;
+  size_t total_symbols = 0;
+  for (size_t stream = 0; stream < tokens.size(); stream++) {
+    bit_decrease += stream_bit_decrease[stream];
+    total_symbols += tokens[stream].size();
+  }
   if (bit_decrease > total_symbols * 0.2 + 16) {
     lz77.enabled = true;
   }
 }
 
+// Matches at least this long make ApplyLZ77_Optimal skip searching for
+// matches starting inside them.
+constexpr size_t kLongMatchLength = 128;
+
 void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
                        const std::vector<std::vector<Token>>& tokens,
                        LZ77Params& lz77,
-                       std::vector<std::vector<Token>>& tokens_lz77) {
+                       std::vector<std::vector<Token>>& tokens_lz77,
+                       ThreadPool* pool) {
   std::vector<std::vector<Token>> tokens_for_cost_estimate;
-  ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate);
+  ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_for_cost_estimate,
+                 pool);
   // If greedy-LZ77 does not give better compression than no-lz77, no reason to
   // run the optimal matching.
   if (!lz77.enabled) return;
   SymbolCostEstimator sce(num_contexts + 1, params.force_huffman,
                           tokens_for_cost_estimate, lz77);
   tokens_lz77.resize(tokens.size());
-  HybridUintConfig uint_config;
-  std::vector<float> sym_cost;
-  std::vector<uint32_t> dist_symbols;
-  for (size_t stream = 0; stream < tokens.size(); stream++) {
+  const auto process_stream = [&](const uint32_t stream, size_t /*thread*/) {
+    HybridUintConfig uint_config;
+    std::vector<uint32_t> dist_symbols;
     size_t distance_multiplier =
         params.image_widths.size() > stream ? params.image_widths[stream] : 0;
     const auto& in = tokens[stream];
     auto& out = tokens_lz77[stream];
     // Cumulative sum of bit costs.
-    sym_cost.resize(in.size() + 1);
+    std::vector<float> sym_cost(in.size() + 1);
     for (size_t i = 0; i < in.size(); i++) {
       uint32_t tok, nbits, unused_bits;
       uint_config.Encode(in[i].value, &tok, &nbits, &unused_bits);
@@ -1398,6 +1494,16 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
         skip_lz77 = dist_symbols.size() - 10;
         rle_length = 0;
       }
+      // Likewise for long matches whose distance is also the cheapest one for
+      // short lengths (e.g. repeated rows of flat areas): matches starting
+      // inside them are almost always suffixes of this one, so only search
+      // again near its end. Comparing candidates against such matches is
+      // what makes the search quadratic otherwise.
+      if (dist_symbols.size() > kLongMatchLength &&
+          dist_symbols[min_length] == dist_symbols.back()) {
+        skip_lz77 = std::max(skip_lz77, dist_symbols.size() - 10);
+        rle_length = 0;
+      }
     }
     size_t pos = in.size();
     while (pos > 0) {
@@ -1413,12 +1519,14 @@ void ApplyLZ77_Optimal(const HistogramParams& params, size_t num_contexts,
       pos -= prefix_costs[pos].len;
     }
     std::reverse(out.begin(), out.end());
-  }
+  };
+  RunOnPool(pool, 0, tokens.size(), ThreadPool::SkipInit(), process_stream,
+            "ApplyLZ77Optimal");
 }
 
 void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
                const std::vector<std::vector<Token>>& tokens, LZ77Params& lz77,
-               std::vector<std::vector<Token>>& tokens_lz77) {
+               std::vector<std::vector<Token>>& tokens_lz77, ThreadPool* pool) {
   lz77.enabled = false;
   if (params.force_huffman) {
     lz77.min_symbol = std::min(PREFIX_MAX_ALPHABET_SIZE - 32, 512);
@@ -1430,26 +1538,103 @@ void ApplyLZ77(const HistogramParams& params, size_t num_contexts,
   } else if (params.lz77_method == HistogramParams::LZ77Method::kRLE) {
     ApplyLZ77_RLE(params, num_contexts, tokens, lz77, tokens_lz77);
   } else if (params.lz77_method == HistogramParams::LZ77Method::kLZ77) {
-    ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77);
+    ApplyLZ77_LZ77(params, num_contexts, tokens, lz77, tokens_lz77, pool);
   } else if (params.lz77_method == HistogramParams::LZ77Method::kOptimal) {
-    ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77);
+    ApplyLZ77_Optimal(params, num_contexts, tokens, lz77, tokens_lz77, pool);
   } else {
     JXL_ABORT("Not implemented");
   }
 }
 }  // namespace
 
+EntropyCodePreset LearnEntropyCodePreset(
+    const HistogramParams& params, size_t num_contexts,
+    const std::vector<std::vector<Token>>& tokens) {
+  HistogramParams learn_params = params;
+  learn_params.lz77_method = HistogramParams::LZ77Method::kNone;
+  learn_params.preset = nullptr;
+  HistogramBuilder builder(num_contexts);
+  HybridUintConfig uint_config;  //  Default config for clustering.
+  if (params.uint_method == HistogramParams::HybridUintMethod::kContextMap) {
+    uint_config = HybridUintConfig(2, 0, 1);
+  }
+  for (size_t i = 0; i < tokens.size(); ++i) {
+    for (size_t j = 0; j < tokens[i].size(); ++j) {
+      const Token token = tokens[i][j];
+      JXL_DASSERT(!token.is_lz77_length);
+      uint32_t tok, nbits, bits;
+      uint_config.Encode(token.value, &tok, &nbits, &bits);
+      builder.VisitSymbol(tok, token.context);
+    }
+  }
+  EntropyEncodingData codes;
+  EntropyCodePreset preset;
+  builder.BuildAndStoreEntropyCodes(learn_params, tokens, &codes,
+                                    &preset.context_map,
+                                    /*use_prefix_code=*/false,
+                                    /*writer=*/nullptr, /*layer=*/0,
+                                    /*aux_out=*/nullptr);
+  preset.uint_config = std::move(codes.uint_config);
+  return preset;
+}
+
+void WriteEntropyCodePreset(const EntropyCodePreset& preset, PaddedBytes* out) {
+  out->resize(4 + preset.context_map.size() + 3 * preset.uint_config.size());
+  uint8_t* pos = out->data();
+  StoreLE32(preset.context_map.size(), pos);
+  pos += 4;
+  for (uint8_t histo : preset.context_map) *pos++ = histo;
+  for (const HybridUintConfig& config : preset.uint_config) {
+    *pos++ = config.split_exponent;
+    *pos++ = config.msb_in_token;
+    *pos++ = config.lsb_in_token;
+  }
+}
+
+Status ReadEntropyCodePreset(Span<const uint8_t> data,
+                             EntropyCodePreset* preset) {
+  if (data.size() < 4) return JXL_FAILURE("Entropy code preset too short");
+  const size_t num_contexts = LoadLE32(data.data());
+  if (num_contexts == 0 || num_contexts > data.size() - 4) {
+    return JXL_FAILURE("Invalid number of contexts in entropy code preset");
+  }
+  EntropyCodePreset result;
+  result.context_map.assign(data.data() + 4, data.data() + 4 + num_contexts);
+  size_t num_histograms = 0;
+  for (uint8_t histo : result.context_map) {
+    num_histograms = std::max<size_t>(num_histograms, histo + 1);
+  }
+  if (data.size() != 4 + num_contexts + 3 * num_histograms) {
+    return JXL_FAILURE("Invalid entropy code preset size");
+  }
+  const uint8_t* pos = data.data() + 4 + num_contexts;
+  for (size_t i = 0; i < num_histograms; i++, pos += 3) {
+    const uint32_t split_exponent = pos[0];
+    const uint32_t msb_in_token = pos[1];
+    const uint32_t lsb_in_token = pos[2];
+    // Same limits as DecodeUintConfig with the largest alphabet.
+    if (split_exponent > PREFIX_MAX_BITS ||
+        msb_in_token + lsb_in_token > split_exponent) {
+      return JXL_FAILURE("Invalid HybridUintConfig in entropy code preset");
+    }
+    result.uint_config.emplace_back(split_exponent, msb_in_token,
+                                    lsb_in_token);
+  }
+  *preset = std::move(result);
+  return true;
+}
+
 size_t BuildAndEncodeHistograms(const HistogramParams& params,
                                 size_t num_contexts,
                                 std::vector<std::vector<Token>>& tokens,
                                 EntropyEncodingData* codes,
                                 std::vector<uint8_t>* context_map,
                                 BitWriter* writer, size_t layer,
-                                AuxOut* aux_out) {
+                                AuxOut* aux_out, ThreadPool* pool) {
   size_t total_bits = 0;
   codes->lz77.nonserialized_distance_context = num_contexts;
   std::vector<std::vector<Token>> tokens_lz77;
-  ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77);
+  ApplyLZ77(params, num_contexts, tokens, codes->lz77, tokens_lz77, pool);
   if (ans_fuzzer_friendly_) {
     codes->lz77.length_uint_config = HybridUintConfig(10, 0, 0);
     codes->lz77.min_symbol = 2048;
@@ -1535,10 +1720,27 @@ size_t BuildAndEncodeHistograms(const HistogramParams& params,
 
 size_t WriteTokens(const std::vector<Token>& tokens,
                    const EntropyEncodingData& codes,
-                   const std::vector<uint8_t>& context_map, BitWriter* writer) {
+                   const std::vector<uint8_t>& context_map, BitWriter* writer,
+                   TokenCheckpoints* checkpoints) {
   size_t num_extra_bits = 0;
+  size_t num_checkpoints = 0;
+  if (checkpoints != nullptr) {
+    JXL_ASSERT(!codes.lz77.enabled);
+    num_checkpoints = checkpoints->tokens.size();
+    JXL_ASSERT(num_checkpoints == 0 ||
+               checkpoints->tokens.back() < tokens.size());
+    checkpoints->bit_offsets.resize(num_checkpoints);
+    checkpoints->ans_states.resize(codes.use_prefix_code ? 0
+                                                         : num_checkpoints);
+  }
   if (codes.use_prefix_code) {
+    uint64_t bits_written = 0;
+    size_t next_checkpoint = 0;
     for (size_t i = 0; i < tokens.size(); i++) {
+      if (next_checkpoint < num_checkpoints &&
+          checkpoints->tokens[next_checkpoint] == i) {
+        checkpoints->bit_offsets[next_checkpoint++] = bits_written;
+      }
       uint32_t tok, nbits, bits;
       const Token& token = tokens[i];
       size_t histo = context_map[token.context];
@@ -1554,6 +1756,7 @@ size_t WriteTokens(const std::vector<Token>& tokens,
       data |= bits << codes.encoding_info[histo][tok].depth;
       writer->Write(codes.encoding_info[histo][tok].depth + nbits, data);
       num_extra_bits += nbits;
+      bits_written += codes.encoding_info[histo][tok].depth + nbits;
     }
     return num_extra_bits;
   }
@@ -1577,6 +1780,10 @@ size_t WriteTokens(const std::vector<Token>& tokens,
   };
   const int end = tokens.size();
   ANSCoder ans;
+  // Bits of the tokens after the current one, as tokens are written in
+  // reverse order; the decoder reads the bits of a token while decoding it.
+  uint64_t bits_after = 0;
+  size_t next_checkpoint = num_checkpoints;
   for (int i = end - 1; i >= 0; --i) {
     const Token token = tokens[i];
     const uint8_t histo = context_map[token.context];
@@ -1592,6 +1799,18 @@ size_t WriteTokens(const std::vector<Token>& tokens,
     uint8_t ans_nbits = 0;
     uint32_t ans_bits = ans.PutSymbol(info, &ans_nbits);
     addbits(ans_bits, ans_nbits);
+    bits_after += nbits + ans_nbits;
+    // The state after encoding a token is the one the decoder has before
+    // decoding it.
+    if (next_checkpoint > 0 &&
+        checkpoints->tokens[next_checkpoint - 1] == static_cast<size_t>(i)) {
+      next_checkpoint--;
+      checkpoints->bit_offsets[next_checkpoint] = bits_after;
+      checkpoints->ans_states[next_checkpoint] = ans.GetState();
+    }
+  }
+  for (size_t i = 0; i < num_checkpoints; i++) {
+    checkpoints->bit_offsets[i] = bits_after - checkpoints->bit_offsets[i];
   }
   const uint32_t state = ans.GetState();
   writer->Write(32, state);
@@ -1605,9 +1824,11 @@ size_t WriteTokens(const std::vector<Token>& tokens,
 void WriteTokens(const std::vector<Token>& tokens,
                  const EntropyEncodingData& codes,
                  const std::vector<uint8_t>& context_map, BitWriter* writer,
-                 size_t layer, AuxOut* aux_out) {
+                 size_t layer, AuxOut* aux_out,
+                 TokenCheckpoints* checkpoints) {
   BitWriter::Allotment allotment(writer, 32 * tokens.size() + 32 * 1024 * 4);
-  size_t num_extra_bits = WriteTokens(tokens, codes, context_map, writer);
+  size_t num_extra_bits =
+      WriteTokens(tokens, codes, context_map, writer, checkpoints);
   ReclaimAndCharge(writer, &allotment, layer, aux_out);
   if (aux_out != nullptr) {
     aux_out->layers[layer].extra_bits += num_extra_bits;
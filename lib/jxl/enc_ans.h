@@ -23,6 +23,9 @@
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/padded_bytes.h"
+#include "lib/jxl/base/span.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/dec_ans.h"
 #include "lib/jxl/enc_ans_params.h"
@@ -91,6 +94,26 @@ struct EntropyEncodingData {
   LZ77Params lz77;
 };
 
+// Context map and per-cluster HybridUintConfigs learned from similar images
+// (see LearnEntropyCodePreset). When set in HistogramParams, they replace the
+// context clustering and the HybridUintConfig search; the histograms
+// themselves are still computed from the tokens of each image, since the
+// bitstream requires them.
+struct EntropyCodePreset {
+  std::vector<uint8_t> context_map;
+  std::vector<HybridUintConfig> uint_config;  // one per cluster
+
+  // Returns true if the preset is well-formed and has `num_contexts` contexts.
+  bool AppliesTo(size_t num_contexts) const {
+    if (context_map.size() != num_contexts) return false;
+    size_t num_histograms = 0;
+    for (uint8_t histo : context_map) {
+      num_histograms = std::max<size_t>(num_histograms, histo + 1);
+    }
+    return num_histograms == uint_config.size();
+  }
+};
+
 // Integer to be encoded by an entropy coder, either ANS or Huffman.
 struct Token {
   Token(uint32_t c, uint32_t value)
@@ -104,28 +127,61 @@ struct Token {
 // histogram (header bits plus data bits).
 float ANSPopulationCost(const ANSHistBin* data, size_t alphabet_size);
 
+// Runs the context clustering and HybridUintConfig search that
+// BuildAndEncodeHistograms would do on `tokens` (e.g. the tokens of a set of
+// training images, one stream per image) and returns the result as a preset.
+// LZ77 is not used and `params.preset` is ignored.
+EntropyCodePreset LearnEntropyCodePreset(
+    const HistogramParams& params, size_t num_contexts,
+    const std::vector<std::vector<Token>>& tokens);
+
+// Serializes `preset`: the number of contexts (32-bit little-endian), the
+// cluster of each context (one byte each), then the split_exponent,
+// msb_in_token and lsb_in_token of each cluster (one byte each).
+void WriteEntropyCodePreset(const EntropyCodePreset& preset, PaddedBytes* out);
+
+// Parses the output of WriteEntropyCodePreset.
+Status ReadEntropyCodePreset(Span<const uint8_t> data,
+                             EntropyCodePreset* preset);
+
 // Apply context clustering, compute histograms and encode them. Returns an
 // estimate of the total bits used for encoding the stream. If `writer` ==
 // nullptr, the bit estimate will not take into account the context map (which
-// does not get written if `num_contexts` == 1).
+// does not get written if `num_contexts` == 1). LZ77 matching runs on `pool`,
+// one task per token stream. If `params.preset` applies to `num_contexts` and
+// LZ77 ends up unused, its context map and HybridUintConfigs are used as-is.
 size_t BuildAndEncodeHistograms(const HistogramParams& params,
                                 size_t num_contexts,
                                 std::vector<std::vector<Token>>& tokens,
                                 EntropyEncodingData* codes,
                                 std::vector<uint8_t>* context_map,
                                 BitWriter* writer, size_t layer,
-                                AuxOut* aux_out);
+                                AuxOut* aux_out, ThreadPool* pool = nullptr);
+
+// Positions of the decoder before some of the tokens, from which decoding can
+// be resumed with ANSSymbolReader::Resume. Not supported with LZ77.
+struct TokenCheckpoints {
+  // Indices of the tokens, in increasing order.
+  std::vector<size_t> tokens;
+  // Computed by WriteTokens: number of bits from the end of the initial ANS
+  // state (or from the first token for prefix codes) and ANS state (empty for
+  // prefix codes) before each of the tokens.
+  std::vector<uint64_t> bit_offsets;
+  std::vector<uint32_t> ans_states;
+};
 
 // Write the tokens to a string.
 void WriteTokens(const std::vector<Token>& tokens,
                  const EntropyEncodingData& codes,
                  const std::vector<uint8_t>& context_map, BitWriter* writer,
-                 size_t layer, AuxOut* aux_out);
+                 size_t layer, AuxOut* aux_out,
+                 TokenCheckpoints* checkpoints = nullptr);
 
 // Same as above, but assumes allotment created by caller.
 size_t WriteTokens(const std::vector<Token>& tokens,
                    const EntropyEncodingData& codes,
-                   const std::vector<uint8_t>& context_map, BitWriter* writer);
+                   const std::vector<uint8_t>& context_map, BitWriter* writer,
+                   TokenCheckpoints* checkpoints = nullptr);
 
 // Exposed for tests; to be used with Writer=BitWriter only.
 template <typename Writer>
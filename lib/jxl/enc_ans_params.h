@@ -15,6 +15,8 @@
 
 namespace jxl {
 
+struct EntropyCodePreset;
+
 struct HistogramParams {
   enum class ClusteringType {
     kFastest,  // Only 4 clusters.
@@ -68,6 +70,9 @@ struct HistogramParams {
   std::vector<size_t> image_widths;
   size_t max_histograms = ~0;
   bool force_huffman = false;
+  // If not null and applicable, skips clustering and HybridUintConfig
+  // selection (owned by caller).
+  const EntropyCodePreset* preset = nullptr;
 };
 
 }  // namespace jxl
@@ -3,6 +3,8 @@
 // Use of this source code is governed by a BSD-style
 // license that can be found in the LICENSE file.
 
+#include "lib/jxl/enc_coeff_order.h"
+
 #include <stdint.h>
 
 #include <algorithm>
@@ -54,10 +56,16 @@ uint32_t ComputeUsedOrders(const SpeedTier speed,
   return ret;
 }
 
-void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
-                       const AcStrategyImage& ac_strategy,
-                       const FrameDimensions& frame_dim, uint32_t& used_orders,
-                       coeff_order_t* JXL_RESTRICT order) {
+namespace {
+
+// `get_group(group_index, rows)` sets rows[c] to the coefficients of the
+// group and returns their type.
+template <typename GetGroup>
+void ComputeCoeffOrderImpl(SpeedTier speed, const GetGroup& get_group,
+                           const AcStrategyImage& ac_strategy,
+                           const FrameDimensions& frame_dim,
+                           uint32_t& used_orders,
+                           coeff_order_t* JXL_RESTRICT order) {
   std::vector<int32_t> num_zeros(kCoeffOrderMaxSize);
   // If compressing at high speed and only using 8x8 DCTs, only consider a
   // subset of blocks.
@@ -95,10 +103,7 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
                       kGroupDimInBlocks, kGroupDimInBlocks,
                       frame_dim.xsize_blocks, frame_dim.ysize_blocks);
       ConstACPtr rows[3];
-      ACType type = acs.Type();
-      for (size_t c = 0; c < 3; c++) {
-        rows[c] = acs.PlaneRow(c, group_index, 0);
-      }
+      const ACType type = get_group(group_index, rows);
       size_t ac_offset = 0;
 
       // TODO(veluca): SIMDfy.
@@ -197,6 +202,43 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
   }
 }
 
+}  // namespace
+
+void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
+                       const AcStrategyImage& ac_strategy,
+                       const FrameDimensions& frame_dim, uint32_t& used_orders,
+                       coeff_order_t* JXL_RESTRICT order) {
+  const auto get_group = [&acs](size_t group_index, ConstACPtr* rows) {
+    for (size_t c = 0; c < 3; c++) {
+      rows[c] = acs.PlaneRow(c, group_index, 0);
+    }
+    return acs.Type();
+  };
+  ComputeCoeffOrderImpl(speed, get_group, ac_strategy, frame_dim, used_orders,
+                        order);
+}
+
+void ComputeCoeffOrder(SpeedTier speed, const GroupCoefficientsFunc& get_group,
+                       const AcStrategyImage& ac_strategy,
+                       const FrameDimensions& frame_dim, uint32_t& used_orders,
+                       coeff_order_t* JXL_RESTRICT order) {
+  ACImageT<int32_t> group;
+  const auto get_one_group = [&](size_t group_index, ConstACPtr* rows) {
+    if (group.IsEmpty()) {
+      group = ACImageT<int32_t>(kGroupDim * kGroupDim, 1);
+    }
+    int32_t* group_rows[3];
+    for (size_t c = 0; c < 3; c++) {
+      group_rows[c] = group.PlaneRow(c, 0, 0).ptr32;
+      rows[c] = ConstACPtr(group_rows[c]);
+    }
+    get_group(group_index, group_rows);
+    return ACType::k32;
+  };
+  ComputeCoeffOrderImpl(speed, get_one_group, ac_strategy, frame_dim,
+                        used_orders, order);
+}
+
 namespace {
 
 void TokenizePermutation(const coeff_order_t* JXL_RESTRICT order, size_t skip,
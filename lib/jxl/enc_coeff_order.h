@@ -9,6 +9,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <functional>
+
 #include "lib/jxl/ac_strategy.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -35,6 +37,19 @@ void ComputeCoeffOrder(SpeedTier speed, const ACImage& acs,
                        const FrameDimensions& frame_dim, uint32_t& used_orders,
                        coeff_order_t* JXL_RESTRICT order);
 
+// Stores the 32-bit quantized coefficients of the group with the given index
+// into rows[c], in the layout of ACImage rows. Each row has room for
+// kGroupDim * kGroupDim coefficients.
+using GroupCoefficientsFunc =
+    std::function<void(size_t group_index, int32_t* rows[3])>;
+
+// Same as above, but the coefficients are produced one group at a time by
+// `get_group`, so that they never need to be stored for the whole frame.
+void ComputeCoeffOrder(SpeedTier speed, const GroupCoefficientsFunc& get_group,
+                       const AcStrategyImage& ac_strategy,
+                       const FrameDimensions& frame_dim, uint32_t& used_orders,
+                       coeff_order_t* JXL_RESTRICT order);
+
 void EncodeCoeffOrders(uint16_t used_orders,
                        const coeff_order_t* JXL_RESTRICT order,
                        BitWriter* writer, size_t layer,
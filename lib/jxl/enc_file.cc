@@ -277,4 +277,42 @@ Status EncodeFile(const CompressParams& cparams_orig, const CodecInOut* io,
   return true;
 }
 
+Status LearnACEntropyCodePreset(const CompressParams& params,
+                                const std::vector<const CodecInOut*>& images,
+                                ThreadPool* pool, EntropyCodePreset* preset) {
+  CompressParams learn_params = params;
+  learn_params.ac_entropy_preset = nullptr;
+  HistogramParams hist_params;
+  size_t num_contexts = 0;
+  std::vector<std::vector<Token>> tokens;
+  for (const CodecInOut* io : images) {
+    PassesEncoderState enc_state;
+    PaddedBytes compressed;
+    JXL_RETURN_IF_ERROR(
+        EncodeFile(learn_params, io, &enc_state, &compressed, nullptr, pool));
+    const size_t image_contexts =
+        enc_state.shared.num_histograms *
+        enc_state.shared.block_ctx_map.NumACContexts();
+    size_t num_tokens = 0;
+    for (PassesEncoderState::PassData& pass : enc_state.passes) {
+      for (std::vector<Token>& group_tokens : pass.ac_tokens) {
+        num_tokens += group_tokens.size();
+        tokens.push_back(std::move(group_tokens));
+      }
+    }
+    if (num_tokens == 0) {
+      return JXL_FAILURE("Image was not encoded with VarDCT");
+    }
+    if (num_contexts == 0) {
+      num_contexts = image_contexts;
+      hist_params = ACHistogramParams(enc_state);
+    } else if (image_contexts != num_contexts) {
+      return JXL_FAILURE("Images have different numbers of AC contexts");
+    }
+  }
+  if (num_contexts == 0) return JXL_FAILURE("No images to learn from");
+  *preset = LearnEntropyCodePreset(hist_params, num_contexts, tokens);
+  return true;
+}
+
 }  // namespace jxl
@@ -8,12 +8,15 @@
 
 // Facade for JXL encoding.
 
+#include <vector>
+
 #include "lib/jxl/aux_out.h"
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/codec_in_out.h"
+#include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_params.h"
 
@@ -35,6 +38,15 @@ Status EncodeFile(const CompressParams& params, const CodecInOut* io,
                   PassesEncoderState* passes_enc_state, PaddedBytes* compressed,
                   AuxOut* aux_out = nullptr, ThreadPool* pool = nullptr);
 
+// Encodes each of `images` with `params` and learns a preset for the
+// histograms of the VarDCT AC coefficients from the tokens of their last
+// frame, to be used as CompressParams::ac_entropy_preset when encoding similar
+// images with the same parameters. Fails if the images are not encoded with
+// VarDCT or if they do not all have the same number of AC contexts.
+Status LearnACEntropyCodePreset(const CompressParams& params,
+                                const std::vector<const CodecInOut*>& images,
+                                ThreadPool* pool, EntropyCodePreset* preset);
+
 // Backwards-compatible interface. Don't use in new code.
 // TODO(deymo): Remove this function once we migrate users to C encoder API.
 struct FrameEncCache {};
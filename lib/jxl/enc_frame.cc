@@ -7,6 +7,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <algorithm>
 #include <array>
@@ -461,6 +462,19 @@ void SimplifyInvisible(Image3F* image, const ImageF& alpha, bool lossless) {
 
 }  // namespace
 
+HistogramParams ACHistogramParams(const PassesEncoderState& enc_state) {
+  HistogramParams hist_params(enc_state.cparams.speed_tier,
+                              enc_state.shared.block_ctx_map.NumACContexts());
+  if (enc_state.cparams.speed_tier > SpeedTier::kTortoise) {
+    hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
+  }
+  if (enc_state.cparams.decoding_speed_tier >= 1) {
+    hist_params.max_histograms = 6;
+  }
+  hist_params.preset = enc_state.cparams.ac_entropy_preset;
+  return hist_params;
+}
+
 class LossyFrameEncoder {
  public:
   LossyFrameEncoder(const CompressParams& cparams,
@@ -562,9 +576,9 @@ class LossyFrameEncoder {
     shared.ac_strategy.FillDCT8();
     FillImage(uint8_t(0), &shared.epf_sharpness);
 
+    // The quantized coefficients are read from the JPEG data one group at a
+    // time (see fill_group below) rather than stored for the whole frame.
     enc_state_->coeffs.clear();
-    enc_state_->coeffs.emplace_back(make_unique<ACImageT<int32_t>>(
-        kGroupDim * kGroupDim, frame_dim.num_groups));
 
     // convert JPEG quantization table to a Quantizer object
     float dcquantization[3];
@@ -709,7 +723,6 @@ class LossyFrameEncoder {
     }
     if (!frame_header->chroma_subsampling.Is444()) {
       ZeroFillImage(&dc);
-      enc_state_->coeffs[0]->ZeroFill();
     }
     // JPEG DC is from -1024 to 1023.
     std::vector<size_t> dc_counts[3] = {};
@@ -719,7 +732,6 @@ class LossyFrameEncoder {
     size_t total_dc[3] = {};
     for (size_t c : {1, 0, 2}) {
       if (jpeg_data.components.size() == 1 && c != 1) {
-        enc_state_->coeffs[0]->ZeroFillPlane(c);
         ZeroFillImage(&dc.Plane(c));
         // Ensure no division by 0.
         dc_counts[c][1024] = 1;
@@ -728,36 +740,56 @@ class LossyFrameEncoder {
       }
       size_t hshift = frame_header->chroma_subsampling.HShift(c);
       size_t vshift = frame_header->chroma_subsampling.VShift(c);
-      ImageSB& map = (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
-      for (size_t group_index = 0; group_index < frame_dim.num_groups;
-           group_index++) {
-        const size_t gx = group_index % frame_dim.xsize_groups;
-        const size_t gy = group_index / frame_dim.xsize_groups;
+      for (size_t by = 0; by < ysize_blocks; ++by) {
+        if ((by >> vshift) << vshift != by) continue;
+        const int16_t* JXL_RESTRICT inputjpeg = jpeg_row(c, by >> vshift);
+        float* JXL_RESTRICT fdc = dc.PlaneRow(c, by >> vshift);
+        for (size_t bx = 0; bx < xsize_blocks; ++bx) {
+          if ((bx >> hshift) << hshift != bx) continue;
+          size_t base = (bx >> hshift) * kDCTBlockSize;
+          int idc;
+          if (DCzero) {
+            idc = inputjpeg[base];
+          } else {
+            idc = inputjpeg[base] + 1024 / qt[c * 64];
+          }
+          dc_counts[c][std::min(static_cast<uint32_t>(idc + 1024),
+                                uint32_t(2047))]++;
+          total_dc[c]++;
+          fdc[bx >> hshift] = idc * dcquantization_r[c];
+        }
+      }
+    }
+
+    // Converts the coefficients of one group from the JPEG data, applying
+    // chroma-from-luma if needed.
+    const GroupCoefficientsFunc fill_group = [&](size_t group_index,
+                                                 int32_t* ac_rows[3]) {
+      const size_t gx = group_index % frame_dim.xsize_groups;
+      const size_t gy = group_index / frame_dim.xsize_groups;
+      for (size_t c : {1, 0, 2}) {
+        int32_t* JXL_RESTRICT ac = ac_rows[c];
+        if (!frame_header->chroma_subsampling.Is444() ||
+            (jpeg_data.components.size() == 1 && c != 1)) {
+          memset(ac, 0, kGroupDim * kGroupDim * sizeof(*ac));
+        }
+        if (jpeg_data.components.size() == 1 && c != 1) continue;
+        size_t hshift = frame_header->chroma_subsampling.HShift(c);
+        size_t vshift = frame_header->chroma_subsampling.VShift(c);
+        const ImageSB& map =
+            (c == 0 ? shared.cmap.ytox_map : shared.cmap.ytob_map);
         size_t offset = 0;
-        int32_t* JXL_RESTRICT ac =
-            enc_state_->coeffs[0]->PlaneRow(c, group_index, 0).ptr32;
         for (size_t by = gy * kGroupDimInBlocks;
              by < ysize_blocks && by < (gy + 1) * kGroupDimInBlocks; ++by) {
           if ((by >> vshift) << vshift != by) continue;
           const int16_t* JXL_RESTRICT inputjpeg = jpeg_row(c, by >> vshift);
           const int16_t* JXL_RESTRICT inputjpegY = jpeg_row(1, by);
-          float* JXL_RESTRICT fdc = dc.PlaneRow(c, by >> vshift);
           const int8_t* JXL_RESTRICT cm =
               map.ConstRow(by / kColorTileDimInBlocks);
           for (size_t bx = gx * kGroupDimInBlocks;
                bx < xsize_blocks && bx < (gx + 1) * kGroupDimInBlocks; ++bx) {
             if ((bx >> hshift) << hshift != bx) continue;
             size_t base = (bx >> hshift) * kDCTBlockSize;
-            int idc;
-            if (DCzero) {
-              idc = inputjpeg[base];
-            } else {
-              idc = inputjpeg[base] + 1024 / qt[c * 64];
-            }
-            dc_counts[c][std::min(static_cast<uint32_t>(idc + 1024),
-                                  uint32_t(2047))]++;
-            total_dc[c]++;
-            fdc[bx >> hshift] = idc * dcquantization_r[c];
             if (c == 1 || !enc_state_->cparams.force_cfl_jpeg_recompression ||
                 !frame_header->chroma_subsampling.Is444()) {
               for (size_t y = 0; y < 8; y++) {
@@ -790,7 +822,7 @@ class LossyFrameEncoder {
           }
         }
       }
-    }
+    };
 
     auto& dct = enc_state_->shared.block_ctx_map.dc_thresholds;
     auto& num_dc_ctxs = enc_state_->shared.block_ctx_map.num_dc_ctxs;
@@ -854,34 +886,35 @@ class LossyFrameEncoder {
     JXL_CHECK(enc_state_->passes.size() ==
               1);  // skipping coeff splitting so need to have only one pass
 
-    ComputeAllCoeffOrders(frame_dim);
+    ComputeAllCoeffOrders(frame_dim, fill_group);
     shared.num_histograms = 1;
 
+    // One group of coefficients per thread.
+    ACImageT<int32_t> group_coeffs;
     const auto tokenize_group_init = [&](const size_t num_threads) {
       group_caches_.resize(num_threads);
+      group_coeffs = ACImageT<int32_t>(kGroupDim * kGroupDim, num_threads);
       return true;
     };
     const auto tokenize_group = [&](const int group_index, const int thread) {
+      int32_t* ac_rows[3] = {
+          group_coeffs.PlaneRow(0, thread, 0).ptr32,
+          group_coeffs.PlaneRow(1, thread, 0).ptr32,
+          group_coeffs.PlaneRow(2, thread, 0).ptr32,
+      };
+      fill_group(group_index, ac_rows);
       // Tokenize coefficients.
       const Rect rect = shared.BlockGroupRect(group_index);
-      for (size_t idx_pass = 0; idx_pass < enc_state_->passes.size();
-           idx_pass++) {
-        JXL_ASSERT(enc_state_->coeffs[idx_pass]->Type() == ACType::k32);
-        const int32_t* JXL_RESTRICT ac_rows[3] = {
-            enc_state_->coeffs[idx_pass]->PlaneRow(0, group_index, 0).ptr32,
-            enc_state_->coeffs[idx_pass]->PlaneRow(1, group_index, 0).ptr32,
-            enc_state_->coeffs[idx_pass]->PlaneRow(2, group_index, 0).ptr32,
-        };
-        // Ensure group cache is initialized.
-        group_caches_[thread].InitOnce();
-        TokenizeCoefficients(
-            &shared.coeff_orders[idx_pass * shared.coeff_order_size], rect,
-            ac_rows, shared.ac_strategy, frame_header->chroma_subsampling,
-            &group_caches_[thread].num_nzeroes,
-            &enc_state_->passes[idx_pass].ac_tokens[group_index],
-            enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
-            enc_state_->shared.block_ctx_map);
-      }
+      const int32_t* JXL_RESTRICT const_ac_rows[3] = {ac_rows[0], ac_rows[1],
+                                                      ac_rows[2]};
+      // Ensure group cache is initialized.
+      group_caches_[thread].InitOnce();
+      TokenizeCoefficients(
+          &shared.coeff_orders[0], rect, const_ac_rows, shared.ac_strategy,
+          frame_header->chroma_subsampling, &group_caches_[thread].num_nzeroes,
+          &enc_state_->passes[0].ac_tokens[group_index],
+          enc_state_->shared.quant_dc, enc_state_->shared.raw_quant_field,
+          enc_state_->shared.block_ctx_map);
     };
     RunOnPool(pool_, 0, shared.frame_dim.num_groups, tokenize_group_init,
               tokenize_group, "TokenizeGroup");
@@ -932,17 +965,8 @@ class LossyFrameEncoder {
           writer, kLayerOrder, aux_out_);
 
       // Encode histograms.
-      HistogramParams hist_params(
-          enc_state_->cparams.speed_tier,
-          enc_state_->shared.block_ctx_map.NumACContexts());
-      if (enc_state_->cparams.speed_tier > SpeedTier::kTortoise) {
-        hist_params.lz77_method = HistogramParams::LZ77Method::kNone;
-      }
-      if (enc_state_->cparams.decoding_speed_tier >= 1) {
-        hist_params.max_histograms = 6;
-      }
       BuildAndEncodeHistograms(
-          hist_params,
+          ACHistogramParams(*enc_state_),
           enc_state_->shared.num_histograms *
               enc_state_->shared.block_ctx_map.NumACContexts(),
           enc_state_->passes[i].ac_tokens, &enc_state_->passes[i].codes,
@@ -962,7 +986,10 @@ class LossyFrameEncoder {
   PassesEncoderState* State() { return enc_state_; }
 
  private:
-  void ComputeAllCoeffOrders(const FrameDimensions& frame_dim) {
+  // If `get_group` is set, it provides the coefficients of a single pass
+  // instead of enc_state_->coeffs.
+  void ComputeAllCoeffOrders(const FrameDimensions& frame_dim,
+                             const GroupCoefficientsFunc& get_group = nullptr) {
     PROFILER_FUNC;
     enc_state_->used_orders.resize(
         enc_state_->progressive_splitter.GetNumPasses());
@@ -974,11 +1001,19 @@ class LossyFrameEncoder {
             enc_state_->cparams.speed_tier, enc_state_->shared.ac_strategy,
             Rect(enc_state_->shared.raw_quant_field));
       }
-      ComputeCoeffOrder(
-          enc_state_->cparams.speed_tier, *enc_state_->coeffs[i],
-          enc_state_->shared.ac_strategy, frame_dim, enc_state_->used_orders[i],
+      coeff_order_t* order =
           &enc_state_->shared
-               .coeff_orders[i * enc_state_->shared.coeff_order_size]);
+               .coeff_orders[i * enc_state_->shared.coeff_order_size];
+      if (get_group) {
+        ComputeCoeffOrder(enc_state_->cparams.speed_tier, get_group,
+                          enc_state_->shared.ac_strategy, frame_dim,
+                          enc_state_->used_orders[i], order);
+      } else {
+        ComputeCoeffOrder(enc_state_->cparams.speed_tier,
+                          *enc_state_->coeffs[i],
+                          enc_state_->shared.ac_strategy, frame_dim,
+                          enc_state_->used_orders[i], order);
+      }
     }
   }
 
@@ -1212,7 +1247,6 @@ Status EncodeFrame(const CompressParams& cparams_orig,
   frame_header->UpdateFlag(
       lossy_frame_encoder.State()->shared.image_features.splines.HasAny(),
       FrameHeader::kSplines);
-  JXL_RETURN_IF_ERROR(WriteFrameHeader(*frame_header, writer, aux_out));
 
   const size_t num_passes =
       passes_enc_state->progressive_splitter.GetNumPasses();
@@ -1257,9 +1291,15 @@ Status EncodeFrame(const CompressParams& cparams_orig,
         lossy_frame_encoder.EncodeGlobalDCInfo(*frame_header, get_output(0)));
   }
   JXL_RETURN_IF_ERROR(
-      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out));
+      modular_frame_encoder->EncodeGlobalInfo(get_output(0), aux_out, pool));
   JXL_RETURN_IF_ERROR(modular_frame_encoder->EncodeStream(
       get_output(0), aux_out, kLayerModularGlobal, ModularStreamId::Global()));
+  // The row index is only known after encoding the global stream.
+  if (!modular_frame_encoder->global_row_index.bit_offsets.empty()) {
+    frame_header->extensions |= FrameHeader::kModularRowIndex;
+    frame_header->modular_row_index = modular_frame_encoder->global_row_index;
+  }
+  JXL_RETURN_IF_ERROR(WriteFrameHeader(*frame_header, writer, aux_out));
 
   const auto process_dc_group = [&](const int group_index, const int thread) {
     AuxOut* my_aux_out = aux_out ? &aux_outs[thread] : nullptr;
@@ -46,6 +46,10 @@ Status EncodeFrame(const CompressParams& cparams_orig,
                    const ImageBundle& ib, PassesEncoderState* passes_enc_state,
                    ThreadPool* pool, BitWriter* writer, AuxOut* aux_out);
 
+// Parameters of the histograms of the VarDCT AC coefficients of a frame
+// encoded with `enc_state` (the frame's CompressParams and block context map).
+HistogramParams ACHistogramParams(const PassesEncoderState& enc_state);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_ENC_FRAME_H_
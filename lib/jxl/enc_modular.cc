@@ -336,6 +336,11 @@ ModularFrameEncoder::ModularFrameEncoder(const FrameHeader& frame_header,
   } else {
     cparams.options.splitting_heuristics_node_threshold = 96;
   }
+  if (cparams.modular_independent_channels) {
+    // Properties of previous channels would make channels depend on each
+    // other.
+    cparams.options.max_properties = 0;
+  }
   {
     // Set properties.
     std::vector<uint32_t> prop_order;
@@ -1010,6 +1015,54 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
   }
 
   image_widths.resize(num_streams);
+  if (cparams.modular_independent_channels) {
+    // One task per coded channel of every stream, so that a few streams with
+    // many channels still use all the threads. The headers and the number of
+    // tokens of each stream are computed first, with placeholder tokens.
+    std::vector<std::pair<size_t, size_t>> channel_tasks;  // stream, channel
+    std::vector<size_t> token_offsets;
+    for (size_t stream_id = 0; stream_id < num_streams; stream_id++) {
+      const Image& image = stream_images[stream_id];
+      tokens[stream_id].clear();
+      if (image.w == 0 || image.h == 0) continue;
+      ModularOptions options = stream_options[stream_id];
+      options.zero_tokens = true;
+      JXL_CHECK(ModularGenericCompress(
+          stream_images[stream_id], options, /*writer=*/nullptr,
+          /*aux_out=*/nullptr, 0, stream_id, /*tree_samples=*/nullptr,
+          /*total_pixels=*/nullptr, /*tree=*/&tree,
+          /*header=*/&stream_headers[stream_id],
+          /*tokens=*/&tokens[stream_id],
+          /*widths=*/&image_widths[stream_id]));
+      size_t offset = 0;
+      for (size_t i : CodedModularChannels(image, options)) {
+        channel_tasks.emplace_back(stream_id, i);
+        token_offsets.push_back(offset);
+        offset += image.channel[i].w * image.channel[i].h;
+      }
+      JXL_ASSERT(offset == tokens[stream_id].size());
+    }
+    RunOnPool(
+        pool, 0, channel_tasks.size(), ThreadPool::SkipInit(),
+        [&](size_t task, size_t _) {
+          const size_t stream_id = channel_tasks[task].first;
+          AuxOut my_aux_out;
+          if (aux_out) {
+            my_aux_out.dump_image = aux_out->dump_image;
+            my_aux_out.debug_prefix = aux_out->debug_prefix;
+          }
+          std::vector<Token> channel_tokens;
+          JXL_CHECK(EncodeModularChannelMAANS(
+              stream_images[stream_id], channel_tasks[task].second,
+              stream_headers[stream_id].wp_header, tree, &channel_tokens,
+              &my_aux_out, stream_id,
+              stream_options[stream_id].skip_encoder_fast_path));
+          std::copy(channel_tokens.begin(), channel_tokens.end(),
+                    tokens[stream_id].begin() + token_offsets[task]);
+        },
+        "ComputeChannelTokens");
+    return true;
+  }
   RunOnPool(
       pool, 0, num_streams, ThreadPool::SkipInit(),
       [&](size_t stream_id, size_t _) {
@@ -1033,7 +1086,8 @@ Status ModularFrameEncoder::PrepareEncoding(ThreadPool* pool,
 }
 
 Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
-                                             AuxOut* aux_out) {
+                                             AuxOut* aux_out,
+                                             ThreadPool* pool) {
   BitWriter::Allotment allotment(writer, 1);
   // If we are using brotli, or not using modular mode.
   if (tree_tokens.empty() || tree_tokens[0].empty()) {
@@ -1081,7 +1135,8 @@ Status ModularFrameEncoder::EncodeGlobalInfo(BitWriter* writer,
   params.image_widths = image_widths;
   // Write histograms.
   BuildAndEncodeHistograms(params, (tree.size() + 1) / 2, tokens, &code,
-                           &context_map, writer, kLayerModularGlobal, aux_out);
+                           &context_map, writer, kLayerModularGlobal, aux_out,
+                           pool);
   return true;
 }
 
@@ -1094,7 +1149,44 @@ Status ModularFrameEncoder::EncodeStream(BitWriter* writer, AuxOut* aux_out,
   }
   JXL_RETURN_IF_ERROR(
       Bundle::Write(stream_headers[stream_id], writer, layer, aux_out));
-  WriteTokens(tokens[stream_id], code, context_map, writer, layer, aux_out);
+  if (stream_id != 0) {
+    WriteTokens(tokens[stream_id], code, context_map, writer, layer, aux_out);
+    return true;
+  }
+  const Image& image = stream_images[stream_id];
+  const std::vector<size_t> channels =
+      CodedModularChannels(image, stream_options[stream_id]);
+  if (aux_out != nullptr) {
+    for (size_t k = 0; k < channels.size(); k++) {
+      aux_out->num_global_modular_channels++;
+      if (k == 0 || !UsesPreviousChannels(tree, channels[k], stream_id)) {
+        aux_out->num_independent_modular_channels++;
+      }
+    }
+  }
+  if (!(cparams.modular_row_index || cparams.modular_independent_channels) ||
+      code.lz77.enabled || tokens[stream_id].empty()) {
+    WriteTokens(tokens[stream_id], code, context_map, writer, layer, aux_out);
+    return true;
+  }
+  // Record where each row (or only the first row) of the coded channels
+  // starts, for parallel decoding.
+  const bool per_channel = !cparams.modular_row_index;
+  TokenCheckpoints checkpoints;
+  size_t num_tokens = 0;
+  for (size_t i : channels) {
+    const Channel& channel = image.channel[i];
+    for (size_t y = 0; y < channel.h; y++) {
+      if (y == 0 || !per_channel) checkpoints.tokens.push_back(num_tokens);
+      num_tokens += channel.w;
+    }
+  }
+  JXL_ASSERT(num_tokens == tokens[stream_id].size());
+  WriteTokens(tokens[stream_id], code, context_map, writer, layer, aux_out,
+              &checkpoints);
+  global_row_index.per_channel = per_channel;
+  global_row_index.bit_offsets = std::move(checkpoints.bit_offsets);
+  global_row_index.ans_states = std::move(checkpoints.ans_states);
   return true;
 }
 
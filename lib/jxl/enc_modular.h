@@ -32,7 +32,8 @@ class ModularFrameEncoder {
                              PassesEncoderState* JXL_RESTRICT enc_state,
                              ThreadPool* pool, AuxOut* aux_out, bool do_color);
   // Encodes global info (tree + histograms) in the `writer`.
-  Status EncodeGlobalInfo(BitWriter* writer, AuxOut* aux_out);
+  Status EncodeGlobalInfo(BitWriter* writer, AuxOut* aux_out,
+                          ThreadPool* pool);
   // Encodes a specific modular image (identified by `stream`) in the `writer`,
   // assigning bits to the provided `layer`.
   Status EncodeStream(BitWriter* writer, AuxOut* aux_out, size_t layer,
@@ -60,6 +61,10 @@ class ModularFrameEncoder {
 
   std::vector<size_t> ac_metadata_size;
   std::vector<uint8_t> extra_dc_precision;
+  // Start of each row (or channel) of the global stream, filled in by
+  // EncodeStream if `cparams.modular_row_index` (or
+  // `cparams.modular_independent_channels`) is set.
+  ModularRowIndex global_row_index;
 
  private:
   Status PrepareEncoding(ThreadPool* pool, const FrameDimensions& frame_dim,
@@ -20,6 +20,8 @@
 
 namespace jxl {
 
+struct EntropyCodePreset;
+
 enum class SpeedTier {
   // Turns on FindBestQuantizationHQ loop. Equivalent to "guetzli" mode.
   kTortoise = 1,
@@ -146,6 +148,22 @@ struct CompressParams {
   // Change group size in modular mode (0=128, 1=256, 2=512, 3=1024).
   size_t modular_group_size_shift = 1;
 
+  // Store the start of each row of the global modular stream in the frame
+  // header, so that decoders can decode its rows in parallel. Costs about 6
+  // bytes per row and channel; ignored if LZ77 is used.
+  bool modular_row_index = false;
+
+  // Do not use properties of previous channels in modular mode, so that the
+  // channels are independent: they are tokenized concurrently, and the start
+  // of each channel of the global stream is stored in the frame header so
+  // that decoders can decode them concurrently (about 6 bytes per channel).
+  bool modular_independent_channels = false;
+
+  // Context map and HybridUintConfigs to use for the VarDCT AC histograms
+  // instead of clustering them for each frame (owned by caller). Ignored if
+  // its number of contexts does not match. See LearnACEntropyCodePreset.
+  const EntropyCodePreset* ac_entropy_preset = nullptr;
+
   Override preview = Override::kDefault;
   Override noise = Override::kDefault;
   Override dots = Override::kDefault;
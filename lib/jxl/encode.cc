@@ -304,7 +304,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(const JxlEncoderOptions* options,
   }
 
   jxl::CodecInOut io;
-  if (!jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(buffer, size), &io)) {
+  if (!jxl::jpeg::DecodeImageJPG(jxl::Span<const uint8_t>(buffer, size), &io,
+                                 options->enc->thread_pool.get())) {
     return JXL_ENC_ERROR;
   }
 
@@ -335,9 +336,8 @@ JxlEncoderStatus JxlEncoderAddJPEGFrame(const JxlEncoderOptions* options,
   }
 
   if (options->enc->store_jpeg_metadata) {
-    jxl::jpeg::JPEGData data_in = *io.Main().jpeg_data;
     jxl::PaddedBytes jpeg_data;
-    if (!EncodeJPEGData(data_in, &jpeg_data)) {
+    if (!EncodeJPEGData(*io.Main().jpeg_data, &jpeg_data)) {
       return JXL_ENC_ERROR;
     }
     options->enc->jpeg_metadata = std::vector<uint8_t>(
@@ -161,6 +161,8 @@ HWY_AFTER_NAMESPACE();
 #endif  // LIB_JXL_FAST_MATH_INL_H_
 
 #if HWY_ONCE
+#ifndef LIB_JXL_FAST_MATH_ONCE
+#define LIB_JXL_FAST_MATH_ONCE
 
 namespace jxl {
 inline float FastLog2f(float f) { return HWY_STATIC_DISPATCH(FastLog2f)(f); }
@@ -172,4 +174,5 @@ inline float FastCosf(float f) { return HWY_STATIC_DISPATCH(FastCosf)(f); }
 inline float FastErff(float f) { return HWY_STATIC_DISPATCH(FastErff)(f); }
 }  // namespace jxl
 
+#endif  // LIB_JXL_FAST_MATH_ONCE
 #endif  // HWY_ONCE
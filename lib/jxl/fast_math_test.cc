@@ -252,6 +252,49 @@ HWY_NOINLINE void TestFastXYB() {
   }
 }
 
+HWY_NOINLINE void TestFastXYBRGBA() {
+  if (!HasFastXYBTosRGB8()) return;
+  // Not a multiple of the vector size, to exercise partial vectors.
+  constexpr size_t kXSize = 37;
+  constexpr size_t kYSize = 3;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+  Image3F rgb(kXSize, kYSize);
+  ImageF alpha(kXSize, kYSize);
+  for (size_t y = 0; y < kYSize; y++) {
+    for (size_t x = 0; x < kXSize; x++) {
+      for (size_t c = 0; c < 3; c++) rgb.PlaneRow(c, y)[x] = dist(rng);
+      alpha.Row(y)[x] = dist(rng);
+    }
+  }
+  ImageMetadata metadata;
+  ImageBundle ib(&metadata);
+  ib.SetFromImage(CopyImage(rgb), ColorEncoding::SRGB());
+  Image3F xyb(kXSize, kYSize);
+  ToXYB(ib, nullptr, &xyb);
+  // Exactly sized, so that out of bounds writes are detected by ASAN.
+  std::vector<uint8_t> rgb8(kXSize * kYSize * 3);
+  std::vector<uint8_t> rgba8(kXSize * kYSize * 4);
+  jxl::HWY_NAMESPACE::FastXYBTosRGB8(xyb, Rect(xyb), Rect(xyb), nullptr,
+                                     Rect(), /*is_rgba=*/false, rgb8.data(),
+                                     kXSize, kXSize * 3);
+  jxl::HWY_NAMESPACE::FastXYBTosRGB8(xyb, Rect(xyb), Rect(xyb), &alpha,
+                                     Rect(alpha), /*is_rgba=*/true,
+                                     rgba8.data(), kXSize, kXSize * 4);
+  for (size_t y = 0; y < kYSize; y++) {
+    for (size_t x = 0; x < kXSize; x++) {
+      const size_t idx = y * kXSize + x;
+      for (size_t c = 0; c < 3; c++) {
+        const float expected = rgb.PlaneRow(c, y)[x] * 255;
+        EXPECT_LT(std::abs(expected - rgb8[3 * idx + c]), 2)
+            << "expected " << expected << " got " << int(rgb8[3 * idx + c]);
+        EXPECT_EQ(rgb8[3 * idx + c], rgba8[4 * idx + c]);
+      }
+      EXPECT_EQ(std::round(alpha.Row(y)[x] * 255), rgba8[4 * idx + 3]);
+    }
+  }
+}
+
 }  // namespace
 // NOLINTNEXTLINE(google-readability-namespace-comments)
 }  // namespace HWY_NAMESPACE
@@ -275,6 +318,7 @@ HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastPQEFD);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastHLGEFD);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFast709EFD);
 HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastXYB);
+HWY_EXPORT_AND_TEST_P(FastMathTargetTest, TestFastXYBRGBA);
 
 }  // namespace jxl
 #endif  // HWY_ONCE
@@ -69,7 +69,8 @@ class VisitorBase : public Visitor {
   // This is the only call site of Fields::VisitFields. Adds tracing and
   // ensures EndExtensions was called.
   Status Visit(Fields* fields, const char* visitor_name) override {
-    fputs(visitor_name, stdout);  // No newline; no effect if empty
+    // No newline. Skipped if empty to avoid locking stdout for every bundle.
+    if (visitor_name[0] != '\0') fputs(visitor_name, stdout);
     if (print_bundles_) {
       Trace("%s\n", print_bundles_ ? fields->Name() : "");
     }
@@ -152,7 +153,7 @@ class VisitorBase : public Visitor {
   const bool print_bundles_;
 };
 
-struct InitVisitor : public VisitorBase {
+struct InitVisitor final : public VisitorBase {
   Status Bits(const size_t /*unused*/, const uint32_t default_value,
               uint32_t* JXL_RESTRICT value) override {
     *value = default_value;
@@ -201,7 +202,7 @@ struct InitVisitor : public VisitorBase {
 };
 
 // Similar to InitVisitor, but also initializes nested fields.
-struct SetDefaultVisitor : public VisitorBase {
+struct SetDefaultVisitor final : public VisitorBase {
   Status Bits(const size_t /*unused*/, const uint32_t default_value,
               uint32_t* JXL_RESTRICT value) override {
     *value = default_value;
@@ -243,7 +244,7 @@ struct SetDefaultVisitor : public VisitorBase {
   const char* VisitorName() override { return "SetDefaultVisitor"; }
 };
 
-class AllDefaultVisitor : public VisitorBase {
+class AllDefaultVisitor final : public VisitorBase {
  public:
   explicit AllDefaultVisitor(bool print_all_default)
       : VisitorBase(print_all_default), print_all_default_(print_all_default) {}
@@ -303,7 +304,7 @@ class AllDefaultVisitor : public VisitorBase {
   bool all_default_ = true;
 };
 
-class ReadVisitor : public VisitorBase {
+class ReadVisitor final : public VisitorBase {
  public:
   ReadVisitor(BitReader* reader, bool print_read)
       : VisitorBase(print_read), print_read_(print_read), reader_(reader) {}
@@ -319,6 +320,18 @@ class ReadVisitor : public VisitorBase {
     return true;
   }
 
+  // Reads the bit directly instead of going through VisitorBase::Bool and
+  // another virtual Bits call; Bool is the most frequent field type.
+  Status Bool(bool /*default_value*/, bool* JXL_RESTRICT value) override {
+    *value = reader_->ReadFixedBits<1>() != 0;
+    if (!reader_->AllReadsWithinBounds()) {
+      return JXL_STATUS(StatusCode::kNotEnoughBytes,
+                        "Not enough bytes for header");
+    }
+    if (print_read_) Trace("  Bool = %d\n", *value);
+    return true;
+  }
+
   Status U32(const U32Enc dist, const uint32_t /*default_value*/,
              uint32_t* JXL_RESTRICT value) override {
     *value = U32Coder::Read(dist, reader_);
@@ -434,7 +447,7 @@ class ReadVisitor : public VisitorBase {
   size_t pos_after_ext_size_ = 0;  // 0 iff extensions == 0.
 };
 
-class MaxBitsVisitor : public VisitorBase {
+class MaxBitsVisitor final : public VisitorBase {
  public:
   Status Bits(const size_t bits, const uint32_t /*default_value*/,
               uint32_t* JXL_RESTRICT /*value*/) override {
@@ -485,7 +498,7 @@ class MaxBitsVisitor : public VisitorBase {
   size_t max_bits_ = 0;
 };
 
-class CanEncodeVisitor : public VisitorBase {
+class CanEncodeVisitor final : public VisitorBase {
  public:
   explicit CanEncodeVisitor(bool print_sizes)
       : VisitorBase(print_sizes), print_sizes_(print_sizes) {}
@@ -587,7 +600,7 @@ class CanEncodeVisitor : public VisitorBase {
   uint64_t pos_after_ext_ = 0;
 };
 
-class WriteVisitor : public VisitorBase {
+class WriteVisitor final : public VisitorBase {
  public:
   WriteVisitor(const size_t extension_bits, BitWriter* JXL_RESTRICT writer)
       : extension_bits_(extension_bits), writer_(writer) {}
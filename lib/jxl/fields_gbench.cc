@@ -0,0 +1,71 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/aux_out.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/fields.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/headers.h"
+#include "lib/jxl/image_metadata.h"
+
+namespace jxl {
+namespace {
+
+// Metadata of a typical animation; its frame headers are mostly default, but
+// not all-default, so nested bundles are visited.
+void SetAnimationMetadata(CodecMetadata* metadata) {
+  JXL_CHECK(metadata->size.Set(640, 480));
+  metadata->m.xyb_encoded = true;
+  metadata->m.SetUintSamples(8);
+  metadata->m.have_animation = true;
+  metadata->m.animation.tps_numerator = 30;
+}
+
+void BM_ReadFrameHeader(benchmark::State& state) {
+  CodecMetadata metadata;
+  SetAnimationMetadata(&metadata);
+  FrameHeader frame_header(&metadata);
+  frame_header.animation_frame.duration = 3;
+  frame_header.is_last = false;
+  frame_header.loop_filter.gab = false;
+  BitWriter writer;
+  JXL_CHECK(WriteFrameHeader(frame_header, &writer, nullptr));
+  writer.ZeroPadToByte();
+
+  for (auto _ : state) {
+    // Constructed inside the loop like in the decoder, which creates a new
+    // FrameHeader for every frame.
+    FrameHeader decoded(&metadata);
+    BitReader reader(writer.GetSpan());
+    JXL_CHECK(ReadFrameHeader(&reader, &decoded));
+    JXL_CHECK(reader.Close());
+    benchmark::DoNotOptimize(decoded.animation_frame.duration);
+  }
+}
+BENCHMARK(BM_ReadFrameHeader);
+
+void BM_ReadImageHeaders(benchmark::State& state) {
+  CodecMetadata metadata;
+  SetAnimationMetadata(&metadata);
+  BitWriter writer;
+  JXL_CHECK(WriteSizeHeader(metadata.size, &writer, 0, nullptr));
+  JXL_CHECK(WriteImageMetadata(metadata.m, &writer, 0, nullptr));
+  writer.ZeroPadToByte();
+
+  CodecMetadata decoded;
+  for (auto _ : state) {
+    BitReader reader(writer.GetSpan());
+    JXL_CHECK(ReadSizeHeader(&reader, &decoded.size));
+    JXL_CHECK(ReadImageMetadata(&reader, &decoded.m));
+    JXL_CHECK(reader.Close());
+    benchmark::DoNotOptimize(decoded.m.xyb_encoded);
+  }
+}
+BENCHMARK(BM_ReadImageHeaders);
+
+}  // namespace
+}  // namespace jxl
@@ -278,6 +278,51 @@ TEST(FieldsTest, TestRoundtripFrame) {
 }
 
 #ifndef JXL_CRASH_ON_ERROR
+// Ensures every truncation of a frame header is reported as not enough bytes
+// rather than another error, which the decoder relies on to request more input.
+TEST(FieldsTest, TestTruncatedFrame) {
+  CodecMetadata metadata;
+  metadata.m.have_animation = true;
+  FrameHeader h(&metadata);
+  h.is_last = false;
+  h.animation_frame.duration = 5;
+  h.loop_filter.gab = false;
+  h.loop_filter.epf_iters = 2;
+
+  size_t extension_bits, total_bits;
+  ASSERT_TRUE(Bundle::CanEncode(h, &extension_bits, &total_bits));
+  BitWriter writer;
+  ASSERT_TRUE(WriteFrameHeader(h, &writer, nullptr));
+  writer.ZeroPadToByte();
+  const Span<const uint8_t> bytes = writer.GetSpan();
+
+  for (size_t size = 0; size * kBitsPerByte < total_bits; size++) {
+    const Span<const uint8_t> truncated(bytes.data(), size);
+    {
+      FrameHeader h2(&metadata);
+      BitReader reader(truncated);
+      EXPECT_FALSE(Bundle::CanRead(&reader, &h2));
+      (void)reader.Close();
+    }
+    {
+      FrameHeader h2(&metadata);
+      BitReader reader(truncated);
+      const Status status = ReadFrameHeader(&reader, &h2);
+      EXPECT_EQ(StatusCode::kNotEnoughBytes, status.code());
+      (void)reader.Close();
+    }
+  }
+
+  FrameHeader h2(&metadata);
+  BitReader reader(bytes);
+  ASSERT_TRUE(ReadFrameHeader(&reader, &h2));
+  EXPECT_TRUE(reader.Close());
+  EXPECT_EQ(h.is_last, h2.is_last);
+  EXPECT_EQ(h.animation_frame.duration, h2.animation_frame.duration);
+  EXPECT_EQ(h.loop_filter.gab, h2.loop_filter.gab);
+  EXPECT_EQ(h.loop_filter.epf_iters, h2.loop_filter.epf_iters);
+}
+
 // Ensure out-of-bounds values cause an error.
 TEST(FieldsTest, TestOutOfRange) {
   SizeHeader h;
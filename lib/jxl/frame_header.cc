@@ -132,6 +132,37 @@ Status Passes::VisitFields(Visitor* JXL_RESTRICT visitor) {
 
   return true;
 }
+
+ModularRowIndex::ModularRowIndex() { Bundle::Init(this); }
+
+Status ModularRowIndex::VisitFields(Visitor* JXL_RESTRICT visitor) {
+  JXL_QUIET_RETURN_IF_ERROR(visitor->Bool(false, &per_channel));
+  uint32_t num_rows = static_cast<uint32_t>(bit_offsets.size());
+  JXL_QUIET_RETURN_IF_ERROR(visitor->U32(Val(0), BitsOffset(10, 1),
+                                         BitsOffset(14, 1025),
+                                         BitsOffset(20, 17409), 0, &num_rows));
+  bool has_ans_states = !ans_states.empty();
+  JXL_QUIET_RETURN_IF_ERROR(visitor->Bool(true, &has_ans_states));
+  if (visitor->IsReading()) {
+    bit_offsets.resize(num_rows);
+    ans_states.resize(has_ans_states ? num_rows : 0);
+  }
+  // Rows are in bitstream order, so only the differences are stored.
+  uint64_t offset = 0;
+  for (size_t i = 0; i < num_rows; i++) {
+    uint64_t delta = bit_offsets[i] - offset;
+    JXL_QUIET_RETURN_IF_ERROR(visitor->U64(0, &delta));
+    if (!SafeAdd(offset, delta, offset)) {
+      return JXL_FAILURE("Invalid modular row index");
+    }
+    bit_offsets[i] = offset;
+    if (visitor->Conditional(has_ans_states)) {
+      JXL_QUIET_RETURN_IF_ERROR(visitor->Bits(32, 0, &ans_states[i]));
+    }
+  }
+  return true;
+}
+
 FrameHeader::FrameHeader(const CodecMetadata* metadata)
     : animation_frame(metadata), nonserialized_metadata(metadata) {
   Bundle::Init(this);
@@ -370,6 +401,9 @@ Status FrameHeader::VisitFields(Visitor* JXL_RESTRICT visitor) {
 
   JXL_QUIET_RETURN_IF_ERROR(visitor->BeginExtensions(&extensions));
   // Extensions: in chronological order of being added to the format.
+  if (visitor->Conditional(extensions & kModularRowIndex)) {
+    JXL_QUIET_RETURN_IF_ERROR(visitor->VisitNested(&modular_row_index));
+  }
   return visitor->EndExtensions();
 }
 
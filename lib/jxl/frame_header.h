@@ -13,6 +13,7 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 #include "lib/jxl/aux_out_fwd.h"
 #include "lib/jxl/base/compiler_specific.h"
@@ -291,6 +292,25 @@ struct Passes : public Fields {
   uint32_t shift[kMaxNumPasses];
 };
 
+// Where the first symbol of each row of the global modular stream is, for the
+// channels that the stream codes (in order, skipping empty channels). This
+// allows decoding rows concurrently. Only for streams without LZ77.
+struct ModularRowIndex : public Fields {
+  ModularRowIndex();
+  const char* Name() const override { return "ModularRowIndex"; }
+
+  Status VisitFields(Visitor* JXL_RESTRICT visitor) override;
+
+  // If true, the entries are for the first row of each coded channel instead
+  // of for every row.
+  bool per_channel;
+  // Number of bits from the end of the initial ANS state (or from the first
+  // symbol for prefix codes) to the first symbol of each row.
+  std::vector<uint64_t> bit_offsets;
+  // ANS state before the first symbol of each row; empty for prefix codes.
+  std::vector<uint32_t> ans_states;
+};
+
 enum FrameType {
   // A "regular" frame: might be a crop, and will be blended on a previous
   // frame, if any, and displayed or blended in future frames.
@@ -473,7 +493,15 @@ struct FrameHeader : public Fields {
            frame_type == FrameType::kSkipProgressive;
   }
 
+  // Bits of `extensions`.
+  enum Extensions : uint64_t {
+    kModularRowIndex = 1,
+  };
+
   uint64_t extensions;
+
+  // Only if extensions & kModularRowIndex.
+  ModularRowIndex modular_row_index;
 };
 
 Status ReadFrameHeader(BitReader* JXL_RESTRICT reader,
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "lib/jxl/base/bits.h"
+#include "lib/jxl/base/byte_order.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/jpeg/dec_jpeg_serialization_state.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
@@ -97,12 +98,9 @@ static JXL_INLINE void DischargeBitBuffer(JpegBitWriter* bw) {
     EmitByte(bw, (bw->put_buffer >> 16) & 0xFF);
   } else {
     // We don't have any 0xFF bytes, output all 6 bytes without checking.
-    bw->data[bw->pos] = (bw->put_buffer >> 56) & 0xFF;
-    bw->data[bw->pos + 1] = (bw->put_buffer >> 48) & 0xFF;
-    bw->data[bw->pos + 2] = (bw->put_buffer >> 40) & 0xFF;
-    bw->data[bw->pos + 3] = (bw->put_buffer >> 32) & 0xFF;
-    bw->data[bw->pos + 4] = (bw->put_buffer >> 24) & 0xFF;
-    bw->data[bw->pos + 5] = (bw->put_buffer >> 16) & 0xFF;
+    // Reserve() above leaves room for a whole 8-byte store; the 2 extra bytes
+    // are overwritten by the next write.
+    StoreBE64(bw->put_buffer, bw->data + bw->pos);
     bw->pos += 6;
   }
   bw->put_buffer <<= 48;
@@ -464,6 +462,52 @@ bool EncodeInterMarkerData(const JPEGData& jpg, SerializationState* state) {
   return true;
 }
 
+// Writes the Huffman code of `symbol` followed by the `nbits` low bits of
+// `bits`, with a single WriteBits call when they fit in it together.
+static JXL_INLINE void WriteSymbolAndBits(JpegBitWriter* bw,
+                                          const HuffmanCodeTable& huff,
+                                          int symbol, int nbits,
+                                          uint32_t bits) {
+  const int depth = huff.depth[symbol];
+  const uint32_t masked_bits = bits & ((1u << nbits) - 1);
+  if (depth > 0 && depth + nbits <= 16) {
+    WriteBits(bw, depth + nbits, (huff.code[symbol] << nbits) | masked_bits);
+    return;
+  }
+  WriteBits(bw, depth, huff.code[symbol]);
+  if (nbits > 0) WriteBits(bw, nbits, masked_bits);
+}
+
+// Returns a 64-bit mask whose bit k is set if and only if the coefficient at
+// zig-zag position k is non-zero. Four coefficients are compared to zero at a
+// time, in the lanes of a 64-bit word.
+static JXL_INLINE uint64_t NonZeroMask(const coeff_t* coeffs) {
+  constexpr uint64_t kLowBits = 0x7FFF7FFF7FFF7FFFULL;
+  constexpr uint64_t kHighBits = 0x8000800080008000ULL;
+  uint64_t mask = 0;
+  for (size_t k = 0; k < 64; k += 4) {
+    const uint64_t lanes =
+        static_cast<uint16_t>(coeffs[kJPEGNaturalOrder[k]]) |
+        (static_cast<uint64_t>(
+             static_cast<uint16_t>(coeffs[kJPEGNaturalOrder[k + 1]]))
+         << 16) |
+        (static_cast<uint64_t>(
+             static_cast<uint16_t>(coeffs[kJPEGNaturalOrder[k + 2]]))
+         << 32) |
+        (static_cast<uint64_t>(
+             static_cast<uint16_t>(coeffs[kJPEGNaturalOrder[k + 3]]))
+         << 48);
+    // The high bit of each lane is set iff the lane is non-zero.
+    const uint64_t non_zero = (((lanes & kLowBits) + kLowBits) | lanes) &
+                              kHighBits;
+    // Gather the high bits of the four lanes into bits 48 to 51.
+    const uint64_t bits =
+        ((non_zero >> 15) * 0x0001000200040008ULL >> 48) & 0xF;
+    mask |= bits << k;
+  }
+  return mask;
+}
+
 bool EncodeDCTBlockSequential(const coeff_t* coeffs,
                               const HuffmanCodeTable& dc_huff,
                               const HuffmanCodeTable& ac_huff,
@@ -480,17 +524,20 @@ bool EncodeDCTBlockSequential(const coeff_t* coeffs,
     temp2--;
   }
   int dc_nbits = (temp == 0) ? 0 : (FloorLog2Nonzero<uint32_t>(temp) + 1);
-  WriteBits(bw, dc_huff.depth[dc_nbits], dc_huff.code[dc_nbits]);
-  if (dc_nbits >= 12) return false;
-  if (dc_nbits > 0) {
-    WriteBits(bw, dc_nbits, temp2 & ((1u << dc_nbits) - 1));
+  if (dc_nbits >= 12) {
+    WriteBits(bw, dc_huff.depth[dc_nbits], dc_huff.code[dc_nbits]);
+    return false;
   }
-  int r = 0;
-  for (int k = 1; k < 64; ++k) {
-    if ((temp = coeffs[kJPEGNaturalOrder[k]]) == 0) {
-      r++;
-      continue;
-    }
+  WriteSymbolAndBits(bw, dc_huff, dc_nbits, dc_nbits, temp2);
+  // Visit the non-zero AC coefficients only, in zig-zag order.
+  uint64_t non_zero = NonZeroMask(coeffs) & ~uint64_t{1};
+  int last_k = 0;
+  while (non_zero != 0) {
+    const int k = Num0BitsBelowLS1Bit_Nonzero(non_zero);
+    non_zero &= non_zero - 1;
+    int r = k - last_k - 1;
+    last_k = k;
+    temp = coeffs[kJPEGNaturalOrder[k]];
     if (temp < 0) {
       temp = -temp;
       temp2 = ~temp;
@@ -504,10 +551,9 @@ bool EncodeDCTBlockSequential(const coeff_t* coeffs,
     int ac_nbits = FloorLog2Nonzero<uint32_t>(temp) + 1;
     if (ac_nbits >= 16) return false;
     int symbol = (r << 4u) + ac_nbits;
-    WriteBits(bw, ac_huff.depth[symbol], ac_huff.code[symbol]);
-    WriteBits(bw, ac_nbits, temp2 & ((1 << ac_nbits) - 1));
-    r = 0;
+    WriteSymbolAndBits(bw, ac_huff, symbol, ac_nbits, temp2);
   }
+  int r = 63 - last_k;
   for (int i = 0; i < num_zero_runs; ++i) {
     WriteBits(bw, ac_huff.depth[0xf0], ac_huff.code[0xf0]);
     r -= 16;
@@ -285,14 +285,15 @@ Status EncodeJPEGData(JPEGData& jpeg_data, PaddedBytes* bytes) {
   return true;
 }
 
-Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io) {
+Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool) {
   io->frames.clear();
   io->frames.reserve(1);
   io->frames.emplace_back(&io->metadata.m);
   io->Main().jpeg_data = make_unique<jpeg::JPEGData>();
   jpeg::JPEGData* jpeg_data = io->Main().jpeg_data.get();
   if (!jpeg::ReadJpeg(bytes.data(), bytes.size(), jpeg::JpegReadMode::kReadAll,
-                      jpeg_data)) {
+                      jpeg_data, pool)) {
     return JXL_FAILURE("Error reading JPEG");
   }
   JXL_RETURN_IF_ERROR(
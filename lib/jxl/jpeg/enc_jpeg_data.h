@@ -6,6 +6,7 @@
 #ifndef LIB_JXL_JPEG_ENC_JPEG_DATA_H_
 #define LIB_JXL_JPEG_ENC_JPEG_DATA_H_
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
@@ -19,9 +20,11 @@ Status SetColorEncodingFromJpegData(const jpeg::JPEGData& jpg,
 
 /**
  * Decodes bytes containing JPEG codestream into a CodecInOut as coefficients
- * only, for lossless JPEG transcoding.
+ * only, for lossless JPEG transcoding. The optional pool is used to
+ * Huffman-decode the scans concurrently.
  */
-Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io);
+Status DecodeImageJPG(const Span<const uint8_t> bytes, CodecInOut* io,
+                      ThreadPool* pool = nullptr);
 }  // namespace jpeg
 }  // namespace jxl
 
@@ -12,6 +12,7 @@
 #include <string>
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/jpeg/enc_jpeg_huffman_decode.h"
@@ -476,16 +477,17 @@ struct BitReaderState {
   // Enqueue the padding bits seen (0 or 1).
   // Returns false if there is inconsistent or invalid padding or the stream
   // ended too early.
-  bool FinishStream(JPEGData* jpg, size_t* pos) {
+  bool FinishStream(std::vector<uint8_t>* padding_bits,
+                    bool* has_zero_padding_bit, size_t* pos) {
     int npadbits = bits_left_ & 7;
     if (npadbits > 0) {
       uint64_t padmask = (1ULL << npadbits) - 1;
       uint64_t padbits = (val_ >> (bits_left_ - npadbits)) & padmask;
       if (padbits != padmask) {
-        jpg->has_zero_padding_bit = true;
+        *has_zero_padding_bit = true;
       }
       for (int i = npadbits - 1; i >= 0; --i) {
-        jpg->padding_bits.push_back((padbits >> i) & 1);
+        padding_bits->push_back((padbits >> i) & 1);
       }
     }
     // Give back some bytes that we did not use.
@@ -578,8 +580,8 @@ int HuffExtend(int x, int s) {
 bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
                     const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
                     int* eobrun, bool* reset_state, int* num_zero_runs,
-                    BitReaderState* br, JPEGData* jpg, coeff_t* last_dc_coeff,
-                    coeff_t* coeffs) {
+                    BitReaderState* br, JPEGReadError* error,
+                    coeff_t* last_dc_coeff, coeff_t* coeffs) {
   // Nowadays multiplication is even faster than variable shift.
   int Am = 1 << Al;
   bool eobrun_allowed = Ss > 0;
@@ -587,7 +589,7 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
     int s = ReadSymbol(dc_huff, br);
     if (s >= kJpegDCAlphabetSize) {
       JXL_JPEG_DEBUG("Invalid Huffman symbol %d  for DC coefficient.", s);
-      jpg->error = JPEGReadError::INVALID_SYMBOL;
+      *error = JPEGReadError::INVALID_SYMBOL;
       return false;
     }
     int diff = 0;
@@ -601,7 +603,7 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
     // TODO(eustas): is there a more elegant / explicit way to check this?
     if (dc_coeff != coeffs[0]) {
       JXL_JPEG_DEBUG("Invalid DC coefficient %d", dc_coeff);
-      jpg->error = JPEGReadError::NON_REPRESENTABLE_DC_COEFF;
+      *error = JPEGReadError::NON_REPRESENTABLE_DC_COEFF;
       return false;
     }
     *last_dc_coeff = coeff;
@@ -619,7 +621,7 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
     int sr = ReadSymbol(ac_huff, br);
     if (sr >= kJpegHuffmanAlphabetSize) {
       JXL_JPEG_DEBUG("Invalid Huffman symbol %d for AC coefficient %d", sr, k);
-      jpg->error = JPEGReadError::INVALID_SYMBOL;
+      *error = JPEGReadError::INVALID_SYMBOL;
       return false;
     }
     int r = sr >> 4;
@@ -628,14 +630,14 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
       k += r;
       if (k > Se) {
         JXL_JPEG_DEBUG("Out-of-band coefficient %d band was %d-%d", k, Ss, Se);
-        jpg->error = JPEGReadError::OUT_OF_BAND_COEFF;
+        *error = JPEGReadError::OUT_OF_BAND_COEFF;
         return false;
       }
       if (s + Al >= kJpegDCAlphabetSize) {
         JXL_JPEG_DEBUG(
             "Out of range AC coefficient value: s = %d Al = %d k = %d", s, Al,
             k);
-        jpg->error = JPEGReadError::NON_REPRESENTABLE_AC_COEFF;
+        *error = JPEGReadError::NON_REPRESENTABLE_AC_COEFF;
         return false;
       }
       int bits = br->ReadBits(s);
@@ -655,7 +657,7 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
       if (r > 0) {
         if (!eobrun_allowed) {
           JXL_JPEG_DEBUG("End-of-block run crossing DC coeff.");
-          jpg->error = JPEGReadError::EOB_RUN_TOO_LONG;
+          *error = JPEGReadError::EOB_RUN_TOO_LONG;
           return false;
         }
         *eobrun += br->ReadBits(r);
@@ -669,7 +671,7 @@ bool DecodeDCTBlock(const HuffmanTableEntry* dc_huff,
 
 bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
                     int* eobrun, bool* reset_state, BitReaderState* br,
-                    JPEGData* jpg, coeff_t* coeffs) {
+                    JPEGReadError* error, coeff_t* coeffs) {
   // Nowadays multiplication is even faster than variable shift.
   int Am = 1 << Al;
   bool eobrun_allowed = Ss > 0;
@@ -694,7 +696,7 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
       s = ReadSymbol(ac_huff, br);
       if (s >= kJpegHuffmanAlphabetSize) {
         JXL_JPEG_DEBUG("Invalid Huffman symbol %d for AC coefficient %d", s, k);
-        jpg->error = JPEGReadError::INVALID_SYMBOL;
+        *error = JPEGReadError::INVALID_SYMBOL;
         return false;
       }
       r = s >> 4;
@@ -703,7 +705,7 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
         if (s != 1) {
           JXL_JPEG_DEBUG("Invalid Huffman symbol %d for AC coefficient %d", s,
                          k);
-          jpg->error = JPEGReadError::INVALID_SYMBOL;
+          *error = JPEGReadError::INVALID_SYMBOL;
           return false;
         }
         s = br->ReadBits(1) ? p1 : m1;
@@ -719,7 +721,7 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
           if (r > 0) {
             if (!eobrun_allowed) {
               JXL_JPEG_DEBUG("End-of-block run crossing DC coeff.");
-              jpg->error = JPEGReadError::EOB_RUN_TOO_LONG;
+              *error = JPEGReadError::EOB_RUN_TOO_LONG;
               return false;
             }
             *eobrun += br->ReadBits(r);
@@ -752,7 +754,7 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
         if (k > Se) {
           JXL_JPEG_DEBUG("Out-of-band coefficient %d band was %d-%d", k, Ss,
                          Se);
-          jpg->error = JPEGReadError::OUT_OF_BAND_COEFF;
+          *error = JPEGReadError::OUT_OF_BAND_COEFF;
           return false;
         }
         coeffs[kJPEGNaturalOrder[k]] = s;
@@ -761,7 +763,7 @@ bool RefineDCTBlock(const HuffmanTableEntry* ac_huff, int Ss, int Se, int Al,
   }
   if (in_zero_run) {
     JXL_JPEG_DEBUG("Extra zero run before end-of-block.");
-    jpg->error = JPEGReadError::EXTRA_ZERO_RUN;
+    *error = JPEGReadError::EXTRA_ZERO_RUN;
     return false;
   }
   if (*eobrun > 0) {
@@ -789,7 +791,8 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
                     int* next_restart_marker, BitReaderState* br,
                     JPEGData* jpg) {
   size_t pos = 0;
-  if (!br->FinishStream(jpg, &pos)) {
+  if (!br->FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit,
+                        &pos)) {
     jpg->error = JPEGReadError::INVALID_SCAN;
     return false;
   }
@@ -808,15 +811,41 @@ bool ProcessRestart(const uint8_t* data, const size_t len,
   return true;
 }
 
-bool ProcessScan(const uint8_t* data, const size_t len,
-                 const std::vector<HuffmanTableEntry>& dc_huff_lut,
-                 const std::vector<HuffmanTableEntry>& ac_huff_lut,
-                 uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
-                 bool is_progressive, size_t* pos, JPEGData* jpg) {
+// Parameters of a scan that are known once its SOS marker segment is read.
+struct ScanParams {
+  // Index of the scan in jpg->scan_info.
+  size_t scan_index;
+  bool is_interleaved;
+  int MCU_rows;
+  int MCUs_per_row;
+  // Number of blocks in each MCU.
+  int blocks_per_MCU;
+  int Al;
+  int Ah;
+  int Ss;
+  int Se;
+  uint32_t restart_interval;
+
+  size_t num_MCUs() const {
+    return static_cast<size_t>(MCU_rows) * MCUs_per_row;
+  }
+  // Number of entropy-coded segments, separated by restart markers.
+  size_t num_segments() const {
+    if (restart_interval == 0 || num_MCUs() == 0) return 1;
+    return DivCeil(num_MCUs(), restart_interval);
+  }
+};
+
+// Reads the SOS marker segment and checks the scan against the previous ones.
+bool StartScan(const uint8_t* data, const size_t len,
+               uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
+               bool is_progressive, size_t* pos, JPEGData* jpg,
+               ScanParams* params) {
   if (!ProcessSOS(data, len, pos, jpg)) {
     return false;
   }
-  JPEGScanInfo* scan_info = &jpg->scan_info.back();
+  params->scan_index = jpg->scan_info.size() - 1;
+  const JPEGScanInfo* scan_info = &jpg->scan_info.back();
   bool is_interleaved = (scan_info->num_components > 1);
   int max_h_samp_factor = 1;
   int max_v_samp_factor = 1;
@@ -829,17 +858,16 @@ bool ProcessScan(const uint8_t* data, const size_t len,
 
   int MCU_rows = DivCeil(jpg->height, max_v_samp_factor * 8);
   int MCUs_per_row = DivCeil(jpg->width, max_h_samp_factor * 8);
+  int blocks_per_MCU = 0;
+  for (size_t i = 0; i < scan_info->num_components; ++i) {
+    const JPEGComponent& c = jpg->components[scan_info->components[i].comp_idx];
+    blocks_per_MCU += is_interleaved ? c.h_samp_factor * c.v_samp_factor : 1;
+  }
   if (!is_interleaved) {
     const JPEGComponent& c = jpg->components[scan_info->components[0].comp_idx];
     MCUs_per_row = DivCeil(jpg->width * c.h_samp_factor, 8 * max_h_samp_factor);
     MCU_rows = DivCeil(jpg->height * c.v_samp_factor, 8 * max_v_samp_factor);
   }
-  coeff_t last_dc_coeff[kMaxComponents] = {0};
-  BitReaderState br(data, len, *pos);
-  int restarts_to_go = jpg->restart_interval;
-  int next_restart_marker = 0;
-  int eobrun = -1;
-  int block_scan_index = 0;
   const int Al = is_progressive ? scan_info->Al : 0;
   const int Ah = is_progressive ? scan_info->Ah : 0;
   const int Ss = is_progressive ? scan_info->Ss : 0;
@@ -872,77 +900,127 @@ bool ProcessScan(const uint8_t* data, const size_t len,
     jpg->error = JPEGReadError::NON_REPRESENTABLE_AC_COEFF;
     return false;
   }
-  for (int mcu_y = 0; mcu_y < MCU_rows; ++mcu_y) {
-    for (int mcu_x = 0; mcu_x < MCUs_per_row; ++mcu_x) {
-      // Handle the restart intervals.
-      if (jpg->restart_interval > 0) {
-        if (restarts_to_go == 0) {
-          if (ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
-            restarts_to_go = jpg->restart_interval;
-            memset(static_cast<void*>(last_dc_coeff), 0, sizeof(last_dc_coeff));
-            if (eobrun > 0) {
-              JXL_JPEG_DEBUG("End-of-block run too long.");
-              jpg->error = JPEGReadError::EOB_RUN_TOO_LONG;
+  params->is_interleaved = is_interleaved;
+  params->MCU_rows = MCU_rows;
+  params->MCUs_per_row = MCUs_per_row;
+  params->blocks_per_MCU = blocks_per_MCU;
+  params->Al = Al;
+  params->Ah = Ah;
+  params->Ss = Ss;
+  params->Se = Se;
+  params->restart_interval = jpg->restart_interval;
+  return true;
+}
+
+// Decodes the MCUs [MCU_begin, MCU_end) of a scan, which must all be in the
+// same restart interval, starting from a fresh decoder state. Reset points and
+// extra zero runs are appended to the given vectors. The end-of-band run left
+// at the end is stored in *eobrun, to be checked by the caller.
+bool DecodeMCUs(const ScanParams& params, const JPEGScanInfo& scan_info,
+                const HuffmanTableEntry* dc_huff_lut,
+                const HuffmanTableEntry* ac_huff_lut, size_t MCU_begin,
+                size_t MCU_end, BitReaderState* br,
+                std::vector<JPEGComponent>* components,
+                std::vector<uint32_t>* reset_points,
+                std::vector<JPEGScanInfo::ExtraZeroRunInfo>* extra_zero_runs,
+                int* eobrun, JPEGReadError* error) {
+  coeff_t last_dc_coeff[kMaxComponents] = {0};
+  *eobrun = -1;  // fresh start
+  size_t block_scan_index = MCU_begin * params.blocks_per_MCU;
+  for (size_t MCU = MCU_begin; MCU < MCU_end; ++MCU) {
+    const int mcu_y = MCU / params.MCUs_per_row;
+    const int mcu_x = MCU % params.MCUs_per_row;
+    // Decode one MCU.
+    for (size_t i = 0; i < scan_info.num_components; ++i) {
+      const JPEGComponentScanInfo* si = &scan_info.components[i];
+      JPEGComponent* c = &(*components)[si->comp_idx];
+      const HuffmanTableEntry* dc_lut =
+          &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
+      const HuffmanTableEntry* ac_lut =
+          &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
+      int nblocks_y = params.is_interleaved ? c->v_samp_factor : 1;
+      int nblocks_x = params.is_interleaved ? c->h_samp_factor : 1;
+      for (int iy = 0; iy < nblocks_y; ++iy) {
+        for (int ix = 0; ix < nblocks_x; ++ix) {
+          int block_y = mcu_y * nblocks_y + iy;
+          int block_x = mcu_x * nblocks_x + ix;
+          int block_idx = block_y * c->width_in_blocks + block_x;
+          bool reset_state = false;
+          int num_zero_runs = 0;
+          coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
+          if (params.Ah == 0) {
+            if (!DecodeDCTBlock(dc_lut, ac_lut, params.Ss, params.Se,
+                                params.Al, eobrun, &reset_state,
+                                &num_zero_runs, br, error,
+                                &last_dc_coeff[si->comp_idx], coeffs)) {
               return false;
             }
-            eobrun = -1;  // fresh start
           } else {
-            return false;
-          }
-        }
-        --restarts_to_go;
-      }
-      // Decode one MCU.
-      for (size_t i = 0; i < scan_info->num_components; ++i) {
-        JPEGComponentScanInfo* si = &scan_info->components[i];
-        JPEGComponent* c = &jpg->components[si->comp_idx];
-        const HuffmanTableEntry* dc_lut =
-            &dc_huff_lut[si->dc_tbl_idx * kJpegHuffmanLutSize];
-        const HuffmanTableEntry* ac_lut =
-            &ac_huff_lut[si->ac_tbl_idx * kJpegHuffmanLutSize];
-        int nblocks_y = is_interleaved ? c->v_samp_factor : 1;
-        int nblocks_x = is_interleaved ? c->h_samp_factor : 1;
-        for (int iy = 0; iy < nblocks_y; ++iy) {
-          for (int ix = 0; ix < nblocks_x; ++ix) {
-            int block_y = mcu_y * nblocks_y + iy;
-            int block_x = mcu_x * nblocks_x + ix;
-            int block_idx = block_y * c->width_in_blocks + block_x;
-            bool reset_state = false;
-            int num_zero_runs = 0;
-            coeff_t* coeffs = &c->coeffs[block_idx * kDCTBlockSize];
-            if (Ah == 0) {
-              if (!DecodeDCTBlock(dc_lut, ac_lut, Ss, Se, Al, &eobrun,
-                                  &reset_state, &num_zero_runs, &br, jpg,
-                                  &last_dc_coeff[si->comp_idx], coeffs)) {
-                return false;
-              }
-            } else {
-              if (!RefineDCTBlock(ac_lut, Ss, Se, Al, &eobrun, &reset_state,
-                                  &br, jpg, coeffs)) {
-                return false;
-              }
-            }
-            if (reset_state) {
-              scan_info->reset_points.emplace_back(block_scan_index);
-            }
-            if (num_zero_runs > 0) {
-              JPEGScanInfo::ExtraZeroRunInfo info;
-              info.block_idx = block_scan_index;
-              info.num_extra_zero_runs = num_zero_runs;
-              scan_info->extra_zero_runs.push_back(info);
+            if (!RefineDCTBlock(ac_lut, params.Ss, params.Se, params.Al,
+                                eobrun, &reset_state, br, error, coeffs)) {
+              return false;
             }
-            ++block_scan_index;
           }
+          if (reset_state) {
+            reset_points->emplace_back(block_scan_index);
+          }
+          if (num_zero_runs > 0) {
+            JPEGScanInfo::ExtraZeroRunInfo info;
+            info.block_idx = block_scan_index;
+            info.num_extra_zero_runs = num_zero_runs;
+            extra_zero_runs->push_back(info);
+          }
+          ++block_scan_index;
         }
       }
     }
   }
+  return true;
+}
+
+bool ProcessScan(const uint8_t* data, const size_t len,
+                 const std::vector<HuffmanTableEntry>& dc_huff_lut,
+                 const std::vector<HuffmanTableEntry>& ac_huff_lut,
+                 uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
+                 bool is_progressive, size_t* pos, JPEGData* jpg) {
+  ScanParams params;
+  if (!StartScan(data, len, scan_progression, is_progressive, pos, jpg,
+                 &params)) {
+    return false;
+  }
+  JPEGScanInfo* scan_info = &jpg->scan_info[params.scan_index];
+  BitReaderState br(data, len, *pos);
+  int next_restart_marker = 0;
+  int eobrun = -1;
+  const size_t num_MCUs = params.num_MCUs();
+  const size_t MCUs_per_segment =
+      params.restart_interval > 0 ? params.restart_interval : num_MCUs;
+  for (size_t MCU = 0; MCU < num_MCUs; MCU += MCUs_per_segment) {
+    // Handle the restart intervals.
+    if (MCU > 0) {
+      if (!ProcessRestart(data, len, &next_restart_marker, &br, jpg)) {
+        return false;
+      }
+      if (eobrun > 0) {
+        JXL_JPEG_DEBUG("End-of-block run too long.");
+        jpg->error = JPEGReadError::EOB_RUN_TOO_LONG;
+        return false;
+      }
+    }
+    if (!DecodeMCUs(params, *scan_info, dc_huff_lut.data(),
+                    ac_huff_lut.data(), MCU,
+                    std::min(num_MCUs, MCU + MCUs_per_segment), &br,
+                    &jpg->components, &scan_info->reset_points,
+                    &scan_info->extra_zero_runs, &eobrun, &jpg->error)) {
+      return false;
+    }
+  }
   if (eobrun > 0) {
     JXL_JPEG_DEBUG("End-of-block run too long.");
     jpg->error = JPEGReadError::EOB_RUN_TOO_LONG;
     return false;
   }
-  if (!br.FinishStream(jpg, pos)) {
+  if (!br.FinishStream(&jpg->padding_bits, &jpg->has_zero_padding_bit, pos)) {
     jpg->error = JPEGReadError::INVALID_SCAN;
     return false;
   }
@@ -955,6 +1033,177 @@ bool ProcessScan(const uint8_t* data, const size_t len,
   return true;
 }
 
+// A scan whose entropy-coded data is only decoded once all the marker segments
+// have been read, concurrently with other scans; see ReadJpeg.
+struct DeferredScan {
+  ScanParams params;
+  // Huffman decoding tables in effect at the SOS marker.
+  std::vector<HuffmanTableEntry> dc_huff_lut;
+  std::vector<HuffmanTableEntry> ac_huff_lut;
+  // Position of the entropy-coded data of each restart interval, and of the
+  // marker that follows it.
+  std::vector<size_t> segment_begin;
+  std::vector<size_t> segment_end;
+};
+
+// Returns the position where BitReaderState stops reading the entropy-coded
+// data starting at `pos`: the next marker, or the last two bytes of the data.
+size_t FindEntropyCodedDataEnd(const uint8_t* data, const size_t len,
+                               size_t pos) {
+  const size_t end = len - 2;
+  while (pos < end) {
+    const void* ff = memchr(data + pos, 0xff, end - pos);
+    if (ff == nullptr) break;
+    pos = static_cast<const uint8_t*>(ff) - data;
+    if (data[pos + 1] != 0) return pos;
+    pos += 2;
+  }
+  return end;
+}
+
+// Reads the SOS marker segment and finds the restart intervals of the scan,
+// assuming that each of them ends right at the next marker (which the decoding
+// of the scan checks later), and skips to the end of the scan. Returns false
+// if the scan can not be decoded this way.
+bool DeferScan(const uint8_t* data, const size_t len,
+               const std::vector<HuffmanTableEntry>& dc_huff_lut,
+               const std::vector<HuffmanTableEntry>& ac_huff_lut,
+               uint16_t scan_progression[kMaxComponents][kDCTBlockSize],
+               bool is_progressive, size_t* pos, JPEGData* jpg,
+               std::vector<DeferredScan>* deferred_scans) {
+  DeferredScan scan;
+  if (!StartScan(data, len, scan_progression, is_progressive, pos, jpg,
+                 &scan.params)) {
+    return false;
+  }
+  const size_t num_segments = scan.params.num_segments();
+  size_t begin = *pos;
+  for (size_t i = 0; i < num_segments; ++i) {
+    if (begin + 2 > len) return false;
+    const size_t end = FindEntropyCodedDataEnd(data, len, begin);
+    if (i + 1 < num_segments && data[end + 1] != 0xd0 + (i & 7)) {
+      return false;
+    }
+    scan.segment_begin.push_back(begin);
+    scan.segment_end.push_back(end);
+    begin = end + 2;
+  }
+  *pos = scan.segment_end.back();
+  scan.dc_huff_lut = dc_huff_lut;
+  scan.ac_huff_lut = ac_huff_lut;
+  deferred_scans->push_back(std::move(scan));
+  return true;
+}
+
+// Whether two scans may update the same coefficients, and thus have to be
+// decoded in order.
+bool ScansOverlap(const JPEGScanInfo& a, const ScanParams& a_params,
+                  const JPEGScanInfo& b, const ScanParams& b_params) {
+  if (a_params.Se < b_params.Ss || b_params.Se < a_params.Ss) return false;
+  for (size_t i = 0; i < a.num_components; ++i) {
+    for (size_t j = 0; j < b.num_components; ++j) {
+      if (a.components[i].comp_idx == b.components[j].comp_idx) return true;
+    }
+  }
+  return false;
+}
+
+// Decodes the entropy-coded data of all the deferred scans. Restart intervals
+// of a scan, and scans that update different coefficients, are decoded
+// concurrently. Returns false if any scan fails to decode or does not end
+// where DeferScan assumed, without setting jpg->error.
+bool DecodeDeferredScans(const uint8_t* data, const size_t len,
+                         const std::vector<DeferredScan>& scans,
+                         ThreadPool* pool, JPEGData* jpg) {
+  // Decoding happens in rounds; each scan is decoded in the round after the
+  // last one of the earlier scans it overlaps with.
+  std::vector<size_t> round(scans.size());
+  size_t num_rounds = 0;
+  for (size_t i = 0; i < scans.size(); ++i) {
+    const JPEGScanInfo& scan_info = jpg->scan_info[scans[i].params.scan_index];
+    for (size_t j = 0; j < i; ++j) {
+      const JPEGScanInfo& prev_info =
+          jpg->scan_info[scans[j].params.scan_index];
+      if (ScansOverlap(scan_info, scans[i].params, prev_info,
+                       scans[j].params)) {
+        round[i] = std::max(round[i], round[j] + 1);
+      }
+    }
+    num_rounds = std::max(num_rounds, round[i] + 1);
+  }
+
+  struct SegmentOutput {
+    std::vector<uint32_t> reset_points;
+    std::vector<JPEGScanInfo::ExtraZeroRunInfo> extra_zero_runs;
+    std::vector<uint8_t> padding_bits;
+    bool has_zero_padding_bit = false;
+    bool ok = false;
+  };
+  std::vector<std::vector<SegmentOutput>> outputs(scans.size());
+  for (size_t i = 0; i < scans.size(); ++i) {
+    outputs[i].resize(scans[i].segment_begin.size());
+  }
+
+  std::vector<std::pair<size_t, size_t>> tasks;
+  for (size_t r = 0; r < num_rounds; ++r) {
+    tasks.clear();
+    for (size_t i = 0; i < scans.size(); ++i) {
+      if (round[i] != r) continue;
+      for (size_t k = 0; k < outputs[i].size(); ++k) {
+        tasks.emplace_back(i, k);
+      }
+    }
+    RunOnPool(
+        pool, 0, tasks.size(), ThreadPool::SkipInit(),
+        [&](const int task, const int /*thread*/) {
+          const DeferredScan& scan = scans[tasks[task].first];
+          const size_t segment = tasks[task].second;
+          SegmentOutput* output = &outputs[tasks[task].first][segment];
+          const size_t MCUs_per_segment = scan.params.restart_interval > 0
+                                              ? scan.params.restart_interval
+                                              : scan.params.num_MCUs();
+          const size_t MCU_begin = segment * MCUs_per_segment;
+          const size_t MCU_end = std::min(scan.params.num_MCUs(),
+                                          MCU_begin + MCUs_per_segment);
+          BitReaderState br(data, len, scan.segment_begin[segment]);
+          int eobrun;
+          JPEGReadError error;
+          size_t end;
+          output->ok =
+              DecodeMCUs(scan.params, jpg->scan_info[scan.params.scan_index],
+                         scan.dc_huff_lut.data(), scan.ac_huff_lut.data(),
+                         MCU_begin, MCU_end, &br, &jpg->components,
+                         &output->reset_points, &output->extra_zero_runs,
+                         &eobrun, &error) &&
+              eobrun <= 0 &&
+              br.FinishStream(&output->padding_bits,
+                              &output->has_zero_padding_bit, &end) &&
+              end == scan.segment_end[segment];
+        },
+        "DecodeJpegScans");
+    for (const auto& task : tasks) {
+      if (!outputs[task.first][task.second].ok) return false;
+    }
+  }
+
+  for (size_t i = 0; i < scans.size(); ++i) {
+    JPEGScanInfo* scan_info = &jpg->scan_info[scans[i].params.scan_index];
+    for (const SegmentOutput& output : outputs[i]) {
+      scan_info->reset_points.insert(scan_info->reset_points.end(),
+                                     output.reset_points.begin(),
+                                     output.reset_points.end());
+      scan_info->extra_zero_runs.insert(scan_info->extra_zero_runs.end(),
+                                        output.extra_zero_runs.begin(),
+                                        output.extra_zero_runs.end());
+      jpg->padding_bits.insert(jpg->padding_bits.end(),
+                               output.padding_bits.begin(),
+                               output.padding_bits.end());
+      jpg->has_zero_padding_bit |= output.has_zero_padding_bit;
+    }
+  }
+  return true;
+}
+
 // Changes the quant_idx field of the components to refer to the index of the
 // quant table in the jpg->quant array.
 bool FixupIndexes(JPEGData* jpg) {
@@ -994,10 +1243,11 @@ size_t FindNextMarker(const uint8_t* data, const size_t len, size_t pos) {
   return num_skipped;
 }
 
-}  // namespace
-
-bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg) {
+// Reads the JPEG stream. If deferred_scans is not null, the entropy-coded
+// data of the scans is skipped and described in *deferred_scans instead, and
+// false is returned for streams that DeferScan can not handle.
+bool ReadJpegImpl(const uint8_t* data, const size_t len, JpegReadMode mode,
+                  JPEGData* jpg, std::vector<DeferredScan>* deferred_scans) {
   size_t pos = 0;
   // Check SOI marker.
   JXL_JPEG_EXPECT_MARKER();
@@ -1056,8 +1306,14 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
         break;
       case 0xda:
         if (mode == JpegReadMode::kReadAll) {
-          ok = ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
-                           scan_progression, is_progressive, &pos, jpg);
+          if (deferred_scans != nullptr) {
+            ok = DeferScan(data, len, dc_huff_lut, ac_huff_lut,
+                           scan_progression, is_progressive, &pos, jpg,
+                           deferred_scans);
+          } else {
+            ok = ProcessScan(data, len, dc_huff_lut, ac_huff_lut,
+                             scan_progression, is_progressive, &pos, jpg);
+          }
         }
         break;
       case 0xdb:
@@ -1138,5 +1394,24 @@ bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
   return true;
 }
 
+}  // namespace
+
+bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
+              JPEGData* jpg, ThreadPool* pool) {
+  if (pool != nullptr && mode == JpegReadMode::kReadAll) {
+    // Any failure of the concurrent decoding (including streams with data
+    // that the scans do not account for) is handled by starting over with
+    // sequential decoding, which then also reports the exact error.
+    const JPEGData initial = *jpg;
+    std::vector<DeferredScan> deferred_scans;
+    if (ReadJpegImpl(data, len, mode, jpg, &deferred_scans) &&
+        DecodeDeferredScans(data, len, deferred_scans, pool, jpg)) {
+      return true;
+    }
+    *jpg = initial;
+  }
+  return ReadJpegImpl(data, len, mode, jpg, /*deferred_scans=*/nullptr);
+}
+
 }  // namespace jpeg
 }  // namespace jxl
@@ -11,6 +11,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/jpeg/jpeg_data.h"
 
 namespace jxl {
@@ -27,8 +28,10 @@ enum class JpegReadMode {
 // If mode is kReadHeader, it fills in only the image dimensions in *jpg.
 // Returns false if the data is not valid JPEG, or if it contains an unsupported
 // JPEG feature.
+// If a pool is given, restart intervals and scans that do not refine the same
+// coefficients are Huffman-decoded concurrently; the result is the same.
 bool ReadJpeg(const uint8_t* data, const size_t len, JpegReadMode mode,
-              JPEGData* jpg);
+              JPEGData* jpg, ThreadPool* pool = nullptr);
 
 }  // namespace jpeg
 }  // namespace jxl
@@ -6,7 +6,10 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -23,17 +26,25 @@
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/color_management.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_file.h"
+#include "lib/jxl/dec_frame.h"
 #include "lib/jxl/dec_params.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_butteraugli_comparator.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_file.h"
+#include "lib/jxl/enc_frame.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/image_test_utils.h"
+#include "lib/jxl/jpeg/dec_jpeg_data_writer.h"
 #include "lib/jxl/jpeg/enc_jpeg_data.h"
+#include "lib/jxl/jpeg/enc_jpeg_data_reader.h"
 #include "lib/jxl/modular/options.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testdata.h"
@@ -740,6 +751,89 @@ TEST(JxlTest, RoundtripAlpha) {
             1.4);
 }
 
+TEST(JxlTest, AlphaOnlyDecode) {
+  ThreadPoolInternal pool(4);
+  const PaddedBytes orig =
+      ReadTestData("wesaturate/500px/tmshre_riaphotographs_alpha.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+  ASSERT_TRUE(io.Main().HasAlpha());
+  io.ShrinkTo(300, 300);
+
+  CompressParams cparams;
+  cparams.butteraugli_distance = 1.0;
+  PassesEncoderState enc_state;
+  PaddedBytes compressed;
+  ASSERT_TRUE(
+      EncodeFile(cparams, &io, &enc_state, &compressed, nullptr, &pool));
+
+  DecompressParams dparams;
+  CodecInOut io_full;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &io_full, &pool));
+
+  dparams.alpha_only = true;
+  CodecInOut io_alpha;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &io_alpha, &pool));
+  ASSERT_TRUE(io_alpha.Main().HasAlpha());
+  EXPECT_EQ(io_full.xsize(), io_alpha.xsize());
+  EXPECT_EQ(io_full.ysize(), io_alpha.ysize());
+  VerifyRelativeError(*io_full.Main().alpha(), *io_alpha.Main().alpha(),
+                      1e-7f, 1e-7f);
+}
+
+TEST(JxlTest, AlphaOnlyDecodeWithoutACGlobal) {
+  ThreadPoolInternal pool(4);
+  const PaddedBytes orig =
+      ReadTestData("wesaturate/500px/tmshre_riaphotographs_alpha.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+  ASSERT_TRUE(io.Main().HasAlpha());
+  io.ShrinkTo(300, 300);
+
+  CompressParams cparams;
+  cparams.butteraugli_distance = 1.0;
+  PassesEncoderState enc_state;
+  BitWriter writer;
+  ASSERT_TRUE(EncodeFrame(cparams, FrameInfo{}, &io.metadata, io.Main(),
+                          &enc_state, &pool, &writer, /*aux_out=*/nullptr));
+  writer.ZeroPadToByte();
+  const PaddedBytes frame = std::move(writer).TakeBytes();
+
+  // Decode only the DC global and DC group sections, as for a partial file
+  // or a flush before the AC global section arrived: the groups are drawn
+  // from the DC.
+  PassesDecoderState dec_state;
+  ASSERT_TRUE(dec_state.output_encoding_info.Set(
+      io.metadata, ColorEncoding::LinearSRGB(/*is_gray=*/false)));
+  FrameDecoder frame_decoder(&dec_state, io.metadata, &pool);
+  frame_decoder.SetSkipColor(true);
+  BitReader reader(frame);
+  ImageBundle decoded(&io.metadata.m);
+  ASSERT_TRUE(frame_decoder.InitFrame(&reader, &decoded, /*is_preview=*/false,
+                                      /*allow_partial_frames=*/true,
+                                      /*allow_partial_dc_global=*/false));
+  const size_t toc_end = reader.TotalBitsConsumed() / kBitsPerByte;
+  const size_t num_dc_sections = 1 + dec_state.shared->frame_dim.num_dc_groups;
+  ASSERT_LT(num_dc_sections, frame_decoder.NumSections());
+  std::vector<std::unique_ptr<BitReader>> section_readers;
+  std::vector<FrameDecoder::SectionInfo> section_info;
+  for (size_t i = 0; i < num_dc_sections; i++) {
+    section_readers.emplace_back(make_unique<BitReader>(Span<const uint8_t>(
+        frame.data() + toc_end + frame_decoder.SectionOffsets()[i],
+        frame_decoder.SectionSizes()[i])));
+    section_info.push_back({section_readers.back().get(), i});
+  }
+  std::vector<FrameDecoder::SectionStatus> section_status(section_info.size());
+  ASSERT_TRUE(frame_decoder.ProcessSections(
+      section_info.data(), section_info.size(), section_status.data()));
+  ASSERT_TRUE(frame_decoder.FinalizeFrame());
+  for (auto& br : section_readers) EXPECT_TRUE(br->Close());
+  EXPECT_TRUE(reader.Close());
+  EXPECT_TRUE(decoded.HasAlpha());
+  EXPECT_EQ(decoded.xsize(), io.xsize());
+  EXPECT_EQ(decoded.ysize(), io.ysize());
+}
+
 TEST(JxlTest, RoundtripAlphaPremultiplied) {
   ThreadPool* pool = nullptr;
   const PaddedBytes orig =
@@ -1026,6 +1120,37 @@ TEST(JxlTest, JXL_SLOW_TEST(RoundtripLosslessNoEncoderVeryFastPathGradient)) {
                                      /*distmap=*/nullptr, &pool));
 }
 
+TEST(JxlTest, RoundtripLossless8HalfPrecision) {
+  ThreadPoolInternal pool(8);
+  const PaddedBytes orig =
+      ReadTestData("wesaturate/500px/tmshre_riaphotographs_srgb8.png");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, &pool));
+  io.ShrinkTo(300, 200);
+
+  CompressParams cparams = CParamsForLossless();
+  DecompressParams dparams;
+  dparams.half_precision_intermediates = true;
+
+  CodecInOut io2;
+  Roundtrip(&io, cparams, dparams, &pool, &io2);
+  // Not bit-exact in float, but binary16 is precise enough to round to the
+  // original 8-bit values.
+  size_t num_different = 0;
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < io.ysize(); y++) {
+      const float* row = io.Main().color()->ConstPlaneRow(c, y);
+      const float* row2 = io2.Main().color()->ConstPlaneRow(c, y);
+      for (size_t x = 0; x < io.xsize(); x++) {
+        if (std::round(row[x] * 255) != std::round(row2[x] * 255)) {
+          num_different++;
+        }
+      }
+    }
+  }
+  EXPECT_EQ(0u, num_different);
+}
+
 TEST(JxlTest, JXL_SLOW_TEST(RoundtripLossless8Falcon)) {
   ThreadPoolInternal pool(8);
   const PaddedBytes orig =
@@ -1333,8 +1458,144 @@ TEST(JxlTest, RoundtripLosslessAnimation) {
             5e-4);
 }
 
+TEST(JxlTest, StreamingAnimationDecode) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = ReadTestData("jxl/traffic_light.gif");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, pool));
+
+  CompressParams cparams = CParamsForLossless();
+  PassesEncoderState enc_state;
+  PaddedBytes compressed;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed, nullptr, pool));
+
+  size_t num_frames = 0;
+  ASSERT_TRUE(CountDisplayedFrames(Span<const uint8_t>(compressed),
+                                   &num_frames));
+  EXPECT_EQ(io.frames.size(), num_frames);
+
+  DecompressParams dparams;
+  CodecInOut io_full;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &io_full, pool));
+  ASSERT_EQ(num_frames, io_full.frames.size());
+
+  CodecInOut io_streamed;
+  size_t num_streamed = 0;
+  ASSERT_TRUE(DecodeFile(
+      dparams, Span<const uint8_t>(compressed), &io_streamed, pool,
+      [&](size_t index, ImageBundle* JXL_RESTRICT frame) -> Status {
+        EXPECT_EQ(num_streamed, index);
+        EXPECT_LE(io_streamed.frames.size(), 1);
+        EXPECT_TRUE(SamePixels(*io_full.frames[index].color(),
+                               *frame->color()));
+        ++num_streamed;
+        return true;
+      }));
+  EXPECT_EQ(num_frames, num_streamed);
+  EXPECT_EQ(1, io_streamed.frames.size());
+}
+
 #endif  // JPEGXL_ENABLE_GIF
 
+TEST(JxlTest, RoundtripACEntropyPreset) {
+  ThreadPoolInternal pool(4);
+  CompressParams cparams;
+  cparams.butteraugli_distance = 1.0;
+  const auto load = [&](const char* pathname, CodecInOut* io) {
+    const PaddedBytes orig = ReadTestData(pathname);
+    ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), io, &pool));
+    io->ShrinkTo(256, 256);
+  };
+  CodecInOut training[2];
+  load("wesaturate/500px/tmshre_riaphotographs_srgb8.png", &training[0]);
+  load("wesaturate/500px/cvo9xd_keong_macan_srgb8.png", &training[1]);
+  EntropyCodePreset preset;
+  ASSERT_TRUE(LearnACEntropyCodePreset(cparams, {&training[0], &training[1]},
+                                       &pool, &preset));
+
+  CodecInOut io;
+  load("wesaturate/500px/u76c0g_bliznaca_srgb8.png", &io);
+  PassesEncoderState enc_state;
+  PaddedBytes compressed;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed,
+                         /*aux_out=*/nullptr, &pool));
+  cparams.ac_entropy_preset = &preset;
+  PassesEncoderState preset_enc_state;
+  PaddedBytes preset_compressed;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &preset_enc_state, &preset_compressed,
+                         /*aux_out=*/nullptr, &pool));
+  // The AC histograms were clustered as in the preset.
+  for (const PassesEncoderState::PassData& pass : preset_enc_state.passes) {
+    EXPECT_EQ(preset.context_map, pass.context_map);
+  }
+
+  // Only the entropy coding differs.
+  DecompressParams dparams;
+  CodecInOut decoded;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &decoded, &pool));
+  CodecInOut preset_decoded;
+  ASSERT_TRUE(DecodeFile(dparams, preset_compressed, &preset_decoded, &pool));
+  EXPECT_TRUE(
+      SamePixels(*decoded.Main().color(), *preset_decoded.Main().color()));
+}
+
+TEST(JxlTest, ParallelAnimationFramesDecode) {
+  ThreadPoolInternal pool(4);
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(8);
+  io.metadata.m.color_encoding = ColorEncoding::SRGB();
+  io.metadata.m.have_animation = true;
+  io.SetSize(67, 45);
+  io.frames.clear();
+  for (int i = 0; i < 7; i++) {
+    Image3F color(67, 45);
+    RandomFillImage(&color, 0.0f, 1.0f, i);
+    ImageBundle frame(&io.metadata.m);
+    frame.SetFromImage(std::move(color), io.metadata.m.color_encoding);
+    frame.duration = 1;
+    io.frames.push_back(std::move(frame));
+  }
+
+  // With noise, each frame continues the noise seed of the previous ones.
+  for (float photon_noise_iso : {0.0f, 3200.0f}) {
+    SCOPED_TRACE(photon_noise_iso);
+    CompressParams cparams;
+    cparams.photon_noise_iso = photon_noise_iso;
+    PassesEncoderState enc_state;
+    PaddedBytes compressed;
+    ASSERT_TRUE(
+        EncodeFile(cparams, &io, &enc_state, &compressed, nullptr, &pool));
+
+    DecompressParams dparams;
+    CodecInOut io_serial;
+    ASSERT_TRUE(DecodeFile(dparams, compressed, &io_serial, &pool));
+    ASSERT_EQ(io.frames.size(), io_serial.frames.size());
+
+    // Batches of 3 frames, so that the last batch is incomplete.
+    dparams.parallel_frames = 3;
+    CodecInOut io_parallel;
+    ASSERT_TRUE(DecodeFile(dparams, compressed, &io_parallel, &pool));
+    ASSERT_EQ(io.frames.size(), io_parallel.frames.size());
+    for (size_t i = 0; i < io.frames.size(); i++) {
+      EXPECT_TRUE(SamePixels(*io_serial.frames[i].color(),
+                             *io_parallel.frames[i].color()));
+    }
+
+    size_t num_streamed = 0;
+    CodecInOut io_streamed;
+    ASSERT_TRUE(DecodeFile(
+        dparams, Span<const uint8_t>(compressed), &io_streamed, &pool,
+        [&](size_t index, ImageBundle* JXL_RESTRICT frame) -> Status {
+          EXPECT_EQ(num_streamed, index);
+          EXPECT_TRUE(SamePixels(*io_serial.frames[index].color(),
+                                 *frame->color()));
+          ++num_streamed;
+          return true;
+        }));
+    EXPECT_EQ(io.frames.size(), num_streamed);
+  }
+}
+
 #if JPEGXL_ENABLE_JPEG
 
 namespace {
@@ -1382,9 +1643,8 @@ size_t RoundtripJpeg(const PaddedBytes& jpeg_in, ThreadPool* pool) {
   jpegxl::tools::JpegXlContainer enc_container;
   enc_container.codestream = codestream.data();
   enc_container.codestream_size = codestream.size();
-  jpeg::JPEGData data_in = *io.Main().jpeg_data;
   jxl::PaddedBytes jpeg_data;
-  EXPECT_TRUE(EncodeJPEGData(data_in, &jpeg_data));
+  EXPECT_TRUE(EncodeJPEGData(*io.Main().jpeg_data, &jpeg_data));
   enc_container.jpeg_reconstruction = jpeg_data.data();
   enc_container.jpeg_reconstruction_size = jpeg_data.size();
   EXPECT_TRUE(EncodeJpegXlContainerOneShot(enc_container, &compressed));
@@ -1581,6 +1841,63 @@ TEST(JxlTest, JXL_TRANSCODE_JPEG_TEST(RoundtripJpegRecompression420Progr)) {
 
 #endif  // JPEGXL_ENABLE_JPEG
 
+namespace {
+
+std::vector<uint8_t> WriteJpegForTest(const jpeg::JPEGData& jpg) {
+  std::vector<uint8_t> bytes;
+  EXPECT_TRUE(jpeg::WriteJpeg(jpg, [&bytes](const uint8_t* buf, size_t len) {
+    bytes.insert(bytes.end(), buf, buf + len);
+    return len;
+  }));
+  return bytes;
+}
+
+}  // namespace
+
+TEST(JxlTest, ParallelJpegRead) {
+  ThreadPoolInternal pool(4);
+  const PaddedBytes orig = ReadTestData(
+      "imagecompression.info/flower_foveon.png.im_q85_420_progr.jpg");
+  jpeg::JPEGData jpg;
+  ASSERT_TRUE(jpeg::ReadJpeg(orig.data(), orig.size(),
+                             jpeg::JpegReadMode::kReadAll, &jpg, &pool));
+  std::vector<uint8_t> reconstructed = WriteJpegForTest(jpg);
+  ASSERT_EQ(orig.size(), reconstructed.size());
+  EXPECT_TRUE(std::equal(orig.begin(), orig.end(), reconstructed.begin()));
+
+  // Same image with restart markers, so that the restart intervals of each
+  // scan are also decoded concurrently.
+  jpg.restart_interval = 7;
+  jpg.marker_order.insert(
+      std::find(jpg.marker_order.begin(), jpg.marker_order.end(), 0xda), 0xdd);
+  const std::vector<uint8_t> with_restarts = WriteJpegForTest(jpg);
+  jpeg::JPEGData jpg_serial;
+  ASSERT_TRUE(jpeg::ReadJpeg(with_restarts.data(), with_restarts.size(),
+                             jpeg::JpegReadMode::kReadAll, &jpg_serial));
+  jpeg::JPEGData jpg_parallel;
+  ASSERT_TRUE(jpeg::ReadJpeg(with_restarts.data(), with_restarts.size(),
+                             jpeg::JpegReadMode::kReadAll, &jpg_parallel,
+                             &pool));
+  EXPECT_EQ(with_restarts, WriteJpegForTest(jpg_serial));
+  EXPECT_EQ(with_restarts, WriteJpegForTest(jpg_parallel));
+  ASSERT_EQ(jpg_serial.components.size(), jpg_parallel.components.size());
+  for (size_t c = 0; c < jpg_serial.components.size(); c++) {
+    EXPECT_EQ(jpg_serial.components[c].coeffs,
+              jpg_parallel.components[c].coeffs);
+  }
+  EXPECT_EQ(jpg_serial.padding_bits, jpg_parallel.padding_bits);
+
+  // Truncated data is rejected the same way with and without a pool.
+  jpeg::JPEGData truncated_serial;
+  jpeg::JPEGData truncated_parallel;
+  EXPECT_FALSE(jpeg::ReadJpeg(with_restarts.data(), with_restarts.size() / 2,
+                              jpeg::JpegReadMode::kReadAll, &truncated_serial));
+  EXPECT_FALSE(jpeg::ReadJpeg(with_restarts.data(), with_restarts.size() / 2,
+                              jpeg::JpegReadMode::kReadAll,
+                              &truncated_parallel, &pool));
+  EXPECT_EQ(truncated_serial.error, truncated_parallel.error);
+}
+
 TEST(JxlTest, RoundtripProgressive) {
   ThreadPoolInternal pool(4);
   const PaddedBytes orig =
@@ -1624,5 +1941,85 @@ TEST(JxlTest, RoundtripAnimationPatches) {
             2.0);
 }
 
+TEST(JxlTest, SpilledLossyReferenceFramesAreExact) {
+  ThreadPool* pool = nullptr;
+  const PaddedBytes orig = ReadTestData("jxl/animation_patches.gif");
+  CodecInOut io;
+  ASSERT_TRUE(SetFromBytes(Span<const uint8_t>(orig), &io, pool));
+
+  // Lossy modular without XYB, so the patch reference frames are lossy
+  // non-XYB frames with fractional samples.
+  CompressParams cparams;
+  cparams.patches = Override::kOn;
+  cparams.modular_mode = true;
+  cparams.quality_pair = {90, 90};
+  cparams.color_transform = ColorTransform::kNone;
+  PassesEncoderState enc_state;
+  PaddedBytes compressed;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed,
+                         /*aux_out=*/nullptr, pool));
+
+  DecompressParams dparams;
+  CodecInOut io_unspilled;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &io_unspilled, pool));
+  dparams.spill_reference_frames = true;
+  CodecInOut io_spilled;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &io_spilled, pool));
+
+  ASSERT_EQ(io_unspilled.frames.size(), io_spilled.frames.size());
+  for (size_t i = 0; i < io_unspilled.frames.size(); i++) {
+    VerifyRelativeError(*io_unspilled.frames[i].color(),
+                        *io_spilled.frames[i].color(), 0.0, 0.0);
+  }
+
+  // Lossy XYB animation whose frames are blended onto the previous ones: the
+  // frames saved for that are saved after the color transform, and so are
+  // not reduced to binary16 either.
+  CodecInOut anim;
+  anim.metadata.m.SetUintSamples(8);
+  anim.metadata.m.SetAlphaBits(8);
+  anim.metadata.m.color_encoding = ColorEncoding::SRGB();
+  anim.metadata.m.have_animation = true;
+  anim.SetSize(67, 45);
+  anim.frames.clear();
+  for (int i = 0; i < 5; i++) {
+    Image3F color(67, 45);
+    RandomFillImage(&color, 0.0f, 1.0f, i);
+    ImageF alpha(67, 45);
+    RandomFillImage(&alpha, 0.0f, 1.0f, 100 + i);
+    ImageBundle frame(&anim.metadata.m);
+    frame.SetFromImage(std::move(color), anim.metadata.m.color_encoding);
+    frame.SetAlpha(std::move(alpha), /*alpha_is_premultiplied=*/false);
+    frame.duration = 1;
+    frame.use_for_next_frame = true;
+    if (i != 0) {
+      frame.blend = true;
+      frame.blendmode = (i % 2 == 0) ? BlendMode::kAdd : BlendMode::kBlend;
+    }
+    anim.frames.push_back(std::move(frame));
+  }
+  CompressParams anim_cparams;
+  PassesEncoderState anim_enc_state;
+  PaddedBytes anim_compressed;
+  ASSERT_TRUE(EncodeFile(anim_cparams, &anim, &anim_enc_state,
+                         &anim_compressed, /*aux_out=*/nullptr, pool));
+
+  dparams.spill_reference_frames = false;
+  CodecInOut anim_unspilled;
+  ASSERT_TRUE(DecodeFile(dparams, anim_compressed, &anim_unspilled, pool));
+  dparams.spill_reference_frames = true;
+  CodecInOut anim_spilled;
+  ASSERT_TRUE(DecodeFile(dparams, anim_compressed, &anim_spilled, pool));
+
+  ASSERT_EQ(anim.frames.size(), anim_unspilled.frames.size());
+  ASSERT_EQ(anim.frames.size(), anim_spilled.frames.size());
+  for (size_t i = 0; i < anim.frames.size(); i++) {
+    VerifyRelativeError(*anim_unspilled.frames[i].color(),
+                        *anim_spilled.frames[i].color(), 0.0, 0.0);
+    VerifyRelativeError(*anim_unspilled.frames[i].alpha(),
+                        *anim_spilled.frames[i].alpha(), 0.0, 0.0);
+  }
+}
+
 }  // namespace
 }  // namespace jxl
@@ -60,8 +60,10 @@ struct Header : public Fields {
 struct State {
   pixel_type_w prediction[kNumPredictors] = {};
   pixel_type_w pred = 0;  // *before* removing the added bits.
-  std::vector<uint32_t> pred_errors[kNumPredictors];
-  std::vector<int32_t> error;
+  // Errors of two rows; they point to the storage of this State or of the one
+  // it was created from.
+  uint32_t *pred_errors[kNumPredictors];
+  int32_t *error;
   Header header;
 
   // Allows to approximate division by a number from 1 to 64.
@@ -75,15 +77,32 @@ struct State {
     // Extra margin to avoid out-of-bounds writes.
     // All have space for two rows of data.
     for (size_t i = 0; i < 4; i++) {
-      pred_errors[i].resize((xsize + 2) * 2);
+      pred_errors_storage[i].resize((xsize + 2) * 2);
+      pred_errors[i] = pred_errors_storage[i].data();
     }
-    error.resize((xsize + 2) * 2);
+    error_storage.resize((xsize + 2) * 2);
+    error = error_storage.data();
     // Initialize division lookup table.
     for (int i = 0; i < 64; i++) {
       divlookup[i] = (1 << 24) / (i + 1);
     }
   }
 
+  // Shares the errors of `rows`, which must outlive this State, so that
+  // different rows of a channel can be predicted concurrently: a pixel can be
+  // predicted once the previous row is done up to two pixels to its right.
+  explicit State(State *rows) : header(rows->header) {
+    for (size_t i = 0; i < kNumPredictors; i++) {
+      pred_errors[i] = rows->pred_errors[i];
+    }
+    error = rows->error;
+    for (int i = 0; i < 64; i++) {
+      divlookup[i] = rows->divlookup[i];
+    }
+  }
+  State(const State &) = delete;
+  State(State &&) = default;
+
   // Approximates 4+(maxweight<<24)/(x+1), avoiding division
   JXL_INLINE uint32_t ErrorWeight(uint64_t x, uint32_t maxweight) const {
     int shift = FloorLog2Nonzero(x + 1) - 5;
@@ -115,17 +134,19 @@ struct State {
     return (sum * divlookup[weight_sum - 1]) >> 24;
   }
 
-  template <bool compute_properties>
+  // If `no_edge_cases`, x must be neither the first nor the last column.
+  template <bool compute_properties, bool no_edge_cases = false>
   JXL_INLINE pixel_type_w Predict(size_t x, size_t y, size_t xsize,
                                   pixel_type_w N, pixel_type_w W,
                                   pixel_type_w NE, pixel_type_w NW,
                                   pixel_type_w NN, Properties *properties,
                                   size_t offset) {
+    JXL_DASSERT(!no_edge_cases || (x > 0 && x + 1 < xsize));
     size_t cur_row = y & 1 ? 0 : (xsize + 2);
     size_t prev_row = y & 1 ? (xsize + 2) : 0;
     size_t pos_N = prev_row + x;
-    size_t pos_NE = x < xsize - 1 ? pos_N + 1 : pos_N;
-    size_t pos_NW = x > 0 ? pos_N - 1 : pos_N;
+    size_t pos_NE = no_edge_cases || x < xsize - 1 ? pos_N + 1 : pos_N;
+    size_t pos_NW = no_edge_cases || x > 0 ? pos_N - 1 : pos_N;
     std::array<uint32_t, kNumPredictors> weights;
     for (size_t i = 0; i < kNumPredictors; i++) {
       // pred_errors[pos_N] also contains the error of pixel W.
@@ -141,7 +162,7 @@ struct State {
     NW = AddBits(NW);
     NN = AddBits(NN);
 
-    pixel_type_w teW = x == 0 ? 0 : error[cur_row + x - 1];
+    pixel_type_w teW = !no_edge_cases && x == 0 ? 0 : error[cur_row + x - 1];
     pixel_type_w teN = error[pos_N];
     pixel_type_w teNW = error[pos_NW];
     pixel_type_w sumWN = teN + teW;
@@ -193,6 +214,10 @@ struct State {
       pred_errors[i][prev_row + x + 1] += err;
     }
   }
+
+ private:
+  std::vector<uint32_t> pred_errors_storage[kNumPredictors];
+  std::vector<int32_t> error_storage;
 };
 
 // Encoder helper function to set the parameters to some presets.
@@ -449,12 +474,28 @@ inline void InitPropsRow(
   (*p)[9] = 0;  // local gradient.
 }
 
+// Returns the range [*begin, *end) of the x in row y of a channel of width w
+// whose neighbours all exist (see detail::kNoEdgeCases); it is empty if there
+// is none.
+inline void NoEdgeCasesRange(size_t w, size_t y, size_t *begin, size_t *end) {
+  if (y < 2 || w < 5) {
+    *begin = *end = w;
+    return;
+  }
+  *begin = 2;
+  *end = w - 2;
+}
+
 namespace detail {
 enum PredictorMode {
   kUseTree = 1,
   kUseWP = 2,
   kForceComputeProperties = 4,
   kAllPredictions = 8,
+  // All the neighbours used by the predictors exist: x is at least two pixels
+  // away from the left and right borders, and y >= 2. This skips the
+  // per-pixel border checks in the inner part of a channel.
+  kNoEdgeCases = 16,
 };
 
 JXL_INLINE pixel_type_w PredictOne(Predictor p, pixel_type_w left,
@@ -509,13 +550,25 @@ inline PredictionResult Predict(
   size_t offset = 3;
   constexpr bool compute_properties =
       mode & kUseTree || mode & kForceComputeProperties;
-  pixel_type_w left = (x ? pp[-1] : (y ? pp[-onerow] : 0));
-  pixel_type_w top = (y ? pp[-onerow] : left);
-  pixel_type_w topleft = (x && y ? pp[-1 - onerow] : left);
-  pixel_type_w topright = (x + 1 < w && y ? pp[1 - onerow] : top);
-  pixel_type_w leftleft = (x > 1 ? pp[-2] : left);
-  pixel_type_w toptop = (y > 1 ? pp[-onerow - onerow] : top);
-  pixel_type_w toprightright = (x + 2 < w && y ? pp[2 - onerow] : topright);
+  constexpr bool no_edge_cases = mode & kNoEdgeCases;
+  pixel_type_w left, top, topleft, topright, leftleft, toptop, toprightright;
+  if (no_edge_cases) {
+    left = pp[-1];
+    top = pp[-onerow];
+    topleft = pp[-1 - onerow];
+    topright = pp[1 - onerow];
+    leftleft = pp[-2];
+    toptop = pp[-onerow - onerow];
+    toprightright = pp[2 - onerow];
+  } else {
+    left = (x ? pp[-1] : (y ? pp[-onerow] : 0));
+    top = (y ? pp[-onerow] : left);
+    topleft = (x && y ? pp[-1 - onerow] : left);
+    topright = (x + 1 < w && y ? pp[1 - onerow] : top);
+    leftleft = (x > 1 ? pp[-2] : left);
+    toptop = (y > 1 ? pp[-onerow - onerow] : top);
+    toprightright = (x + 2 < w && y ? pp[2 - onerow] : topright);
+  }
 
   if (compute_properties) {
     // location
@@ -542,7 +595,7 @@ inline PredictionResult Predict(
 
   pixel_type_w wp_pred = 0;
   if (mode & kUseWP) {
-    wp_pred = wp_state->Predict<compute_properties>(
+    wp_pred = wp_state->Predict<compute_properties, no_edge_cases>(
         x, y, w, top, left, topright, topleft, toptop, p, offset);
   }
   if (compute_properties) {
@@ -594,17 +647,22 @@ inline PredictionResult PredictNoTreeWP(size_t w,
       /*references=*/nullptr, wp_state, /*predictions=*/nullptr);
 }
 
+// If `no_edge_cases`, x must be in the range given by NoEdgeCasesRange().
+template <bool no_edge_cases = false>
 inline PredictionResult PredictTreeNoWP(Properties *p, size_t w,
                                         const pixel_type *JXL_RESTRICT pp,
                                         const intptr_t onerow, const int x,
                                         const int y,
                                         const MATreeLookup &tree_lookup,
                                         const Channel &references) {
-  return detail::Predict<detail::kUseTree>(
+  return detail::Predict<detail::kUseTree |
+                         (no_edge_cases ? detail::kNoEdgeCases : 0)>(
       p, w, pp, onerow, x, y, Predictor::Zero, &tree_lookup, &references,
       /*wp_state=*/nullptr, /*predictions=*/nullptr);
 }
 
+// If `no_edge_cases`, x must be in the range given by NoEdgeCasesRange().
+template <bool no_edge_cases = false>
 inline PredictionResult PredictTreeWP(Properties *p, size_t w,
                                       const pixel_type *JXL_RESTRICT pp,
                                       const intptr_t onerow, const int x,
@@ -612,7 +670,8 @@ inline PredictionResult PredictTreeWP(Properties *p, size_t w,
                                       const MATreeLookup &tree_lookup,
                                       const Channel &references,
                                       weighted::State *wp_state) {
-  return detail::Predict<detail::kUseTree | detail::kUseWP>(
+  return detail::Predict<detail::kUseTree | detail::kUseWP |
+                         (no_edge_cases ? detail::kNoEdgeCases : 0)>(
       p, w, pp, onerow, x, y, Predictor::Zero, &tree_lookup, &references,
       wp_state, /*predictions=*/nullptr);
 }
@@ -36,6 +36,14 @@ Tree LearnTree(TreeSamples &&tree_samples, size_t total_pixels,
 
 // TODO(veluca): make cleaner interfaces.
 
+// Appends the tokens of channel `chan` of `image`, coded with `global_tree`.
+// Channels can be tokenized concurrently.
+Status EncodeModularChannelMAANS(const Image &image, pixel_type chan,
+                                 const weighted::Header &wp_header,
+                                 const Tree &global_tree,
+                                 std::vector<Token> *tokens, AuxOut *aux_out,
+                                 size_t group_id, bool skip_encoder_fast_path);
+
 Status ModularGenericCompress(
     Image &image, const ModularOptions &opts, BitWriter *writer,
     AuxOut *aux_out = nullptr, size_t layer = 0, size_t group_id = 0,
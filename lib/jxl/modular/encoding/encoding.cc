@@ -8,7 +8,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <atomic>
 #include <queue>
+#include <thread>
 
 #include "lib/jxl/modular/encoding/context_predict.h"
 #include "lib/jxl/modular/options.h"
@@ -123,6 +125,34 @@ FlatTree FilterTree(const Tree &global_tree,
   return output;
 }
 
+namespace {
+
+// Like FilterTree, but tree lookup returns a *clustered* context ID.
+// This avoids an extra memory lookup after tree traversal.
+FlatTree FilterClusteredTree(
+    const Tree &global_tree, const std::vector<uint8_t> &context_map,
+    std::array<pixel_type, kNumStaticProperties> &static_props,
+    size_t *num_props, bool *use_wp, bool *wp_only, bool *gradient_only) {
+  FlatTree tree = FilterTree(global_tree, static_props, num_props, use_wp,
+                             wp_only, gradient_only);
+  for (size_t i = 0; i < tree.size(); i++) {
+    if (tree[i].property0 == -1) {
+      tree[i].childID = context_map[tree[i].childID];
+    }
+  }
+  return tree;
+}
+
+JXL_INLINE pixel_type MakePixel(uint64_t v, pixel_type multiplier,
+                                 pixel_type_w offset) {
+  JXL_DASSERT((v & 0xFFFFFFFF) == v);
+  pixel_type_w val = UnpackSigned(v);
+  // if it overflows, it overflows, and we have a problem anyway
+  return val * multiplier + offset;
+}
+
+}  // namespace
+
 Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                  const std::vector<uint8_t> &context_map,
                                  const Tree &global_tree,
@@ -142,29 +172,12 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
   bool is_wp_only = false;
   bool is_gradient_only = false;
   size_t num_props;
-  FlatTree tree =
-      FilterTree(global_tree, static_props, &num_props,
-                 &tree_has_wp_prop_or_pred, &is_wp_only, &is_gradient_only);
-
-  // From here on, tree lookup returns a *clustered* context ID.
-  // This avoids an extra memory lookup after tree traversal.
-  for (size_t i = 0; i < tree.size(); i++) {
-    if (tree[i].property0 == -1) {
-      tree[i].childID = context_map[tree[i].childID];
-    }
-  }
+  FlatTree tree = FilterClusteredTree(
+      global_tree, context_map, static_props, &num_props,
+      &tree_has_wp_prop_or_pred, &is_wp_only, &is_gradient_only);
 
   JXL_DEBUG_V(3, "Decoded MA tree with %zu nodes", tree.size());
 
-  // MAANS decode
-  const auto make_pixel = [](uint64_t v, pixel_type multiplier,
-                             pixel_type_w offset) -> pixel_type {
-    JXL_DASSERT((v & 0xFFFFFFFF) == v);
-    pixel_type_w val = UnpackSigned(v);
-    // if it overflows, it overflows, and we have a problem anyway
-    return val * multiplier + offset;
-  };
-
   if (tree.size() == 1) {
     // special optimized case: no meta-adaptation, so no need
     // to compute properties.
@@ -179,7 +192,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         // Special-case: histogram has a single symbol, with no extra bits, and
         // we use ANS mode.
         JXL_DEBUG_V(8, "Fastest track.");
-        pixel_type v = make_pixel(value, multiplier, offset);
+        pixel_type v = MakePixel(value, multiplier, offset);
         for (size_t y = 0; y < channel.h; y++) {
           pixel_type *JXL_RESTRICT r = channel.Row(y);
           std::fill(r, r + channel.w, v);
@@ -191,7 +204,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
           pixel_type *JXL_RESTRICT r = channel.Row(y);
           for (size_t x = 0; x < channel.w; x++) {
             uint32_t v = reader->ReadHybridUintClustered(ctx_id, br);
-            r[x] = make_pixel(v, multiplier, offset);
+            r[x] = MakePixel(v, multiplier, offset);
           }
         }
       }
@@ -207,7 +220,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
           pixel_type topleft = (x && y ? *(r + x - 1 - onerow) : left);
           pixel_type guess = ClampedGradient(top, left, topleft);
           uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-          r[x] = make_pixel(v, 1, guess);
+          r[x] = MakePixel(v, 1, guess);
         }
       }
     } else if (predictor != Predictor::Weighted) {
@@ -222,7 +235,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
           pixel_type_w g = pred.guess + offset;
           uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
           // NOTE: pred.multiplier is unset.
-          r[x] = make_pixel(v, multiplier, g);
+          r[x] = MakePixel(v, multiplier, g);
         }
       }
     } else {
@@ -237,7 +250,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                                .guess +
                            offset;
           uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-          r[x] = make_pixel(v, multiplier, g);
+          r[x] = MakePixel(v, multiplier, g);
           wp_state.UpdateErrors(r[x], x, y, channel.w);
         }
       }
@@ -276,7 +289,7 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
                 kPropRangeFast - 1);
         uint32_t ctx_id = context_lookup[pos];
         uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-        r[x] = make_pixel(v, multipliers[pos],
+        r[x] = MakePixel(v, multipliers[pos],
                           static_cast<pixel_type_w>(offsets[pos]) + guess);
       }
     }
@@ -285,10 +298,34 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
     const intptr_t onerow = channel.plane.PixelsPerRow();
     weighted::State wp_state(wp_header, channel.w, channel.h);
     Properties properties(1);
+    const auto decode_pixel = [&](pixel_type *JXL_RESTRICT r, size_t x,
+                                  size_t y, int32_t guess) {
+      uint32_t pos =
+          kPropRangeFast + std::min(std::max(-kPropRangeFast, properties[0]),
+                                    kPropRangeFast - 1);
+      uint32_t ctx_id = context_lookup[pos];
+      uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
+      r[x] = MakePixel(v, multipliers[pos],
+                        static_cast<pixel_type_w>(offsets[pos]) + guess);
+      wp_state.UpdateErrors(r[x], x, y, channel.w);
+    };
     for (size_t y = 0; y < channel.h; y++) {
       pixel_type *JXL_RESTRICT r = channel.Row(y);
+      size_t begin, end;
+      NoEdgeCasesRange(channel.w, y, &begin, &end);
       for (size_t x = 0; x < channel.w; x++) {
-        size_t offset = 0;
+        if (x == begin) {
+          // All the neighbours exist.
+          for (; x < end; x++) {
+            const pixel_type *JXL_RESTRICT rx = r + x;
+            int32_t guess = wp_state.Predict</*compute_properties=*/true,
+                                             /*no_edge_cases=*/true>(
+                x, y, channel.w, rx[-onerow], rx[-1], rx[1 - onerow],
+                rx[-1 - onerow], rx[-onerow - onerow], &properties,
+                /*offset=*/0);
+            decode_pixel(r, x, y, guess);
+          }
+        }
         pixel_type_w left = (x ? r[x - 1] : y ? *(r + x - onerow) : 0);
         pixel_type_w top = (y ? *(r + x - onerow) : left);
         pixel_type_w topleft = (x && y ? *(r + x - 1 - onerow) : left);
@@ -297,15 +334,8 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
         pixel_type_w toptop = (y > 1 ? *(r + x - onerow - onerow) : top);
         int32_t guess = wp_state.Predict</*compute_properties=*/true>(
             x, y, channel.w, top, left, topright, topleft, toptop, &properties,
-            offset);
-        uint32_t pos =
-            kPropRangeFast + std::min(std::max(-kPropRangeFast, properties[0]),
-                                      kPropRangeFast - 1);
-        uint32_t ctx_id = context_lookup[pos];
-        uint64_t v = reader->ReadHybridUintClustered(ctx_id, br);
-        r[x] = make_pixel(v, multipliers[pos],
-                          static_cast<pixel_type_w>(offsets[pos]) + guess);
-        wp_state.UpdateErrors(r[x], x, y, channel.w);
+            /*offset=*/0);
+        decode_pixel(r, x, y, guess);
       }
     }
   } else if (!tree_has_wp_prop_or_pred) {
@@ -320,12 +350,23 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
       pixel_type *JXL_RESTRICT p = channel.Row(y);
       PrecomputeReferences(channel, y, *image, chan, &references);
       InitPropsRow(&properties, static_props, y);
+      size_t begin, end;
+      NoEdgeCasesRange(channel.w, y, &begin, &end);
       for (size_t x = 0; x < channel.w; x++) {
+        if (x == begin) {
+          for (; x < end; x++) {
+            PredictionResult res = PredictTreeNoWP</*no_edge_cases=*/true>(
+                &properties, channel.w, p + x, onerow, x, y, tree_lookup,
+                references);
+            uint64_t v = reader->ReadHybridUintClustered(res.context, br);
+            p[x] = MakePixel(v, res.multiplier, res.guess);
+          }
+        }
         PredictionResult res =
             PredictTreeNoWP(&properties, channel.w, p + x, onerow, x, y,
                             tree_lookup, references);
         uint64_t v = reader->ReadHybridUintClustered(res.context, br);
-        p[x] = make_pixel(v, res.multiplier, res.guess);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
       }
     }
   } else {
@@ -339,12 +380,24 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
       pixel_type *JXL_RESTRICT p = channel.Row(y);
       InitPropsRow(&properties, static_props, y);
       PrecomputeReferences(channel, y, *image, chan, &references);
+      size_t begin, end;
+      NoEdgeCasesRange(channel.w, y, &begin, &end);
       for (size_t x = 0; x < channel.w; x++) {
+        if (x == begin) {
+          for (; x < end; x++) {
+            PredictionResult res = PredictTreeWP</*no_edge_cases=*/true>(
+                &properties, channel.w, p + x, onerow, x, y, tree_lookup,
+                references, &wp_state);
+            uint64_t v = reader->ReadHybridUintClustered(res.context, br);
+            p[x] = MakePixel(v, res.multiplier, res.guess);
+            wp_state.UpdateErrors(p[x], x, y, channel.w);
+          }
+        }
         PredictionResult res =
             PredictTreeWP(&properties, channel.w, p + x, onerow, x, y,
                           tree_lookup, references, &wp_state);
         uint64_t v = reader->ReadHybridUintClustered(res.context, br);
-        p[x] = make_pixel(v, res.multiplier, res.guess);
+        p[x] = MakePixel(v, res.multiplier, res.guess);
         wp_state.UpdateErrors(p[x], x, y, channel.w);
       }
     }
@@ -352,6 +405,237 @@ Status DecodeModularChannelMAANS(BitReader *br, ANSSymbolReader *reader,
   return true;
 }
 
+namespace {
+
+// Number of pixels that a row decodes before publishing its progress.
+constexpr size_t kRowChunk = 64;
+
+// Returns whether a decode that resumed at an entry of `row_index` stopped
+// where entry `next_entry` starts (bit position and ANS state), or, if
+// `next_entry` is past the last entry, with a valid final ANS state. Reads past
+// the end of the input never match.
+bool EndMatchesRowIndex(const ModularRowIndex &row_index, size_t next_entry,
+                        size_t data_start, BitReader *br,
+                        ANSSymbolReader *reader) {
+  if (!br->AllReadsWithinBounds()) return false;
+  if (next_entry == row_index.bit_offsets.size()) {
+    return reader->CheckANSFinalState();
+  }
+  return br->TotalBitsConsumed() ==
+             data_start + row_index.bit_offsets[next_entry] &&
+         reader->CheckANSState(row_index.ans_states.empty()
+                                   ? 0
+                                   : row_index.ans_states[next_entry]);
+}
+
+// Decodes the rows of one channel concurrently. Row `y` of the channel is
+// row `first_row + y` of `row_index`; it resumes the stream at the recorded
+// position and waits for the previous row to be done two pixels to the right
+// of its current chunk. Stores where the last row ends in `end_bits`, and
+// whether every row ended where the index says that the next one starts in
+// `index_matches`.
+Status DecodeModularChannelRows(const BitReader &br, size_t data_start,
+                                const ANSCode *code,
+                                const std::vector<uint8_t> &context_map,
+                                const Tree &global_tree,
+                                const weighted::Header &wp_header,
+                                pixel_type chan, size_t group_id,
+                                const ModularRowIndex &row_index,
+                                size_t first_row, ThreadPool *pool,
+                                Image *image, bool *index_matches,
+                                uint64_t *end_bits) {
+  Channel &channel = image->channel[chan];
+  JXL_ASSERT(channel.w != 0 && channel.h != 0);
+  const size_t w = channel.w;
+
+  std::array<pixel_type, kNumStaticProperties> static_props = {chan,
+                                                               (int)group_id};
+  bool use_wp, is_wp_only, is_gradient_only;
+  size_t num_props;
+  FlatTree tree =
+      FilterClusteredTree(global_tree, context_map, static_props, &num_props,
+                          &use_wp, &is_wp_only, &is_gradient_only);
+  MATreeLookup tree_lookup(tree);
+  const intptr_t onerow = channel.plane.PixelsPerRow();
+
+  weighted::State wp_rows(wp_header, w, channel.h);
+  std::vector<Properties> properties;
+  std::vector<Channel> references;
+  std::vector<weighted::State> wp_states;
+  const auto init = [&](size_t num_threads) {
+    for (size_t i = 0; i < num_threads; i++) {
+      properties.emplace_back(num_props);
+      references.emplace_back(num_props - kNumNonrefProperties, w);
+      wp_states.emplace_back(&wp_rows);
+    }
+    return true;
+  };
+
+  // Rows are claimed in order rather than by task index, so that the previous
+  // row of a claimed row is always being decoded by a running thread.
+  std::atomic<uint32_t> next_row{0};
+  std::vector<std::atomic<uint32_t>> progress(channel.h);
+  for (auto &p : progress) p.store(0, std::memory_order_relaxed);
+  std::atomic<bool> any_mismatch{false};
+
+  const auto decode_row = [&](const uint32_t /*task*/, size_t thread) {
+    const size_t y = next_row.fetch_add(1, std::memory_order_relaxed);
+    const size_t row = first_row + y;
+    BitReader row_br(Span<const uint8_t>(br.FirstByte(), br.TotalBytes()));
+    row_br.SkipBits(data_start + row_index.bit_offsets[row]);
+    ANSSymbolReader reader = ANSSymbolReader::Resume(
+        code, code->use_prefix_code ? 0 : row_index.ans_states[row]);
+    Properties &props = properties[thread];
+    Channel &refs = references[thread];
+    weighted::State &wp_state = wp_states[thread];
+
+    pixel_type *JXL_RESTRICT p = channel.Row(y);
+    InitPropsRow(&props, static_props, y);
+    PrecomputeReferences(channel, y, *image, chan, &refs);
+    size_t begin, end;
+    NoEdgeCasesRange(w, y, &begin, &end);
+    const auto decode_pixel = [&](size_t x, const PredictionResult &res) {
+      uint64_t v = reader.ReadHybridUintClustered(res.context, &row_br);
+      p[x] = MakePixel(v, res.multiplier, res.guess);
+      if (use_wp) wp_state.UpdateErrors(p[x], x, y, w);
+    };
+    for (size_t x0 = 0; x0 < w; x0 += kRowChunk) {
+      const size_t x1 = std::min(w, x0 + kRowChunk);
+      if (y > 0) {
+        const size_t needed = std::min(w, x1 + 1);
+        while (progress[y - 1].load(std::memory_order_acquire) < needed) {
+          std::this_thread::yield();
+        }
+      }
+      const size_t inner_begin = std::max(x0, begin);
+      const size_t inner_end = std::min(x1, end);
+      for (size_t x = x0; x < x1; x++) {
+        if (x == inner_begin) {
+          for (; x < inner_end; x++) {
+            decode_pixel(x, use_wp ? PredictTreeWP</*no_edge_cases=*/true>(
+                                         &props, w, p + x, onerow, x, y,
+                                         tree_lookup, refs, &wp_state)
+                                   : PredictTreeNoWP</*no_edge_cases=*/true>(
+                                         &props, w, p + x, onerow, x, y,
+                                         tree_lookup, refs));
+          }
+          if (x == x1) break;
+        }
+        decode_pixel(x, use_wp ? PredictTreeWP(&props, w, p + x, onerow, x, y,
+                                               tree_lookup, refs, &wp_state)
+                               : PredictTreeNoWP(&props, w, p + x, onerow, x,
+                                                 y, tree_lookup, refs));
+      }
+      progress[y].store(x1, std::memory_order_release);
+    }
+    if (!EndMatchesRowIndex(row_index, row + 1, data_start, &row_br,
+                            &reader)) {
+      any_mismatch.store(true, std::memory_order_relaxed);
+    }
+    if (y + 1 == channel.h) *end_bits = row_br.TotalBitsConsumed();
+    (void)row_br.Close();
+  };
+  if (!RunOnPool(pool, 0, channel.h, init, decode_row,
+                 "DecodeModularChannelRows")) {
+    return JXL_FAILURE("Failed to decode modular rows");
+  }
+  *index_matches = !any_mismatch.load(std::memory_order_relaxed);
+  return true;
+}
+
+// Decodes channel `chan` on its own, resuming the stream at entry `entry` of
+// `row_index`. Stores where the channel ends in `end_bits`, and whether that is
+// where entry `next_entry` starts in `index_matches`.
+Status DecodeModularChannelAt(const BitReader &br, size_t data_start,
+                              const ANSCode *code,
+                              const std::vector<uint8_t> &context_map,
+                              const Tree &global_tree,
+                              const weighted::Header &wp_header,
+                              pixel_type chan, size_t group_id,
+                              const ModularRowIndex &row_index, size_t entry,
+                              size_t next_entry, Image *image,
+                              bool *index_matches, uint64_t *end_bits) {
+  BitReader channel_br(Span<const uint8_t>(br.FirstByte(), br.TotalBytes()));
+  channel_br.SkipBits(data_start + row_index.bit_offsets[entry]);
+  ANSSymbolReader reader = ANSSymbolReader::Resume(
+      code, code->use_prefix_code ? 0 : row_index.ans_states[entry]);
+  Status status =
+      DecodeModularChannelMAANS(&channel_br, &reader, context_map, global_tree,
+                                wp_header, chan, group_id, image);
+  *index_matches = EndMatchesRowIndex(row_index, next_entry, data_start,
+                                      &channel_br, &reader);
+  *end_bits = channel_br.TotalBitsConsumed();
+  (void)channel_br.Close();
+  return status;
+}
+
+// Returns the number of entries that a row index of the stream has.
+size_t NumIndexEntries(const Image &image, const ModularOptions &options,
+                       bool per_channel) {
+  const std::vector<size_t> channels = CodedModularChannels(image, options);
+  if (per_channel) return channels.size();
+  size_t num_rows = 0;
+  for (size_t i : channels) num_rows += image.channel[i].h;
+  return num_rows;
+}
+
+// Returns whether `row_index` may be used to decode the coded channels of
+// `image`, whose data starts at the current position of `br` and `reader`: it
+// must have an entry for each row (or channel), the first of which is that
+// position, with bit offsets in stream order that are within the input.
+bool RowIndexFitsStream(const ModularRowIndex &row_index, const Image &image,
+                        const ModularOptions &options, const ANSCode &code,
+                        BitReader *br, const ANSSymbolReader &reader) {
+  const std::vector<uint64_t> &offsets = row_index.bit_offsets;
+  if (code.lz77.enabled || !br->AllReadsWithinBounds()) return false;
+  if (offsets.empty() ||
+      offsets.size() !=
+          NumIndexEntries(image, options, row_index.per_channel) ||
+      row_index.ans_states.size() !=
+          (code.use_prefix_code ? 0 : offsets.size())) {
+    return false;
+  }
+  if (offsets[0] != 0 ||
+      !reader.CheckANSState(code.use_prefix_code ? 0
+                                                 : row_index.ans_states[0])) {
+    return false;
+  }
+  // Rows that only have single-symbol histograms take no bits, so offsets may
+  // repeat.
+  for (size_t i = 1; i < offsets.size(); i++) {
+    if (offsets[i] < offsets[i - 1]) return false;
+  }
+  return offsets.back() <=
+         br->TotalBytes() * kBitsPerByte - br->TotalBitsConsumed();
+}
+
+}  // namespace
+
+std::vector<size_t> CodedModularChannels(const Image &image,
+                                         const ModularOptions &options) {
+  std::vector<size_t> channels;
+  for (size_t i = 0; i < image.channel.size(); i++) {
+    const Channel &channel = image.channel[i];
+    if (!channel.w || !channel.h) continue;
+    if (i >= image.nb_meta_channels && (channel.w > options.max_chan_size ||
+                                        channel.h > options.max_chan_size)) {
+      break;
+    }
+    channels.push_back(i);
+  }
+  return channels;
+}
+
+bool UsesPreviousChannels(const Tree &tree, pixel_type chan, size_t group_id) {
+  std::array<pixel_type, kNumStaticProperties> static_props = {
+      chan, static_cast<pixel_type>(group_id)};
+  size_t num_props;
+  bool use_wp, wp_only, gradient_only;
+  FilterTree(tree, static_props, &num_props, &use_wp, &wp_only,
+             &gradient_only);
+  return num_props > kNumNonrefProperties;
+}
+
 GroupHeader::GroupHeader() { Bundle::Init(this); }
 
 Status ValidateChannelDimensions(const Image &image,
@@ -382,7 +666,8 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
                      size_t group_id, ModularOptions *options,
                      const Tree *global_tree, const ANSCode *global_code,
                      const std::vector<uint8_t> *global_ctx_map,
-                     bool allow_truncated_group) {
+                     bool allow_truncated_group,
+                     const ModularRowIndex *row_index, ThreadPool *pool) {
   if (image.channel.empty()) return true;
 
   // decode transforms
@@ -462,6 +747,69 @@ Status ModularDecode(BitReader *br, Image &image, GroupHeader &header,
 
   // Read channels
   ANSSymbolReader reader(code, br, distance_multiplier);
+  // The row index is only a hint: if it does not match the stream, including
+  // if a row or channel does not end where the next entry starts, the
+  // channels are decoded sequentially.
+  if (row_index != nullptr && pool != nullptr &&
+      RowIndexFitsStream(*row_index, image, *options, *code, br, reader)) {
+    const size_t data_start = br->TotalBitsConsumed();
+    const std::vector<size_t> channels = CodedModularChannels(image, *options);
+    // Index entry of the first row of each coded channel, and one past the
+    // last entry.
+    std::vector<size_t> first_entry(channels.size() + 1);
+    for (size_t k = 1; k <= channels.size(); k++) {
+      first_entry[k] = first_entry[k - 1] +
+                       (row_index->per_channel
+                            ? 1
+                            : image.channel[channels[k - 1]].h);
+    }
+    uint64_t end_bits = data_start;
+    bool index_matches = true;
+    for (size_t k = 0; k < channels.size() && index_matches;) {
+      // Channels that do not use properties of previous channels are decoded
+      // together with the ones before them.
+      size_t batch_end = k + 1;
+      while (batch_end < channels.size() &&
+             !UsesPreviousChannels(*tree, channels[batch_end], group_id)) {
+        batch_end++;
+      }
+      if (batch_end == k + 1 && !row_index->per_channel) {
+        JXL_RETURN_IF_ERROR(DecodeModularChannelRows(
+            *br, data_start, code, *context_map, *tree, header.wp_header,
+            channels[k], group_id, *row_index, first_entry[k], pool, &image,
+            &index_matches, &end_bits));
+        k = batch_end;
+        continue;
+      }
+      const size_t batch_size = batch_end - k;
+      std::vector<uint8_t> channel_matches(batch_size);
+      std::vector<uint64_t> channel_end_bits(batch_size);
+      const auto decode_channel = [&](const uint32_t task, size_t /*thread*/) {
+        const size_t j = task - k;
+        bool matches;
+        const Status status = DecodeModularChannelAt(
+            *br, data_start, code, *context_map, *tree, header.wp_header,
+            channels[task], group_id, *row_index, first_entry[task],
+            first_entry[task + 1], &image, &matches, &channel_end_bits[j]);
+        channel_matches[j] = status && matches;
+      };
+      if (!RunOnPool(pool, k, batch_end, ThreadPool::SkipInit(),
+                     decode_channel, "DecodeModularChannels")) {
+        return JXL_FAILURE("Failed to decode modular channels");
+      }
+      for (size_t j = 0; j < batch_size; j++) {
+        if (!channel_matches[j]) index_matches = false;
+      }
+      end_bits = channel_end_bits.back();
+      k = batch_end;
+    }
+    if (index_matches) {
+      br->SkipBits(end_bits - br->TotalBitsConsumed());
+      return true;
+    }
+    JXL_DEBUG_V(2, "Modular row index does not match the stream");
+    // `br` and `reader` are still at the start of the channel data.
+  }
   for (size_t i = 0; i < nb_channels; i++) {
     Channel &channel = image.channel[i];
     if (!channel.w || !channel.h) {
@@ -493,7 +841,9 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 ModularOptions *options, int undo_transforms,
                                 const Tree *tree, const ANSCode *code,
                                 const std::vector<uint8_t> *ctx_map,
-                                bool allow_truncated_group) {
+                                bool allow_truncated_group,
+                                const ModularRowIndex *row_index,
+                                ThreadPool *pool) {
 #ifdef JXL_ENABLE_ASSERT
   std::vector<std::pair<uint32_t, uint32_t>> req_sizes(image.channel.size());
   for (size_t c = 0; c < req_sizes.size(); c++) {
@@ -503,7 +853,8 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
   GroupHeader local_header;
   if (header == nullptr) header = &local_header;
   auto dec_status = ModularDecode(br, image, *header, group_id, options, tree,
-                                  code, ctx_map, allow_truncated_group);
+                                  code, ctx_map, allow_truncated_group,
+                                  row_index, pool);
   if (!allow_truncated_group) JXL_RETURN_IF_ERROR(dec_status);
   if (dec_status.IsFatalError()) return dec_status;
   image.undo_transforms(header->wp_header, undo_transforms);
@@ -11,7 +11,9 @@
 
 #include <vector>
 
+#include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/dec_ans.h"
+#include "lib/jxl/frame_header.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/modular/encoding/context_predict.h"
 #include "lib/jxl/modular/encoding/dec_ma.h"
@@ -119,6 +121,16 @@ bool TreeToLookupTable(const FlatTree &tree,
 }
 // TODO(veluca): make cleaner interfaces.
 
+// Returns the channels of `image` that are coded in its modular stream, in
+// bitstream order: the non-empty ones, up to the first that is too large.
+std::vector<size_t> CodedModularChannels(const Image &image,
+                                         const ModularOptions &options);
+
+// Returns true if `tree` uses properties of previous channels to code channel
+// `chan` of group `group_id`. Otherwise, the channel can be decoded
+// concurrently with the ones before it.
+bool UsesPreviousChannels(const Tree &tree, pixel_type chan, size_t group_id);
+
 Status ValidateChannelDimensions(const Image &image,
                                  const ModularOptions &options);
 
@@ -127,6 +139,9 @@ Status ValidateChannelDimensions(const Image &image,
 // undo_transforms == 0: undo all transforms
 // undo_transforms == -1: undo all transforms but don't clamp to range
 // undo_transforms == -2: don't undo any transform
+// If `row_index` matches the stream and `pool` is not null, channels that
+// do not use previous channels are decoded concurrently; with a per-row index,
+// so are the rows of other channels.
 Status ModularGenericDecompress(BitReader *br, Image &image,
                                 GroupHeader *header, size_t group_id,
                                 ModularOptions *options,
@@ -134,7 +149,9 @@ Status ModularGenericDecompress(BitReader *br, Image &image,
                                 const Tree *tree = nullptr,
                                 const ANSCode *code = nullptr,
                                 const std::vector<uint8_t> *ctx_map = nullptr,
-                                bool allow_truncated_group = false);
+                                bool allow_truncated_group = false,
+                                const ModularRowIndex *row_index = nullptr,
+                                ThreadPool *pool = nullptr);
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_ENCODING_ENCODING_H_
@@ -5,8 +5,9 @@
 
 #include "lib/jxl/modular/transform/enc_palette.h"
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <numeric>
+#include <vector>
 
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/base/status.h"
@@ -93,6 +94,89 @@ static int QuantizeColorToImplicitPaletteIndex(
   }
 }
 
+// Not a color index.
+static constexpr uint32_t kNoColor = ~0u;
+
+// Open-addressing hash set of colors with `nb` channels. Colors are numbered
+// in insertion order.
+class ColorHash {
+ public:
+  explicit ColorHash(size_t nb)
+      : nb_(nb), table_(kInitialCapacity, kNoColor) {}
+
+  size_t size() const { return colors_.size() / nb_; }
+  const pixel_type *Color(size_t index) const { return &colors_[index * nb_]; }
+
+  // Returns the index of `color`, adding it if it is new.
+  uint32_t Insert(const pixel_type *color) {
+    size_t slot = Slot(color);
+    if (table_[slot] != kNoColor) return table_[slot];
+    const uint32_t index = size();
+    colors_.insert(colors_.end(), color, color + nb_);
+    table_[slot] = index;
+    if (2 * size() > table_.size()) Grow();
+    return index;
+  }
+
+  // Returns the index of `color`, or kNoColor if it was never added.
+  uint32_t Find(const pixel_type *color) const {
+    return table_[Slot(color)];
+  }
+
+  // Returns the color indices sorted by lexicographic order of the colors.
+  std::vector<uint32_t> SortedIndices() const {
+    std::vector<uint32_t> indices(size());
+    std::iota(indices.begin(), indices.end(), 0);
+    std::sort(indices.begin(), indices.end(), [this](uint32_t a, uint32_t b) {
+      return std::lexicographical_compare(Color(a), Color(a) + nb_, Color(b),
+                                          Color(b) + nb_);
+    });
+    return indices;
+  }
+
+ private:
+  static constexpr size_t kInitialCapacity = 256;  // power of two
+
+  static size_t Hash(const pixel_type *color, size_t nb) {
+    uint32_t hash = 0;
+    for (size_t c = 0; c < nb; c++) {
+      hash = (hash ^ static_cast<uint32_t>(color[c])) * 0x9E3779B1u;
+    }
+    return hash ^ (hash >> 15);
+  }
+
+  // Returns the slot that holds `color`, or the empty slot where it belongs.
+  size_t Slot(const pixel_type *color) const {
+    const size_t mask = table_.size() - 1;
+    for (size_t slot = Hash(color, nb_) & mask;; slot = (slot + 1) & mask) {
+      const uint32_t index = table_[slot];
+      if (index == kNoColor ||
+          std::equal(color, color + nb_, colors_.begin() + index * nb_)) {
+        return slot;
+      }
+    }
+  }
+
+  void Grow() {
+    std::vector<uint32_t> old_table(table_.size() * 2, kNoColor);
+    table_.swap(old_table);  // old_table now holds the previous slots.
+    const size_t mask = table_.size() - 1;
+    for (uint32_t index : old_table) {
+      if (index == kNoColor) continue;
+      size_t slot = Hash(Color(index), nb_) & mask;
+      while (table_[slot] != kNoColor) slot = (slot + 1) & mask;
+      table_[slot] = index;
+    }
+  }
+
+  size_t nb_;
+  std::vector<pixel_type> colors_;
+  std::vector<uint32_t> table_;
+};
+
+// Rows sampled before the full scan, to reject photographic content quickly.
+static constexpr size_t kNumSampledRows = 32;
+
 }  // namespace palette_internal
 
 Status FwdPalette(Image &input, uint32_t begin_c, uint32_t end_c,
@@ -165,16 +249,36 @@ Status FwdPalette(Image &input, uint32_t begin_c, uint32_t end_c,
       begin_c, end_c, nb_colors);
   int nb_deltas = 0;
   bool delta_used = false;
-  std::set<std::vector<pixel_type>>
-      candidate_palette;  // ordered lexicographically
-  std::vector<std::vector<pixel_type>> candidate_palette_imageorder;
   std::vector<pixel_type> color(nb);
   std::vector<float> color_with_error(nb);
   std::vector<const pixel_type *> p_in(nb);
 
+  if (!lossy && h >= 2 * palette_internal::kNumSampledRows) {
+    // Images with too many colors usually have too many in a few rows spread
+    // over the image already, while the first rows may be flat.
+    palette_internal::ColorHash sampled_colors(nb);
+    const size_t step = h / palette_internal::kNumSampledRows;
+    for (size_t y = step / 2; y < h; y += step) {
+      for (uint32_t c = 0; c < nb; c++) {
+        p_in[c] = input.channel[begin_c + c].Row(y);
+      }
+      for (size_t x = 0; x < w; x++) {
+        for (uint32_t c = 0; c < nb; c++) color[c] = p_in[c][x];
+        sampled_colors.Insert(color.data());
+      }
+      if (sampled_colors.size() > nb_colors) {
+        return false;  // too many colors
+      }
+    }
+  }
+
+  // Colors in image order; the frequent colors of a lossy palette come first.
+  palette_internal::ColorHash candidate_palette(nb);
+
   if (lossy) {
     // Count color frequency for colors that make a cross.
-    std::map<std::vector<pixel_type>, size_t> color_freq_map;
+    palette_internal::ColorHash cross_colors(nb);
+    std::vector<size_t> color_freq;
     for (size_t y = 1; y + 1 < h; y++) {
       for (uint32_t c = 0; c < nb; c++) {
         p_in[c] = input.channel[begin_c + c].Row(y);
@@ -194,33 +298,42 @@ Status FwdPalette(Image &input, uint32_t begin_c, uint32_t end_c,
             }
           }
         }
-        if (makes_cross) color_freq_map[color] += 1;
+        if (!makes_cross) continue;
+        const uint32_t index = cross_colors.Insert(color.data());
+        if (index == color_freq.size()) color_freq.push_back(0);
+        color_freq[index] += 1;
       }
     }
-    // Add colors satisfying frequency condition to the palette.
+    // Add colors satisfying frequency condition to the palette, in
+    // lexicographic order.
     constexpr float kImageFraction = 0.01f;
     size_t color_frequency_lower_bound = 5 + input.h * input.w * kImageFraction;
-    for (const auto &color_freq : color_freq_map) {
-      if (color_freq.second > color_frequency_lower_bound) {
-        candidate_palette.insert(color_freq.first);
-        candidate_palette_imageorder.push_back(color_freq.first);
+    for (uint32_t index : cross_colors.SortedIndices()) {
+      if (color_freq[index] > color_frequency_lower_bound) {
+        candidate_palette.Insert(cross_colors.Color(index));
       }
     }
   }
 
   for (size_t y = 0; y < h; y++) {
+    if (lossy && candidate_palette.size() >= nb_colors) break;
     for (uint32_t c = 0; c < nb; c++) {
       p_in[c] = input.channel[begin_c + c].Row(y);
     }
     for (size_t x = 0; x < w; x++) {
       if (lossy && candidate_palette.size() >= nb_colors) break;
+      // Runs of equal colors are common in images that suit a palette.
+      if (x > 0) {
+        bool same_color = true;
+        for (uint32_t c = 0; c < nb; c++) {
+          same_color &= p_in[c][x] == color[c];
+        }
+        if (same_color) continue;
+      }
       for (uint32_t c = 0; c < nb; c++) {
         color[c] = p_in[c][x];
       }
-      const bool new_color = candidate_palette.insert(color).second;
-      if (new_color) {
-        candidate_palette_imageorder.push_back(color);
-      }
+      candidate_palette.Insert(color.data());
       if (candidate_palette.size() > nb_colors) {
         return false;  // too many colors
       }
@@ -233,32 +346,28 @@ Status FwdPalette(Image &input, uint32_t begin_c, uint32_t end_c,
 
   Channel pch(nb_colors, nb);
   pch.hshift = -1;
-  int x = 0;
   pixel_type *JXL_RESTRICT p_palette = pch.Row(0);
   intptr_t onerow = pch.plane.PixelsPerRow();
   intptr_t onerow_image = input.channel[begin_c].plane.PixelsPerRow();
   const int bit_depth = input.bitdepth;
+  // Palette index of each color of candidate_palette.
+  std::vector<pixel_type> palette_index(nb_colors);
+  std::vector<uint32_t> palette_order;
   if (ordered) {
     JXL_DEBUG_V(7, "Palette of %i colors, using lexicographic order",
                 nb_colors);
-    for (auto pcol : candidate_palette) {
-      JXL_DEBUG_V(9, "  Color %i :  ", x);
-      for (size_t i = 0; i < nb; i++) {
-        p_palette[i * onerow + x] = pcol[i];
-      }
-      for (size_t i = 0; i < nb; i++) {
-        JXL_DEBUG_V(9, "%i ", pcol[i]);
-      }
-      x++;
-    }
+    palette_order = candidate_palette.SortedIndices();
   } else {
     JXL_DEBUG_V(7, "Palette of %i colors, using image order", nb_colors);
-    for (auto pcol : candidate_palette_imageorder) {
-      JXL_DEBUG_V(9, "  Color %i :  ", x);
-      for (size_t i = 0; i < nb; i++) p_palette[i * onerow + x] = pcol[i];
-      for (size_t i = 0; i < nb; i++) JXL_DEBUG_V(9, "%i ", pcol[i]);
-      x++;
-    }
+    palette_order.resize(nb_colors);
+    std::iota(palette_order.begin(), palette_order.end(), 0);
+  }
+  for (size_t x = 0; x < nb_colors; x++) {
+    const pixel_type *pcol = candidate_palette.Color(palette_order[x]);
+    palette_index[palette_order[x]] = x;
+    JXL_DEBUG_V(9, "  Color %i :  ", static_cast<int>(x));
+    for (size_t i = 0; i < nb; i++) p_palette[i * onerow + x] = pcol[i];
+    for (size_t i = 0; i < nb; i++) JXL_DEBUG_V(9, "%i ", pcol[i]);
   }
   std::vector<weighted::State> wp_states;
   for (size_t c = 0; c < nb; c++) {
@@ -286,21 +395,21 @@ Status FwdPalette(Image &input, uint32_t begin_c, uint32_t end_c,
     for (size_t x = 0; x < w; x++) {
       int index;
       if (!lossy) {
-        for (size_t c = 0; c < nb; c++) color[c] = p_in[c][x];
-        // Exact search.
-        for (index = 0; static_cast<uint32_t>(index) < nb_colors; index++) {
-          bool found = true;
+        if (x > 0) {
+          bool same_color = true;
           for (size_t c = 0; c < nb; c++) {
-            if (color[c] != p_palette[c * onerow + index]) {
-              found = false;
-              break;
-            }
+            same_color &= p_in[c][x] == color[c];
+          }
+          if (same_color) {
+            // p[x - 1] was already overwritten with the index.
+            p[x] = p[x - 1];
+            continue;
           }
-          if (found) break;
-        }
-        if (index < nb_deltas) {
-          delta_used = true;
         }
+        for (size_t c = 0; c < nb; c++) color[c] = p_in[c][x];
+        const uint32_t color_index = candidate_palette.Find(color.data());
+        JXL_DASSERT(color_index != palette_internal::kNoColor);
+        index = palette_index[color_index];
       } else {
         for (size_t c = 0; c < nb; c++) {
           color_with_error[c] = p_in[c][x] + error_row[0][c][x + 2];
@@ -143,8 +143,16 @@ static Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
           [&](const int task, const int thread) {
             const size_t y = task;
             pixel_type *p = input.channel[c0].Row(y);
+            const pixel_type max_index = static_cast<pixel_type>(palette.w) - 1;
+            if (max_index >= 0) {
+              // Clamped indices are always explicit palette entries.
+              for (size_t x = 0; x < w; x++) {
+                p[x] = p_palette[Clamp1(p[x], 0, max_index)];
+              }
+              return;
+            }
             for (size_t x = 0; x < w; x++) {
-              const int index = Clamp1(p[x], 0, (pixel_type)palette.w - 1);
+              const int index = Clamp1(p[x], 0, max_index);
               p[x] = palette_internal::GetPaletteValue(
                   p_palette, index, /*c=*/0,
                   /*palette_size=*/palette.w,
@@ -157,15 +165,26 @@ static Status InvPalette(Image &input, uint32_t begin_c, uint32_t nb_colors,
           pool, 0, h, ThreadPool::SkipInit(),
           [&](const int task, const int thread) {
             const size_t y = task;
-            std::vector<pixel_type *> p_out(nb);
             const pixel_type *p_index = input.channel[c0].Row(y);
-            for (int c = 0; c < nb; c++)
-              p_out[c] = input.channel[c0 + c].Row(y);
+            // If no index of the row refers to an implicit entry, each channel
+            // is a plain table lookup.
+            bool all_explicit = true;
             for (size_t x = 0; x < w; x++) {
-              const int index = p_index[x];
-              for (int c = 0; c < nb; c++) {
-                p_out[c][x] = palette_internal::GetPaletteValue(
-                    p_palette, index, /*c=*/c,
+              all_explicit &= static_cast<uint32_t>(p_index[x]) < palette.w;
+            }
+            // The first output channel holds the indices: write it last.
+            for (int c = nb - 1; c >= 0; c--) {
+              pixel_type *p_out = input.channel[c0 + c].Row(y);
+              if (all_explicit) {
+                const pixel_type *p_palette_c = p_palette + c * onerow;
+                for (size_t x = 0; x < w; x++) {
+                  p_out[x] = p_palette_c[p_index[x]];
+                }
+                continue;
+              }
+              for (size_t x = 0; x < w; x++) {
+                p_out[x] = palette_internal::GetPaletteValue(
+                    p_palette, p_index[x], /*c=*/c,
                     /*palette_size=*/palette.w,
                     /*onerow=*/onerow, /*bit_depth=*/bit_depth);
               }
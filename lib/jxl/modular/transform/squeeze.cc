@@ -7,6 +7,9 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
+#include <vector>
+
 #include "lib/jxl/base/data_parallel.h"
 #include "lib/jxl/common.h"
 #include "lib/jxl/modular/modular_image.h"
@@ -280,11 +283,112 @@ Status MetaSqueeze(Image &image, std::vector<SqueezeParams> *parameters) {
   return true;
 }
 
+namespace {
+
+// Size and shifts that a channel whose refinement stopped early would have if
+// all of its squeeze steps were undone.
+struct PendingChannel {
+  bool pending = false;
+  size_t w = 0, h = 0;
+  int hshift = 0, vshift = 0;
+};
+
+// Source positions and weights of the linear interpolation of one axis that
+// was squeezed `shift` times. Squeezed sample i averages the 2^shift full
+// resolution samples starting at i << shift, so it sits at their center, and
+// output sample x interpolates between its two nearest centers with weights
+// out of 2^(shift+1); edges repeat the outermost sample.
+struct UpsampleTaps {
+  std::vector<size_t> first, second;
+  std::vector<pixel_type_w> weight;  // of `second`
+};
+
+UpsampleTaps ComputeUpsampleTaps(size_t in_size, size_t out_size, int shift) {
+  UpsampleTaps taps;
+  taps.first.resize(out_size);
+  taps.second.resize(out_size);
+  taps.weight.resize(out_size);
+  const int64_t scale = int64_t{1} << shift;
+  for (size_t x = 0; x < out_size; x++) {
+    // Position of x in units of 1/(2 * scale) input samples.
+    const int64_t pos =
+        std::max<int64_t>(2 * static_cast<int64_t>(x) + 1 - scale, 0);
+    const size_t i = pos >> (shift + 1);
+    if (i + 1 >= in_size) {
+      taps.first[x] = taps.second[x] = in_size - 1;
+      taps.weight[x] = 0;
+      continue;
+    }
+    taps.first[x] = i;
+    taps.second[x] = i + 1;
+    taps.weight[x] = pos - (static_cast<int64_t>(i) << (shift + 1));
+  }
+  return taps;
+}
+
+// Replaces `channel` with its bilinear upsampling to `target`, so that images
+// whose finest squeeze levels were not decoded still look smooth rather than
+// blocky. Each squeeze step halves coordinates (rounding up the size).
+void UpsampleChannel(Channel &channel, const PendingChannel &target,
+                     ThreadPool *pool) {
+  const int dx = channel.hshift - target.hshift;
+  const int dy = channel.vshift - target.vshift;
+  JXL_ASSERT(dx >= 0 && dy >= 0);
+  Channel chout(target.w, target.h, target.hshift, target.vshift);
+  JXL_DEBUG_V(4, "Upsampling channel from %zux%zu to %zux%zu", channel.w,
+              channel.h, chout.w, chout.h);
+  if (channel.w == 0 || channel.h == 0) {
+    channel = std::move(chout);
+    return;
+  }
+  const UpsampleTaps tx = ComputeUpsampleTaps(channel.w, chout.w, dx);
+  const UpsampleTaps ty = ComputeUpsampleTaps(channel.h, chout.h, dy);
+  const int total_shift = dx + dy + 2;
+  const pixel_type_w wx_total = pixel_type_w{2} << dx;
+  const pixel_type_w wy_total = pixel_type_w{2} << dy;
+  RunOnPool(
+      pool, 0, chout.h, ThreadPool::SkipInit(),
+      [&](const int task, const int thread) {
+        const size_t y = task;
+        const pixel_type *JXL_RESTRICT p_in0 = channel.Row(ty.first[y]);
+        const pixel_type *JXL_RESTRICT p_in1 = channel.Row(ty.second[y]);
+        const pixel_type_w wy1 = ty.weight[y];
+        const pixel_type_w wy0 = wy_total - wy1;
+        pixel_type *JXL_RESTRICT p_out = chout.Row(y);
+        for (size_t x = 0; x < chout.w; x++) {
+          const size_t x0 = tx.first[x], x1 = tx.second[x];
+          const pixel_type_w wx1 = tx.weight[x];
+          const pixel_type_w wx0 = wx_total - wx1;
+          const pixel_type_w top = p_in0[x0] * wx0 + p_in0[x1] * wx1;
+          const pixel_type_w bottom = p_in1[x0] * wx0 + p_in1[x1] * wx1;
+          const pixel_type_w sum = top * wy0 + bottom * wy1;
+          // Rounds to nearest; >> is a floor division also for negatives.
+          p_out[x] = static_cast<pixel_type>(
+              (sum + (pixel_type_w{1} << (total_shift - 1))) >> total_shift);
+        }
+      },
+      "UpsampleSqueezedChannel");
+  channel = std::move(chout);
+}
+
+}  // namespace
+
 Status InvSqueeze(Image &input, std::vector<SqueezeParams> parameters,
                   ThreadPool *pool) {
+  return InvSqueeze(input, std::move(parameters), pool,
+                    std::vector<bool>(input.channel.size(), true));
+}
+
+Status InvSqueeze(Image &input, std::vector<SqueezeParams> parameters,
+                  ThreadPool *pool, std::vector<bool> decoded) {
   if (parameters.empty()) {
     DefaultSqueezeParameters(&parameters, input);
   }
+  if (decoded.size() != input.channel.size()) {
+    return JXL_FAILURE("Invalid decoded channels");
+  }
+  // Entries are kept in sync with input.channel.
+  std::vector<PendingChannel> pending(input.channel.size());
 
   for (int i = parameters.size() - 1; i >= 0; i--) {
     JXL_RETURN_IF_ERROR(
@@ -310,18 +414,48 @@ Status InvSqueeze(Image &input, std::vector<SqueezeParams> parameters,
       // MetaApply should imply that `rc` is within range, otherwise there's a
       // programming bug.
       JXL_ASSERT(rc < input.channel.size());
-      if ((input.channel[c].w < input.channel[rc].w) ||
-          (input.channel[c].h < input.channel[rc].h)) {
+      const Channel &chin = input.channel[c];
+      const Channel &chin_residual = input.channel[rc];
+      PendingChannel &target = pending[c];
+      const size_t w = target.pending ? target.w : chin.w;
+      const size_t h = target.pending ? target.h : chin.h;
+      if ((w < chin_residual.w) || (h < chin_residual.h)) {
         return JXL_FAILURE("Corrupted squeeze transform");
       }
+      const bool has_residual =
+          decoded[rc] || chin_residual.w == 0 || chin_residual.h == 0;
+      if (!target.pending && has_residual) {
+        if (horizontal) {
+          InvHSqueeze(input, c, rc, pool);
+        } else {
+          InvVSqueeze(input, c, rc, pool);
+        }
+        continue;
+      }
+      if (!target.pending) {
+        target.pending = true;
+        target.w = chin.w;
+        target.h = chin.h;
+        target.hshift = chin.hshift;
+        target.vshift = chin.vshift;
+      }
       if (horizontal) {
-        InvHSqueeze(input, c, rc, pool);
+        target.w += chin_residual.w;
+        target.hshift--;
       } else {
-        InvVSqueeze(input, c, rc, pool);
+        target.h += chin_residual.h;
+        target.vshift--;
       }
     }
     input.channel.erase(input.channel.begin() + offset,
                         input.channel.begin() + offset + (endc - beginc + 1));
+    decoded.erase(decoded.begin() + offset,
+                  decoded.begin() + offset + (endc - beginc + 1));
+    pending.erase(pending.begin() + offset,
+                  pending.begin() + offset + (endc - beginc + 1));
+  }
+  for (size_t c = 0; c < input.channel.size(); c++) {
+    if (pending[c].pending) UpsampleChannel(input.channel[c], pending[c], pool);
   }
   return true;
 }
@@ -89,6 +89,14 @@ Status MetaSqueeze(Image &image, std::vector<SqueezeParams> *parameters);
 Status InvSqueeze(Image &input, std::vector<SqueezeParams> parameters,
                   ThreadPool *pool);
 
+// Like InvSqueeze, but `decoded[c]` tells whether channel `c` of `input` was
+// actually decoded (e.g. not zero-filled because a pass is missing). The first
+// missing residual of a channel stops its refinement: the channel is upsampled
+// to its final size by pixel replication instead, which is much cheaper than
+// undoing the remaining steps with all-zero residuals.
+Status InvSqueeze(Image &input, std::vector<SqueezeParams> parameters,
+                  ThreadPool *pool, std::vector<bool> decoded);
+
 }  // namespace jxl
 
 #endif  // LIB_JXL_MODULAR_TRANSFORM_SQUEEZE_H_
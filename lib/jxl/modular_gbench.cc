@@ -0,0 +1,72 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <random>
+
+#include "benchmark/benchmark.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/enc_bit_writer.h"
+#include "lib/jxl/modular/encoding/enc_encoding.h"
+#include "lib/jxl/modular/encoding/encoding.h"
+#include "lib/jxl/modular/modular_image.h"
+#include "lib/jxl/modular/options.h"
+
+namespace jxl {
+namespace {
+
+constexpr size_t kSize = 256;
+constexpr size_t kNumChannels = 3;
+
+// Smooth gradients with some noise, so that the learned trees are not trivial.
+Image TestImage() {
+  Image image(kSize, kSize, /*bitdepth=*/8, kNumChannels);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> noise(-4, 4);
+  for (size_t c = 0; c < kNumChannels; c++) {
+    for (size_t y = 0; y < kSize; y++) {
+      pixel_type* JXL_RESTRICT row = image.channel[c].Row(y);
+      for (size_t x = 0; x < kSize; x++) {
+        row[x] = ((x * (c + 1) + y * 2) & 0xFF) / 2 + noise(rng);
+      }
+    }
+  }
+  return image;
+}
+
+// Arguments: predictor and tree mode. They select which of the decoder
+// loops (WP-only, tree without WP, tree with WP) is used.
+void BM_ModularDecode(benchmark::State& state) {
+  ModularOptions options;
+  options.predictor = static_cast<Predictor>(state.range(0));
+  options.wp_tree_mode = static_cast<ModularOptions::TreeMode>(state.range(1));
+  Image image = TestImage();
+  BitWriter writer;
+  JXL_CHECK(ModularGenericCompress(image, options, &writer));
+  writer.ZeroPadToByte();
+  for (auto _ : state) {
+    Image decoded(kSize, kSize, /*bitdepth=*/8, kNumChannels);
+    BitReader reader(writer.GetSpan());
+    JXL_CHECK(ModularGenericDecompress(&reader, decoded, /*header=*/nullptr,
+                                       /*group_id=*/0, &options));
+    JXL_CHECK(reader.Close());
+    benchmark::DoNotOptimize(decoded.channel[0].Row(0)[0]);
+  }
+  state.SetItemsProcessed(state.iterations() * kSize * kSize * kNumChannels);
+}
+
+BENCHMARK(BM_ModularDecode)
+    ->Args({static_cast<int>(Predictor::Gradient),
+            static_cast<int>(ModularOptions::TreeMode::kGradientOnly)})
+    ->Args({static_cast<int>(Predictor::Gradient),
+            static_cast<int>(ModularOptions::TreeMode::kNoWP)})
+    ->Args({static_cast<int>(Predictor::Weighted),
+            static_cast<int>(ModularOptions::TreeMode::kWPOnly)})
+    ->Args({static_cast<int>(Predictor::Weighted),
+            static_cast<int>(ModularOptions::TreeMode::kDefault)})
+    ->Args({static_cast<int>(Predictor::Best),
+            static_cast<int>(ModularOptions::TreeMode::kDefault)});
+
+}  // namespace
+}  // namespace jxl
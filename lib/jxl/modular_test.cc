@@ -5,8 +5,11 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include <algorithm>
 #include <array>
+#include <memory>
 #include <random>
 #include <string>
 #include <utility>
@@ -23,18 +26,30 @@
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/color_encoding_internal.h"
 #include "lib/jxl/color_management.h"
+#include "lib/jxl/dec_ans.h"
+#include "lib/jxl/dec_bit_reader.h"
+#include "lib/jxl/dec_cache.h"
 #include "lib/jxl/dec_file.h"
+#include "lib/jxl/dec_frame.h"
 #include "lib/jxl/dec_params.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_bit_writer.h"
 #include "lib/jxl/enc_butteraugli_comparator.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_file.h"
+#include "lib/jxl/enc_frame.h"
 #include "lib/jxl/enc_params.h"
+#include "lib/jxl/frame_header.h"
 #include "lib/jxl/image.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
 #include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/modular/encoding/enc_encoding.h"
 #include "lib/jxl/modular/encoding/encoding.h"
+#include "lib/jxl/modular/transform/enc_palette.h"
+#include "lib/jxl/modular/transform/enc_squeeze.h"
+#include "lib/jxl/modular/transform/palette.h"
+#include "lib/jxl/modular/transform/squeeze.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testdata.h"
 
@@ -124,6 +139,276 @@ TEST(ModularTest, RoundtripLossy16) {
             1.5);
 }
 
+TEST(ModularTest, RoundtripLossless12BitGroups) {
+  // Larger than a group, without global transforms, so that the decoder
+  // stores the frame with 16 bits per sample.
+  constexpr size_t kXSize = 300;
+  constexpr size_t kYSize = 270;
+  constexpr float kMaxVal = 4095.0f;
+  ThreadPoolInternal pool(4);
+  std::mt19937 rng(12);
+  std::uniform_int_distribution<int> dist(0, 4095);
+  Image3F color(kXSize, kYSize);
+  ImageF alpha(kXSize, kYSize);
+  for (size_t y = 0; y < kYSize; y++) {
+    for (size_t c = 0; c < 3; c++) {
+      float* JXL_RESTRICT row = color.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        // Smooth content with some noise.
+        row[x] = ((x * (c + 1) + y * 7) % 3000 + dist(rng) % 64) / kMaxVal;
+      }
+    }
+    float* JXL_RESTRICT row = alpha.Row(y);
+    for (size_t x = 0; x < kXSize; x++) row[x] = dist(rng) / kMaxVal;
+  }
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(12);
+  io.metadata.m.SetAlphaBits(12);
+  io.SetFromImage(std::move(color), ColorEncoding::SRGB());
+  io.Main().SetAlpha(std::move(alpha), /*alpha_is_premultiplied=*/false);
+
+  CompressParams cparams;
+  cparams.modular_mode = true;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  cparams.colorspace = 0;
+  cparams.palette_colors = 0;
+  cparams.channel_colors_pre_transform_percent = 0;
+  DecompressParams dparams;
+
+  CodecInOut io_out;
+  Roundtrip(&io, cparams, dparams, &pool, &io_out);
+  VerifyRelativeError(*io.Main().color(), *io_out.Main().color(),
+                      0.5f / kMaxVal, 0.0f);
+  VerifyRelativeError(*io.Main().alpha(), *io_out.Main().alpha(),
+                      0.5f / kMaxVal, 0.0f);
+
+  // Decode the frame on its own to check that it was stored with 16 bits.
+  io.metadata.m.xyb_encoded = false;
+  PassesEncoderState enc_state;
+  BitWriter writer;
+  ASSERT_TRUE(EncodeFrame(cparams, FrameInfo{}, &io.metadata, io.Main(),
+                          &enc_state, &pool, &writer, /*aux_out=*/nullptr));
+  writer.ZeroPadToByte();
+  const PaddedBytes frame = std::move(writer).TakeBytes();
+  PassesDecoderState dec_state;
+  ASSERT_TRUE(dec_state.output_encoding_info.Set(
+      io.metadata, ColorEncoding::LinearSRGB(/*is_gray=*/false)));
+  FrameDecoder frame_decoder(&dec_state, io.metadata, &pool);
+  BitReader reader(frame);
+  ImageBundle decoded(&io.metadata.m);
+  ASSERT_TRUE(frame_decoder.InitFrame(&reader, &decoded, /*is_preview=*/false,
+                                      /*allow_partial_frames=*/false,
+                                      /*allow_partial_dc_global=*/false));
+  const size_t toc_end = reader.TotalBitsConsumed() / kBitsPerByte;
+  std::vector<std::unique_ptr<BitReader>> section_readers;
+  std::vector<FrameDecoder::SectionInfo> section_info;
+  for (size_t i = 0; i < frame_decoder.NumSections(); i++) {
+    section_readers.emplace_back(make_unique<BitReader>(Span<const uint8_t>(
+        frame.data() + toc_end + frame_decoder.SectionOffsets()[i],
+        frame_decoder.SectionSizes()[i])));
+    section_info.push_back({section_readers.back().get(), i});
+  }
+  std::vector<FrameDecoder::SectionStatus> section_status(section_info.size());
+  ASSERT_TRUE(frame_decoder.ProcessSections(
+      section_info.data(), section_info.size(), section_status.data()));
+  // Three color channels and alpha, no meta channels.
+  for (size_t c = 0; c < 4; c++) {
+    EXPECT_TRUE(frame_decoder.GetModularFrameDecoder().IsStoredIn16Bit(c))
+        << "c=" << c;
+  }
+  ASSERT_TRUE(frame_decoder.FinalizeFrame());
+  for (auto& br : section_readers) EXPECT_TRUE(br->Close());
+  EXPECT_TRUE(reader.Close());
+}
+
+TEST(ModularTest, RoundtripLosslessRowIndex) {
+  // Fits in one group, so all the channels are in the global stream.
+  constexpr size_t kXSize = 200;
+  constexpr size_t kYSize = 150;
+  ThreadPoolInternal pool(8);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(0, 15);
+  Image3F color(kXSize, kYSize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      float* JXL_RESTRICT row = color.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = ((x * (c + 1) + y * 3) % 200 + dist(rng)) / 255.0f;
+      }
+    }
+  }
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(8);
+  io.SetFromImage(std::move(color), ColorEncoding::SRGB());
+
+  CompressParams cparams;
+  cparams.modular_mode = true;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  cparams.palette_colors = 0;
+  DecompressParams dparams;
+
+  CodecInOut io_ref;
+  size_t ref_size = Roundtrip(&io, cparams, dparams, &pool, &io_ref);
+  cparams.modular_row_index = true;
+  CodecInOut io_out;
+  size_t compressed_size = Roundtrip(&io, cparams, dparams, &pool, &io_out);
+  EXPECT_GT(compressed_size, ref_size);
+  EXPECT_LE(compressed_size, ref_size + 3 * kYSize * 8);
+  VerifyRelativeError(*io.Main().color(), *io_out.Main().color(),
+                      0.5f / 255.0f, 0.0f);
+  // Also decodes without threads, ignoring the index.
+  CodecInOut io_serial;
+  Roundtrip(&io, cparams, dparams, /*pool=*/nullptr, &io_serial);
+  VerifyRelativeError(*io_out.Main().color(), *io_serial.Main().color(), 0.0f,
+                      0.0f);
+}
+
+TEST(ModularTest, RowIndexMismatchFallsBackToSequential) {
+  constexpr size_t kXSize = 70;
+  constexpr size_t kYSize = 40;
+  constexpr size_t kNumChannels = 3;
+  ThreadPoolInternal pool(4);
+  std::mt19937 rng(0);
+  Image image(kXSize, kYSize, 8, kNumChannels);
+  for (size_t c = 0; c < kNumChannels; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      pixel_type* JXL_RESTRICT row = image.channel[c].Row(y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = (x * (c + 1) + y * 3) % 200 + rng() % 16;
+      }
+    }
+  }
+  // Uses a property of the previous channel, so that the rows of each channel
+  // are decoded concurrently, but not the channels.
+  Tree tree;
+  tree.push_back(PropertyDecisionNode::Split(kNumNonrefProperties, 150, 1));
+  tree.push_back(PropertyDecisionNode::Leaf(Predictor::Gradient));
+  tree.push_back(PropertyDecisionNode::Leaf(Predictor::Weighted));
+  const size_t num_contexts = (tree.size() + 1) / 2;
+  GroupHeader header;
+  header.use_global_tree = true;
+  std::vector<std::vector<Token>> tokens(1);
+  TokenCheckpoints checkpoints;
+  for (size_t c = 0; c < kNumChannels; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      checkpoints.tokens.push_back(tokens[0].size() + y * kXSize);
+    }
+    ASSERT_TRUE(EncodeModularChannelMAANS(image, c, header.wp_header, tree,
+                                          &tokens[0], /*aux_out=*/nullptr,
+                                          /*group_id=*/0,
+                                          /*skip_encoder_fast_path=*/false));
+  }
+  EntropyEncodingData codes;
+  std::vector<uint8_t> context_map;
+  BitWriter histo_writer;
+  // The row index is not used with LZ77.
+  HistogramParams params;
+  params.lz77_method = HistogramParams::LZ77Method::kNone;
+  BuildAndEncodeHistograms(params, num_contexts, tokens, &codes, &context_map,
+                           &histo_writer, 0, nullptr);
+  histo_writer.ZeroPadToByte();
+  BitWriter writer;
+  ASSERT_TRUE(Bundle::Write(header, &writer, 0, nullptr));
+  WriteTokens(tokens[0], codes, context_map, &writer, 0, nullptr,
+              &checkpoints);
+  writer.ZeroPadToByte();
+
+  ANSCode code;
+  std::vector<uint8_t> decoded_context_map;
+  BitReader histo_reader(histo_writer.GetSpan());
+  ASSERT_TRUE(DecodeHistograms(&histo_reader, num_contexts, &code,
+                               &decoded_context_map));
+  ASSERT_TRUE(histo_reader.Close());
+  ASSERT_FALSE(code.use_prefix_code);
+  ASSERT_FALSE(code.lz77.enabled);
+
+  const auto expect_decodes = [&](const ModularRowIndex& row_index) {
+    Image decoded(kXSize, kYSize, 8, kNumChannels);
+    ModularOptions options;
+    BitReader reader(writer.GetSpan());
+    EXPECT_TRUE(ModularGenericDecompress(
+        &reader, decoded, /*header=*/nullptr, /*group_id=*/0, &options,
+        /*undo_transforms=*/-1, &tree, &code, &decoded_context_map,
+        /*allow_truncated_group=*/false, &row_index, &pool));
+    EXPECT_TRUE(reader.Close());
+    for (size_t c = 0; c < kNumChannels; c++) {
+      VerifyRelativeError(image.channel[c].plane, decoded.channel[c].plane, 0,
+                          0);
+    }
+  };
+  ModularRowIndex row_index;
+  row_index.per_channel = false;
+  row_index.bit_offsets = checkpoints.bit_offsets;
+  row_index.ans_states = checkpoints.ans_states;
+  ModularRowIndex channel_index;
+  channel_index.per_channel = true;
+  for (size_t c = 0; c < kNumChannels; c++) {
+    channel_index.bit_offsets.push_back(row_index.bit_offsets[c * kYSize]);
+    channel_index.ans_states.push_back(row_index.ans_states[c * kYSize]);
+  }
+  for (const ModularRowIndex& index : {row_index, channel_index}) {
+    expect_decodes(index);
+    // A middle row or channel that does not start where the previous one
+    // ends.
+    const size_t middle = index.bit_offsets.size() / 2;
+    ModularRowIndex bad_state = index;
+    bad_state.ans_states[middle] ^= 1;
+    expect_decodes(bad_state);
+    ModularRowIndex bad_offset = index;
+    bad_offset.bit_offsets[middle] += 1;
+    expect_decodes(bad_offset);
+  }
+
+  ModularRowIndex empty;
+  empty.per_channel = false;
+  expect_decodes(empty);
+  empty.per_channel = true;
+  expect_decodes(empty);
+}
+
+TEST(ModularTest, RoundtripIndependentChannels) {
+  constexpr size_t kXSize = 200;
+  constexpr size_t kYSize = 150;
+  ThreadPoolInternal pool(8);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(0, 15);
+  Image3F color(kXSize, kYSize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      float* JXL_RESTRICT row = color.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = ((x * (c + 1) + y * 3) % 200 + dist(rng)) / 255.0f;
+      }
+    }
+  }
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(8);
+  io.SetFromImage(std::move(color), ColorEncoding::SRGB());
+
+  CompressParams cparams;
+  cparams.modular_mode = true;
+  cparams.color_transform = jxl::ColorTransform::kNone;
+  cparams.palette_colors = 0;
+  DecompressParams dparams;
+
+  CodecInOut io_ref;
+  size_t ref_size = Roundtrip(&io, cparams, dparams, &pool, &io_ref);
+  // Properties of previous channels are not used, even if requested.
+  cparams.options.max_properties = 4;
+  cparams.modular_independent_channels = true;
+  CodecInOut io_out;
+  size_t compressed_size = Roundtrip(&io, cparams, dparams, &pool, &io_out);
+  EXPECT_GT(compressed_size, ref_size);
+  EXPECT_LE(compressed_size, ref_size + 3 * 8);
+  VerifyRelativeError(*io.Main().color(), *io_out.Main().color(),
+                      0.5f / 255.0f, 0.0f);
+  // Also decodes without threads, ignoring the index.
+  CodecInOut io_serial;
+  Roundtrip(&io, cparams, dparams, /*pool=*/nullptr, &io_serial);
+  VerifyRelativeError(*io_out.Main().color(), *io_serial.Main().color(), 0.0f,
+                      0.0f);
+}
+
 TEST(ModularTest, RoundtripExtraProperties) {
   constexpr size_t kSize = 250;
   Image image(kSize, kSize, /*bitdepth=*/8, 3);
@@ -167,5 +452,137 @@ TEST(ModularTest, RoundtripExtraProperties) {
   }
 }
 
+TEST(ModularTest, PaletteRoundtrip) {
+  constexpr size_t kXSize = 300;
+  constexpr size_t kYSize = 200;
+  constexpr size_t kNumColors = 500;
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<std::array<pixel_type, 3>> colors(kNumColors);
+  for (auto& color : colors) {
+    for (pixel_type& v : color) v = dist(rng);
+  }
+  for (bool ordered : {false, true}) {
+    Image image(kXSize, kYSize, /*bitdepth=*/8, 3);
+    for (size_t y = 0; y < kYSize; y++) {
+      for (size_t x = 0; x < kXSize; x++) {
+        // Runs of equal colors, as in screen content.
+        const auto& color = colors[(x / 7 + y * 13) % kNumColors];
+        for (size_t c = 0; c < 3; c++) image.channel[c].Row(y)[x] = color[c];
+      }
+    }
+    uint32_t nb_colors = kNumColors;
+    Predictor predictor = Predictor::Gradient;
+    weighted::Header wp_header;
+    ASSERT_TRUE(FwdPalette(image, 0, 2, nb_colors, ordered, /*lossy=*/false,
+                           predictor, wp_header));
+    ASSERT_EQ(kNumColors, nb_colors);
+    EXPECT_EQ(Predictor::Zero, predictor);
+    ASSERT_EQ(2u, image.channel.size());
+    const Channel& palette = image.channel[0];
+    const intptr_t onerow = palette.plane.PixelsPerRow();
+    for (size_t i = 1; i < kNumColors; i++) {
+      const pixel_type* prev = palette.Row(0) + i - 1;
+      const pixel_type* cur = palette.Row(0) + i;
+      const std::array<pixel_type, 3> a = {prev[0], prev[onerow],
+                                           prev[2 * onerow]};
+      const std::array<pixel_type, 3> b = {cur[0], cur[onerow],
+                                           cur[2 * onerow]};
+      if (ordered) {
+        EXPECT_LT(a, b);
+      } else {
+        // Image order: color k first appears before color k + 1.
+        EXPECT_EQ(colors[i - 1], a);
+      }
+    }
+    // One implicit (delta) entry takes the slow path of the inverse palette.
+    const pixel_type implicit_index = -2;
+    image.channel[1].Row(0)[0] = implicit_index;
+    ASSERT_TRUE(InvPalette(image, 0, nb_colors, 0, predictor, wp_header,
+                           /*pool=*/nullptr));
+    ASSERT_EQ(3u, image.channel.size());
+    for (size_t c = 0; c < 3; c++) {
+      for (size_t y = 0; y < kYSize; y++) {
+        for (size_t x = 0; x < kXSize; x++) {
+          const pixel_type expected =
+              x == 0 && y == 0 ? palette_internal::GetPaletteValue(
+                                     nullptr, implicit_index, c, kNumColors,
+                                     /*onerow=*/0, /*bit_depth=*/8)
+                               : colors[(x / 7 + y * 13) % kNumColors][c];
+          ASSERT_EQ(expected, image.channel[c].Row(y)[x])
+              << "c = " << c << ", x = " << x << ",  y = " << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(ModularTest, PaletteTooManyColors) {
+  constexpr size_t kXSize = 256;
+  constexpr size_t kYSize = 256;
+  // Flat top, noisy bottom.
+  Image image(kXSize, kYSize, /*bitdepth=*/8, 3);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      for (size_t x = 0; x < kXSize; x++) {
+        image.channel[c].Row(y)[x] = y < kYSize / 2 ? 0 : dist(rng);
+      }
+    }
+  }
+  uint32_t nb_colors = 1024;
+  Predictor predictor = Predictor::Gradient;
+  EXPECT_FALSE(FwdPalette(image, 0, 2, nb_colors, /*ordered=*/true,
+                          /*lossy=*/false, predictor, weighted::Header()));
+  EXPECT_EQ(3u, image.channel.size());
+  EXPECT_EQ(0, image.channel[0].Row(0)[0]);
+}
+
+TEST(ModularTest, SqueezeMissingResiduals) {
+  constexpr size_t kXSize = 300;
+  constexpr size_t kYSize = 100;
+  // A ramp, which bilinear upsampling of the averages reproduces away from the
+  // edges.
+  const auto make_image = [&]() {
+    Image image(kXSize, kYSize, /*bitdepth=*/10, 1);
+    for (size_t y = 0; y < kYSize; y++) {
+      for (size_t x = 0; x < kXSize; x++) {
+        image.channel[0].Row(y)[x] = x + 2 * y;
+      }
+    }
+    return image;
+  };
+  std::vector<SqueezeParams> params;
+  Image image = make_image();
+  DefaultSqueezeParameters(&params, image);
+  ASSERT_TRUE(FwdSqueeze(image, params, /*pool=*/nullptr));
+  // Residuals with a shift below 2 were not decoded: the squeeze steps to
+  // (1, 0), (1, 1) and (2, 1) cannot be undone.
+  std::vector<bool> decoded(image.channel.size());
+  for (size_t c = 0; c < image.channel.size(); c++) {
+    const Channel& channel = image.channel[c];
+    decoded[c] = c == 0 || std::min(channel.hshift, channel.vshift) >= 2;
+  }
+  ASSERT_TRUE(InvSqueeze(image, params, /*pool=*/nullptr, decoded));
+  ASSERT_EQ(1u, image.channel.size());
+  const Channel& channel = image.channel[0];
+  ASSERT_EQ(kXSize, channel.w);
+  ASSERT_EQ(kYSize, channel.h);
+  EXPECT_EQ(0, channel.hshift);
+  EXPECT_EQ(0, channel.vshift);
+
+  // Nearest-neighbour upsampling by (4, 2) would be off in most pixels.
+  const Image expected = make_image();
+  for (size_t y = 0; y < kYSize; y++) {
+    for (size_t x = 0; x < kXSize; x++) {
+      const bool border = x < 2 || x + 2 >= kXSize || y < 1 || y + 1 >= kYSize;
+      ASSERT_LE(std::abs(expected.channel[0].Row(y)[x] - channel.Row(y)[x]),
+                border ? 3 : 0)
+          << "x = " << x << ", y = " << y;
+    }
+  }
+}
+
 }  // namespace
 }  // namespace jxl
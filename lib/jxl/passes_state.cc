@@ -8,9 +8,36 @@
 #include "lib/jxl/chroma_from_luma.h"
 #include "lib/jxl/coeff_order.h"
 #include "lib/jxl/common.h"
+#include "lib/jxl/image_ops.h"
 
 namespace jxl {
 
+const float* PassesSharedState::ReferenceFrame::ConstRow(
+    size_t c, size_t x0, size_t y, size_t xsize,
+    float* JXL_RESTRICT scratch) const {
+  if (!spilled.empty()) {
+    spilled.LoadRow(c, x0, y, xsize, scratch);
+    return scratch;
+  }
+  const ImageBundle& ib = *frame;
+  const ImageF& plane =
+      c < 3 ? ib.color().Plane(c) : ib.extra_channels()[c - 3];
+  return plane.ConstRow(y) + x0;
+}
+
+void PassesSharedState::ReferenceFrame::CopyTo(size_t c, const Rect& rect,
+                                               const Rect& out_rect,
+                                               ImageF* out) const {
+  if (!spilled.empty()) {
+    spilled.CopyTo(c, rect, out_rect, out);
+    return;
+  }
+  const ImageBundle& ib = *frame;
+  const ImageF& plane =
+      c < 3 ? ib.color().Plane(c) : ib.extra_channels()[c - 3];
+  CopyImageTo(rect, plane, out_rect, out);
+}
+
 Status InitializePassesSharedState(const FrameHeader& frame_header,
                                    PassesSharedState* JXL_RESTRICT shared,
                                    bool encoder) {
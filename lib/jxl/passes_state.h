@@ -18,6 +18,7 @@
 #include "lib/jxl/noise.h"
 #include "lib/jxl/quant_weights.h"
 #include "lib/jxl/quantizer.h"
+#include "lib/jxl/spilled_image.h"
 #include "lib/jxl/splines.h"
 
 // Structures that hold the (en/de)coder state for a JPEG XL kVarDCT
@@ -73,7 +74,7 @@ struct PassesSharedState {
 
   Image3F dc_frames[4];
 
-  struct {
+  struct ReferenceFrame {
     ImageBundle storage;
     // Can either point to `storage`, if this is a frame that is not stored in
     // the CodecInOut, or can point to an existing ImageBundle.
@@ -82,6 +83,27 @@ struct PassesSharedState {
     ImageBundle* JXL_RESTRICT frame = &storage;
     // ImageBundle doesn't yet have a simple way to state it is in XYB.
     bool ib_is_in_xyb = false;
+    // If not empty, holds the samples of this frame in place of `storage`,
+    // which is then empty. Access through the methods below to handle both.
+    SpilledImage spilled;
+
+    size_t xsize() const {
+      return spilled.empty() ? frame->xsize() : spilled.xsize();
+    }
+    size_t ysize() const {
+      return spilled.empty() ? frame->ysize() : spilled.ysize();
+    }
+    FrameOrigin origin() const {
+      return spilled.empty() ? frame->origin : spilled.origin();
+    }
+    // Returns `xsize` samples of channel `c` (0-2: color, then extra
+    // channels) starting at (x0, y). Spilled frames are converted into
+    // `scratch`, which must have room for `xsize` floats.
+    const float* ConstRow(size_t c, size_t x0, size_t y, size_t xsize,
+                          float* JXL_RESTRICT scratch) const;
+    // Copies `rect` of channel `c` to `out_rect` of `out`.
+    void CopyTo(size_t c, const Rect& rect, const Rect& out_rect,
+                ImageF* out) const;
   } reference_frames[4] = {};
 
   // Number of pre-clustered set of histograms (with the same ctx map), per
@@ -26,6 +26,7 @@
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/image_bundle.h"
 #include "lib/jxl/image_ops.h"
+#include "lib/jxl/image_test_utils.h"
 #include "lib/jxl/test_utils.h"
 #include "lib/jxl/testdata.h"
 
@@ -337,6 +338,127 @@ TEST(PassesTest, ProgressiveDownsample2DegradesCorrectly) {
   EXPECT_GE(butteraugli_distance_down2_full, 1.0f);
 }
 
+TEST(PassesTest, ResponsiveDownsample2StopsSqueeze) {
+  ThreadPoolInternal pool(8);
+  // Wide, so that the finest squeeze steps are horizontal. Gradients with a
+  // little noise, so that interpolating the skipped step stays close.
+  constexpr size_t kXSize = 600;
+  constexpr size_t kYSize = 300;
+  Image3F image(kXSize, kYSize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      float* JXL_RESTRICT row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = (x * (c + 1) / 12 + y / 4 + (x * y) % 7) / 255.0f;
+      }
+    }
+  }
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(8);
+  io.SetFromImage(std::move(image), ColorEncoding::SRGB());
+
+  CompressParams cparams;
+  cparams.modular_mode = true;
+  cparams.responsive = true;
+  cparams.progressive_mode = true;
+  cparams.saliency_num_progressive_steps = 2;
+  cparams.patches = Override::kOff;
+  PaddedBytes compressed;
+  PassesEncoderState enc_state;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed,
+                         /*aux_out=*/nullptr, &pool));
+
+  DecompressParams dparams;
+  CodecInOut output;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &output, &pool));
+  VerifyRelativeError(*io.Main().color(), *output.Main().color(),
+                      0.5f / 255.0f, 0.0f);
+
+  // The residuals of the finest (horizontal) squeeze step are in the last
+  // pass, which is skipped: the image is interpolated from half the width
+  // instead of replicating pairs of pixels.
+  dparams.max_downsampling = 2;
+  CodecInOut output_d2;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &output_d2, &pool));
+  ASSERT_EQ(output_d2.xsize(), kXSize);
+  ASSERT_EQ(output_d2.ysize(), kYSize);
+  size_t num_different_pairs = 0;
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      const float* JXL_RESTRICT row =
+          output_d2.Main().color()->ConstPlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x += 2) {
+        if (row[x] != row[x + 1]) num_different_pairs++;
+      }
+    }
+  }
+  EXPECT_GT(num_different_pairs, 0);
+  VerifyRelativeError(*output.Main().color(), *output_d2.Main().color(),
+                      16.0f / 255.0f, 0.0f);
+}
+
+TEST(PassesTest, ResponsiveTruncatedKeepsDecodedGroups) {
+  ThreadPoolInternal pool(8);
+  // 3x2 groups, the last one is at (512, 256).
+  constexpr size_t kXSize = 600;
+  constexpr size_t kYSize = 300;
+  Image3F image(kXSize, kYSize);
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      float* JXL_RESTRICT row = image.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = ((x * (c + 3) + y * 5 + (x * y) % 7) % 256) / 255.0f;
+      }
+    }
+  }
+  CodecInOut io;
+  io.metadata.m.SetUintSamples(8);
+  io.SetFromImage(std::move(image), ColorEncoding::SRGB());
+
+  CompressParams cparams;
+  cparams.modular_mode = true;
+  cparams.responsive = true;
+  cparams.progressive_mode = true;
+  cparams.saliency_num_progressive_steps = 2;
+  cparams.patches = Override::kOff;
+  PaddedBytes compressed;
+  PassesEncoderState enc_state;
+  ASSERT_TRUE(EncodeFile(cparams, &io, &enc_state, &compressed,
+                         /*aux_out=*/nullptr, &pool));
+
+  DecompressParams dparams;
+  CodecInOut output;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &output, &pool));
+
+  // Only the last pass of the last group is missing: the other groups keep
+  // all of their residuals.
+  compressed.resize(compressed.size() - 1);
+  dparams.allow_partial_files = true;
+  CodecInOut output_partial;
+  ASSERT_TRUE(DecodeFile(dparams, compressed, &output_partial, &pool));
+  ASSERT_EQ(output_partial.xsize(), kXSize);
+  ASSERT_EQ(output_partial.ysize(), kYSize);
+  size_t num_different_last_group = 0;
+  for (size_t c = 0; c < 3; c++) {
+    for (size_t y = 0; y < kYSize; y++) {
+      const float* JXL_RESTRICT row =
+          output.Main().color()->ConstPlaneRow(c, y);
+      const float* JXL_RESTRICT row_partial =
+          output_partial.Main().color()->ConstPlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        // Leave some room for the filters around the last group.
+        if (x < 480 || y < 224) {
+          ASSERT_EQ(row[x], row_partial[x])
+              << "c = " << c << ", x = " << x << ", y = " << y;
+        } else if (x >= 512 && y >= 256 && row[x] != row_partial[x]) {
+          num_different_last_group++;
+        }
+      }
+    }
+  }
+  EXPECT_NE(num_different_last_group, 0);
+}
+
 TEST(PassesTest, NonProgressiveDCImage) {
   ThreadPoolInternal pool(8);
   const PaddedBytes orig =
@@ -0,0 +1,348 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/spilled_image.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cmath>
+#include <string>
+#include <utility>
+
+#include "lib/jxl/base/os_macros.h"
+
+#if !JXL_OS_WIN
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#undef HWY_TARGET_INCLUDE
+#define HWY_TARGET_INCLUDE "lib/jxl/spilled_image.cc"
+#include <hwy/foreach_target.h>
+#include <hwy/highway.h>
+
+#include "lib/jxl/base/cache_aligned.h"
+#include "lib/jxl/common.h"
+
+HWY_BEFORE_NAMESPACE();
+namespace jxl {
+namespace HWY_NAMESPACE {
+
+// The rows of a SpilledImage are tightly packed and thus not aligned, and
+// their length is not a multiple of the vector size: all loops below process
+// whole vectors of `d` and then the remainder with single-lane vectors.
+
+template <class D>
+size_t FloatToIntRow(D d, const float* JXL_RESTRICT in, float scale,
+                     size_t x, size_t xsize, uint8_t* JXL_RESTRICT out,
+                     size_t bytes_per_sample) {
+  const auto vscale = Set(d, scale);
+  const auto one = Set(d, 1.0f);
+  const hwy::HWY_NAMESPACE::Rebind<uint8_t, D> du8;
+  const hwy::HWY_NAMESPACE::Rebind<uint16_t, D> du16;
+  for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+    // Clamp turns NaN to 'min'.
+    auto v = Clamp(LoadU(d, in + x), Zero(d), one);
+    auto i = NearestInt(v * vscale);
+    if (bytes_per_sample == 1) {
+      StoreU(DemoteTo(du8, i), du8, out + x);
+    } else {
+      StoreU(DemoteTo(du16, i), du16,
+             reinterpret_cast<uint16_t*>(out) + x);
+    }
+  }
+  return x;
+}
+
+template <class D, class DI>
+size_t IntToFloatRow(D d, DI di, const uint8_t* JXL_RESTRICT in,
+                     float inv_scale, size_t x, size_t xsize,
+                     float* JXL_RESTRICT out, size_t bytes_per_sample) {
+  const auto vinv_scale = Set(d, inv_scale);
+  const hwy::HWY_NAMESPACE::Rebind<uint8_t, D> du8;
+  const hwy::HWY_NAMESPACE::Rebind<uint16_t, D> du16;
+  const uint16_t* JXL_RESTRICT in16 = reinterpret_cast<const uint16_t*>(in);
+  for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+    auto i = bytes_per_sample == 1 ? PromoteTo(di, LoadU(du8, in + x))
+                                   : PromoteTo(di, LoadU(du16, in16 + x));
+    StoreU(ConvertTo(d, i) * vinv_scale, d, out + x);
+  }
+  return x;
+}
+
+template <class D>
+size_t FloatToF16Row(D d, const float* JXL_RESTRICT in, size_t x, size_t xsize,
+                     hwy::float16_t* JXL_RESTRICT out) {
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, D> df16;
+  for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+    StoreU(DemoteTo(df16, LoadU(d, in + x)), df16, out + x);
+  }
+  return x;
+}
+
+template <class D>
+size_t F16ToFloatRow(D d, const hwy::float16_t* JXL_RESTRICT in, size_t x,
+                     size_t xsize, float* JXL_RESTRICT out) {
+  const hwy::HWY_NAMESPACE::Rebind<hwy::float16_t, D> df16;
+  for (; x + Lanes(d) <= xsize; x += Lanes(d)) {
+    StoreU(PromoteTo(d, LoadU(df16, in + x)), d, out + x);
+  }
+  return x;
+}
+
+void StoreSpilledRow(const float* JXL_RESTRICT in, size_t xsize, int format,
+                     float scale, uint8_t* JXL_RESTRICT out) {
+  const HWY_FULL(float) d;
+  const HWY_CAPPED(float, 1) d1;
+  switch (format) {
+    case 0:
+    case 1: {
+      const size_t bytes_per_sample = format + 1;
+      size_t x = FloatToIntRow(d, in, scale, 0, xsize, out, bytes_per_sample);
+      FloatToIntRow(d1, in, scale, x, xsize, out, bytes_per_sample);
+      break;
+    }
+    case 2: {
+      auto* out16 = reinterpret_cast<hwy::float16_t*>(out);
+      size_t x = FloatToF16Row(d, in, 0, xsize, out16);
+      FloatToF16Row(d1, in, x, xsize, out16);
+      break;
+    }
+    default:
+      memcpy(out, in, xsize * sizeof(float));
+  }
+}
+
+void LoadSpilledRow(const uint8_t* JXL_RESTRICT in, size_t xsize, int format,
+                    float scale, float* JXL_RESTRICT out) {
+  const HWY_FULL(float) d;
+  const HWY_CAPPED(float, 1) d1;
+  const hwy::HWY_NAMESPACE::Rebind<int32_t, decltype(d)> di;
+  const hwy::HWY_NAMESPACE::Rebind<int32_t, decltype(d1)> di1;
+  switch (format) {
+    case 0:
+    case 1: {
+      const size_t bytes_per_sample = format + 1;
+      const float inv_scale = 1.0f / scale;
+      size_t x =
+          IntToFloatRow(d, di, in, inv_scale, 0, xsize, out, bytes_per_sample);
+      IntToFloatRow(d1, di1, in, inv_scale, x, xsize, out, bytes_per_sample);
+      break;
+    }
+    case 2: {
+      const auto* in16 = reinterpret_cast<const hwy::float16_t*>(in);
+      size_t x = F16ToFloatRow(d, in16, 0, xsize, out);
+      F16ToFloatRow(d1, in16, x, xsize, out);
+      break;
+    }
+    default:
+      memcpy(out, in, xsize * sizeof(float));
+  }
+}
+
+// NOLINTNEXTLINE(google-readability-namespace-comments)
+}  // namespace HWY_NAMESPACE
+}  // namespace jxl
+HWY_AFTER_NAMESPACE();
+
+#if HWY_ONCE
+namespace jxl {
+
+HWY_EXPORT(StoreSpilledRow);
+HWY_EXPORT(LoadSpilledRow);
+
+SpilledImage::SpilledImage(SpilledImage&& other) noexcept {
+  *this = std::move(other);
+}
+
+SpilledImage& SpilledImage::operator=(SpilledImage&& other) noexcept {
+  if (this == &other) return *this;
+  Free();
+  xsize_ = other.xsize_;
+  ysize_ = other.ysize_;
+  origin_ = other.origin_;
+  channels_ = std::move(other.channels_);
+  data_ = other.data_;
+  size_ = other.size_;
+  mapped_ = other.mapped_;
+  other.channels_.clear();
+  other.data_ = nullptr;
+  other.size_ = 0;
+  other.mapped_ = false;
+  other.xsize_ = other.ysize_ = 0;
+  return *this;
+}
+
+SpilledImage::~SpilledImage() { Free(); }
+
+void SpilledImage::Free() {
+  if (data_ != nullptr) {
+#if !JXL_OS_WIN
+    if (mapped_) {
+      munmap(data_, size_);
+    } else {
+      CacheAligned::Free(data_);
+    }
+#else
+    CacheAligned::Free(data_);
+#endif
+  }
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+Status SpilledImage::Allocate(size_t size) {
+  Free();
+  if (size == 0) return true;
+#if !JXL_OS_WIN
+  // Back the samples by an unlinked temporary file, so that the kernel can
+  // write them out under memory pressure instead of keeping them resident.
+  const char* tmpdir = getenv("TMPDIR");
+  std::string path = (tmpdir != nullptr && tmpdir[0] != '\0') ? tmpdir : "/tmp";
+  path += "/jxl_spill_XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  if (fd >= 0) {
+    unlink(path.c_str());
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0) {
+      void* mapped =
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mapped != MAP_FAILED) {
+        data_ = static_cast<uint8_t*>(mapped);
+        mapped_ = true;
+      }
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+  }
+#endif
+  if (data_ == nullptr) {
+    // No usable temporary storage: keep the compact copy on the heap.
+    data_ = static_cast<uint8_t*>(CacheAligned::Allocate(size));
+    if (data_ == nullptr) {
+      return JXL_FAILURE("Failed to allocate %zu bytes for spilled image",
+                         size);
+    }
+  }
+  size_ = size;
+  return true;
+}
+
+namespace {
+
+// Returns whether all the samples of `plane` are exactly i / scale for integers
+// i in [0, scale], i.e. whether storing them as integers is lossless. This is
+// the case for the output of lossless decodes, but not for lossy frames, which
+// may have fractional or out-of-range samples.
+bool HasIntegerSamples(const ImageF& plane, size_t xsize, size_t ysize,
+                       float scale) {
+  // Same computation as LoadSpilledRow.
+  const float inv_scale = 1.0f / scale;
+  for (size_t y = 0; y < ysize; y++) {
+    const float* JXL_RESTRICT row = plane.ConstRow(y);
+    for (size_t x = 0; x < xsize; x++) {
+      if (!(row[x] >= 0.0f && row[x] <= 1.0f)) return false;
+      const float i = std::round(row[x] * scale);
+      if (i * inv_scale != row[x]) return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+Status SpilledImage::Create(const ImageBundle& ib, bool is_xyb,
+                            SpilledImage* out) {
+  const ImageMetadata* metadata = ib.metadata();
+  const size_t xsize = ib.xsize();
+  const size_t ysize = ib.ysize();
+  auto format_for = [&](const BitDepth& bit_depth, const ImageF& plane,
+                        Channel* ch) {
+    ch->format = Format::kF32;
+    ch->scale = 1.0f;
+    if (bit_depth.floating_point_sample || bit_depth.bits_per_sample > 16) {
+      return;
+    }
+    const float scale = (1u << bit_depth.bits_per_sample) - 1;
+    if (!HasIntegerSamples(plane, xsize, ysize, scale)) return;
+    ch->format = bit_depth.bits_per_sample <= 8 ? Format::kU8 : Format::kU16;
+    ch->scale = scale;
+  };
+
+  SpilledImage spilled;
+  spilled.xsize_ = xsize;
+  spilled.ysize_ = ysize;
+  spilled.origin_ = ib.origin;
+  spilled.channels_.resize(3 + ib.extra_channels().size());
+  for (size_t c = 0; c < spilled.channels_.size(); c++) {
+    Channel& ch = spilled.channels_[c];
+    if (c >= 3) {
+      format_for(metadata->extra_channel_info[c - 3].bit_depth,
+                 ib.extra_channels()[c - 3], &ch);
+    } else if (is_xyb) {
+      // Color saved before the color transform, which may be out of the
+      // nominal range.
+      ch.format = Format::kF16;
+      ch.scale = 1.0f;
+    } else {
+      format_for(metadata->bit_depth, ib.color().Plane(c), &ch);
+    }
+    switch (ch.format) {
+      case Format::kU8:
+        ch.bytes_per_sample = 1;
+        break;
+      case Format::kU16:
+      case Format::kF16:
+        ch.bytes_per_sample = 2;
+        break;
+      case Format::kF32:
+        ch.bytes_per_sample = 4;
+        break;
+    }
+  }
+  size_t size = 0;
+  for (Channel& ch : spilled.channels_) {
+    ch.offset = size;
+    size += RoundUpTo(spilled.xsize_ * spilled.ysize_ * ch.bytes_per_sample,
+                      sizeof(float));
+  }
+  JXL_RETURN_IF_ERROR(spilled.Allocate(size));
+
+  for (size_t c = 0; c < spilled.channels_.size(); c++) {
+    const Channel& ch = spilled.channels_[c];
+    const ImageF& plane =
+        c < 3 ? ib.color().Plane(c) : ib.extra_channels()[c - 3];
+    for (size_t y = 0; y < spilled.ysize_; y++) {
+      HWY_DYNAMIC_DISPATCH(StoreSpilledRow)
+      (plane.ConstRow(y), spilled.xsize_, static_cast<int>(ch.format),
+       ch.scale, spilled.Row(c, y));
+    }
+  }
+  *out = std::move(spilled);
+  return true;
+}
+
+void SpilledImage::LoadRow(size_t c, size_t x0, size_t y, size_t xsize,
+                           float* JXL_RESTRICT out) const {
+  JXL_DASSERT(c < channels_.size());
+  JXL_DASSERT(x0 + xsize <= xsize_ && y < ysize_);
+  const Channel& ch = channels_[c];
+  HWY_DYNAMIC_DISPATCH(LoadSpilledRow)
+  (ConstRow(c, y) + x0 * ch.bytes_per_sample, xsize,
+   static_cast<int>(ch.format), ch.scale, out);
+}
+
+void SpilledImage::CopyTo(size_t c, const Rect& rect, const Rect& out_rect,
+                          ImageF* out) const {
+  JXL_ASSERT(SameSize(rect, out_rect));
+  JXL_ASSERT(rect.IsInside(Rect(0, 0, xsize_, ysize_)));
+  for (size_t y = 0; y < rect.ysize(); y++) {
+    LoadRow(c, rect.x0(), rect.y0() + y, rect.xsize(), out_rect.Row(out, y));
+  }
+}
+
+}  // namespace jxl
+#endif  // HWY_ONCE
@@ -0,0 +1,102 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#ifndef LIB_JXL_SPILLED_IMAGE_H_
+#define LIB_JXL_SPILLED_IMAGE_H_
+
+// Compact, file-backed storage for decoded frames that are only read back
+// occasionally, such as reference frames of long animations.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "lib/jxl/base/compiler_specific.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/frame_header.h"
+#include "lib/jxl/image.h"
+#include "lib/jxl/image_bundle.h"
+
+namespace jxl {
+
+// Read-only copy of the color and extra channels of an ImageBundle. Channels
+// of up to 16 bits whose samples are all exactly representable as integers (as
+// is the output of a lossless decode) are stored as 8 or 16-bit integers; XYB
+// color (saved before the color transform) is stored as binary16; everything
+// else, including lossy frames saved after the color transform, is kept as
+// float so that spilling does not change the decoded pixels. Samples are held
+// in an unlinked, memory-mapped temporary file where the OS supports it, so
+// that they can be paged out instead of taking up heap memory; otherwise they
+// are kept in a heap buffer.
+//
+// Rows are converted back to float on access, so random access at row
+// granularity (as done by blending and patches) is cheap.
+class SpilledImage {
+ public:
+  SpilledImage() = default;
+  SpilledImage(const SpilledImage&) = delete;
+  SpilledImage& operator=(const SpilledImage&) = delete;
+  SpilledImage(SpilledImage&& other) noexcept;
+  SpilledImage& operator=(SpilledImage&& other) noexcept;
+  ~SpilledImage();
+
+  // Creates a copy of `ib`. If `is_xyb`, the color channels are in XYB and
+  // are always stored as binary16.
+  static Status Create(const ImageBundle& ib, bool is_xyb, SpilledImage* out);
+
+  bool empty() const { return channels_.empty(); }
+  size_t xsize() const { return xsize_; }
+  size_t ysize() const { return ysize_; }
+  // Channels 0-2 are the color channels, followed by the extra channels.
+  size_t num_channels() const { return channels_.size(); }
+  FrameOrigin origin() const { return origin_; }
+  // Number of bytes used to store the samples.
+  size_t bytes() const { return size_; }
+
+  // Converts `xsize` samples of channel `c`, starting at (x0, y), to float.
+  void LoadRow(size_t c, size_t x0, size_t y, size_t xsize,
+               float* JXL_RESTRICT out) const;
+
+  // Copies `rect` of channel `c` to `out_rect` of `out`.
+  void CopyTo(size_t c, const Rect& rect, const Rect& out_rect,
+              ImageF* out) const;
+
+ private:
+  enum class Format : uint8_t { kU8, kU16, kF16, kF32 };
+
+  struct Channel {
+    Format format;
+    // Multiplier from [0, 1] to the stored integer range.
+    float scale;
+    size_t bytes_per_sample;
+    size_t offset;
+  };
+
+  const uint8_t* ConstRow(size_t c, size_t y) const {
+    const Channel& ch = channels_[c];
+    return data_ + ch.offset + y * xsize_ * ch.bytes_per_sample;
+  }
+  uint8_t* Row(size_t c, size_t y) {
+    const Channel& ch = channels_[c];
+    return data_ + ch.offset + y * xsize_ * ch.bytes_per_sample;
+  }
+
+  Status Allocate(size_t size);
+  void Free();
+
+  size_t xsize_ = 0;
+  size_t ysize_ = 0;
+  FrameOrigin origin_{0, 0};
+  std::vector<Channel> channels_;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  // Whether data_ is a file mapping rather than a heap allocation.
+  bool mapped_ = false;
+};
+
+}  // namespace jxl
+
+#endif  // LIB_JXL_SPILLED_IMAGE_H_
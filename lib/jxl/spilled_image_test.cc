@@ -0,0 +1,149 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include "lib/jxl/spilled_image.h"
+
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lib/jxl/color_encoding_internal.h"
+#include "lib/jxl/image_metadata.h"
+
+namespace jxl {
+namespace {
+
+// Odd sizes so that rows do not consist of whole vectors.
+constexpr size_t kXSize = 37;
+constexpr size_t kYSize = 5;
+
+ImageBundle RandomBundle(const ImageMetadata* metadata, float min, float max,
+                         float color_bits, float alpha_bits) {
+  std::mt19937 rng(123);
+  std::uniform_real_distribution<float> dist(min, max);
+  auto quantize = [](float v, float bits) {
+    if (bits == 0) return v;
+    const float mul = std::exp2(bits) - 1;
+    return std::round(v * mul) / mul;
+  };
+  Image3F color(kXSize, kYSize);
+  ImageF alpha(kXSize, kYSize);
+  for (size_t y = 0; y < kYSize; y++) {
+    for (size_t c = 0; c < 3; c++) {
+      float* JXL_RESTRICT row = color.PlaneRow(c, y);
+      for (size_t x = 0; x < kXSize; x++) {
+        row[x] = quantize(dist(rng), color_bits);
+      }
+    }
+    float* JXL_RESTRICT row = alpha.Row(y);
+    for (size_t x = 0; x < kXSize; x++) {
+      row[x] = quantize(dist(rng), alpha_bits);
+    }
+  }
+  ImageBundle ib(metadata);
+  ib.SetFromImage(std::move(color), ColorEncoding::SRGB());
+  std::vector<ImageF> extra_channels;
+  extra_channels.push_back(std::move(alpha));
+  ib.SetExtraChannels(std::move(extra_channels));
+  return ib;
+}
+
+void ExpectSame(const ImageBundle& ib, const SpilledImage& spilled,
+                float color_tolerance, float alpha_tolerance) {
+  ASSERT_EQ(ib.xsize(), spilled.xsize());
+  ASSERT_EQ(ib.ysize(), spilled.ysize());
+  ASSERT_EQ(4u, spilled.num_channels());
+  std::vector<float> row(kXSize);
+  for (size_t c = 0; c < 4; c++) {
+    const ImageF& plane = c < 3 ? ib.color().Plane(c) : ib.extra_channels()[0];
+    const float tolerance = c < 3 ? color_tolerance : alpha_tolerance;
+    for (size_t y = 0; y < kYSize; y++) {
+      // Also exercise unaligned starting positions.
+      for (size_t x0 : {size_t(0), size_t(3)}) {
+        spilled.LoadRow(c, x0, y, kXSize - x0, row.data());
+        for (size_t x = x0; x < kXSize; x++) {
+          EXPECT_NEAR(plane.ConstRow(y)[x], row[x - x0], tolerance)
+              << "c=" << c << " x=" << x << " y=" << y;
+        }
+      }
+    }
+  }
+}
+
+TEST(SpilledImageTest, IntegerSamplesAreExact) {
+  ImageMetadata metadata;
+  metadata.SetUintSamples(8);
+  metadata.SetAlphaBits(16);
+  metadata.xyb_encoded = false;
+  ImageBundle ib = RandomBundle(&metadata, 0.0f, 1.0f, 8, 16);
+  SpilledImage spilled;
+  ASSERT_TRUE(SpilledImage::Create(ib, /*is_xyb=*/false, &spilled));
+  // 1 byte per color sample, 2 per alpha sample.
+  EXPECT_LE(spilled.bytes(), kXSize * kYSize * 5 + 4 * sizeof(float));
+  ExpectSame(ib, spilled, 1e-6f, 1e-6f);
+}
+
+TEST(SpilledImageTest, LossySamplesAreExact) {
+  ImageMetadata metadata;
+  metadata.SetUintSamples(8);
+  metadata.SetAlphaBits(8);
+  metadata.xyb_encoded = false;
+  // Fractional and out-of-range samples, as decoded from a lossy non-XYB frame.
+  ImageBundle ib = RandomBundle(&metadata, -0.2f, 1.2f, 0, 0);
+  SpilledImage spilled;
+  ASSERT_TRUE(SpilledImage::Create(ib, /*is_xyb=*/false, &spilled));
+  ExpectSame(ib, spilled, 0.0f, 0.0f);
+}
+
+TEST(SpilledImageTest, XybEncodedAfterColorTransformIsExact) {
+  ImageMetadata metadata;
+  metadata.SetUintSamples(8);
+  metadata.SetAlphaBits(8);
+  metadata.xyb_encoded = true;
+  // A lossy XYB frame saved after the color transform is no longer in XYB.
+  ImageBundle ib = RandomBundle(&metadata, -0.2f, 1.2f, 0, 0);
+  SpilledImage spilled;
+  ASSERT_TRUE(SpilledImage::Create(ib, /*is_xyb=*/false, &spilled));
+  ExpectSame(ib, spilled, 0.0f, 0.0f);
+}
+
+TEST(SpilledImageTest, XybIsStoredAsHalf) {
+  ImageMetadata metadata;
+  metadata.SetUintSamples(8);
+  metadata.SetAlphaBits(8);
+  ImageBundle ib = RandomBundle(&metadata, -0.5f, 1.5f, 0, 8);
+  SpilledImage spilled;
+  ASSERT_TRUE(SpilledImage::Create(ib, /*is_xyb=*/true, &spilled));
+  // binary16 has an 11-bit significand.
+  ExpectSame(ib, spilled, 1.5f / 2048, 1e-6f);
+}
+
+TEST(SpilledImageTest, CopyToRect) {
+  ImageMetadata metadata;
+  metadata.SetUintSamples(16);
+  metadata.SetAlphaBits(16);
+  metadata.xyb_encoded = false;
+  ImageBundle ib = RandomBundle(&metadata, 0.0f, 1.0f, 16, 16);
+  SpilledImage spilled;
+  ASSERT_TRUE(SpilledImage::Create(ib, /*is_xyb=*/false, &spilled));
+  SpilledImage moved = std::move(spilled);
+  EXPECT_TRUE(spilled.empty());
+
+  const Rect rect(5, 1, 20, 3);
+  ImageF out(30, 4);
+  const Rect out_rect(7, 0, 20, 3);
+  moved.CopyTo(1, rect, out_rect, &out);
+  for (size_t y = 0; y < rect.ysize(); y++) {
+    for (size_t x = 0; x < rect.xsize(); x++) {
+      EXPECT_NEAR(rect.ConstPlaneRow(*ib.color(), 1, y)[x],
+                  out_rect.ConstRow(out, y)[x], 1e-6f);
+    }
+  }
+}
+
+}  // namespace
+}  // namespace jxl
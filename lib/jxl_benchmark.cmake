@@ -8,7 +8,10 @@
 set(JPEGXL_INTERNAL_SOURCES_GBENCH
   extras/tone_mapping_gbench.cc
   jxl/dec_external_image_gbench.cc
+  jxl/dec_transforms_gbench.cc
   jxl/enc_external_image_gbench.cc
+  jxl/fields_gbench.cc
+  jxl/modular_gbench.cc
   jxl/splines_gbench.cc
   jxl/tf_gbench.cc
 )
@@ -56,6 +56,7 @@ set(TEST_FILES
   jxl/robust_statistics_test.cc
   jxl/roundtrip_test.cc
   jxl/speed_tier_test.cc
+  jxl/spilled_image_test.cc
   jxl/splines_test.cc
   jxl/toc_test.cc
   jxl/xorshift128plus_test.cc
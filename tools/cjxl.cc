@@ -24,12 +24,14 @@
 #include "lib/jxl/base/cache_aligned.h"
 #include "lib/jxl/base/compiler_specific.h"
 #include "lib/jxl/base/data_parallel.h"
+#include "lib/jxl/base/file_io.h"
 #include "lib/jxl/base/padded_bytes.h"
 #include "lib/jxl/base/profiler.h"
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/base/thread_pool_internal.h"
 #include "lib/jxl/codec_in_out.h"
 #include "lib/jxl/common.h"
+#include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_cache.h"
 #include "lib/jxl/enc_file.h"
 #include "lib/jxl/enc_params.h"
@@ -458,6 +460,13 @@ void CompressArgs::AddCommandLineOptions(CommandLineParser* cmdline) {
   cmdline->AddOptionValue('\0', "saliency_threshold", "0..1", nullptr,
                           &params.saliency_threshold, &ParseFloat, 2);
 
+  cmdline->AddOptionValue(
+      '\0', "ac_entropy_preset", "FILE",
+      "[VarDCT encoding] use the context clustering and HybridUintConfigs "
+      "learned by learn_entropy_preset from similar images encoded with the "
+      "same settings, instead of computing them for each image",
+      &ac_entropy_preset_filename, &ParseString, 2);
+
   cmdline->AddOptionValue(
       'x', "dec-hints", "key=value",
       "color_space indicates the ColorEncoding, see Description();\n"
@@ -499,6 +508,18 @@ void CompressArgs::AddCommandLineOptions(CommandLineParser* cmdline) {
        "(default: 1 or 2)"),
       &params.modular_group_size_shift, &ParseUnsigned, 1);
 
+  cmdline->AddOptionFlag(
+      '\0', "row-index",
+      "[modular encoding] store the start of each row of the global modular "
+      "stream, so that it can be decoded with multiple threads",
+      &params.modular_row_index, &SetBooleanTrue, 2);
+
+  cmdline->AddOptionFlag(
+      '\0', "independent-channels",
+      "[modular encoding] do not use properties of previous channels, so that "
+      "channels can be encoded and decoded with multiple threads",
+      &params.modular_independent_channels, &SetBooleanTrue, 2);
+
   cmdline->AddOptionValue(
       'P', "predictor", "K",
       "[modular encoding] predictor(s) to use: 0=zero, "
@@ -779,6 +800,18 @@ jxl::Status LoadAll(CompressArgs& args, jxl::ThreadPoolInternal* pool,
     args.params.saliency_map = &saliency_map;
   }
 
+  if (!args.ac_entropy_preset_filename.empty()) {
+    jxl::PaddedBytes preset_bytes;
+    if (!jxl::ReadFile(args.ac_entropy_preset_filename, &preset_bytes) ||
+        !jxl::ReadEntropyCodePreset(jxl::Span<const uint8_t>(preset_bytes),
+                                    &args.ac_entropy_preset)) {
+      fprintf(stderr, "Failed to read entropy code preset %s.\n",
+              args.ac_entropy_preset_filename.c_str());
+      return false;
+    }
+    args.params.ac_entropy_preset = &args.ac_entropy_preset;
+  }
+
   const double t1 = jxl::Now();
   const size_t pixels = io->xsize() * io->ysize();
   *decode_mps = pixels * io->frames.size() * 1E-6 / (t1 - t0);
@@ -17,6 +17,7 @@
 #include "lib/jxl/base/status.h"
 #include "lib/jxl/base/thread_pool_internal.h"
 #include "lib/jxl/codec_in_out.h"
+#include "lib/jxl/enc_ans.h"
 #include "lib/jxl/enc_params.h"
 #include "lib/jxl/jxl_inspection.h"
 #include "tools/cmdline.h"
@@ -64,6 +65,11 @@ struct CompressArgs {
   // Filename for the user provided saliency-map.
   std::string saliency_map_filename;
 
+  // Filename of the VarDCT AC entropy code preset (see learn_entropy_preset),
+  // and the preset loaded from it that params.ac_entropy_preset points to.
+  std::string ac_entropy_preset_filename;
+  jxl::EntropyCodePreset ac_entropy_preset;
+
   // Whether to perform lossless transcoding with kVarDCT or kJPEG encoding.
   // If true, attempts to load JPEG coefficients instead of pixels.
   // Reset to false if input image is not a JPEG.
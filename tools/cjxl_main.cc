@@ -90,8 +90,7 @@ int CompressJpegXlMain(int argc, const char* argv[]) {
     }
     jxl::PaddedBytes jpeg_data;
     if (io.Main().IsJPEG()) {
-      jxl::jpeg::JPEGData data_in = *io.Main().jpeg_data;
-      JXL_RETURN_IF_ERROR(EncodeJPEGData(data_in, &jpeg_data));
+      JXL_RETURN_IF_ERROR(EncodeJPEGData(*io.Main().jpeg_data, &jpeg_data));
       container.jpeg_reconstruction = jpeg_data.data();
       container.jpeg_reconstruction_size = jpeg_data.size();
     }
@@ -109,6 +109,21 @@ void DecompressArgs::AddCommandLineOptions(CommandLineParser* cmdline) {
                          "files. No effect without --allow_partial_files",
                          &params.allow_more_progressive_steps, &SetBooleanTrue);
 
+  cmdline->AddOptionFlag('\0', "spill_reference_frames",
+                         "keep frames saved for reference in compact temporary "
+                         "files instead of memory (for large animations)",
+                         &params.spill_reference_frames, &SetBooleanTrue);
+
+  cmdline->AddOptionFlag('\0', "half_precision_intermediates",
+                         "store intermediate images of Modular frames in "
+                         "half precision (sufficient for 8-bit output)",
+                         &params.half_precision_intermediates, &SetBooleanTrue);
+
+  cmdline->AddOptionValue('\0', "parallel_frames", "N",
+                          "decode up to N independent animation frames at "
+                          "once, one thread each",
+                          &params.parallel_frames, &ParseUnsigned);
+
 #if JPEGXL_ENABLE_JPEG
   cmdline->AddOptionFlag(
       'j', "pixels_to_jpeg",
@@ -236,22 +251,24 @@ jxl::Status DecompressJxlToJPEG(const JpegXlContainer& container,
   return true;
 }
 
-jxl::Status WriteJxlOutput(const DecompressArgs& args, const char* file_out,
-                           jxl::CodecInOut& io, jxl::ThreadPool* pool) {
-  // Can only write if we decoded and have an output filename.
-  // (Writing large PNGs is slow, so allow skipping it for benchmarks.)
-  if (file_out == nullptr) return true;
+namespace {
 
+// Returns the color encoding and bit depth of the output file(s), i.e. those
+// of the original image unless overridden by `args`.
+jxl::Status GetOutputEncoding(const DecompressArgs& args,
+                              const jxl::CodecInOut& io,
+                              jxl::ColorEncoding* JXL_RESTRICT c_out,
+                              size_t* JXL_RESTRICT bits_per_sample) {
   // Override original color space with arg if specified.
-  jxl::ColorEncoding c_out = io.metadata.m.color_encoding;
+  *c_out = io.metadata.m.color_encoding;
   if (!args.color_space.empty()) {
     bool color_space_applied = false;
-    if (jxl::ParseDescription(args.color_space, &c_out) && c_out.CreateICC()) {
+    if (jxl::ParseDescription(args.color_space, c_out) && c_out->CreateICC()) {
       color_space_applied = true;
     } else {
       jxl::PaddedBytes icc;
       if (jxl::ReadFile(args.color_space, &icc) &&
-          c_out.SetICC(std::move(icc))) {
+          c_out->SetICC(std::move(icc))) {
         color_space_applied = true;
       }
     }
@@ -263,54 +280,139 @@ jxl::Status WriteJxlOutput(const DecompressArgs& args, const char* file_out,
   }
 
   // Override original #bits with arg if specified.
-  size_t bits_per_sample = io.metadata.m.bit_depth.bits_per_sample;
-  if (args.bits_per_sample != 0) bits_per_sample = args.bits_per_sample;
+  *bits_per_sample = io.metadata.m.bit_depth.bits_per_sample;
+  if (args.bits_per_sample != 0) *bits_per_sample = args.bits_per_sample;
+
+  if (args.tone_map && c_out->tf.IsPQ() && args.color_space.empty()) {
+    // Prevent writing the tone-mapped image to PQ output unless explicitly
+    // requested. The result would look even dimmer than it would have without
+    // tone mapping.
+    c_out->tf.SetTransferFunction(jxl::TransferFunction::kSRGB);
+    jxl::Status status = c_out->CreateICC();
+    if (!status) fprintf(stderr, "Failed to create ICC\n");
+    JXL_RETURN_IF_ERROR(status);
+  }
+  return true;
+}
+
+// Returns "<base>-<index><extension>" where index is zero-padded to the number
+// of digits required for `num_frames` frames.
+std::string FrameFilename(const char* file_out, size_t index,
+                          size_t num_frames) {
+  const char* extension = strrchr(file_out, '.');
+  std::string base = extension == nullptr
+                         ? std::string(file_out)
+                         : std::string(file_out, extension - file_out);
+  if (extension == nullptr) extension = "";
+  const int digits = 1 + static_cast<int>(std::log10(
+                             std::max(1, static_cast<int>(num_frames - 1))));
+  std::vector<char> output_filename;
+  output_filename.resize(base.size() + 1 + digits + strlen(extension) + 1);
+  snprintf(output_filename.data(), output_filename.size(), "%s-%0*zu%s",
+           base.c_str(), digits, index, extension);
+  return std::string(output_filename.data());
+}
 
+// Writes a single animation frame to its own file.
+jxl::Status WriteFrame(const DecompressArgs& args,
+                       const jxl::ColorEncoding& c_out, size_t bits_per_sample,
+                       const jxl::ImageBundle& frame,
+                       const std::string& filename, jxl::ThreadPool* pool) {
+  jxl::CodecInOut frame_io;
+  frame_io.SetFromImage(jxl::CopyImage(frame.color()), frame.c_current());
+  frame_io.metadata.m = *frame.metadata();
+  if (frame.HasAlpha()) {
+    frame_io.Main().SetAlpha(
+        jxl::CopyImage(frame.alpha()),
+        /*alpha_is_premultiplied=*/frame.AlphaIsPremultiplied());
+  }
   if (args.tone_map) {
-    jxl::Status status = jxl::ToneMapTo(args.display_nits, &io, pool);
+    jxl::Status status = jxl::ToneMapTo(args.display_nits, &frame_io, pool);
     if (!status) fprintf(stderr, "Failed to map tones.\n");
     JXL_RETURN_IF_ERROR(status);
-    if (c_out.tf.IsPQ() && args.color_space.empty()) {
-      // Prevent writing the tone-mapped image to PQ output unless explicitly
-      // requested. The result would look even dimmer than it would have without
-      // tone mapping.
-      c_out.tf.SetTransferFunction(jxl::TransferFunction::kSRGB);
-      status = c_out.CreateICC();
-      if (!status) fprintf(stderr, "Failed to create ICC\n");
-      JXL_RETURN_IF_ERROR(c_out.CreateICC());
+  }
+  return EncodeToFile(frame_io, c_out, bits_per_sample, filename, pool);
+}
+
+}  // namespace
+
+jxl::Status DecompressJxlToFrameFiles(const jxl::Span<const uint8_t> compressed,
+                                      const DecompressArgs& args,
+                                      jxl::ThreadPool* pool,
+                                      jxl::CodecInOut* JXL_RESTRICT io,
+                                      SpeedStats* JXL_RESTRICT stats) {
+  const double t0 = jxl::Now();
+  size_t num_frames = 0;
+  // Only the headers and TOCs are parsed; this is required for naming the
+  // output files before all the frames are known.
+  const bool counted = jxl::CountDisplayedFrames(compressed, &num_frames);
+  if (!counted && !args.params.allow_partial_files) {
+    fprintf(stderr, "Failed to decompress to pixels.\n");
+    return false;
+  }
+  // The zero-padded width of the file names is fixed before decoding, so that
+  // all the names sort in frame order. If the file is truncated, at most one
+  // more (partial) frame can be decoded.
+  const size_t max_frames = counted ? num_frames : num_frames + 1;
+
+  jxl::ColorEncoding c_out;
+  size_t bits_per_sample = 0;
+  bool have_output_encoding = false;
+  // Time spent writing the frame files, which is not part of the decoding.
+  double write_seconds = 0.0;
+  const auto write_frame = [&](size_t index,
+                               jxl::ImageBundle* JXL_RESTRICT frame)
+      -> jxl::Status {
+    if (!io->metadata.m.have_animation) return true;
+    const double write_t0 = jxl::Now();
+    if (!have_output_encoding) {
+      JXL_RETURN_IF_ERROR(
+          GetOutputEncoding(args, *io, &c_out, &bits_per_sample));
+      have_output_encoding = true;
+    }
+    if (!WriteFrame(args, c_out, bits_per_sample, *frame,
+                    FrameFilename(args.file_out, index, max_frames), pool)) {
+      fprintf(stderr, "Failed to write decoded image for frame %zu/%zu.\n",
+              index + 1, max_frames);
+      return false;
     }
+    write_seconds += jxl::Now() - write_t0;
+    return true;
+  };
+  if (!jxl::DecodeFile(args.params, compressed, io, pool, write_frame)) {
+    fprintf(stderr, "Failed to decompress to pixels.\n");
+    return false;
   }
+  const double t1 = jxl::Now();
+  stats->NotifyElapsed(t1 - t0 - write_seconds);
+  stats->SetImageSize(io->xsize(), io->ysize());
+  return true;
+}
+
+jxl::Status WriteJxlOutput(const DecompressArgs& args, const char* file_out,
+                           jxl::CodecInOut& io, jxl::ThreadPool* pool) {
+  // Can only write if we decoded and have an output filename.
+  // (Writing large PNGs is slow, so allow skipping it for benchmarks.)
+  if (file_out == nullptr) return true;
+
+  jxl::ColorEncoding c_out;
+  size_t bits_per_sample;
+  JXL_RETURN_IF_ERROR(GetOutputEncoding(args, io, &c_out, &bits_per_sample));
 
   if (!io.metadata.m.have_animation) {
+    if (args.tone_map) {
+      jxl::Status status = jxl::ToneMapTo(args.display_nits, &io, pool);
+      if (!status) fprintf(stderr, "Failed to map tones.\n");
+      JXL_RETURN_IF_ERROR(status);
+    }
     if (!EncodeToFile(io, c_out, bits_per_sample, file_out, pool)) {
       fprintf(stderr, "Failed to write decoded image.\n");
       return false;
     }
   } else {
-    const char* extension = strrchr(file_out, '.');
-    std::string base = extension == nullptr
-                           ? std::string(file_out)
-                           : std::string(file_out, extension - file_out);
-    if (extension == nullptr) extension = "";
-    const int digits = 1 + static_cast<int>(std::log10(std::max(
-                               1, static_cast<int>(io.frames.size() - 1))));
-    std::vector<char> output_filename;
-    output_filename.resize(base.size() + 1 + digits + strlen(extension) + 1);
-
     for (size_t i = 0; i < io.frames.size(); ++i) {
-      jxl::CodecInOut frame_io;
-      frame_io.SetFromImage(jxl::CopyImage(*io.frames[i].color()),
-                            io.frames[i].c_current());
-      frame_io.metadata.m = *io.frames[i].metadata();
-      if (io.frames[i].HasAlpha()) {
-        frame_io.Main().SetAlpha(
-            jxl::CopyImage(*io.frames[i].alpha()),
-            /*alpha_is_premultiplied=*/io.frames[i].AlphaIsPremultiplied());
-      }
-      snprintf(output_filename.data(), output_filename.size(), "%s-%0*zu%s",
-               base.c_str(), digits, i, extension);
-      if (!EncodeToFile(frame_io, c_out, bits_per_sample,
-                        output_filename.data(), pool)) {
+      if (!WriteFrame(args, c_out, bits_per_sample, io.frames[i],
+                      FrameFilename(file_out, i, io.frames.size()), pool)) {
         fprintf(stderr, "Failed to write decoded image for frame %zu/%zu.\n",
                 i + 1, io.frames.size());
       }
@@ -74,6 +74,17 @@ jxl::Status DecompressJxlToPixels(const jxl::Span<const uint8_t> compressed,
                                   jxl::CodecInOut* JXL_RESTRICT io,
                                   SpeedStats* JXL_RESTRICT stats);
 
+// Same as DecompressJxlToPixels, but if the image is an animation, each frame
+// is written to its own numbered output file as soon as it is decoded, so that
+// only the reference frames kept by the decoder stay in memory. In that case
+// `io` only holds the last frame afterwards and WriteJxlOutput must not be
+// called; still images are left in `io` for WriteJxlOutput.
+jxl::Status DecompressJxlToFrameFiles(const jxl::Span<const uint8_t> compressed,
+                                      const DecompressArgs& args,
+                                      jxl::ThreadPool* pool,
+                                      jxl::CodecInOut* JXL_RESTRICT io,
+                                      SpeedStats* JXL_RESTRICT stats);
+
 jxl::Status DecompressJxlToJPEG(const JpegXlContainer& container,
                                 const DecompressArgs& args,
                                 jxl::ThreadPool* pool, jxl::PaddedBytes* output,
@@ -171,17 +171,26 @@ int DecompressMain(int argc, const char* argv[]) {
     io.jpeg_quality = args.jpeg_quality;
 
     // Decode to pixels.
+    const jxl::Span<const uint8_t> codestream(container.codestream,
+                                              container.codestream_size);
+    // Animation frames are written while decoding, unless we are benchmarking
+    // (repeated) decoding only.
+    const bool stream_frames = args.file_out != nullptr && args.num_reps == 1;
     for (size_t i = 0; i < args.num_reps; ++i) {
-      if (!DecompressJxlToPixels(
-              jxl::Span<const uint8_t>(container.codestream,
-                                       container.codestream_size),
-              args.params, &pool, &io, &stats)) {
+      if (stream_frames) {
+        if (!DecompressJxlToFrameFiles(codestream, args, &pool, &io, &stats)) {
+          // Error is already reported by DecompressJxlToFrameFiles.
+          return 1;
+        }
+      } else if (!DecompressJxlToPixels(codestream, args.params, &pool, &io,
+                                        &stats)) {
         // Error is already reported by DecompressJxlToPixels.
         return 1;
       }
     }
     if (!args.quiet) fprintf(stderr, "Decoded to pixels.\n");
-    if (!WriteJxlOutput(args, args.file_out, io, &pool)) {
+    if (!(stream_frames && io.metadata.m.have_animation) &&
+        !WriteJxlOutput(args, args.file_out, io, &pool)) {
       // Error is already reported by WriteJxlOutput.
       return 1;
     }
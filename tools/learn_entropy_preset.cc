@@ -0,0 +1,74 @@
+// Copyright (c) the JPEG XL Project Authors. All rights reserved.
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lib/extras/codec.h"
+#include "lib/jxl/base/file_io.h"
+#include "lib/jxl/base/padded_bytes.h"
+#include "lib/jxl/base/status.h"
+#include "lib/jxl/base/thread_pool_internal.h"
+#include "lib/jxl/codec_in_out.h"
+#include "lib/jxl/common.h"
+#include "lib/jxl/enc_ans.h"
+#include "lib/jxl/enc_file.h"
+#include "lib/jxl/enc_params.h"
+
+namespace jxl {
+namespace {
+
+// Learns the VarDCT AC entropy code preset of a set of similar images, to be
+// passed to cjxl --ac_entropy_preset when encoding more of them with the same
+// distance (and the default effort).
+int LearnPreset(int argc, char** argv) {
+  if (argc < 4) {
+    fprintf(stderr, "Args: out_preset distance in [in...]\n");
+    return 1;
+  }
+  const std::string& pathname_out = argv[1];
+  CompressParams cparams;
+  cparams.butteraugli_distance = strtof(argv[2], nullptr);
+  if (!(cparams.butteraugli_distance > 0)) {
+    fprintf(stderr, "Invalid distance %s\n", argv[2]);
+    return 1;
+  }
+
+  ThreadPoolInternal pool(4);
+  std::vector<std::unique_ptr<CodecInOut>> images;
+  std::vector<const CodecInOut*> image_ptrs;
+  for (int i = 3; i < argc; i++) {
+    images.push_back(make_unique<CodecInOut>());
+    if (!SetFromFile(argv[i], images.back().get(), &pool)) {
+      fprintf(stderr, "Failed to read %s\n", argv[i]);
+      return 1;
+    }
+    image_ptrs.push_back(images.back().get());
+  }
+
+  EntropyCodePreset preset;
+  if (!LearnACEntropyCodePreset(cparams, image_ptrs, &pool, &preset)) {
+    fprintf(stderr, "Failed to learn the preset\n");
+    return 1;
+  }
+  PaddedBytes bytes;
+  WriteEntropyCodePreset(preset, &bytes);
+  if (!WriteFile(bytes, pathname_out)) {
+    fprintf(stderr, "Failed to write %s\n", pathname_out.c_str());
+    return 1;
+  }
+  fprintf(stderr, "%zu contexts, %zu clusters\n", preset.context_map.size(),
+          preset.uint_config.size());
+  return 0;
+}
+
+}  // namespace
+}  // namespace jxl
+
+int main(int argc, char** argv) { return jxl::LearnPreset(argc, argv); }